@@ -59,6 +59,15 @@ void error_func(VMHANDLE LV_UNUSED_ARG(v), const LVChar *s, ...) {
 	va_end(vl);
 }
 
+/* The VMs of pmap, pfilter and preduce load the same modules */
+void init_worker(VMHANDLE v) {
+	lv_pushroottable(v);
+	lv_init_modules(v);
+	init_module(sqlite, v);
+	init_module(pgsql, v);
+	lv_pop(v, 1);
+}
+
 LVChar *read_func(VMHANDLE LV_UNUSED_ARG(v)) {
 	LVChar *line = lv_malloc(128);
 	LVChar *linep = line;
@@ -107,8 +116,10 @@ void print_usage() {
 	          _LC("  -c <file>       Compile file (default output 'out.lavc')\n")
 	          _LC("  -d              Enable debug info\n")
 	          _LC("  -n              Always run script (omit compile cache)\n")
+	          _LC("  -O<level>       Optimization level 0-2 (default 2)\n")
 	          _LC("  -v              Version\n")
-	          _LC("  -h              This help\n"));
+	          _LC("  -h              This help\n\n")
+	          _LC("Set LAVRIL_HASHSEED to a number to keep the order of table keys across runs\n"));
 }
 
 time_t get_mtime(const char *path) {
@@ -147,6 +158,9 @@ enum result getargs(VMHANDLE v, int argc, char *argv[], LVInteger *retval) {
 					case 'd':
 						lv_enabledebuginfo(v, 1);
 						break;
+					case 'O':
+						lv_setoptimizationlevel(v, atoi(&argv[arg][2]));
+						break;
 					case 'c':
 						compiles_only = 1;
 						break;
@@ -379,6 +393,7 @@ int main(int argc, char *argv[]) {
 
 	lv_setprintfunc(v, print_func, error_func);
 	lv_setreadfunc(v, read_func);
+	lv_setworkerhook(v, init_worker);
 
 	lv_pushroottable(v);
 
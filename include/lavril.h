@@ -161,11 +161,36 @@ typedef union {
 	LVRawObjectVal raw;
 } LVObjectValue;
 
+#ifdef USEPACKEDOBJ
+/*
+ * Packed objects are a single 64 bit word, the raw type index sits in the
+ * top LV_TAGBITS bits and the value in the remaining bits. Pointers and single
+ * precision floats fit as is, integers are narrowed to 59 bits.
+ */
+#if !defined(_LV64) || defined(USEDOUBLE)
+#error "USEPACKEDOBJ requires a 64 bit build without USEDOUBLE"
+#endif
+
+#define LV_TAGBITS 5
+#define LV_TAGSHIFT (64 - LV_TAGBITS)
+#define LV_PAYLOADMASK ((((LVUnsignedInteger)1) << LV_TAGSHIFT) - 1)
+
+typedef struct {
+	LVUnsignedInteger _raw;
+} LVObject;
+
+LAVRIL_API const LVObjectType lv_tagtypes[1 << LV_TAGBITS];
+
+#define lv_type(o) (lv_tagtypes[(o)._raw >> LV_TAGSHIFT])
+#else
 typedef struct {
 	LVObjectType _type;
 	LVObjectValue _unVal;
 } LVObject;
 
+#define lv_type(o) ((o)._type)
+#endif // USEPACKEDOBJ
+
 //TODO not used
 typedef struct {
 	LVBool _static;
@@ -178,6 +203,35 @@ typedef struct {
 	LVInteger line;
 } LVStackInfos;
 
+typedef struct {
+	LVInteger young;        /* objects in the young generation */
+	LVInteger old;          /* objects in the old generation */
+	LVInteger minor;        /* young collections run */
+	LVInteger major;        /* full collections run */
+	LVInteger steps;        /* incremental steps run */
+	LVInteger incremental;  /* incremental cycles completed */
+	LVInteger promoted;     /* objects moved to the old generation */
+	LVInteger collected;    /* objects finalized by all collections */
+	LVFloat lastpause;      /* seconds spent in the last collection */
+	LVFloat totalpause;     /* seconds spent in all collections */
+} LVGCStats;
+
+typedef struct {
+	LVInteger size;         /* block size of the class */
+	LVInteger allocs;       /* blocks handed out */
+	LVInteger frees;        /* blocks given back */
+	LVInteger chunks;       /* chunks carved into blocks */
+} LVPoolStats;
+
+typedef struct {
+	LVInteger strings;      /* interned strings */
+	LVInteger slots;        /* buckets of the table */
+	LVInteger used;         /* buckets holding at least one string */
+	LVInteger longest;      /* strings in the longest chain */
+	LVFloat meanchain;      /* mean length of the chains that are not empty */
+	LVInteger pending;      /* buckets left to move while the table is resized */
+} LVStringTableStats;
+
 typedef struct LVVM *VMHANDLE;
 typedef LVObject OBJHANDLE;
 typedef LVMemberHandle MEMBERHANDLE;
@@ -190,6 +244,7 @@ typedef CALLBACK void (*LVDEBUGHOOK)(VMHANDLE /*v*/, LVInteger /*type*/, const L
 typedef LVInteger (*LVWRITEFUNC)(LVUserPointer, LVUserPointer, LVInteger);
 typedef LVInteger (*LVREADFUNC)(LVUserPointer, LVUserPointer, LVInteger);
 typedef LVInteger (*LVLEXREADFUNC)(LVUserPointer);
+typedef void (*LVWORKERHOOK)(VMHANDLE);
 
 typedef struct {
 	const LVChar *name;
@@ -208,7 +263,10 @@ typedef struct {
 typedef void *LVFILE;
 
 /* VM */
+/* The order of table keys changes from run to run, unless LAVRIL_HASHSEED holds a number to seed the hashes */
 LAVRIL_API VMHANDLE lv_open(LVInteger initialstacksize);
+/* Opens a VM as a copy of what bootstrap holds, NULL if it holds something that cannot be copied */
+LAVRIL_API VMHANDLE lv_openfrom(VMHANDLE bootstrap, LVInteger initialstacksize);
 LAVRIL_API VMHANDLE lv_newthread(VMHANDLE friendvm, LVInteger initialstacksize);
 LAVRIL_API void lv_seterrorhandler(VMHANDLE v);
 LAVRIL_API void lv_close(VMHANDLE v);
@@ -224,6 +282,7 @@ LAVRIL_API void lv_setprintfunc(VMHANDLE v, LVPRINTFUNCTION printfunc, LVPRINTFU
 LAVRIL_API void lv_setreadfunc(VMHANDLE v, LVREADFUNCTION readfunc);
 LAVRIL_API LVPRINTFUNCTION lv_getprintfunc(VMHANDLE v);
 LAVRIL_API LVPRINTFUNCTION lv_geterrorfunc(VMHANDLE v);
+LAVRIL_API void lv_setworkerhook(VMHANDLE v, LVWORKERHOOK hook);
 LAVRIL_API LVRESULT lv_suspendvm(VMHANDLE v);
 LAVRIL_API LVRESULT lv_wakeupvm(VMHANDLE v, LVBool resumedret, LVBool retval, LVBool raiseerror, LVBool throwerror);
 LAVRIL_API LVInteger lv_getvmstate(VMHANDLE v);
@@ -233,7 +292,10 @@ LAVRIL_API LVInteger lv_getversion();
 LAVRIL_API LVRESULT lv_compile(VMHANDLE v, LVLEXREADFUNC read, LVUserPointer p, const LVChar *sourcename, LVBool raiseerror);
 LAVRIL_API LVRESULT lv_compilebuffer(VMHANDLE v, const LVChar *s, LVInteger size, const LVChar *sourcename, LVBool raiseerror);
 LAVRIL_API void lv_enabledebuginfo(VMHANDLE v, LVBool enable);
+LAVRIL_API void lv_setoptimizationlevel(VMHANDLE v, LVInteger level);
+LAVRIL_API LVInteger lv_getoptimizationlevel(VMHANDLE v);
 LAVRIL_API void lv_notifyallexceptions(VMHANDLE v, LVBool enable);
+LAVRIL_API void lv_enablejit(VMHANDLE v, LVBool enable);
 LAVRIL_API void lv_setcompilererrorhandler(VMHANDLE v, LVCOMPILERERROR f);
 
 /* Stack operations */
@@ -363,6 +425,10 @@ LAVRIL_API LVUnsignedInteger lv_getvmrefcount(VMHANDLE v, const OBJHANDLE *po);
 
 /* GC */
 LAVRIL_API LVInteger lv_collectgarbage(VMHANDLE v);
+LAVRIL_API LVInteger lv_collectyounggarbage(VMHANDLE v);
+LAVRIL_API LVInteger lv_collectgarbagestep(VMHANDLE v, LVInteger budget_us);
+LAVRIL_API void lv_setgcthreshold(VMHANDLE v, LVInteger young);
+LAVRIL_API LVRESULT lv_getgcstats(VMHANDLE v, LVGCStats *stats);
 LAVRIL_API LVRESULT lv_resurrectunreachable(VMHANDLE v);
 
 /* Serialization */
@@ -373,6 +439,9 @@ LAVRIL_API LVRESULT lv_readclosure(VMHANDLE vm, LVREADFUNC readf, LVUserPointer
 LAVRIL_API void *lv_malloc(LVUnsignedInteger size);
 LAVRIL_API void *lv_realloc(void *p, LVUnsignedInteger oldsize, LVUnsignedInteger newsize);
 LAVRIL_API void lv_free(void *p, LVUnsignedInteger size);
+LAVRIL_API LVInteger lv_getpoolstats(LVPoolStats *stats, LVInteger n);
+LAVRIL_API void lv_reservestrings(VMHANDLE v, LVInteger slots);
+LAVRIL_API void lv_getstringtablestats(VMHANDLE v, LVStringTableStats *stats);
 
 /* Debug */
 LAVRIL_API LVRESULT lv_stackinfos(VMHANDLE v, LVInteger level, LVStackInfos *si);
@@ -401,6 +470,9 @@ LAVRIL_API LVUserPointer lv_createblob(VMHANDLE v, LVInteger size);
 LAVRIL_API LVRESULT lv_getblob(VMHANDLE v, LVInteger idx, LVUserPointer *ptr);
 LAVRIL_API LVInteger lv_getblobsize(VMHANDLE v, LVInteger idx);
 
+/* Isolates, a VM from lv_open shares nothing and may run on its own thread beside the others */
+LAVRIL_API LVRESULT lv_copyvalue(VMHANDLE from, LVInteger idx, VMHANDLE to);
+
 /* String */
 #ifdef REGEX
 LAVRIL_API LVRex *sqstd_rex_compile(const LVChar *pattern, const LVChar **error);
@@ -416,30 +488,32 @@ LAVRIL_API LVRESULT sqstd_format(VMHANDLE v, LVInteger nformatstringidx, LVInteg
 /* Modules */
 LAVRIL_API LVRESULT mod_init_io(VMHANDLE v);
 LAVRIL_API LVRESULT mod_init_blob(VMHANDLE v);
+LAVRIL_API LVRESULT mod_init_stringbuilder(VMHANDLE v);
+LAVRIL_API LVRESULT mod_init_typedarray(VMHANDLE v);
+LAVRIL_API LVRESULT mod_init_isolate(VMHANDLE v);
 LAVRIL_API LVRESULT mod_init_string(VMHANDLE v);
 
 #include "modules.h"
 
 /* Auxiliary macros */
-#define lv_isnumeric(o) ((o)._type & OBJECT_NUMERIC)
-#define lv_istable(o) ((o)._type == OT_TABLE)
-#define lv_isarray(o) ((o)._type == OT_ARRAY)
-#define lv_isfunction(o) ((o)._type == OT_FUNCPROTO)
-#define lv_isclosure(o) ((o)._type == OT_CLOSURE)
-#define lv_isgenerator(o) ((o)._type == OT_GENERATOR)
-#define lv_isnativeclosure(o) ((o)._type == OT_NATIVECLOSURE)
-#define lv_isstring(o) ((o)._type == OT_STRING)
-#define lv_isinteger(o) ((o)._type == OT_INTEGER)
-#define lv_isfloat(o) ((o)._type == OT_FLOAT)
-#define lv_isuserpointer(o) ((o)._type == OT_USERPOINTER)
-#define lv_isuserdata(o) ((o)._type == OT_USERDATA)
-#define lv_isthread(o) ((o)._type == OT_THREAD)
-#define lv_isnull(o) ((o)._type == OT_NULL)
-#define lv_isclass(o) ((o)._type == OT_CLASS)
-#define lv_isinstance(o) ((o)._type == OT_INSTANCE)
-#define lv_isbool(o) ((o)._type == OT_BOOL)
-#define lv_isweakref(o) ((o)._type == OT_WEAKREF)
-#define lv_type(o) ((o)._type)
+#define lv_isnumeric(o) (lv_type(o) & OBJECT_NUMERIC)
+#define lv_istable(o) (lv_type(o) == OT_TABLE)
+#define lv_isarray(o) (lv_type(o) == OT_ARRAY)
+#define lv_isfunction(o) (lv_type(o) == OT_FUNCPROTO)
+#define lv_isclosure(o) (lv_type(o) == OT_CLOSURE)
+#define lv_isgenerator(o) (lv_type(o) == OT_GENERATOR)
+#define lv_isnativeclosure(o) (lv_type(o) == OT_NATIVECLOSURE)
+#define lv_isstring(o) (lv_type(o) == OT_STRING)
+#define lv_isinteger(o) (lv_type(o) == OT_INTEGER)
+#define lv_isfloat(o) (lv_type(o) == OT_FLOAT)
+#define lv_isuserpointer(o) (lv_type(o) == OT_USERPOINTER)
+#define lv_isuserdata(o) (lv_type(o) == OT_USERDATA)
+#define lv_isthread(o) (lv_type(o) == OT_THREAD)
+#define lv_isnull(o) (lv_type(o) == OT_NULL)
+#define lv_isclass(o) (lv_type(o) == OT_CLASS)
+#define lv_isinstance(o) (lv_type(o) == OT_INSTANCE)
+#define lv_isbool(o) (lv_type(o) == OT_BOOL)
+#define lv_isweakref(o) (lv_type(o) == OT_WEAKREF)
 
 #define LV_OK (0)
 #define LV_ERROR (-1)
@@ -11,15 +11,17 @@ static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
                                 'w', 'x', 'y', 'z', '0', '1', '2', '3',
                                 '4', '5', '6', '7', '8', '9', '+', '/'
                                };
-static char *decoding_table = NULL;
 static int mod_table[] = {0, 2, 1};
 
-static void build_decoding_table() {
-	decoding_table = (char *)malloc(256);
-
-	for (int i = 0; i < 64; i++) {
-		decoding_table[(unsigned char) encoding_table[i]] = i;
-	}
+/* No table built on first use, so that VMs on several threads can decode at once */
+static uint32_t decode_char(char c) {
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	return c == '+' ? 62 : c == '/' ? 63 : 0;
 }
 
 char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length) {
@@ -49,9 +51,6 @@ char *base64_encode(const unsigned char *data, size_t input_length, size_t *outp
 }
 
 unsigned char *base64_decode(const char *data, size_t input_length, size_t *output_length) {
-	if (decoding_table == NULL)
-		build_decoding_table();
-
 	if (input_length % 4 != 0)
 		return NULL;
 
@@ -66,10 +65,10 @@ unsigned char *base64_decode(const char *data, size_t input_length, size_t *outp
 		return NULL;
 
 	for (int i = 0, j = 0; i < input_length;) {
-		uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[(int)data[i++]];
-		uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[(int)data[i++]];
-		uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[(int)data[i++]];
-		uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[(int)data[i++]];
+		uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decode_char(data[i++]);
+		uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decode_char(data[i++]);
+		uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decode_char(data[i++]);
+		uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decode_char(data[i++]);
 
 		uint32_t triple = (sextet_a << 3 * 6)
 		                  + (sextet_b << 2 * 6)
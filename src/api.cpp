@@ -56,6 +56,22 @@ VMHANDLE lv_open(LVInteger initialstacksize) {
 	return v;
 }
 
+VMHANDLE lv_openfrom(VMHANDLE bootstrap, LVInteger initialstacksize) {
+	LVSharedState *ss = NULL;
+	LVVM *v = NULL;
+	lv_new(ss, LVSharedState);
+	ss->InitFrom(_ss(bootstrap));
+	v = (LVVM *)LV_MALLOC(sizeof(LVVM));
+	new (v) LVVM(ss);
+	ss->_root_vm = v;
+	if (v->InitFrom(bootstrap, initialstacksize)) {
+		return v;
+	} else {
+		lv_close(v);
+		return NULL;
+	}
+}
+
 VMHANDLE lv_newthread(VMHANDLE friendvm, LVInteger initialstacksize) {
 	LVSharedState *ss = NULL;
 	LVVM *v = NULL;
@@ -123,7 +139,7 @@ LVInteger lv_getversion() {
 LVRESULT lv_compile(VMHANDLE v, LVLEXREADFUNC read, LVUserPointer p, const LVChar *sourcename, LVBool raiseerror) {
 	LVObjectPtr o;
 #ifndef NO_COMPILER
-	if (RunCompiler(v, read, p, sourcename, o, raiseerror ? true : false, _ss(v)->_debuginfo)) {
+	if (RunCompiler(v, read, p, sourcename, o, raiseerror ? true : false, _ss(v)->_debuginfo, _ss(v)->_optlevel)) {
 		v->Push(LVClosure::Create(_ss(v), _funcproto(o), _table(v->_roottable)->GetWeakRef(OT_TABLE)));
 		return LV_OK;
 	}
@@ -137,14 +153,26 @@ void lv_enabledebuginfo(VMHANDLE v, LVBool enable) {
 	_ss(v)->_debuginfo = enable ? true : false;
 }
 
+void lv_setoptimizationlevel(VMHANDLE v, LVInteger level) {
+	_ss(v)->_optlevel = level;
+}
+
+LVInteger lv_getoptimizationlevel(VMHANDLE v) {
+	return _ss(v)->_optlevel;
+}
+
 void lv_notifyallexceptions(VMHANDLE v, LVBool enable) {
 	_ss(v)->_notifyallexceptions = enable ? true : false;
 }
 
+void lv_enablejit(VMHANDLE v, LVBool enable) {
+	_ss(v)->_jit = enable ? true : false;
+}
+
 void lv_addref(VMHANDLE v, OBJHANDLE *po) {
 	if (!ISREFCOUNTED(type(*po))) return;
 #ifdef NO_GARBAGE_COLLECTOR
-	__AddRef(po->_type, po->_unVal);
+	__AddRef(*po);
 #else
 	_ss(v)->_refs_table.AddRef(*po);
 #endif
@@ -153,7 +181,7 @@ void lv_addref(VMHANDLE v, OBJHANDLE *po) {
 LVUnsignedInteger lv_getrefcount(VMHANDLE v, OBJHANDLE *po) {
 	if (!ISREFCOUNTED(type(*po))) return 0;
 #ifdef NO_GARBAGE_COLLECTOR
-	return po->_unVal.pRefCounted->_uiRef;
+	return _refcounted(*po)->_uiRef;
 #else
 	return _ss(v)->_refs_table.GetRefCount(*po);
 #endif
@@ -163,8 +191,8 @@ LVBool lv_release(VMHANDLE v, OBJHANDLE *po) {
 	if (!ISREFCOUNTED(type(*po)))
 		return LVTrue;
 #ifdef NO_GARBAGE_COLLECTOR
-	bool ret = (po->_unVal.pRefCounted->_uiRef <= 1) ? LVTrue : LVFalse;
-	__Release(po->_type, po->_unVal);
+	bool ret = (_refcounted(*po)->_uiRef <= 1) ? LVTrue : LVFalse;
+	__Release(*po);
 	return ret; //the ret val doesn't work(and cannot be fixed)
 #else
 	return _ss(v)->_refs_table.Release(*po);
@@ -174,7 +202,7 @@ LVBool lv_release(VMHANDLE v, OBJHANDLE *po) {
 LVUnsignedInteger lv_getvmrefcount(VMHANDLE LV_UNUSED_ARG(v), const OBJHANDLE *po) {
 	if (!ISREFCOUNTED(type(*po)))
 		return 0;
-	return po->_unVal.pRefCounted->_uiRef;
+	return _refcounted(*po)->_uiRef;
 }
 
 const LVChar *lv_objtostring(const OBJHANDLE *o) {
@@ -327,6 +355,7 @@ LVRESULT lv_arrayreverse(VMHANDLE v, LVInteger idx) {
 		LVObjectPtr t;
 		LVInteger size = arr->Size();
 		LVInteger n = size >> 1;
+		arr->Unshare();
 		size -= 1;
 		for (LVInteger i = 0; i < n; i++) {
 			t = arr->_values[i];
@@ -1024,7 +1053,7 @@ const LVChar *lv_getlocal(VMHANDLE v, LVUnsignedInteger level, LVUnsignedInteger
 		LVClosure *c = _closure(ci._closure);
 		FunctionPrototype *func = c->_function;
 		if (func->_noutervalues > (LVInteger)idx) {
-			v->Push(*_outer(c->_outervalues[idx])->_valptr);
+			v->Push(*_outervalptr(c, idx));
 			return _stringval(func->_outervalues[idx]._name);
 		}
 		idx -= func->_noutervalues;
@@ -1038,8 +1067,7 @@ void lv_pushobject(VMHANDLE v, OBJHANDLE obj) {
 }
 
 void lv_resetobject(OBJHANDLE *po) {
-	po->_unVal.pUserPointer = NULL;
-	po->_type = OT_NULL;
+	OBJECT_INIT(*po, OT_NULL, pUserPointer, NULL);
 }
 
 LVRESULT lv_throwerror(VMHANDLE v, const LVChar *err) {
@@ -1230,6 +1258,40 @@ LVInteger lv_collectgarbage(VMHANDLE v) {
 #endif
 }
 
+LVInteger lv_collectyounggarbage(VMHANDLE v) {
+#ifndef NO_GARBAGE_COLLECTOR
+	return _ss(v)->CollectYoung();
+#else
+	return -1;
+#endif
+}
+
+LVInteger lv_collectgarbagestep(VMHANDLE v, LVInteger budget_us) {
+#ifndef NO_GARBAGE_COLLECTOR
+	return _ss(v)->CollectStep(v, budget_us);
+#else
+	return -1;
+#endif
+}
+
+void lv_setgcthreshold(VMHANDLE v, LVInteger young) {
+#ifndef NO_GARBAGE_COLLECTOR
+	//a threshold of 0 or less turns the young collections off
+	_ss(v)->_gc_threshold = young > 0 ? young : (LVInteger)(~(LVUnsignedInteger)0 >> 1);
+#endif
+}
+
+LVRESULT lv_getgcstats(VMHANDLE v, LVGCStats *stats) {
+#ifndef NO_GARBAGE_COLLECTOR
+	*stats = _ss(v)->_gc_stats;
+	stats->young = _ss(v)->_gc_young;
+	stats->old = _ss(v)->_gc_old;
+	return LV_OK;
+#else
+	return lv_throwerror(v, _LC("getgcstats requires a garbage collector build"));
+#endif
+}
+
 LVRESULT lv_getcallee(VMHANDLE v) {
 	if (v->_callsstacksize > 1) {
 		v->Push(v->_callsstack[v->_callsstacksize - 2]._closure);
@@ -1246,7 +1308,7 @@ const LVChar *lv_getfreevariable(VMHANDLE v, LVInteger idx, LVUnsignedInteger nv
 			LVClosure *clo = _closure(self);
 			FunctionPrototype *fp = clo->_function;
 			if (((LVUnsignedInteger)fp->_noutervalues) > nval) {
-				v->Push(*(_outer(clo->_outervalues[nval])->_valptr));
+				v->Push(*_outervalptr(clo, nval));
 				LVOuterVar& ov = fp->_outervalues[nval];
 				name = _stringval(ov._name);
 			}
@@ -1272,7 +1334,7 @@ LVRESULT lv_setfreevariable(VMHANDLE v, LVInteger idx, LVUnsignedInteger nval) {
 		case OT_CLOSURE: {
 			FunctionPrototype *fp = _closure(self)->_function;
 			if (((LVUnsignedInteger)fp->_noutervalues) > nval) {
-				*(_outer(_closure(self)->_outervalues[nval])->_valptr) = stack_get(v, -1);
+				*_outervalptr(_closure(self), nval) = stack_get(v, -1);
 			} else return lv_throwerror(v, _LC("invalid free var index"));
 		}
 		break;
@@ -1528,6 +1590,11 @@ void lv_setprintfunc(VMHANDLE v, LVPRINTFUNCTION printfunc, LVPRINTFUNCTION errf
 	_ss(v)->_errorfunc = errfunc;
 }
 
+/* Called on the thread of every worker VM pmap, pfilter and preduce start, before it runs anything */
+void lv_setworkerhook(VMHANDLE v, LVWORKERHOOK hook) {
+	_ss(v)->_workerhook = hook;
+}
+
 void lv_setreadfunc(VMHANDLE v, LVREADFUNCTION readfunc) {
 	_ss(v)->_readfunc = readfunc;
 }
@@ -1540,14 +1607,27 @@ LVPRINTFUNCTION lv_geterrorfunc(VMHANDLE v) {
 	return _ss(v)->_errorfunc;
 }
 
+//not pooled, the sizes hosts and modules pass are not always the allocated ones
 void *lv_malloc(LVUnsignedInteger size) {
-	return LV_MALLOC(size);
+	return lv_vm_malloc(size);
 }
 
 void *lv_realloc(void *p, LVUnsignedInteger oldsize, LVUnsignedInteger newsize) {
-	return LV_REALLOC(p, oldsize, newsize);
+	return lv_vm_realloc(p, oldsize, newsize);
 }
 
 void lv_free(void *p, LVUnsignedInteger size) {
-	LV_FREE(p, size);
+	lv_vm_free(p, size);
+}
+
+LVInteger lv_getpoolstats(LVPoolStats *stats, LVInteger n) {
+	return lv_pool_getstats(stats, n);
+}
+
+void lv_reservestrings(VMHANDLE v, LVInteger slots) {
+	_ss(v)->_stringtable->Reserve(slots);
+}
+
+void lv_getstringtablestats(VMHANDLE v, LVStringTableStats *stats) {
+	_ss(v)->_stringtable->GetStats(stats);
 }
@@ -1,15 +1,31 @@
 #ifndef _ARRAY_H_
 #define _ARRAY_H_
 
+//shorter slices are copied, a view costs about as much as copying them
+#define ARRAY_VIEW_MINSIZE 16
+
+/*
+ * A slice of ARRAY_VIEW_MINSIZE values or more is a view: an array without
+ * values of its own that reads _length values of _base from _offset. The
+ * arrays viewing an array are linked from its _views. A view copies its
+ * values before it changes, and before its base changes, in Unshare().
+ */
 struct LVArray : public CHAINABLE_OBJ {
   private:
 	LVArray(LVSharedState *ss, LVInteger nsize) {
 		_values.resize(nsize);
+		_offset = 0;
+		_length = 0;
+		_views = NULL;
+		_nextview = NULL;
+		_prevview = NULL;
 		INIT_CHAIN();
 		ADD_TO_CHAIN(&_ss(this)->_gc_chain, this);
 	}
 
 	~LVArray() {
+		if (IsView())
+			Unview();
 		REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain, this);
 	}
 
@@ -28,19 +44,43 @@ struct LVArray : public CHAINABLE_OBJ {
 #endif
 
 	void Finalize() {
+		if (IsView())
+			Unview();
+		while (_views)
+			_views->Unview();
 		_values.resize(0);
 	}
 
+	bool IsView() const {
+		return type(_base) == OT_ARRAY;
+	}
+
+	//the values, which a view reads from its base
+	LVObjectPtr *Values() const {
+		return IsView() ? &_array(_base)->_values[_offset] : _values._vals;
+	}
+
+	//must be called before the values change, or are used through _values
+	void Unshare() {
+		if (IsView() || _views)
+			UnshareViews();
+	}
+
+	void UnshareViews();
+	void Unview();
+	LVArray *Slice(LVInteger sidx, LVInteger eidx);
+
 	bool Get(const LVInteger nidx, LVObjectPtr& val) {
-		if (nidx >= 0 && nidx < (LVInteger)_values.size()) {
-			LVObjectPtr& o = _values[nidx];
+		if (nidx >= 0 && nidx < Size()) {
+			LVObjectPtr& o = Values()[nidx];
 			val = _realval(o);
 			return true;
 		} else return false;
 	}
 
 	bool Set(const LVInteger nidx, const LVObjectPtr& val) {
-		if (nidx >= 0 && nidx < (LVInteger)_values.size()) {
+		if (nidx >= 0 && nidx < Size()) {
+			Unshare();
 			_values[nidx] = val;
 			return true;
 		} else return false;
@@ -48,10 +88,10 @@ struct LVArray : public CHAINABLE_OBJ {
 
 	LVInteger Next(const LVObjectPtr& refpos, LVObjectPtr& outkey, LVObjectPtr& outval) {
 		LVUnsignedInteger idx = TranslateIndex(refpos);
-		while (idx < _values.size()) {
+		while (idx < (LVUnsignedInteger)Size()) {
 			//first found
 			outkey = (LVInteger)idx;
-			LVObjectPtr& o = _values[idx];
+			LVObjectPtr& o = Values()[idx];
 			outval = _realval(o);
 			//return idx for the next iteration
 			return ++idx;
@@ -61,13 +101,15 @@ struct LVArray : public CHAINABLE_OBJ {
 	}
 
 	LVArray *Clone() {
+		if (IsView())
+			return _array(_base)->Slice(_offset, _offset + _length);
 		LVArray *anew = Create(_opt_ss(this), 0);
 		anew->_values.copy(_values);
 		return anew;
 	}
 
 	LVInteger Size() const {
-		return _values.size();
+		return IsView() ? _length : (LVInteger)_values.size();
 	}
 
 	void Resize(LVInteger size) {
@@ -76,32 +118,37 @@ struct LVArray : public CHAINABLE_OBJ {
 	}
 
 	void Resize(LVInteger size, LVObjectPtr& fill) {
+		Unshare();
 		_values.resize(size, fill);
 		ShrinkIfNeeded();
 	}
 
 	void Reserve(LVInteger size) {
+		Unshare();
 		_values.reserve(size);
 	}
 
 	void Append(const LVObject& o) {
+		Unshare();
 		_values.push_back(o);
 	}
 
 	void Extend(const LVArray *a);
 
 	LVObjectPtr& Top() {
-		return _values.top();
+		return Values()[Size() - 1];
 	}
 
 	void Pop() {
+		Unshare();
 		_values.pop_back();
 		ShrinkIfNeeded();
 	}
 
 	bool Insert(LVInteger idx, const LVObject& val) {
-		if (idx < 0 || idx > (LVInteger)_values.size())
+		if (idx < 0 || idx > Size())
 			return false;
+		Unshare();
 		_values.insert(idx, val);
 		return true;
 	}
@@ -112,8 +159,9 @@ struct LVArray : public CHAINABLE_OBJ {
 	}
 
 	bool Remove(LVInteger idx) {
-		if (idx < 0 || idx >= (LVInteger)_values.size())
+		if (idx < 0 || idx >= Size())
 			return false;
+		Unshare();
 		_values.remove(idx);
 		ShrinkIfNeeded();
 		return true;
@@ -124,5 +172,11 @@ struct LVArray : public CHAINABLE_OBJ {
 	}
 
 	LVObjectPtrVec _values;
+	LVObjectPtr _base;
+	LVInteger _offset;
+	LVInteger _length;
+	LVArray *_views;
+	LVArray *_nextview;
+	LVArray *_prevview;
 };
 #endif // _ARRAY_H_
@@ -205,12 +205,114 @@ static LVInteger base_collectgarbage(VMHANDLE v) {
 	lv_pushinteger(v, lv_collectgarbage(v));
 	return 1;
 }
+static LVInteger base_collectyounggarbage(VMHANDLE v) {
+	lv_pushinteger(v, lv_collectyounggarbage(v));
+	return 1;
+}
+static LVInteger base_collectgarbagestep(VMHANDLE v) {
+	LVInteger budget;
+	lv_getinteger(v, 2, &budget);
+	lv_pushinteger(v, lv_collectgarbagestep(v, budget));
+	return 1;
+}
+static LVInteger base_setgcthreshold(VMHANDLE v) {
+	LVInteger young;
+	lv_getinteger(v, 2, &young);
+	lv_setgcthreshold(v, young);
+	return 0;
+}
+static LVInteger base_gcstats(VMHANDLE v) {
+	LVGCStats stats;
+	lv_getgcstats(v, &stats);
+	lv_newtable(v);
+	lv_pushstring(v, _LC("young"), -1);
+	lv_pushinteger(v, stats.young);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("old"), -1);
+	lv_pushinteger(v, stats.old);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("minor"), -1);
+	lv_pushinteger(v, stats.minor);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("major"), -1);
+	lv_pushinteger(v, stats.major);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("steps"), -1);
+	lv_pushinteger(v, stats.steps);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("incremental"), -1);
+	lv_pushinteger(v, stats.incremental);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("promoted"), -1);
+	lv_pushinteger(v, stats.promoted);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("collected"), -1);
+	lv_pushinteger(v, stats.collected);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("lastpause"), -1);
+	lv_pushfloat(v, stats.lastpause);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("totalpause"), -1);
+	lv_pushfloat(v, stats.totalpause);
+	lv_newslot(v, -3, LVFalse);
+	return 1;
+}
 static LVInteger base_resurectureachable(VMHANDLE v) {
 	lv_resurrectunreachable(v);
 	return 1;
 }
 #endif
 
+static LVInteger base_poolstats(VMHANDLE v) {
+	LVPoolStats stats[32];
+	LVInteger n = lv_getpoolstats(stats, 32);
+	if (n > 32)
+		n = 32;
+	lv_newarray(v, 0);
+	for (LVInteger i = 0; i < n; i++) {
+		lv_newtable(v);
+		lv_pushstring(v, _LC("size"), -1);
+		lv_pushinteger(v, stats[i].size);
+		lv_newslot(v, -3, LVFalse);
+		lv_pushstring(v, _LC("allocs"), -1);
+		lv_pushinteger(v, stats[i].allocs);
+		lv_newslot(v, -3, LVFalse);
+		lv_pushstring(v, _LC("frees"), -1);
+		lv_pushinteger(v, stats[i].frees);
+		lv_newslot(v, -3, LVFalse);
+		lv_pushstring(v, _LC("chunks"), -1);
+		lv_pushinteger(v, stats[i].chunks);
+		lv_newslot(v, -3, LVFalse);
+		lv_arrayappend(v, -2);
+	}
+	return 1;
+}
+
+static LVInteger base_stringtablestats(VMHANDLE v) {
+	LVStringTableStats stats;
+	lv_getstringtablestats(v, &stats);
+	lv_newtable(v);
+	lv_pushstring(v, _LC("strings"), -1);
+	lv_pushinteger(v, stats.strings);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("slots"), -1);
+	lv_pushinteger(v, stats.slots);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("used"), -1);
+	lv_pushinteger(v, stats.used);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("longest"), -1);
+	lv_pushinteger(v, stats.longest);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("meanchain"), -1);
+	lv_pushfloat(v, stats.meanchain);
+	lv_newslot(v, -3, LVFalse);
+	lv_pushstring(v, _LC("pending"), -1);
+	lv_pushinteger(v, stats.pending);
+	lv_newslot(v, -3, LVFalse);
+	return 1;
+}
+
 static LVInteger base_getroottable(VMHANDLE v) {
 	v->Push(v->_roottable);
 	return 1;
@@ -254,6 +356,26 @@ static LVInteger base_enabledebuginfo(VMHANDLE v) {
 	return 0;
 }
 
+static LVInteger base_setoptimizationlevel(VMHANDLE v) {
+	LVInteger level;
+
+	lv_getinteger(v, 2, &level);
+	lv_setoptimizationlevel(v, level);
+	return 0;
+}
+
+static LVInteger base_getoptimizationlevel(VMHANDLE v) {
+	lv_pushinteger(v, lv_getoptimizationlevel(v));
+	return 1;
+}
+
+static LVInteger base_enablejit(VMHANDLE v) {
+	LVObjectPtr& o = stack_get(v, 2);
+
+	lv_enablejit(v, LVVM::IsFalse(o) ? LVFalse : LVTrue);
+	return 0;
+}
+
 static LVInteger __getcallstackinfos(VMHANDLE v, LVInteger level) {
 	LVStackInfos si;
 	LVInteger seq = 0;
@@ -450,6 +572,9 @@ static const LVRegFunction base_funcs[] = {
 	{_LC("seterrorhandler"), base_seterrorhandler, 2, NULL},
 	{_LC("setdebughook"), base_setdebughook, 2, NULL},
 	{_LC("enabledebuginfo"), base_enabledebuginfo, 2, NULL},
+	{_LC("setoptimizationlevel"), base_setoptimizationlevel, 2, _LC(".n")},
+	{_LC("getoptimizationlevel"), base_getoptimizationlevel, 1, NULL},
+	{_LC("enablejit"), base_enablejit, 2, NULL},
 	{_LC("getstackinfos"), base_getstackinfos, 2, _LC(".n")},
 	{_LC("getroottable"), base_getroottable, 1, NULL},
 	{_LC("setroottable"), base_setroottable, 2, NULL},
@@ -473,8 +598,14 @@ static const LVRegFunction base_funcs[] = {
 	{_LC("blub"), base_blub, 0, NULL},
 #ifndef NO_GARBAGE_COLLECTOR
 	{_LC("collectgarbage"), base_collectgarbage, 0, NULL},
+	{_LC("collectyounggarbage"), base_collectyounggarbage, 0, NULL},
+	{_LC("collectgarbagestep"), base_collectgarbagestep, 2, _LC(".n")},
+	{_LC("setgcthreshold"), base_setgcthreshold, 2, _LC(".n")},
+	{_LC("gcstats"), base_gcstats, 0, NULL},
 	{_LC("resurrectunreachable"), base_resurectureachable, 0, NULL},
 #endif
+	{_LC("poolstats"), base_poolstats, 0, NULL},
+	{_LC("stringtablestats"), base_stringtablestats, 0, NULL},
 	{NULL, (LVFUNCTION)0, 0, NULL}
 };
 
@@ -494,6 +625,9 @@ void lv_base_register(VMHANDLE v) {
 	/* Additional modules */
 	mod_init_io(v);
 	mod_init_blob(v);
+	mod_init_stringbuilder(v);
+	mod_init_typedarray(v);
+	mod_init_isolate(v);
 	mod_init_string(v);
 
 	/* Global variables */
@@ -843,67 +977,437 @@ static bool _sort_compare(VMHANDLE v, LVObjectPtr& a, LVObjectPtr& b, LVInteger
 	return true;
 }
 
-static bool _hsort_sift_down(VMHANDLE v, LVArray *arr, LVInteger root, LVInteger bottom, LVInteger func) {
-	LVInteger maxChild;
-	LVInteger done = 0;
-	LVInteger ret;
-	LVInteger root2;
-	while (((root2 = root * 2) <= bottom) && (!done)) {
-		if (root2 == bottom) {
-			maxChild = root2;
-		} else {
-			if (!_sort_compare(v, arr->_values[root2], arr->_values[root2 + 1], func, ret))
-				return false;
-			if (ret > 0) {
-				maxChild = root2;
-			} else {
-				maxChild = root2 + 1;
+/*
+ * Sort predicates store in less whether a orders before b. They return false
+ * when the comparison failed, after raising the error.
+ */
+struct LVSortInteger {
+	bool operator()(const LVObjectPtr& a, const LVObjectPtr& b, bool& less) {
+		less = _integer(a) < _integer(b);
+		return true;
+	}
+};
+
+struct LVSortFloat {
+	//NaNs go last, or they would break the ordering the sort relies on
+	bool operator()(const LVObjectPtr& a, const LVObjectPtr& b, bool& less) {
+		less = _float(a) < _float(b) || (_float(a) == _float(a) && _float(b) != _float(b));
+		return true;
+	}
+};
+
+struct LVSortString {
+	bool operator()(const LVObjectPtr& a, const LVObjectPtr& b, bool& less) {
+		less = _rawval(a) != _rawval(b) && scstrcmp(_stringval(a), _stringval(b)) < 0;
+		return true;
+	}
+};
+
+/*
+ * ObjCmp, or the compare function at stack index func. Both can run scripts
+ * that resize the array being sorted, which would leave the sort working on
+ * freed memory, so that is checked after every comparison.
+ */
+struct LVSortCompare {
+	LVSortCompare(VMHANDLE v, LVArray *arr, LVInteger func) : _v(v), _arr(arr), _func(func) {
+		_vals = arr->_values._vals;
+		_size = arr->Size();
+	}
+	bool operator()(const LVObjectPtr& a, const LVObjectPtr& b, bool& less) {
+		LVInteger ret;
+		if (!_sort_compare(_v, (LVObjectPtr&)a, (LVObjectPtr&)b, _func, ret))
+			return false;
+		if (_arr->_values._vals != _vals || _arr->Size() != _size) {
+			_v->Raise_Error(_LC("array modified during sort"));
+			return false;
+		}
+		//a slice taken meanwhile must not see the sort go on
+		_arr->Unshare();
+		less = ret < 0;
+		return true;
+	}
+	VMHANDLE _v;
+	LVArray *_arr;
+	LVInteger _func;
+	LVObjectPtr *_vals;
+	LVInteger _size;
+};
+
+//the type shared by every value, if it is one the sort has a native predicate for
+static LVObjectType _sort_type(LVObjectPtr *vals, LVInteger n) {
+	LVObjectType t = type(vals[0]);
+	if (t != OT_INTEGER && t != OT_FLOAT && t != OT_STRING)
+		return OT_NULL;
+	for (LVInteger i = 1; i < n; i++) {
+		if (type(vals[i]) != t)
+			return OT_NULL;
+	}
+	return t;
+}
+
+#define PDQ_INSERTION_SORT 24
+#define PDQ_NINTHER 128
+#define PDQ_PARTIAL_INSERTION 8
+
+#define _SORT_LESS(a, b, r) { if (!_less(a, b, r)) return false; }
+
+/*
+ * Pattern-defeating quicksort. Values only ever change places by swapping,
+ * so the array stays a permutation of itself while a compare function runs,
+ * and every scan is bounded by the range rather than by a sentinel, so a
+ * compare function that contradicts itself gives a wrong order, never a crash.
+ */
+template<typename Less>
+struct LVPdqSort {
+	LVPdqSort(Less& less) : _less(less) {}
+
+	bool Sort(LVObjectPtr *begin, LVInteger n) {
+		LVInteger bad = 0;
+		for (LVInteger i = n; i > 1; i >>= 1)
+			bad++;
+		return Loop(begin, begin + n, bad, true);
+	}
+
+  private:
+	bool InsertionSort(LVObjectPtr *begin, LVObjectPtr *end) {
+		bool r;
+		for (LVObjectPtr *i = begin + 1; i < end; i++) {
+			for (LVObjectPtr *j = i; j > begin; j--) {
+				_SORT_LESS(j[0], j[-1], r);
+				if (!r)
+					break;
+				_Swap(j[0], j[-1]);
 			}
 		}
+		return true;
+	}
 
-		if (!_sort_compare(v, arr->_values[root], arr->_values[maxChild], func, ret))
-			return false;
-		if (ret < 0) {
-			if (root == maxChild) {
-				v->Raise_Error(_LC("inconsistent compare function"));
-				return false; // We'd be swapping ourselve. The compare function is incorrect
+	//gives up, leaving a permutation, once it has taken too many swaps
+	bool PartialInsertionSort(LVObjectPtr *begin, LVObjectPtr *end, bool& done) {
+		LVInteger swaps = 0;
+		bool r;
+		done = false;
+		for (LVObjectPtr *i = begin + 1; i < end; i++) {
+			for (LVObjectPtr *j = i; j > begin; j--) {
+				_SORT_LESS(j[0], j[-1], r);
+				if (!r)
+					break;
+				if (++swaps > PDQ_PARTIAL_INSERTION)
+					return true;
+				_Swap(j[0], j[-1]);
 			}
+		}
+		done = true;
+		return true;
+	}
 
-			_Swap(arr->_values[root], arr->_values[maxChild]);
-			root = maxChild;
-		} else {
-			done = 1;
+	bool SiftDown(LVObjectPtr *a, LVInteger root, LVInteger n) {
+		bool r;
+		for (;;) {
+			LVInteger child = root * 2 + 1;
+			if (child >= n)
+				return true;
+			if (child + 1 < n) {
+				_SORT_LESS(a[child], a[child + 1], r);
+				if (r)
+					child++;
+			}
+			_SORT_LESS(a[root], a[child], r);
+			if (!r)
+				return true;
+			_Swap(a[root], a[child]);
+			root = child;
 		}
 	}
-	return true;
-}
 
-static bool _hsort(VMHANDLE v, LVObjectPtr& arr, LVInteger LV_UNUSED_ARG(l), LVInteger LV_UNUSED_ARG(r), LVInteger func) {
-	LVArray *a = _array(arr);
-	LVInteger i;
-	LVInteger array_size = a->Size();
-	for (i = (array_size / 2); i >= 0; i--) {
-		if (!_hsort_sift_down(v, a, i, array_size - 1, func)) return false;
+	bool HeapSort(LVObjectPtr *begin, LVObjectPtr *end) {
+		LVInteger n = end - begin;
+		for (LVInteger i = n / 2 - 1; i >= 0; i--) {
+			if (!SiftDown(begin, i, n))
+				return false;
+		}
+		for (LVInteger i = n - 1; i > 0; i--) {
+			_Swap(begin[0], begin[i]);
+			if (!SiftDown(begin, 0, i))
+				return false;
+		}
+		return true;
+	}
+
+	bool Sort3(LVObjectPtr *a, LVObjectPtr *b, LVObjectPtr *c) {
+		bool r;
+		_SORT_LESS(*b, *a, r);
+		if (r)
+			_Swap(*a, *b);
+		_SORT_LESS(*c, *b, r);
+		if (r) {
+			_Swap(*b, *c);
+			_SORT_LESS(*b, *a, r);
+			if (r)
+				_Swap(*a, *b);
+		}
+		return true;
+	}
+
+	//pivot in *begin, values less than it end up on its left
+	bool PartitionRight(LVObjectPtr *begin, LVObjectPtr *end, LVObjectPtr *&pivot, bool& partitioned) {
+		LVObjectPtr *i = begin + 1, *j = end - 1;
+		bool r;
+		partitioned = true;
+		for (;;) {
+			for (; i <= j; i++) {
+				_SORT_LESS(*i, *begin, r);
+				if (!r)
+					break;
+			}
+			for (; i <= j; j--) {
+				_SORT_LESS(*j, *begin, r);
+				if (r)
+					break;
+			}
+			if (i >= j)
+				break;
+			_Swap(*i++, *j--);
+			partitioned = false;
+		}
+		pivot = i - 1;
+		_Swap(*begin, *pivot);
+		return true;
+	}
+
+	//pivot in *begin, values equal to it end up on its left
+	bool PartitionLeft(LVObjectPtr *begin, LVObjectPtr *end, LVObjectPtr *&pivot) {
+		LVObjectPtr *i = begin + 1, *j = end - 1;
+		bool r;
+		for (;;) {
+			for (; i <= j; i++) {
+				_SORT_LESS(*begin, *i, r);
+				if (r)
+					break;
+			}
+			for (; i <= j; j--) {
+				_SORT_LESS(*begin, *j, r);
+				if (!r)
+					break;
+			}
+			if (i >= j)
+				break;
+			_Swap(*i++, *j--);
+		}
+		pivot = i - 1;
+		_Swap(*begin, *pivot);
+		return true;
+	}
+
+	bool Loop(LVObjectPtr *begin, LVObjectPtr *end, LVInteger bad, bool leftmost) {
+		LVObjectPtr *pivot;
+		bool r, partitioned, done;
+		for (;;) {
+			LVInteger size = end - begin;
+			if (size < PDQ_INSERTION_SORT)
+				return InsertionSort(begin, end);
+
+			//the median of three, or of three medians, goes to *begin
+			LVInteger s2 = size / 2;
+			if (size > PDQ_NINTHER) {
+				if (!Sort3(begin, begin + s2, end - 1) || !Sort3(begin + 1, begin + s2 - 1, end - 2)
+				        || !Sort3(begin + 2, begin + s2 + 1, end - 3) || !Sort3(begin + s2 - 1, begin + s2, begin + s2 + 1))
+					return false;
+				_Swap(begin[0], begin[s2]);
+			} else if (!Sort3(begin + s2, begin, end - 1)) {
+				return false;
+			}
+
+			//a pivot equal to the one before the range means a run of equal values, which needs no more sorting
+			if (!leftmost) {
+				_SORT_LESS(begin[-1], begin[0], r);
+				if (!r) {
+					if (!PartitionLeft(begin, end, pivot))
+						return false;
+					begin = pivot + 1;
+					continue;
+				}
+			}
+
+			if (!PartitionRight(begin, end, pivot, partitioned))
+				return false;
+			LVInteger lsize = pivot - begin, rsize = end - (pivot + 1);
+			if (lsize < size / 8 || rsize < size / 8) {
+				//unbalanced, so break up whatever pattern caused it, or give up and heap sort
+				if (--bad == 0)
+					return HeapSort(begin, end);
+				if (lsize >= PDQ_INSERTION_SORT) {
+					_Swap(begin[0], begin[lsize / 4]);
+					_Swap(pivot[-1], pivot[-lsize / 4]);
+				}
+				if (rsize >= PDQ_INSERTION_SORT) {
+					_Swap(pivot[1], pivot[1 + rsize / 4]);
+					_Swap(end[-1], end[-rsize / 4]);
+				}
+			} else if (partitioned) {
+				//already in order, as far as partitioning could tell
+				if (!PartialInsertionSort(begin, pivot, done))
+					return false;
+				if (done) {
+					if (!PartialInsertionSort(pivot + 1, end, done))
+						return false;
+					if (done)
+						return true;
+				}
+			}
+
+			if (!Loop(begin, pivot, bad, leftmost))
+				return false;
+			begin = pivot + 1;
+			leftmost = false;
+		}
 	}
 
-	for (i = array_size - 1; i >= 1; i--) {
-		_Swap(a->_values[0], a->_values[i]);
-		if (!_hsort_sift_down(v, a, 0, i - 1, func)) return false;
+	Less& _less;
+};
+
+/*
+ * Stable merge sort of the indices in idx by the values they index in keys,
+ * for sortby(). tmp has room for n indices.
+ */
+template<typename Less>
+static bool _merge_sort(Less& _less, LVObjectPtr *keys, LVInteger *idx, LVInteger *tmp, LVInteger n) {
+	bool r;
+	if (n <= PDQ_INSERTION_SORT / 2) {
+		for (LVInteger i = 1; i < n; i++) {
+			for (LVInteger j = i; j > 0; j--) {
+				_SORT_LESS(keys[idx[j]], keys[idx[j - 1]], r);
+				if (!r)
+					break;
+				LVInteger t = idx[j];
+				idx[j] = idx[j - 1];
+				idx[j - 1] = t;
+			}
+		}
+		return true;
+	}
+	LVInteger m = n / 2;
+	if (!_merge_sort(_less, keys, idx, tmp, m) || !_merge_sort(_less, keys, idx + m, tmp, n - m))
+		return false;
+	_SORT_LESS(keys[idx[m]], keys[idx[m - 1]], r);
+	if (!r)
+		return true;
+	LVInteger i = 0, j = m, k = 0;
+	while (i < m && j < n) {
+		//the right run only goes first when strictly less, which keeps equal keys in order
+		_SORT_LESS(keys[idx[j]], keys[idx[i]], r);
+		tmp[k++] = r ? idx[j++] : idx[i++];
 	}
+	while (i < m)
+		tmp[k++] = idx[i++];
+	memcpy(idx, tmp, k * sizeof(LVInteger));
 	return true;
 }
 
+template<typename Less>
+static bool _sort(Less& less, LVObjectPtr *vals, LVInteger n) {
+	LVPdqSort<Less> s(less);
+	return s.Sort(vals, n);
+}
+
 static LVInteger array_sort(VMHANDLE v) {
-	LVInteger func = -1;
-	LVObjectPtr& o = stack_get(v, 1);
-	if (_array(o)->Size() > 1) {
-		if (lv_gettop(v) == 2)
-			func = 2;
-		if (!_hsort(v, o, 0, _array(o)->Size() - 1, func))
-			return LV_ERROR;
+	LVArray *a = _array(stack_get(v, 1));
+	LVInteger n = a->Size();
+	if (n < 2)
+		return 0;
+	a->Unshare();
+	LVObjectPtr *vals = a->_values._vals;
+	bool ok;
+	if (lv_gettop(v) == 2) {
+		LVSortCompare less(v, a, 2);
+		ok = _sort(less, vals, n);
+	} else {
+		switch (_sort_type(vals, n)) {
+			case OT_INTEGER: {
+				LVSortInteger less;
+				ok = _sort(less, vals, n);
+				break;
+			}
+			case OT_FLOAT: {
+				LVSortFloat less;
+				ok = _sort(less, vals, n);
+				break;
+			}
+			case OT_STRING: {
+				LVSortString less;
+				ok = _sort(less, vals, n);
+				break;
+			}
+			default: {
+				LVSortCompare less(v, a, -1);
+				ok = _sort(less, vals, n);
+				break;
+			}
+		}
+	}
+	return ok ? 0 : LV_ERROR;
+}
 
+/*
+ * Sorts by the key the function returns for every value, calling it once per
+ * value rather than twice per comparison. Values with equal keys keep their order.
+ */
+static LVInteger array_sortby(VMHANDLE v) {
+	LVArray *a = _array(stack_get(v, 1));
+	LVInteger n = a->Size();
+	if (n < 2)
+		return 0;
+	//the keys stay on the stack, below a copy of the key function for __map_array
+	LVObjectPtr keys = LVArray::Create(_ss(v), n);
+	v->Push(keys);
+	lv_push(v, 2);
+	if (LV_FAILED(__map_array(_array(keys), a, v)))
+		return LV_ERROR;
+	if (a->Size() != n)
+		return lv_throwerror(v, _LC("array modified during sort"));
+
+	LVObjectPtr *kvals = _array(keys)->_values._vals;
+	LVInteger *idx = (LVInteger *)lv_malloc(n * 2 * sizeof(LVInteger));
+	for (LVInteger i = 0; i < n; i++)
+		idx[i] = i;
+	bool ok;
+	switch (_sort_type(kvals, n)) {
+		case OT_INTEGER: {
+			LVSortInteger less;
+			ok = _merge_sort(less, kvals, idx, idx + n, n);
+			break;
+		}
+		case OT_FLOAT: {
+			LVSortFloat less;
+			ok = _merge_sort(less, kvals, idx, idx + n, n);
+			break;
+		}
+		case OT_STRING: {
+			LVSortString less;
+			ok = _merge_sort(less, kvals, idx, idx + n, n);
+			break;
+		}
+		default: {
+			LVSortCompare less(v, _array(keys), -1);
+			ok = _merge_sort(less, kvals, idx, idx + n, n);
+			break;
+		}
 	}
-	return 0;
+	if (ok && a->Size() != n) {
+		v->Raise_Error(_LC("array modified during sort"));
+		ok = false;
+	}
+	if (ok) {
+		a->Unshare();
+		//a permutation, so the values move without touching their reference counts
+		LVObject *sorted = (LVObject *)lv_malloc(n * sizeof(LVObject));
+		for (LVInteger i = 0; i < n; i++)
+			sorted[i] = a->_values[idx[i]];
+		memcpy((void *)a->_values._vals, sorted, n * sizeof(LVObject));
+		lv_free(sorted, n * sizeof(LVObject));
+	}
+	lv_free(idx, n * 2 * sizeof(LVInteger));
+	return ok ? 0 : LV_ERROR;
 }
 
 static LVInteger array_slice(VMHANDLE v) {
@@ -920,17 +1424,15 @@ static LVInteger array_slice(VMHANDLE v) {
 		return lv_throwerror(v, _LC("wrong indexes"));
 	if (eidx > alen || sidx < 0)
 		return lv_throwerror(v, _LC("slice out of range"));
-	LVArray *arr = LVArray::Create(_ss(v), eidx - sidx);
-	LVObjectPtr t;
-	LVInteger count = 0;
-	for (LVInteger i = sidx; i < eidx; i++) {
-		_array(o)->Get(i, t);
-		arr->Set(count++, t);
-	}
-	v->Push(arr);
+	v->Push(_array(o)->Slice(sidx, eidx));
 	return 1;
 }
 
+//parallel.cpp
+LVInteger array_pmap(VMHANDLE v);
+LVInteger array_pfilter(VMHANDLE v);
+LVInteger array_preduce(VMHANDLE v);
+
 const LVRegFunction LVSharedState::_array_default_delegate_funcz[] = {
 	{_LC("length"), default_delegate_len, 1, _LC("a")},
 	{_LC("size"), default_delegate_len, 1, _LC("a")},
@@ -944,6 +1446,7 @@ const LVRegFunction LVSharedState::_array_default_delegate_funcz[] = {
 	{_LC("resize"), array_resize, -2, _LC("an")},
 	{_LC("reverse"), array_reverse, 1, _LC("a")},
 	{_LC("sort"), array_sort, -1, _LC("ac")},
+	{_LC("sortby"), array_sortby, 2, _LC("ac")},
 	{_LC("slice"), array_slice, -1, _LC("ann")},
 	{_LC("weakref"), obj_delegate_weakref, 1, NULL },
 	{_LC("tostring"), default_delegate_tostring, 1, _LC(".")},
@@ -953,6 +1456,9 @@ const LVRegFunction LVSharedState::_array_default_delegate_funcz[] = {
 	{_LC("reduce"), array_reduce, 2, _LC("ac")},
 	{_LC("filter"), array_filter, 2, _LC("ac")},
 	{_LC("find"), array_find, 2, _LC("a.")},
+	{_LC("pmap"), array_pmap, -2, _LC("acn")},
+	{_LC("pfilter"), array_pfilter, -2, _LC("acn")},
+	{_LC("preduce"), array_preduce, -2, _LC("acn")},
 	{NULL, (LVFUNCTION)0, 0, NULL}
 };
 
@@ -973,7 +1479,11 @@ static LVInteger string_slice(VMHANDLE v) {
 	if (eidx > slen || sidx < 0)
 		return lv_throwerror(v, _LC("slice out of range"));
 
-	v->Push(LVString::Create(_ss(v), &_stringval(o)[sidx], eidx - sidx));
+	//strings are interned, so the whole string is the string itself
+	if (sidx == 0 && eidx == slen)
+		v->Push(o);
+	else
+		v->Push(LVString::Create(_ss(v), &_stringval(o)[sidx], eidx - sidx));
 	return 1;
 }
 
@@ -1060,7 +1570,7 @@ static LVInteger _closure_acall(VMHANDLE v, LVBool raiseerror) {
 	LVArray *aparams = _array(stack_get(v, 2));
 	LVInteger nparams = aparams->Size();
 	v->Push(stack_get(v, 1));
-	for (LVInteger i = 0; i < nparams; i++)v->Push(aparams->_values[i]);
+	for (LVInteger i = 0; i < nparams; i++)v->Push(aparams->Values()[i]);
 	return LV_SUCCEEDED(lv_call(v, nparams, LVTrue, raiseerror)) ? 1 : LV_ERROR;
 }
 
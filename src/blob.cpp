@@ -108,6 +108,25 @@ struct LVBlob : public LVStream {
 	LVUserPointer GetBuf() {
 		return _buf;
 	}
+	/* Gives the buffer away and starts over empty */
+	LVUserPointer TakeBuf(LVInteger *size, LVInteger *allocated) {
+		unsigned char *buf = _buf;
+		*size = _size;
+		*allocated = _allocated;
+		_buf = (unsigned char *)lv_malloc(0);
+		_size = 0;
+		_allocated = 0;
+		_ptr = 0;
+		return buf;
+	}
+	/* Takes over a buffer from lv_malloc */
+	void GiveBuf(LVUserPointer buf, LVInteger size, LVInteger allocated) {
+		lv_free(_buf, _allocated);
+		_buf = (unsigned char *)buf;
+		_size = size;
+		_allocated = allocated;
+		_ptr = 0;
+	}
 
   private:
 	LVInteger _size;
@@ -340,7 +359,7 @@ LVUserPointer lv_createblob(VMHANDLE v, LVInteger size) {
 	lv_pushstring(v, _LC("std_blob"), -1);
 	if (LV_SUCCEEDED(lv_get(v, -2))) {
 		lv_remove(v, -2); //removes the registry
-		lv_push(v, 1); // push the this
+		lv_pushroottable(v); // push the this, the stack may be empty
 		lv_pushinteger(v, size); //size
 		LVBlob *blob = NULL;
 		if (LV_SUCCEEDED(lv_call(v, 2, LVTrue, LVFalse))
@@ -353,6 +372,22 @@ LVUserPointer lv_createblob(VMHANDLE v, LVInteger size) {
 	return NULL;
 }
 
+LVUserPointer blob_takebuffer(VMHANDLE v, LVInteger idx, LVInteger *size, LVInteger *allocated) {
+	LVBlob *blob;
+	if (LV_FAILED(lv_getinstanceup(v, idx, (LVUserPointer *)&blob, (LVUserPointer)BLOB_TYPE_TAG)) || !blob || !blob->IsValid())
+		return NULL;
+	return blob->TakeBuf(size, allocated);
+}
+
+LVRESULT blob_givebuffer(VMHANDLE v, LVUserPointer buf, LVInteger size, LVInteger allocated) {
+	LVBlob *blob;
+	if (!lv_createblob(v, 0))
+		return LV_ERROR;
+	lv_getinstanceup(v, -1, (LVUserPointer *)&blob, (LVUserPointer)BLOB_TYPE_TAG);
+	blob->GiveBuf(buf, size, allocated);
+	return LV_OK;
+}
+
 LVRESULT mod_init_blob(VMHANDLE v) {
 	return declare_stream(v, _LC("blob"), (LVUserPointer)BLOB_TYPE_TAG, _LC("std_blob"), _blob_methods, bloblib_funcs);
 }
@@ -0,0 +1,473 @@
+//before the headers of the VM, whose type() macro breaks it
+#include <mutex>
+
+#include "pcheader.h"
+#include "vm.h"
+#include "lvstring.h"
+#include "table.h"
+#include "array.h"
+#include "userdata.h"
+#include "class.h"
+#include "funcproto.h"
+#include "closure.h"
+
+/*
+ * lv_openfrom opens a VM as a copy of a bootstrap VM, which the host sets up
+ * once with the modules and the scripts every VM needs. Copying the objects
+ * skips what building them costs: parsing the type masks, hashing the
+ * strings, growing the tables and looking up the registry for every class.
+ *
+ * The copy only reads the bootstrap, it takes no references to its objects,
+ * so several threads can open VMs from the same bootstrap at once as long
+ * as nothing runs in the bootstrap meanwhile. The copies share the string
+ * hash seed of the bootstrap, which lets them keep its hashes and the
+ * layout of its tables.
+ *
+ * The bootstrap may hold null, bools, numbers, strings, tables, arrays,
+ * functions, classes and instances whose class copies them with _cloned.
+ * Anything else, or a function that runs, fails the copy.
+ */
+
+#define COPY_MINSLOTS 1024
+
+//instances are copied by their _cloned, which needs a reference to the original
+static std::mutex _clonedlock;
+
+struct LVStateCopy {
+	LVStateCopy(LVVM *v) : _v(v), _state(_ss(v)) {
+		_numofslots = COPY_MINSLOTS;
+		_used = 0;
+		_keys = (const void **)lv_malloc(_numofslots * sizeof(const void *));
+		_vals = (LVObjectPtr *)lv_malloc(_numofslots * sizeof(LVObjectPtr));
+		memset(_keys, 0, _numofslots * sizeof(const void *));
+	}
+	~LVStateCopy() {
+		Free(_keys, _vals, _numofslots);
+	}
+
+	bool Copy(const LVObject& o, LVObjectPtr& ret) {
+		switch (type(o)) {
+			case OT_NULL:
+			case OT_BOOL:
+			case OT_INTEGER:
+			case OT_FLOAT:
+			case OT_USERPOINTER:
+				ret = o;
+				return true;
+			case OT_STRING:
+				ret = _state->_stringtable->Add(_string(o));
+				return true;
+			case OT_WEAKREF:
+				return CopyWeakRef(_weakref(o), ret);
+			default:
+				break;
+		}
+		if (Find(_refcounted(o), ret))
+			return true;
+		switch (type(o)) {
+			case OT_TABLE:
+				return CopyTable(_table(o), ret);
+			case OT_ARRAY:
+				return CopyArray(_array(o), ret);
+			case OT_NATIVECLOSURE:
+				return CopyNativeClosure(_nativeclosure(o), ret);
+			case OT_CLOSURE:
+				return CopyClosure(_closure(o), ret);
+			case OT_FUNCPROTO:
+				return CopyProto(_funcproto(o), ret);
+			case OT_OUTER:
+				return CopyOuter(_outer(o), ret);
+			case OT_CLASS:
+				return CopyClass(_class(o), ret);
+			case OT_INSTANCE:
+				return CopyInstance(_instance(o), ret);
+			default:
+				return false;
+		}
+	}
+
+  private:
+	static LVObject Raw(LVObjectType t, LVRefCounted *o) {
+		LVObject r;
+		OBJECT_INIT(r, t, pRefCounted, o);
+		return r;
+	}
+
+	static void Free(const void **keys, LVObjectPtr *vals, LVInteger n) {
+		for (LVInteger i = 0; i < n; i++) {
+			if (keys[i])
+				vals[i].~LVObjectPtr();
+		}
+		lv_free(keys, n * sizeof(const void *));
+		lv_free(vals, n * sizeof(LVObjectPtr));
+	}
+
+	inline LVInteger Slot(const void *key) {
+		LVHash mask = (LVHash)_numofslots - 1;
+		LVHash i = _mixhash(hashptr(key)) >> 16 & mask;
+		while (_keys[i] && _keys[i] != key)
+			i = (i + 1) & mask;
+		return (LVInteger)i;
+	}
+
+	bool Find(const void *key, LVObjectPtr& ret) {
+		LVInteger i = Slot(key);
+		if (!_keys[i])
+			return false;
+		ret = _vals[i];
+		return true;
+	}
+
+	//the copies are held until the end, so that weak references to them stay valid
+	void Remember(const void *key, const LVObjectPtr& copy) {
+		if (_used * 2 >= _numofslots) {
+			const void **keys = _keys;
+			LVObjectPtr *vals = _vals;
+			LVInteger n = _numofslots;
+			_numofslots *= 2;
+			_keys = (const void **)lv_malloc(_numofslots * sizeof(const void *));
+			_vals = (LVObjectPtr *)lv_malloc(_numofslots * sizeof(LVObjectPtr));
+			memset(_keys, 0, _numofslots * sizeof(const void *));
+			for (LVInteger i = 0; i < n; i++) {
+				if (keys[i]) {
+					LVInteger k = Slot(keys[i]);
+					_keys[k] = keys[i];
+					new (&_vals[k]) LVObjectPtr(vals[i]);
+				}
+			}
+			Free(keys, vals, n);
+		}
+		LVInteger i = Slot(key);
+		_keys[i] = key;
+		new (&_vals[i]) LVObjectPtr(copy);
+		_used++;
+	}
+
+	bool CopyWeakRef(LVWeakRef *w, LVObjectPtr& ret) {
+		LVObjectPtr target;
+		if (!Copy(w->_obj, target))
+			return false;
+		if (ISREFCOUNTED(type(target)))
+			ret = _refcounted(target)->GetWeakRef(type(target));
+		else
+			ret = target;
+		return true;
+	}
+
+	//a missing or dead weak reference stays NULL
+	bool CopyWeakRef(LVWeakRef *w, LVWeakRef *&ret) {
+		LVObjectPtr r;
+		ret = NULL;
+		if (!w || !CopyWeakRef(w, r))
+			return w == NULL;
+		if (type(r) == OT_WEAKREF) {
+			ret = _weakref(r);
+			__ObjAddRef(ret);
+		}
+		return true;
+	}
+
+	//hashes of pointers differ between the states, the other ones are the same
+	static bool SameLayout(LVTable *t) {
+		for (LVInteger i = 0; i < t->_numofnodes; i++) {
+			if (!(t->_ctrl[i] & CTRL_EMPTY)) {
+				switch (type(t->_nodes[i].key)) {
+					case OT_STRING:
+					case OT_INTEGER:
+					case OT_FLOAT:
+					case OT_BOOL:
+						break;
+					default:
+						return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool CopyTable(LVTable *t, LVObjectPtr& ret) {
+		LVObjectPtr key, val;
+		if (t->_shape || !SameLayout(t)) {
+			LVTable *nt = LVTable::Create(_state, t->CountUsed());
+			ret = nt;
+			Remember(t, ret);
+			for (LVInteger i = 0; t->_shape && i < t->_shape->_nkeys; i++) {
+				if (t->_IsHole(i))
+					continue;
+				if (!Copy(t->_shape->_keys[i], key) || !Copy(t->_slots[i], val))
+					return false;
+				nt->NewSlot(key, val);
+			}
+			for (LVInteger i = 0; i < t->_numofnodes && !t->_shape; i++) {
+				if (t->_ctrl[i] & CTRL_EMPTY)
+					continue;
+				if (!Copy(t->_nodes[i].key, key) || !Copy(t->_nodes[i].val, val))
+					return false;
+				nt->NewSlot(key, val);
+			}
+		} else {
+			//every key lands in the same slot, the nodes are filled in place
+			LVTable *nt = LVTable::Create(_state, LVTable::_MaxLoad(t->_numofnodes));
+			ret = nt;
+			Remember(t, ret);
+			memcpy(nt->_ctrl, t->_ctrl, t->_numofnodes + TABLE_GROUP);
+			for (LVInteger i = 0; i < t->_numofnodes; i++) {
+				if (!(t->_ctrl[i] & CTRL_EMPTY))
+					new (&nt->_nodes[i]) LVTable::_HashNode(key, val);
+			}
+			nt->_usednodes = t->_usednodes;
+			nt->_growthleft = t->_growthleft;
+			for (LVInteger i = 0; i < t->_numofnodes; i++) {
+				if (t->_ctrl[i] & CTRL_EMPTY)
+					continue;
+				if (!Copy(t->_nodes[i].key, nt->_nodes[i].key) || !Copy(t->_nodes[i].val, nt->_nodes[i].val))
+					return false;
+			}
+		}
+		if (t->_delegate) {
+			if (!Copy(Raw(OT_TABLE, t->_delegate), val))
+				return false;
+			_table(ret)->SetDelegate(_table(val));
+		}
+		return true;
+	}
+
+	bool CopyArray(LVArray *a, LVObjectPtr& ret) {
+		LVInteger n = a->Size();
+		LVArray *na = LVArray::Create(_state, n);
+		LVObjectPtr *vals = a->Values();
+		ret = na;
+		Remember(a, ret);
+		for (LVInteger i = 0; i < n; i++) {
+			if (!Copy(vals[i], na->Values()[i]))
+				return false;
+		}
+		return true;
+	}
+
+	bool CopyNativeClosure(LVNativeClosure *c, LVObjectPtr& ret) {
+		LVNativeClosure *nc = LVNativeClosure::Create(_state, c->_function, c->_noutervalues);
+		ret = nc;
+		Remember(c, ret);
+		nc->_nparamscheck = c->_nparamscheck;
+		nc->_typecheck.copy(c->_typecheck);
+		if (!Copy(c->_name, nc->_name) || !CopyWeakRef(c->_env, nc->_env))
+			return false;
+		for (LVUnsignedInteger i = 0; i < c->_noutervalues; i++) {
+			if (!Copy(c->_outervalues[i], nc->_outervalues[i]))
+				return false;
+		}
+		return true;
+	}
+
+	bool CopyClosure(LVClosure *c, LVObjectPtr& ret) {
+		LVObjectPtr proto, base;
+		LVWeakRef *root;
+		if (!CopyProto(c->_function, proto) || !CopyWeakRef(c->_root, root))
+			return false;
+		LVClosure *nc = LVClosure::Create(_state, _funcproto(proto), root);
+		__ObjRelease(root);
+		ret = nc;
+		Remember(c, ret);
+		if (!CopyWeakRef(c->_env, nc->_env))
+			return false;
+		if (c->_base) {
+			if (!Copy(Raw(OT_CLASS, c->_base), base))
+				return false;
+			nc->_base = _class(base);
+			__ObjAddRef(nc->_base);
+		}
+		FunctionPrototype *f = c->_function;
+		for (LVInteger i = 0; i < f->_noutervalues; i++) {
+			//a local read off the stack is as open as an open outer
+			if (type(c->_outervalues[i]) == OT_INTEGER || !Copy(c->_outervalues[i], nc->_outervalues[i]))
+				return false;
+		}
+		for (LVInteger i = 0; i < f->_ndefaultparams; i++) {
+			if (!Copy(c->_defaultparams[i], nc->_defaultparams[i]))
+				return false;
+		}
+		return true;
+	}
+
+	bool CopyProto(FunctionPrototype *f, LVObjectPtr& ret) {
+		if (Find(f, ret))
+			return true;
+		FunctionPrototype *nf = FunctionPrototype::Create(_state, f->_ninstructions, f->_nliterals, f->_nparameters,
+		                        f->_nfunctions, f->_noutervalues, f->_nlineinfos, f->_nlocalvarinfos, f->_ndefaultparams);
+		ret = nf;
+		Remember(f, ret);
+		memcpy(nf->_instructions, f->_instructions, f->_ninstructions * sizeof(LVInstruction));
+		memcpy(nf->_lineinfos, f->_lineinfos, f->_nlineinfos * sizeof(LVLineInfo));
+		memcpy(nf->_defaultparams, f->_defaultparams, f->_ndefaultparams * sizeof(LVInteger));
+		nf->_stacksize = f->_stacksize;
+		nf->_bgenerator = f->_bgenerator;
+		nf->_varparams = f->_varparams;
+		if (!Copy(f->_sourcename, nf->_sourcename) || !Copy(f->_name, nf->_name))
+			return false;
+		for (LVInteger i = 0; i < f->_nliterals; i++) {
+			if (!Copy(f->_literals[i], nf->_literals[i]))
+				return false;
+		}
+		for (LVInteger i = 0; i < f->_nparameters; i++) {
+			if (!Copy(f->_parameters[i], nf->_parameters[i]))
+				return false;
+		}
+		for (LVInteger i = 0; i < f->_nfunctions; i++) {
+			if (!Copy(f->_functions[i], nf->_functions[i]))
+				return false;
+		}
+		for (LVInteger i = 0; i < f->_noutervalues; i++) {
+			LVOuterVar& ov = nf->_outervalues[i];
+			ov._type = f->_outervalues[i]._type;
+			if (!Copy(f->_outervalues[i]._name, ov._name) || !Copy(f->_outervalues[i]._src, ov._src))
+				return false;
+		}
+		for (LVInteger i = 0; i < f->_nlocalvarinfos; i++) {
+			LVLocalVarInfo& lvi = nf->_localvarinfos[i];
+			lvi._start_op = f->_localvarinfos[i]._start_op;
+			lvi._end_op = f->_localvarinfos[i]._end_op;
+			lvi._pos = f->_localvarinfos[i]._pos;
+			if (!Copy(f->_localvarinfos[i]._name, lvi._name))
+				return false;
+		}
+		return true;
+	}
+
+	//an outer still on the stack belongs to a function that runs
+	bool CopyOuter(LVOuter *o, LVObjectPtr& ret) {
+		if (o->_valptr != &o->_value)
+			return false;
+		LVOuter *no = LVOuter::Create(_state, NULL);
+		no->_valptr = &no->_value;
+		ret = no;
+		Remember(o, ret);
+		return Copy(o->_value, no->_value);
+	}
+
+	bool CopyClass(LVClass *c, LVObjectPtr& ret) {
+		LVObjectPtr base, members;
+		LVClass *nc = LVClass::Create(_state, NULL);
+		ret = nc;
+		Remember(c, ret);
+		if (c->_base) {
+			if (!Copy(Raw(OT_CLASS, c->_base), base))
+				return false;
+			nc->_base = _class(base);
+			__ObjAddRef(nc->_base);
+		}
+		if (!Copy(Raw(OT_TABLE, c->_members), members))
+			return false;
+		__ObjRelease(nc->_members);
+		nc->_members = _table(members);
+		__ObjAddRef(nc->_members);
+		nc->_defaultvalues.resize(c->_defaultvalues.size());
+		for (LVUnsignedInteger i = 0; i < c->_defaultvalues.size(); i++) {
+			if (!Copy(c->_defaultvalues[i].val, nc->_defaultvalues[i].val) || !Copy(c->_defaultvalues[i].attrs, nc->_defaultvalues[i].attrs))
+				return false;
+		}
+		nc->_methods.resize(c->_methods.size());
+		for (LVUnsignedInteger i = 0; i < c->_methods.size(); i++) {
+			if (!Copy(c->_methods[i].val, nc->_methods[i].val) || !Copy(c->_methods[i].attrs, nc->_methods[i].attrs))
+				return false;
+		}
+		for (LVInteger i = 0; i < MT_LAST; i++) {
+			if (!Copy(c->_metamethods[i], nc->_metamethods[i]))
+				return false;
+		}
+		nc->_typetag = c->_typetag;
+		nc->_hook = c->_hook;
+		nc->_abstract = c->_abstract;
+		nc->_locked = c->_locked;
+		nc->_constructoridx = c->_constructoridx;
+		nc->_udsize = c->_udsize;
+		return Copy(c->_attributes, nc->_attributes);
+	}
+
+	bool CopyInstance(LVInstance *inst, LVObjectPtr& ret) {
+		LVObjectPtr cls, res;
+		if (!Copy(Raw(OT_CLASS, inst->_class), cls))
+			return false;
+		LVClass *nc = _class(cls);
+		LVInstance *ni = nc->CreateInstance();
+		ret = ni;
+		Remember(inst, ret);
+		for (LVUnsignedInteger i = 0; i < nc->_defaultvalues.size(); i++) {
+			if (!Copy(inst->_values[i], ni->_values[i]))
+				return false;
+		}
+		if (!inst->_userpointer)
+			return true;
+		LVObjectPtr& cloned = nc->_metamethods[MT_CLONED];
+		if (type(cloned) == OT_NULL)
+			return false;
+		//the reference the stack takes is the only write to the bootstrap
+		std::lock_guard<std::mutex> l(_clonedlock);
+		_v->Push(ret);
+		_v->Push(Raw(OT_INSTANCE, inst));
+		return _v->CallMetaMethod(cloned, MT_CLONED, 2, res);
+	}
+
+	LVVM *_v;
+	LVSharedState *_state;
+	const void **_keys;
+	LVObjectPtr *_vals;
+	LVInteger _numofslots;
+	LVInteger _used;
+};
+
+void LVSharedState::InitFrom(LVSharedState *boot) {
+	InitHeap(boot->_hashseed);
+	_stringtable->Reserve(boot->_stringtable->Count());
+	//what the destructor expects should the copy fail
+	_metamethodsmap = LVTable::Create(this, 0);
+	_registry = LVTable::Create(this, 0);
+	_consts = LVTable::Create(this, 0);
+	_compilererrorhandler = boot->_compilererrorhandler;
+	_printfunc = boot->_printfunc;
+	_errorfunc = boot->_errorfunc;
+	_readfunc = boot->_readfunc;
+	_debuginfo = boot->_debuginfo;
+	_optlevel = boot->_optlevel;
+	_notifyallexceptions = boot->_notifyallexceptions;
+	_jit = boot->_jit;
+	_workerhook = boot->_workerhook;
+#ifndef NO_GARBAGE_COLLECTOR
+	_gc_threshold = boot->_gc_threshold;
+#endif
+}
+
+bool LVVM::InitFrom(LVVM *boot, LVInteger stacksize) {
+	LVSharedState *ss = _ss(this);
+	LVSharedState *bs = _ss(boot);
+	LVObjectPtr o;
+	InitStack(stacksize);
+	LVStateCopy c(this);
+	//the root table first, the weak references of the functions point to it
+	if (!c.Copy(boot->_roottable, _roottable) || !c.Copy(boot->_errorhandler, _errorhandler))
+		return false;
+	for (LVUnsignedInteger i = 0; i < bs->_systemstrings->size(); i++) {
+		if (!c.Copy((*bs->_systemstrings)[i], o))
+			return false;
+		ss->_systemstrings->push_back(o);
+	}
+	for (LVUnsignedInteger i = 0; i < bs->_metamethods->size(); i++) {
+		if (!c.Copy((*bs->_metamethods)[i], o))
+			return false;
+		ss->_metamethods->push_back(o);
+	}
+	return c.Copy(bs->_metamethodsmap, ss->_metamethodsmap)
+	       && c.Copy(bs->_constructoridx, ss->_constructoridx)
+	       && c.Copy(bs->_registry, ss->_registry)
+	       && c.Copy(bs->_consts, ss->_consts)
+	       && c.Copy(bs->_table_default_delegate, ss->_table_default_delegate)
+	       && c.Copy(bs->_array_default_delegate, ss->_array_default_delegate)
+	       && c.Copy(bs->_string_default_delegate, ss->_string_default_delegate)
+	       && c.Copy(bs->_number_default_delegate, ss->_number_default_delegate)
+	       && c.Copy(bs->_closure_default_delegate, ss->_closure_default_delegate)
+	       && c.Copy(bs->_generator_default_delegate, ss->_generator_default_delegate)
+	       && c.Copy(bs->_thread_default_delegate, ss->_thread_default_delegate)
+	       && c.Copy(bs->_class_default_delegate, ss->_class_default_delegate)
+	       && c.Copy(bs->_instance_default_delegate, ss->_instance_default_delegate)
+	       && c.Copy(bs->_weakref_default_delegate, ss->_weakref_default_delegate);
+}
@@ -13,6 +13,7 @@ LVClass::LVClass(LVSharedState *ss, LVClass *base) {
 	_abstract = false;
 	_locked = false;
 	_constructoridx = -1;
+	_stamp = ++ss->_classstamp;
 	if (_base) {
 		_constructoridx = _base->_constructoridx;
 		_udsize = _base->_udsize;
@@ -49,6 +50,7 @@ bool LVClass::NewSlot(LVSharedState *ss, const LVObjectPtr& key, const LVObjectP
 	bool belongs_to_static_table = type(val) == OT_CLOSURE || type(val) == OT_NATIVECLOSURE || bstatic;
 	if (_locked && !belongs_to_static_table)
 		return false; //the class already has an instance so cannot be modified
+	_stamp = ++ss->_classstamp;
 	if (_members->Get(key, temp) && _isfield(temp)) { //overrides the default value
 		_defaultvalues[_member_idx(temp)].val = val;
 		return true;
@@ -97,6 +97,8 @@ struct LVClass : public CHAINABLE_OBJ {
 	bool _locked;
 	LVInteger _constructoridx;
 	LVInteger _udsize;
+	/* Changes whenever a member is added, see LVVM::GetGlobalCached */
+	LVUnsignedInteger _stamp;
 };
 
 #define calcinstancesize(_theclass_) \
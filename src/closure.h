@@ -15,6 +15,7 @@ struct LVClosure : public CHAINABLE_OBJ {
 		ADD_TO_CHAIN(&_ss(this)->_gc_chain, this);
 		_env = NULL;
 		_root = NULL;
+		_stackowner = NULL;
 	}
 
   public:
@@ -38,7 +39,7 @@ struct LVClosure : public CHAINABLE_OBJ {
 		_DESTRUCT_VECTOR(LVObjectPtr, f->_ndefaultparams, _defaultparams);
 		__ObjRelease(_function);
 		this->~LVClosure();
-		lv_vm_free(this, size);
+		LV_FREE(this, size);
 	}
 
 	void SetRoot(LVWeakRef *r) {
@@ -47,15 +48,8 @@ struct LVClosure : public CHAINABLE_OBJ {
 		__ObjAddRef(_root);
 	}
 
-	LVClosure *Clone() {
-		FunctionPrototype *f = _function;
-		LVClosure *ret = LVClosure::Create(_opt_ss(this), f, _root);
-		ret->_env = _env;
-		if (ret->_env) __ObjAddRef(ret->_env);
-		_COPY_VECTOR(ret->_outervalues, _outervalues, f->_noutervalues);
-		_COPY_VECTOR(ret->_defaultparams, _defaultparams, f->_ndefaultparams);
-		return ret;
-	}
+	LVClosure *Clone();
+	void CloseStackOuters();
 
 	~LVClosure();
 
@@ -82,8 +76,14 @@ struct LVClosure : public CHAINABLE_OBJ {
 	FunctionPrototype *_function;
 	LVObjectPtr *_outervalues;
 	LVObjectPtr *_defaultparams;
+	LVVM *_stackowner;
 };
 
+/* Where outer i of a closure lives, a slot of the stack of _stackowner or an LVOuter, see LVVM::CLOSURE_OP */
+#define _outervalptr(c, i) (type((c)->_outervalues[i]) == OT_INTEGER \
+	? &(c)->_stackowner->_stack._vals[_integer((c)->_outervalues[i])] \
+	: _outer((c)->_outervalues[i])->_valptr)
+
 struct LVOuter : public CHAINABLE_OBJ {
   private:
 	LVOuter(LVSharedState *ss, LVObjectPtr *outer) {
@@ -106,7 +106,7 @@ struct LVOuter : public CHAINABLE_OBJ {
 
 	void Release() {
 		this->~LVOuter();
-		lv_vm_free(this, sizeof(LVOuter));
+		LV_FREE(this, sizeof(LVOuter));
 	}
 
 #ifndef NO_GARBAGE_COLLECTOR
@@ -228,7 +228,7 @@ struct LVNativeClosure : public CHAINABLE_OBJ {
 		LVInteger size = _CALC_NATVIVECLOSURE_SIZE(_noutervalues);
 		_DESTRUCT_VECTOR(LVObjectPtr, _noutervalues, _outervalues);
 		this->~LVNativeClosure();
-		lv_free(this, size);
+		LV_FREE(this, size);
 	}
 
 #ifndef NO_GARBAGE_COLLECTOR
@@ -69,11 +69,12 @@ struct Scope {
 
 class LVCompiler {
   public:
-	LVCompiler(LVVM *v, LVLEXREADFUNC rg, LVUserPointer up, const LVChar *sourcename, bool raiseerror, bool lineinfo) {
+	LVCompiler(LVVM *v, LVLEXREADFUNC rg, LVUserPointer up, const LVChar *sourcename, bool raiseerror, bool lineinfo, LVInteger optlevel) {
 		_vm = v;
 		_lex.Init(_ss(v), rg, up, ThrowError, this);
 		_sourcename = LVString::Create(_ss(v), sourcename);
 		_lineinfo = lineinfo;
+		_optlevel = optlevel;
 		_raiseerror = raiseerror;
 		_scope.outers = 0;
 		_scope.stacksize = 0;
@@ -196,6 +197,7 @@ class LVCompiler {
 			_fs->AddLineInfos(_lex._currentline, _lineinfo, true);
 			_fs->AddInstruction(_OP_RETURN, 0xFF);
 			_fs->SetStackSize(0);
+			_fs->Optimize(_optlevel, !_lineinfo);
 			o = _fs->BuildProto();
 #ifdef _DEBUG_DUMP
 			_fs->Dump(_funcproto(o));
@@ -981,7 +983,7 @@ class LVCompiler {
 			}
 			break;
 			case _LC('{'):
-				_fs->AddInstruction(_OP_NEWOBJ, _fs->PushTarget(), 0, NOT_TABLE);
+				_fs->AddInstruction(_OP_NEWOBJ, _fs->PushTarget(), 0, 0, NOT_TABLE);
 				Lex();
 				ParseTableOrClass(_LC(','), _LC('}'));
 				break;
@@ -1116,6 +1118,11 @@ class LVCompiler {
 		while (_token != _LC(')')) {
 			Expression();
 			MoveIfCurrentTargetIsLocal();
+			/* a function literal handed to a call is most likely a callback
+			 * that dies with this frame, let it read its outers off the stack */
+			LVInstruction& last = _fs->GetInstruction(_fs->GetCurrentPos());
+			if (last.op == _OP_CLOSURE && last._arg0 == _fs->TopTarget())
+				last._arg3 = 1;
 			nargs++;
 			if (_token == _LC(',')) {
 				Lex();
@@ -1133,6 +1140,7 @@ class LVCompiler {
 
 	void ParseTableOrClass(LVInteger separator, LVInteger terminator) {
 		LVInteger tpos = _fs->GetCurrentPos(), nkeys = 0;
+		bool constkeys = true;
 		while (_token != terminator) {
 			bool isstatic = false;
 			if (separator == ';') {
@@ -1157,6 +1165,7 @@ class LVCompiler {
 					Lex();
 					CommaExpr();
 					Expect(_LC(']'));
+					constkeys = false;
 					Expect(_LC('='));
 					Expression();
 					break;
@@ -1185,8 +1194,12 @@ class LVCompiler {
 				_fs->AddInstruction(_OP_NEWSLOTA, flags, table, key, val); //this for classes only as it invokes _newmember
 			}
 		}
-		if (separator == _LC(',')) //hack recognizes a table from the separator
+		if (separator == _LC(',')) { //hack recognizes a table from the separator
 			_fs->SetIntructionParam(tpos, 1, nkeys);
+			//a literal with only constant keys starts as a shaped table
+			if (constkeys && nkeys > 0 && nkeys <= SHAPE_MAXKEYS)
+				_fs->SetIntructionParam(tpos, 2, 1);
+		}
 
 		Lex();
 	}
@@ -1426,6 +1439,12 @@ class LVCompiler {
 		LVInteger skipcondjmp = -1;
 		LVInteger __nbreaks__ = _fs->_unresolvedbreaks.size();
 		_fs->_breaktargets.push_back(0);
+		//becomes a _OP_SWITCH when every case is an integer or string constant
+		_fs->AddInstruction(_OP_JMP, 0, 0);
+		LVInteger dispatch = _fs->GetCurrentPos();
+		LVObjectPtrVec labels;
+		LVIntVector bodies;
+		bool constcases = true;
 		while (_token == TK_CASE) {
 			if (!bfirst) {
 				_fs->AddInstruction(_OP_JMP, 0, 0);
@@ -1434,8 +1453,13 @@ class LVCompiler {
 			}
 			//condition
 			Lex();
+			LVInteger labelpos = _fs->GetCurrentPos() + 1;
 			Expression();
 			Expect(_LC(':'));
+			LVObjectPtr label;
+			if (_fs->GetCurrentPos() != labelpos || !_fs->GetLoadedConstant(labelpos, label))
+				constcases = false;
+			labels.push_back(label);
 			LVInteger trg = _fs->PopTarget();
 			LVInteger eqtarget = trg;
 			bool local = _fs->IsLocal(trg);
@@ -1453,6 +1477,7 @@ class LVCompiler {
 				_fs->SetIntructionParam(skipcondjmp, 1, (_fs->GetCurrentPos() - skipcondjmp));
 			}
 			tonextcondjmp = _fs->GetCurrentPos();
+			bodies.push_back(tonextcondjmp + 1);
 			BEGIN_SCOPE();
 			Statements();
 			END_SCOPE();
@@ -1460,6 +1485,16 @@ class LVCompiler {
 		}
 		if (tonextcondjmp != -1)
 			_fs->SetIntructionParam(tonextcondjmp, 1, _fs->GetCurrentPos() - tonextcondjmp);
+		if (constcases && !labels.empty() && _fs->_nliterals <= MAX_SWITCH_LITERAL) {
+			//the first case with a label wins, as in the chain
+			LVObjectPtr cases = LVTable::Create(_ss(_vm), labels.size()), offset;
+			for (LVUnsignedInteger i = 0; i < labels.size(); i++) {
+				if (!_table(cases)->Get(labels[i], offset))
+					_table(cases)->NewSlot(labels[i], bodies[i] - dispatch - 1);
+			}
+			LVInteger lit = _fs->GetConstant(cases);
+			_fs->GetInstruction(dispatch) = LVInstruction(_OP_SWITCH, expr, _fs->GetCurrentPos() - dispatch, lit & 0xFF, lit >> 8);
+		}
 		if (_token == TK_DEFAULT) {
 			Lex();
 			Expect(_LC(':'));
@@ -1522,35 +1557,29 @@ class LVCompiler {
 
 	LVObject ExpectScalar() {
 		LVObject val;
-		val._type = OT_NULL;
-		val._unVal.nInteger = 0; //shut up GCC 4.x
+		OBJECT_INIT(val, OT_NULL, nInteger, 0);
 		switch (_token) {
 			case TK_INTEGER:
-				val._type = OT_INTEGER;
-				val._unVal.nInteger = _lex._nvalue;
+				OBJECT_INIT(val, OT_INTEGER, nInteger, _lex._nvalue);
 				break;
 			case TK_FLOAT:
-				val._type = OT_FLOAT;
-				val._unVal.fFloat = _lex._fvalue;
+				OBJECT_INIT(val, OT_FLOAT, fFloat, _lex._fvalue);
 				break;
 			case TK_STRING_LITERAL:
 				val = _fs->CreateString(_lex._svalue, _lex._longstr.size() - 1);
 				break;
 			case TK_TRUE:
 			case TK_FALSE:
-				val._type = OT_BOOL;
-				val._unVal.nInteger = _token == TK_TRUE ? 1 : 0;
+				OBJECT_INIT(val, OT_BOOL, nInteger, _token == TK_TRUE ? 1 : 0);
 				break;
 			case '-':
 				Lex();
 				switch (_token) {
 					case TK_INTEGER:
-						val._type = OT_INTEGER;
-						val._unVal.nInteger = -_lex._nvalue;
+						OBJECT_INIT(val, OT_INTEGER, nInteger, -_lex._nvalue);
 						break;
 					case TK_FLOAT:
-						val._type = OT_FLOAT;
-						val._unVal.fFloat = -_lex._fvalue;
+						OBJECT_INIT(val, OT_FLOAT, fFloat, -_lex._fvalue);
 						break;
 					default:
 						Error(_LC("scalar expected: integer, float"));
@@ -1577,8 +1606,7 @@ class LVCompiler {
 				Lex();
 				val = ExpectScalar();
 			} else {
-				val._type = OT_INTEGER;
-				val._unVal.nInteger = nval++;
+				OBJECT_INIT(val, OT_INTEGER, nInteger, nval++);
 			}
 			_table(table)->NewSlot(LVObjectPtr(key), LVObjectPtr(val));
 			if (_token == ',') Lex();
@@ -1743,6 +1771,7 @@ class LVCompiler {
 		funcstate->AddInstruction(_OP_RETURN, -1);
 		funcstate->SetStackSize(0);
 
+		funcstate->Optimize(_optlevel, !_lineinfo);
 		FunctionPrototype *func = funcstate->BuildProto();
 #ifdef _DEBUG_DUMP
 		funcstate->Dump(func);
@@ -1778,6 +1807,7 @@ class LVCompiler {
 	LVObjectPtr _sourcename;
 	LVLexer _lex;
 	bool _lineinfo;
+	LVInteger _optlevel;
 	bool _raiseerror;
 	LVInteger _debugline;
 	LVInteger _debugop;
@@ -1788,8 +1818,8 @@ class LVCompiler {
 	LVVM *_vm;
 };
 
-bool RunCompiler(LVVM *vm, LVLEXREADFUNC rg, LVUserPointer up, const LVChar *sourcename, LVObjectPtr& out, bool raiseerror, bool lineinfo) {
-	LVCompiler compiler(vm, rg, up, sourcename, raiseerror, lineinfo);
+bool RunCompiler(LVVM *vm, LVLEXREADFUNC rg, LVUserPointer up, const LVChar *sourcename, LVObjectPtr& out, bool raiseerror, bool lineinfo, LVInteger optlevel) {
+	LVCompiler compiler(vm, rg, up, sourcename, raiseerror, lineinfo, optlevel);
 	return compiler.StartCompiler(out);
 }
 
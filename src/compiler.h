@@ -73,5 +73,5 @@ struct LVVM;
 #define TK_ARROW_RIGHT 326
 
 typedef void(*CompilerErrorFunc)(void *ud, const LVChar *s);
-bool RunCompiler(LVVM *vm, LVLEXREADFUNC rg, LVUserPointer up, const LVChar *sourcename, LVObjectPtr& out, bool raiseerror, bool lineinfo);
+bool RunCompiler(LVVM *vm, LVLEXREADFUNC rg, LVUserPointer up, const LVChar *sourcename, LVObjectPtr& out, bool raiseerror, bool lineinfo, LVInteger optlevel);
 #endif // _COMPILER_H_
@@ -3,6 +3,14 @@
 
 #include "opcodes.h"
 
+struct LVJitCode;
+
+/* The class of the instances a free variable was last read through, see LVVM::GetGlobalCached */
+struct LVGlobalCache {
+	LVClass *_class;
+	LVUnsignedInteger _stamp;
+};
+
 enum LVOuterType {
 	otLOCAL = 0,
 	otOUTER = 1
@@ -55,7 +63,8 @@ typedef lvvector<LVLineInfo> LVLineInfoVec;
         +((ni-1)*sizeof(LVInstruction))+(nl*sizeof(LVObjectPtr)) \
         +(nparams*sizeof(LVObjectPtr))+(nfuncs*sizeof(LVObjectPtr)) \
         +(nouters*sizeof(LVOuterVar))+(nlineinf*sizeof(LVLineInfo)) \
-        +(localinf*sizeof(LVLocalVarInfo))+(defparams*sizeof(LVInteger)))
+        +(localinf*sizeof(LVLocalVarInfo))+(defparams*sizeof(LVInteger)) \
+        +(ni*sizeof(LVInt32)))
 
 
 struct FunctionPrototype : public CHAINABLE_OBJ {
@@ -87,6 +96,8 @@ struct FunctionPrototype : public CHAINABLE_OBJ {
 		f->_nlocalvarinfos = nlocalvarinfos;
 		f->_defaultparams = (LVInteger *)&f->_localvarinfos[nlocalvarinfos];
 		f->_ndefaultparams = ndefaultparams;
+		f->_icache = (LVInt32 *)&f->_defaultparams[ndefaultparams];
+		memset(f->_icache, 0, ninstructions * sizeof(LVInt32));
 
 		_CONSTRUCT_VECTOR(LVObjectPtr, f->_nliterals, f->_literals);
 		_CONSTRUCT_VECTOR(LVObjectPtr, f->_nparameters, f->_parameters);
@@ -150,6 +161,15 @@ struct FunctionPrototype : public CHAINABLE_OBJ {
 	LVInteger _ndefaultparams;
 	LVInteger *_defaultparams;
 
+	/* Inline cache slot per instruction, see LVTable::GetCached */
+	LVInt32 *_icache;
+	/* Per instruction, allocated on the first free variable read in a method */
+	LVGlobalCache *_gcache;
+
+	/* Call counter and native code, see jit.h */
+	LVInteger _hotcount;
+	LVJitCode *_jitcode;
+
 	LVInteger _ninstructions;
 	LVInstruction _instructions[1];
 };
@@ -1,4 +1,5 @@
 #include "pcheader.h"
+#include <math.h>
 #ifndef NO_COMPILER
 #include "compiler.h"
 #include "lvstring.h"
@@ -70,6 +71,15 @@ LVInstructionDesc instruction_desc[] = {
 	{_LC("_OP_NEWSLOTA")},
 	{_LC("_OP_GETBASE")},
 	{_LC("_OP_CLOSE")},
+	{_LC("_OP_ADDI")},
+	{_LC("_OP_SUBI")},
+	{_LC("_OP_MULI")},
+	{_LC("_OP_ADDF")},
+	{_LC("_OP_SUBF")},
+	{_LC("_OP_MULF")},
+	{_LC("_OP_JCMPI")},
+	{_LC("_OP_JCMPF")},
+	{_LC("_OP_SWITCH")},
 };
 
 void DumpLiteral(LVObjectPtr& o) {
@@ -585,6 +595,752 @@ void FunctionState::AddInstruction(LVInstruction& i) {
 	_instructions.push_back(i);
 }
 
+/*
+ * The optimizer, a pass over the instructions of a finished function before
+ * BuildProto. Level 1 removes the code no path reaches, threads jumps to
+ * jumps and drops the moves and line ops that do nothing, level 2 also folds
+ * arithmetic on constants and, without debug info, inlines calls to small
+ * local functions. Like the peephole above, it counts on a
+ * temporary being free once the instruction that reads it has run.
+ */
+
+#define OPT_MAX_HOPS 16
+
+static bool IsJump(const LVInstruction& i) {
+	switch (i.op) {
+		case _OP_JMP:
+		case _OP_JCMP:
+		case _OP_JZ:
+		case _OP_AND:
+		case _OP_OR:
+		case _OP_FOREACH:
+		case _OP_POSTFOREACH:
+		case _OP_PUSHTRAP:
+		case _OP_SWITCH:
+			return true;
+		default:
+			return false;
+	}
+}
+
+//the VM jumps from the next instruction, but for _OP_POSTFOREACH
+static LVInteger JumpTarget(const LVInstruction& i, LVInteger pos) {
+	return i.op == _OP_POSTFOREACH ? pos + i._arg1 : pos + 1 + i._arg1;
+}
+
+static void SetJumpTarget(LVInstruction& i, LVInteger pos, LVInteger target) {
+	i._arg1 = (LVInt32)(i.op == _OP_POSTFOREACH ? target - pos : target - pos - 1);
+}
+
+//a jump to a jump goes where the last one goes
+static LVInteger ThreadJump(const LVInstructionVec& instructions, LVInteger t) {
+	LVInteger n = instructions.size();
+	for (LVInteger hops = 0; hops < OPT_MAX_HOPS && t < n && instructions[t].op == _OP_JMP; hops++)
+		t = JumpTarget(instructions[t], t);
+	return t;
+}
+
+//the cases of a _OP_SWITCH, each one jumps like arg1 does when nothing matches
+static LVTable *SwitchCases(const LVObjectPtrVec& literals, const LVInstruction& i) {
+	return _table(literals[i._arg2 | (i._arg3 << 8)]);
+}
+
+static bool FallsThrough(const LVInstruction& i) {
+	return i.op != _OP_JMP && i.op != _OP_RETURN && i.op != _OP_THROW;
+}
+
+static bool LoadedValue(const LVObjectPtrVec& literals, const LVInstruction& i, bool second, LVObjectPtr& o) {
+	LVUnsignedInteger lit;
+	switch (i.op) {
+		case _OP_LOADINT:
+			o = (LVInteger)i._arg1;
+			return true;
+		case _OP_LOADFLOAT:
+			o = *((const LVFloat *)&i._arg1);
+			return true;
+		case _OP_LOAD:
+		case _OP_DLOAD:
+			lit = second ? i._arg3 : (LVUnsignedInteger)i._arg1;
+			if (lit >= literals.size())
+				return false;
+			o = literals[lit];
+			return type(o) == OT_INTEGER || type(o) == OT_FLOAT || type(o) == OT_STRING;
+		default:
+			return false;
+	}
+}
+
+//what the VM computes for STK(arg2) op STK(arg1), false where it raises an error or is undefined
+static bool FoldArith(const LVInstruction& i, const LVObjectPtr& o1, const LVObjectPtr& o2, LVObjectPtr& res) {
+	LVInteger tmask = type(o1) | type(o2);
+	if (tmask == OT_INTEGER) {
+		LVInteger i1 = _integer(o1), i2 = _integer(o2);
+		switch (i.op) {
+			case _OP_ADD:
+				res = (LVInteger)((LVUnsignedInteger)i1 + (LVUnsignedInteger)i2);
+				return true;
+			case _OP_SUB:
+				res = (LVInteger)((LVUnsignedInteger)i1 - (LVUnsignedInteger)i2);
+				return true;
+			case _OP_MUL:
+				res = (LVInteger)((LVUnsignedInteger)i1 * (LVUnsignedInteger)i2);
+				return true;
+			case _OP_DIV:
+			case _OP_MOD:
+				if (i2 == 0 || i2 == -1)
+					return false;
+				res = i.op == _OP_DIV ? i1 / i2 : i1 % i2;
+				return true;
+			case _OP_BITW:
+				switch (i._arg3) {
+					case BW_AND:
+						res = i1 & i2;
+						return true;
+					case BW_OR:
+						res = i1 | i2;
+						return true;
+					case BW_XOR:
+						res = i1 ^ i2;
+						return true;
+					default:
+						if (i2 < 0 || i2 >= (LVInteger)(sizeof(LVInteger) * 8))
+							return false;
+				}
+				if (i._arg3 == BW_SHIFTL)
+					res = (LVInteger)((LVUnsignedInteger)i1 << i2);
+				else if (i._arg3 == BW_SHIFTR)
+					res = i1 >> i2;
+				else
+					res = (LVInteger)((LVUnsignedInteger)i1 >> i2);
+				return true;
+		}
+	} else if (tmask == OT_FLOAT || tmask == (OT_FLOAT | OT_INTEGER)) {
+		LVFloat f1 = tofloat(o1), f2 = tofloat(o2);
+		switch (i.op) {
+			case _OP_ADD:
+				res = f1 + f2;
+				return true;
+			case _OP_SUB:
+				res = f1 - f2;
+				return true;
+			case _OP_MUL:
+				res = f1 * f2;
+				return true;
+			case _OP_DIV:
+				res = f1 / f2;
+				return true;
+			case _OP_MOD:
+				res = LVFloat(fmod((double)f1, (double)f2));
+				return true;
+		}
+	}
+	return false;
+}
+
+bool FunctionState::IsLocalAt(LVInteger pos, LVInteger stkpos) {
+	for (LVUnsignedInteger i = 0; i < _localvarinfos.size(); i++) {
+		LVLocalVarInfo& lvi = _localvarinfos[i];
+		if (lvi._pos == (LVUnsignedInteger)stkpos && lvi._start_op <= (LVUnsignedInteger)pos && lvi._end_op >= (LVUnsignedInteger)pos)
+			return true;
+	}
+	return false;
+}
+
+void FunctionState::GetLiterals(LVObjectPtrVec& literals) {
+	LVObjectPtr refidx, key, val;
+	LVInteger idx;
+	literals.resize(_nliterals);
+	while ((idx = _table(_literals)->Next(false, refidx, key, val)) != -1) {
+		literals[_integer(val)] = key;
+		refidx = idx;
+	}
+}
+
+bool FunctionState::GetLoadedConstant(LVInteger pos, LVObjectPtr& o) {
+	LVInstruction& inst = _instructions[pos];
+	LVObjectPtr refidx, key, val;
+	LVInteger idx;
+	if (inst.op == _OP_LOADINT) {
+		o = (LVInteger)inst._arg1;
+		return true;
+	}
+	if (inst.op != _OP_LOAD)
+		return false;
+	while ((idx = _table(_literals)->Next(false, refidx, key, val)) != -1) {
+		if (_integer(val) == inst._arg1) {
+			o = key;
+			return type(o) == OT_INTEGER || type(o) == OT_STRING;
+		}
+		refidx = idx;
+	}
+	return false;
+}
+
+/*
+ * Inlining. A call to a local variable that holds the only closure it is
+ * ever given, of a small function without outers, nested functions, traps
+ * or variable parameters, becomes the body of the function: its stack
+ * frame goes where the call puts it in the caller, at the stack base of the
+ * call, and its returns move the value to the target of the call. The 'this'
+ * of such a call is the 'this' of the caller, so slot 0 of the body stays
+ * slot 0 and free variables still fall back to the root table.
+ */
+
+#define INLINE_MAX_INSTRUCTIONS 16
+
+//whether an instruction of the caller can write stack slot s, erring on yes
+static bool Writes(const LVInstruction& i, LVInteger s) {
+	switch (i.op) {
+		case _OP_LINE:
+		case _OP_JMP:
+		case _OP_JCMP:
+		case _OP_JZ:
+		case _OP_RETURN:
+		case _OP_THROW:
+		case _OP_SWITCH:
+		case _OP_APPENDARRAY:
+		case _OP_POPTRAP:
+			return false;
+		case _OP_DLOAD:
+		case _OP_DMOVE:
+			return i._arg0 == s || i._arg2 == s;
+		case _OP_LOADNULLS:
+			return s >= i._arg0 && s < i._arg0 + i._arg1;
+		case _OP_PREPCALL:
+		case _OP_PREPCALLK:
+			return i._arg0 == s || i._arg3 == s;
+		case _OP_INCL:
+		case _OP_PINCL:
+			return i._arg0 == s || i._arg1 == s;
+		case _OP_FOREACH:
+			return i._arg0 == s || (s >= i._arg2 && s <= i._arg2 + 2);
+		default:
+			return i._arg0 == s;
+	}
+}
+
+//moves the slots an instruction of an inlined body uses to the frame in the caller, false if it cannot be inlined
+static bool Relocate(LVInstruction& i, LVInteger base) {
+#define _SLOT(a) a = (unsigned char)((a) ? base + (a) : 0)
+	switch (i.op) {
+		case _OP_LOAD:
+		case _OP_LOADINT:
+		case _OP_LOADFLOAT:
+		case _OP_LOADBOOL:
+		case _OP_LOADNULLS:
+		case _OP_LOADROOT:
+		case _OP_JZ:
+			_SLOT(i._arg0);
+			break;
+		case _OP_DLOAD:
+		case _OP_GETK:
+		case _OP_JCMP:
+		case _OP_AND:
+		case _OP_OR:
+			_SLOT(i._arg0);
+			_SLOT(i._arg2);
+			break;
+		case _OP_MOVE:
+		case _OP_NEG:
+		case _OP_NOT:
+		case _OP_BWNOT:
+		case _OP_TYPEOF:
+		case _OP_INCL:
+		case _OP_PINCL:
+			_SLOT(i._arg0);
+			_SLOT(i._arg1);
+			break;
+		case _OP_EQ:
+		case _OP_NE:
+			_SLOT(i._arg0);
+			if (!i._arg3)
+				_SLOT(i._arg1);
+			_SLOT(i._arg2);
+			break;
+		case _OP_GET:
+		case _OP_ADD:
+		case _OP_SUB:
+		case _OP_MUL:
+		case _OP_DIV:
+		case _OP_MOD:
+		case _OP_BITW:
+		case _OP_CMP:
+		case _OP_EXISTS:
+		case _OP_INSTANCEOF:
+		case _OP_INC:
+		case _OP_PINC:
+			_SLOT(i._arg0);
+			_SLOT(i._arg1);
+			_SLOT(i._arg2);
+			break;
+		case _OP_PREPCALLK:
+			_SLOT(i._arg0);
+			_SLOT(i._arg2);
+			_SLOT(i._arg3);
+			break;
+		case _OP_DMOVE:
+		case _OP_PREPCALL:
+			_SLOT(i._arg0);
+			_SLOT(i._arg1);
+			_SLOT(i._arg2);
+			_SLOT(i._arg3);
+			break;
+		case _OP_SET:
+			if (i._arg0 != 0xFF)
+				_SLOT(i._arg0);
+			_SLOT(i._arg1);
+			_SLOT(i._arg2);
+			_SLOT(i._arg3);
+			break;
+		case _OP_TAILCALL:
+		case _OP_CALL:
+			//the caller stays on the call stack
+			i.op = _OP_CALL;
+			if (i._arg0 != 0xFF)
+				_SLOT(i._arg0);
+			_SLOT(i._arg1);
+			_SLOT(i._arg2);
+			break;
+		case _OP_JMP:
+			break;
+		default:
+			return false;
+	}
+#undef _SLOT
+	return true;
+}
+
+//the function a call at pos can be replaced with, NULL if none
+FunctionPrototype *FunctionState::InlineCandidate(LVInteger pos) {
+	LVInstruction& call = _instructions[pos];
+	LVInteger s = call._arg1, base = call._arg2;
+	for (LVUnsignedInteger v = 0; v < _localvarinfos.size(); v++) {
+		LVLocalVarInfo& lvi = _localvarinfos[v];
+		if (lvi._pos != (LVUnsignedInteger)s || lvi._start_op == 0 || lvi._start_op > (LVUnsignedInteger)pos || lvi._end_op < (LVUnsignedInteger)pos)
+			continue;
+		//given a closure where it is declared and never again
+		LVInstruction& init = _instructions[lvi._start_op - 1];
+		if (init.op != _OP_CLOSURE || init._arg0 != s)
+			return NULL;
+		for (LVUnsignedInteger k = lvi._start_op; k <= lvi._end_op && k < _instructions.size(); k++) {
+			if (Writes(_instructions[k], s))
+				return NULL;
+		}
+		for (LVUnsignedInteger k = 0; k < _functions.size(); k++) {
+			FunctionPrototype *f = _funcproto(_functions[k]);
+			for (LVInteger o = 0; o < f->_noutervalues; o++) {
+				if (f->_outervalues[o]._type == otLOCAL && _integer(f->_outervalues[o]._src) == s)
+					return NULL;
+			}
+		}
+		FunctionPrototype *f = _funcproto(_functions[init._arg1]);
+		if (f->_bgenerator || f->_varparams || f->_noutervalues || f->_nfunctions
+		        || f->_nparameters != call._arg3 || f->_ninstructions > INLINE_MAX_INSTRUCTIONS
+		        || base + f->_stacksize >= MAX_FUNC_STACKSIZE)
+			return NULL;
+		//'this' is a copy of the one of the caller
+		for (LVInteger k = pos - 1; k >= (LVInteger)lvi._start_op; k--) {
+			LVInstruction& i = _instructions[k];
+			if (!Writes(i, base))
+				continue;
+			if ((i.op == _OP_MOVE || i.op == _OP_DMOVE) && i._arg0 == base && i._arg1 == 0)
+				return f;
+			if (i.op == _OP_DMOVE && i._arg2 == base && i._arg3 == 0)
+				return f;
+			return NULL;
+		}
+		return NULL;
+	}
+	return NULL;
+}
+
+//appends the body of f for the call at pos to out, false if some instruction cannot be inlined
+bool FunctionState::InlineBody(FunctionPrototype *f, LVInteger pos, LVObjectPtrVec& literals, LVInstructionVec& out) {
+	LVInstruction call = _instructions[pos];
+	LVInteger n = f->_ninstructions;
+	//where each instruction of f starts in out, and the jumps with the instruction of f they come from
+	LVIntVector at(n + 1), jumps, origins;
+	for (LVInteger k = 0; k < n; k++) {
+		LVInstruction i = f->_instructions[k];
+		at[k] = out.size();
+		if (i.op == _OP_LINE)
+			continue;
+		if (i.op == _OP_RETURN) {
+			if (call._arg0 != 0xFF) {
+				if (i._arg0 == 0xFF)
+					out.push_back(LVInstruction(_OP_LOADNULLS, call._arg0, 1));
+				else
+					out.push_back(LVInstruction(_OP_MOVE, call._arg0, i._arg1 ? call._arg2 + i._arg1 : 0));
+			}
+			if (k < n - 1) {
+				jumps.push_back(out.size());
+				origins.push_back(-1);
+				out.push_back(LVInstruction(_OP_JMP));
+			}
+			continue;
+		}
+		if (!Relocate(i, call._arg2))
+			return false;
+		//the literals move to the caller
+		LVObjectPtr lit;
+		switch (i.op) {
+			case _OP_EQ:
+			case _OP_NE:
+				if (!i._arg3)
+					break;
+			case _OP_LOAD:
+			case _OP_GETK:
+			case _OP_PREPCALLK:
+				lit = f->_literals[i._arg1];
+				i._arg1 = (LVInt32)GetConstant(lit);
+				if (i._arg1 == (LVInteger)literals.size())
+					literals.push_back(lit);
+				break;
+			case _OP_DLOAD: {
+				LVInteger l1 = GetConstant(f->_literals[i._arg1]);
+				if (l1 == (LVInteger)literals.size())
+					literals.push_back(f->_literals[i._arg1]);
+				LVInteger l2 = GetConstant(f->_literals[i._arg3]);
+				if (l2 == (LVInteger)literals.size())
+					literals.push_back(f->_literals[i._arg3]);
+				if (l2 > 0xFF) {
+					out.push_back(LVInstruction(_OP_LOAD, i._arg0, l1));
+					i = LVInstruction(_OP_LOAD, i._arg2, l2);
+				} else {
+					i._arg1 = (LVInt32)l1;
+					i._arg3 = (unsigned char)l2;
+				}
+			}
+			break;
+			default:
+				break;
+		}
+		if (IsJump(i)) {
+			jumps.push_back(out.size());
+			origins.push_back(k);
+		}
+		out.push_back(i);
+	}
+	at[n] = out.size();
+	//a return jumps past the end of the body
+	for (LVUnsignedInteger j = 0; j < jumps.size(); j++) {
+		LVInstruction& i = out[jumps[j]];
+		SetJumpTarget(i, jumps[j], at[origins[j] == -1 ? n : JumpTarget(i, origins[j])]);
+	}
+	if (call._arg2 + f->_stacksize > _stacksize)
+		_stacksize = call._arg2 + f->_stacksize;
+	return true;
+}
+
+void FunctionState::InlineCalls(LVObjectPtrVec& literals) {
+	LVInteger n = _instructions.size();
+	LVInstructionVec out;
+	LVIntVector newpos(n + 1), origins;
+	bool inlined = false;
+	for (LVInteger i = 0; i < n; i++) {
+		LVInstruction& inst = _instructions[i];
+		FunctionPrototype *f;
+		newpos[i] = out.size();
+		if ((inst.op == _OP_CALL || inst.op == _OP_TAILCALL) && (f = InlineCandidate(i))) {
+			LVInteger mark = out.size(), stacksize = _stacksize;
+			if (InlineBody(f, i, literals, out)) {
+				origins.resize(out.size(), -1);
+				inlined = true;
+				continue;
+			}
+			//the literals it added stay, they only cost a slot
+			out.resize(mark);
+			_stacksize = stacksize;
+		}
+		out.push_back(inst);
+		origins.push_back(i);
+	}
+	newpos[n] = out.size();
+	if (!inlined)
+		return;
+	LVObjectPtr refidx, key, val;
+	LVInteger idx;
+	for (LVInteger k = 0; k < (LVInteger)out.size(); k++) {
+		LVInteger i = origins[k];
+		if (i == -1)
+			continue;
+		LVInstruction& inst = out[k];
+		if (IsJump(inst))
+			SetJumpTarget(inst, k, newpos[JumpTarget(_instructions[i], i)]);
+		if (inst.op == _OP_SWITCH) {
+			LVTable *cases = SwitchCases(literals, inst);
+			for (refidx.Null(); (idx = cases->Next(false, refidx, key, val)) != -1; refidx = idx)
+				cases->Set(key, newpos[i + 1 + _integer(val)] - k - 1);
+		}
+	}
+	_instructions.copy(out);
+	for (LVUnsignedInteger i = 0; i < _lineinfos.size(); i++) {
+		LVLineInfo& li = _lineinfos[i];
+		li._op = newpos[li._op < n ? li._op : n];
+	}
+	for (LVUnsignedInteger i = 0; i < _localvarinfos.size(); i++) {
+		LVLocalVarInfo& lvi = _localvarinfos[i];
+		lvi._start_op = newpos[lvi._start_op < (LVUnsignedInteger)n ? lvi._start_op : n];
+		lvi._end_op = newpos[lvi._end_op < (LVUnsignedInteger)n ? lvi._end_op + 1 : n] - 1;
+	}
+}
+
+void FunctionState::FoldConstants(LVObjectPtrVec& literals, lvvector<bool>& removed, const lvvector<bool>& targets) {
+	LVObjectPtr o1, o2, res;
+	//the load each stack slot got its constant from in the straight code so far, -1 if none
+	LVInteger from[MAX_FUNC_STACKSIZE + 1];
+	bool second[MAX_FUNC_STACKSIZE + 1];
+	LVInteger n = _instructions.size();
+	for (LVInteger s = 0; s <= MAX_FUNC_STACKSIZE; s++)
+		from[s] = -1;
+	for (LVInteger i = 0; i < n; i++) {
+		LVInstruction& inst = _instructions[i];
+		if (targets[i]) {
+			for (LVInteger s = 0; s <= MAX_FUNC_STACKSIZE; s++)
+				from[s] = -1;
+		}
+		switch (inst.op) {
+			case _OP_LINE:
+				break;
+			case _OP_LOADINT:
+			case _OP_LOADFLOAT:
+			case _OP_LOAD:
+				from[inst._arg0] = i;
+				second[inst._arg0] = false;
+				break;
+			case _OP_DLOAD:
+				from[inst._arg0] = i;
+				second[inst._arg0] = false;
+				from[inst._arg2] = i;
+				second[inst._arg2] = true;
+				break;
+			case _OP_ADD:
+			case _OP_SUB:
+			case _OP_MUL:
+			case _OP_DIV:
+			case _OP_MOD:
+			case _OP_BITW: {
+				LVInteger s1 = inst._arg2, s2 = inst._arg1, trg = inst._arg0;
+				bool folded = from[s1] != -1 && from[s2] != -1 && !IsLocalAt(i, s1) && !IsLocalAt(i, s2)
+				              && LoadedValue(literals, _instructions[from[s1]], second[s1], o1)
+				              && LoadedValue(literals, _instructions[from[s2]], second[s2], o2);
+				if (folded && type(o1) == OT_STRING && type(o2) == OT_STRING && inst.op == _OP_ADD) {
+					LVInteger l1 = _string(o1)->_len, l2 = _string(o2)->_len;
+					//not the scratch pad, the host may be holding on to it while it compiles
+					LVChar *buf = (LVChar *)LV_MALLOC(lv_rsl(l1 + l2));
+					memcpy(buf, _stringval(o1), lv_rsl(l1));
+					memcpy(buf + l1, _stringval(o2), lv_rsl(l2));
+					res = CreateString(buf, l1 + l2);
+					LV_FREE(buf, lv_rsl(l1 + l2));
+				} else if (!folded || !FoldArith(inst, o1, o2, res)) {
+					//the operands stay loaded for the instruction that reads them
+					from[s1] = from[s2] = from[trg] = -1;
+					break;
+				}
+				//the loads of the operands go, as the constant replaces the instruction
+				for (LVInteger k = 0; k < 2; k++) {
+					LVInteger s = k ? s2 : s1;
+					if (k && s2 == s1)
+						break;
+					LVInstruction& load = _instructions[from[s]];
+					if (load.op != _OP_DLOAD) {
+						removed[from[s]] = true;
+					} else {
+						//the other half stays as a _OP_LOAD
+						if (!second[s]) {
+							load._arg0 = load._arg2;
+							load._arg1 = load._arg3;
+							second[load._arg0] = false;
+						}
+						load.op = _OP_LOAD;
+						load._arg2 = load._arg3 = 0;
+					}
+					from[s] = -1;
+				}
+				if (type(res) == OT_INTEGER && _integer(res) <= INT_MAX && _integer(res) > INT_MIN) {
+					inst = LVInstruction(_OP_LOADINT, trg, _integer(res));
+				} else if (type(res) == OT_FLOAT && sizeof(LVFloat) == sizeof(LVInt32)) {
+					LVFloat f = _float(res);
+					inst = LVInstruction(_OP_LOADFLOAT, trg, *((LVInt32 *)&f));
+				} else {
+					LVInteger lit = GetConstant(res);
+					if (lit == (LVInteger)literals.size())
+						literals.push_back(res);
+					inst = LVInstruction(_OP_LOAD, trg, lit);
+				}
+				from[trg] = i;
+				second[trg] = false;
+			}
+			break;
+			default:
+				for (LVInteger s = 0; s <= MAX_FUNC_STACKSIZE; s++)
+					from[s] = -1;
+				break;
+		}
+	}
+}
+
+void FunctionState::Optimize(LVInteger level, bool inlinecalls) {
+	LVInteger n = _instructions.size();
+	if (level < 1 || n == 0)
+		return;
+	LVObjectPtrVec literals;
+	LVObjectPtr refidx, key, val;
+	LVInteger idx;
+	GetLiterals(literals);
+	if (level >= 2 && inlinecalls) {
+		InlineCalls(literals);
+		n = _instructions.size();
+	}
+	lvvector<bool> targets(n + 1), removed(n), reached(n);
+
+	for (LVInteger i = 0; i < n; i++) {
+		LVInstruction& inst = _instructions[i];
+		if (inst.op == _OP_SWITCH) {
+			LVTable *cases = SwitchCases(literals, inst);
+			for (refidx.Null(); (idx = cases->Next(false, refidx, key, val)) != -1; refidx = idx)
+				cases->Set(key, ThreadJump(_instructions, i + 1 + _integer(val)) - i - 1);
+		} else if (inst.op != _OP_JMP && inst.op != _OP_JZ && inst.op != _OP_JCMP && inst.op != _OP_AND && inst.op != _OP_OR) {
+			continue;
+		}
+		SetJumpTarget(inst, i, ThreadJump(_instructions, JumpTarget(inst, i)));
+	}
+	for (LVInteger i = 0; i < n; i++) {
+		LVInstruction& inst = _instructions[i];
+		if (IsJump(inst))
+			targets[JumpTarget(inst, i)] = true;
+		//_OP_FOREACH skips _OP_POSTFOREACH to the loop body
+		if (inst.op == _OP_FOREACH)
+			targets[i + 2] = true;
+		if (inst.op == _OP_SWITCH) {
+			LVTable *cases = SwitchCases(literals, inst);
+			for (refidx.Null(); (idx = cases->Next(false, refidx, key, val)) != -1; refidx = idx)
+				targets[i + 1 + _integer(val)] = true;
+		}
+	}
+
+	if (level >= 2)
+		FoldConstants(literals, removed, targets);
+
+	LVIntVector work;
+	work.push_back(0);
+	reached[0] = true;
+	while (!work.empty()) {
+		LVInteger i = work.back(), next[3], nnext = 0;
+		work.pop_back();
+		LVInstruction& inst = _instructions[i];
+		if (FallsThrough(inst))
+			next[nnext++] = i + 1;
+		if (inst.op == _OP_FOREACH)
+			next[nnext++] = i + 2;
+		if (IsJump(inst))
+			next[nnext++] = JumpTarget(inst, i);
+		for (LVInteger k = 0; k < nnext; k++) {
+			if (next[k] < n && !reached[next[k]]) {
+				reached[next[k]] = true;
+				work.push_back(next[k]);
+			}
+		}
+		if (inst.op == _OP_SWITCH) {
+			LVTable *cases = SwitchCases(literals, inst);
+			for (refidx.Null(); (idx = cases->Next(false, refidx, key, val)) != -1; refidx = idx) {
+				LVInteger t = i + 1 + _integer(val);
+				if (t < n && !reached[t]) {
+					reached[t] = true;
+					work.push_back(t);
+				}
+			}
+		}
+	}
+
+	LVInteger prev = -1;
+	bool landed = false;
+	for (LVInteger i = 0; i < n; i++) {
+		LVInstruction& inst = _instructions[i];
+		landed = landed || targets[i];
+		if (!reached[i])
+			removed[i] = true;
+		if (removed[i])
+			continue;
+		if (inst.op == _OP_DMOVE && inst._arg0 == inst._arg1) {
+			inst = LVInstruction(_OP_MOVE, inst._arg2, inst._arg3);
+		} else if (inst.op == _OP_DMOVE && inst._arg2 == inst._arg3) {
+			inst = LVInstruction(_OP_MOVE, inst._arg0, inst._arg1);
+		}
+		if (inst.op == _OP_MOVE && inst._arg0 == inst._arg1) {
+			removed[i] = true;
+			continue;
+		}
+		if (prev != -1) {
+			LVInstruction& pi = _instructions[prev];
+			//a move back, or the same move again, when nothing jumps in between
+			if (!landed && pi.op == _OP_MOVE && inst.op == _OP_MOVE
+			        && ((inst._arg0 == pi._arg1 && inst._arg1 == pi._arg0) || (inst._arg0 == pi._arg0 && inst._arg1 == pi._arg1))) {
+				removed[i] = true;
+				continue;
+			}
+			if (pi.op == _OP_LINE && inst.op == _OP_LINE)
+				removed[prev] = true;
+		}
+		prev = i;
+		landed = false;
+	}
+
+	//jumps to the instruction that follows anyway
+	for (LVInteger i = n - 1, next = n; i >= 0; i--) {
+		if (removed[i])
+			continue;
+		LVInstruction& inst = _instructions[i];
+		LVInteger t = JumpTarget(inst, i);
+		if ((inst.op == _OP_JMP || inst.op == _OP_JZ) && t > i && next >= t)
+			removed[i] = true;
+		else
+			next = i;
+	}
+
+	LVIntVector newpos(n + 1);
+	LVInteger m = 0;
+	for (LVInteger i = 0; i < n; i++) {
+		newpos[i] = m;
+		if (!removed[i])
+			m++;
+	}
+	newpos[n] = m;
+	if (m == n)
+		return;
+	for (LVInteger i = 0; i < n; i++) {
+		if (removed[i])
+			continue;
+		LVInstruction inst = _instructions[i];
+		if (IsJump(inst))
+			SetJumpTarget(inst, newpos[i], newpos[JumpTarget(inst, i)]);
+		if (inst.op == _OP_SWITCH) {
+			LVTable *cases = SwitchCases(literals, inst);
+			for (refidx.Null(); (idx = cases->Next(false, refidx, key, val)) != -1; refidx = idx)
+				cases->Set(key, newpos[i + 1 + _integer(val)] - newpos[i] - 1);
+		}
+		_instructions[newpos[i]] = inst;
+	}
+	_instructions.resize(m);
+	for (LVUnsignedInteger i = 0; i < _lineinfos.size(); i++) {
+		LVLineInfo& li = _lineinfos[i];
+		li._op = newpos[li._op < n ? li._op : n];
+	}
+	//a local whose instructions are all gone drops out of the debug info
+	LVLocalVarInfoVec locals;
+	for (LVUnsignedInteger i = 0; i < _localvarinfos.size(); i++) {
+		LVLocalVarInfo lvi = _localvarinfos[i];
+		LVInteger start = newpos[lvi._start_op < (LVUnsignedInteger)n ? lvi._start_op : n];
+		LVInteger end = newpos[lvi._end_op < (LVUnsignedInteger)n ? lvi._end_op + 1 : n] - 1;
+		if (end < start)
+			continue;
+		lvi._start_op = start;
+		lvi._end_op = end;
+		locals.push_back(lvi);
+	}
+	_localvarinfos.copy(locals);
+}
+
 LVObject FunctionState::CreateString(const LVChar *s, LVInteger len) {
 	LVObjectPtr ns(LVString::Create(_sharedstate, s, len));
 	_table(_strings)->NewSlot(ns, (LVInteger)1);
@@ -630,7 +1386,7 @@ FunctionPrototype *FunctionState::BuildProto() {
 }
 
 FunctionState *FunctionState::PushChildState(LVSharedState *ss) {
-	FunctionState *child = (FunctionState *)lv_malloc(sizeof(FunctionState));
+	FunctionState *child = (FunctionState *)LV_MALLOC(sizeof(FunctionState));
 	new (child) FunctionState(ss, this, _errfunc, _errtarget);
 	_childstates.push_back(child);
 	return child;
@@ -48,6 +48,7 @@ struct FunctionState {
 	void MarkLocalAsOuter(LVInteger pos);
 	LVInteger GetOuterVariable(const LVObject& name);
 	LVInteger GenerateCode();
+	void Optimize(LVInteger level, bool inlinecalls);
 	LVInteger GetStackSize();
 	LVInteger CalcStackFrameSize();
 	void AddLineInfos(LVInteger line, bool lineop, bool force = false);
@@ -93,8 +94,15 @@ struct FunctionState {
 	LVSharedState *_sharedstate;
 	lvvector<FunctionState *> _childstates;
 	LVInteger GetConstant(const LVObject& cons);
+	bool GetLoadedConstant(LVInteger pos, LVObjectPtr& o);
 
   private:
+	void GetLiterals(LVObjectPtrVec& literals);
+	void FoldConstants(LVObjectPtrVec& literals, lvvector<bool>& removed, const lvvector<bool>& targets);
+	bool IsLocalAt(LVInteger pos, LVInteger stkpos);
+	FunctionPrototype *InlineCandidate(LVInteger pos);
+	bool InlineBody(FunctionPrototype *f, LVInteger pos, LVObjectPtrVec& literals, LVInstructionVec& out);
+	void InlineCalls(LVObjectPtrVec& literals);
 	CompilerErrorFunc _errfunc;
 	void *_errtarget;
 	LVSharedState *_ss;
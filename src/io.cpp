@@ -158,6 +158,21 @@ static LVInteger _file_constructor(VMHANDLE v) {
 	return 0;
 }
 
+/* The copy writes to the same handle, only the original closes it */
+static LVInteger _file__cloned(VMHANDLE v) {
+	LVFile *other = NULL;
+	if (LV_FAILED(lv_getinstanceup(v, 2, (LVUserPointer *)&other, (LVUserPointer)FILE_TYPE_TAG)) || !other)
+		return LV_ERROR;
+	LVFile *f = new(lv_malloc(sizeof(LVFile))) LVFile(other->GetHandle(), false);
+	if (LV_FAILED(lv_setinstanceup(v, 1, f))) {
+		f->~LVFile();
+		lv_free(f, sizeof(LVFile));
+		return lv_throwerror(v, _LC("cannot clone file"));
+	}
+	lv_setreleasehook(v, 1, _file_releasehook);
+	return 0;
+}
+
 static LVInteger _file_close(VMHANDLE v) {
 	LVFile *self = NULL;
 	if (LV_SUCCEEDED(lv_getinstanceup(v, 1, (LVUserPointer *)&self, (LVUserPointer)FILE_TYPE_TAG)) && self != NULL) {
@@ -170,6 +185,7 @@ static LVInteger _file_close(VMHANDLE v) {
 static const LVRegFunction _file_methods[] = {
 	_DECL_FILE_FUNC(constructor, 3, _LC("x")),
 	_DECL_FILE_FUNC(_typeof, 1, _LC("x")),
+	_DECL_FILE_FUNC(_cloned, 2, _LC("xx")),
 	_DECL_FILE_FUNC(close, 1, _LC("x")),
 	{NULL, (LVFUNCTION)0, 0, NULL}
 };
@@ -0,0 +1,821 @@
+#include "pcheader.h"
+#include "vm.h"
+#include "funcproto.h"
+#include "closure.h"
+#include "table.h"
+#include "array.h"
+#include "class.h"
+#include "jit.h"
+
+#ifdef LV_JIT
+#include <stddef.h>
+#include <sys/mman.h>
+
+/*
+ * Slow paths, called from native code. Each one either completes the
+ * instruction or returns false without side effects, in which case the
+ * native code hands the instruction back to the interpreter.
+ */
+static void jit_move(LVObjectPtr *trg, const LVObjectPtr *src) {
+	*trg = *src;
+}
+
+static void jit_null(LVObjectPtr *trg) {
+	trg->Null();
+}
+
+static bool jit_arith(LVVM *v, LVInteger op, LVObjectPtr *trg, const LVObjectPtr *o1, const LVObjectPtr *o2) {
+	LVInteger tmask = type(*o1) | type(*o2);
+	if (tmask == OT_INTEGER) {
+		LVInteger i2 = _integer(*o2);
+		if ((op == '/' || op == '%') && i2 == 0)
+			return false;
+		if (op == '/' && i2 == -1 && _integer(*o1) == INT_MIN)
+			return false;
+	} else if (tmask != OT_FLOAT && tmask != (OT_FLOAT | OT_INTEGER)) {
+		return false;
+	}
+	return v->ARITH_OP(op, *trg, *o1, *o2);
+}
+
+static bool jit_bitw(LVVM *v, LVInteger op, LVObjectPtr *trg, const LVObjectPtr *o1, const LVObjectPtr *o2) {
+	if ((type(*o1) | type(*o2)) != OT_INTEGER)
+		return false;
+	return v->BW_OP(op, *trg, *o1, *o2);
+}
+
+static bool jit_neg(LVVM *v, LVObjectPtr *trg, const LVObjectPtr *o) {
+	if (!lv_isnumeric(*o))
+		return false;
+	return v->NEG_OP(*trg, *o);
+}
+
+static bool jit_comparable(const LVObjectPtr *o1, const LVObjectPtr *o2) {
+	return (lv_isnumeric(*o1) && lv_isnumeric(*o2))
+	       || (type(*o1) == OT_STRING && type(*o2) == OT_STRING);
+}
+
+static bool jit_cmp(LVVM *v, LVInteger op, LVObjectPtr *trg, const LVObjectPtr *o1, const LVObjectPtr *o2) {
+	if (!jit_comparable(o1, o2))
+		return false;
+	return v->CMP_OP((CmpOP)op, *o1, *o2, *trg);
+}
+
+/* Returns 1 when the comparison holds, 0 when not, -1 to bail out */
+static LVInteger jit_jcmp(LVVM *v, LVInteger op, const LVObjectPtr *o1, const LVObjectPtr *o2) {
+	LVObjectPtr res;
+	if (!jit_comparable(o1, o2) || !v->CMP_OP((CmpOP)op, *o1, *o2, res))
+		return -1;
+	return LVVM::IsFalse(res) ? 0 : 1;
+}
+
+static void jit_eq(LVObjectPtr *trg, const LVObjectPtr *o1, const LVObjectPtr *o2, LVInteger neg) {
+	bool res;
+	LVVM::IsEqual(*o1, *o2, res);
+	*trg = (res != (neg != 0));
+}
+
+static void jit_not(LVObjectPtr *trg, LVObjectPtr *o) {
+	*trg = LVVM::IsFalse(*o);
+}
+
+static bool jit_isfalse(LVObjectPtr *o) {
+	return LVVM::IsFalse(*o);
+}
+
+/* Returns the instruction a _OP_SWITCH at i goes to */
+static LVInteger jit_switch(const LVObjectPtr *o, const LVObjectPtr *cases, LVInteger i, LVInteger deflt) {
+	LVObjectPtr offset;
+	if (type(*o) == OT_INTEGER || type(*o) == OT_STRING)
+		return _table(*cases)->Get(*o, offset) ? i + 1 + _integer(offset) : deflt;
+	return type(*o) == OT_FLOAT ? i + 1 : deflt;
+}
+
+static bool jit_get(LVVM *v, LVObjectPtr *trg, const LVObjectPtr *self, const LVObjectPtr *key) {
+	LVObjectPtr tmp;
+	if (!v->Get(*self, *key, tmp, GET_FLAG_RAW | GET_FLAG_DO_NOT_RAISE_ERROR, DONT_FALL_BACK))
+		return false;
+	*trg = tmp;
+	return true;
+}
+
+static bool jit_set(const LVObjectPtr *self, const LVObjectPtr *key, const LVObjectPtr *val) {
+	switch (type(*self)) {
+		case OT_TABLE:
+			return _table(*self)->Set(*key, *val);
+		case OT_INSTANCE:
+			return _instance(*self)->Set(*key, *val);
+		case OT_ARRAY:
+			return lv_isnumeric(*key) && _array(*self)->Set(tointeger(*key), *val);
+		default:
+			return false;
+	}
+}
+
+/*
+ * x86-64 emitter. Hot code goes to the main buffer, slow paths and exits to
+ * the cold buffer which is laid out after it. rbx holds the frame stack,
+ * r12 the VM.
+ */
+enum JitReg {
+	RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7, R8 = 8
+};
+
+enum JitCond {
+	CC_E = 0x84, CC_NE = 0x85, CC_S = 0x88,
+	CC_L = 0x8C, CC_GE = 0x8D, CC_LE = 0x8E, CC_G = 0x8F
+};
+
+#define SLOT(i) ((LVInt32)((i) * sizeof(LVObjectPtr)))
+#define SLOT_TYPE(i) ((LVInt32)((i) * sizeof(LVObjectPtr) + offsetof(LVObject, _type)))
+#define SLOT_VAL(i) ((LVInt32)((i) * sizeof(LVObjectPtr) + offsetof(LVObject, _unVal)))
+
+struct LVJitAssembler {
+	enum { MAIN = 0, COLD = 1 };
+
+	struct Label {
+		LVInteger buf;
+		LVInteger pos;
+	};
+
+	struct Fixup {
+		LVInteger buf;
+		LVInteger pos;
+		LVInteger label;
+	};
+
+	LVJitAssembler() {
+		_cur = MAIN;
+	}
+
+	LVInteger NewLabel() {
+		Label l;
+		l.buf = -1;
+		l.pos = 0;
+		_labels.push_back(l);
+		return _labels.size() - 1;
+	}
+
+	void Bind(LVInteger label) {
+		_labels[label].buf = _cur;
+		_labels[label].pos = _code[_cur].size();
+	}
+
+	LVInteger Offset(LVInteger label) {
+		Label& l = _labels[label];
+		return (l.buf == COLD ? _code[MAIN].size() : 0) + l.pos;
+	}
+
+	void B(unsigned char b) {
+		_code[_cur].push_back(b);
+	}
+
+	void D(LVInt32 d) {
+		for (int i = 0; i < 4; i++) B((unsigned char)(d >> (i * 8)));
+	}
+
+	void Q(LVInteger q) {
+		for (int i = 0; i < 8; i++) B((unsigned char)(q >> (i * 8)));
+	}
+
+	void Rel(LVInteger label) {
+		Fixup f;
+		f.buf = _cur;
+		f.pos = _code[_cur].size();
+		f.label = label;
+		_fixups.push_back(f);
+		D(0);
+	}
+
+	/* [rbx+disp32] operand with reg in the ModRM reg field */
+	void Mem(LVInteger reg, LVInt32 disp) {
+		B((unsigned char)(0x80 | ((reg & 7) << 3) | RBX));
+		D(disp);
+	}
+
+	void Jmp(LVInteger label) {
+		B(0xE9);
+		Rel(label);
+	}
+
+	void Jcc(LVInteger cc, LVInteger label) {
+		B(0x0F);
+		B((unsigned char)cc);
+		Rel(label);
+	}
+
+	void CmpType(LVInteger slot, LVInt32 t) {
+		B(0x81);
+		Mem(7, SLOT_TYPE(slot));
+		D(t);
+	}
+
+	void TestType(LVInteger slot, LVInt32 mask) {
+		B(0xF7);
+		Mem(0, SLOT_TYPE(slot));
+		D(mask);
+	}
+
+	void SetType(LVInteger slot, LVInt32 t) {
+		B(0xC7);
+		Mem(0, SLOT_TYPE(slot));
+		D(t);
+	}
+
+	void SetVal(LVInteger slot, LVInteger raw) {
+		if (raw == (LVInt32)raw) {
+			B(0x48);
+			B(0xC7);
+			Mem(0, SLOT_VAL(slot));
+			D((LVInt32)raw);
+		} else {
+			MovImm(RAX, raw);
+			StoreVal(slot);
+		}
+	}
+
+	void LoadVal(LVInteger slot) {
+		B(0x48);
+		B(0x8B);
+		Mem(RAX, SLOT_VAL(slot));
+	}
+
+	void StoreVal(LVInteger slot) {
+		B(0x48);
+		B(0x89);
+		Mem(RAX, SLOT_VAL(slot));
+	}
+
+	void LoadType(LVInteger slot) {
+		B(0x8B);
+		Mem(RAX, SLOT_TYPE(slot));
+	}
+
+	void OrType(LVInteger slot) {
+		B(0x0B);
+		Mem(RAX, SLOT_TYPE(slot));
+	}
+
+	void StoreType(LVInteger slot) {
+		B(0x89);
+		Mem(RAX, SLOT_TYPE(slot));
+	}
+
+	void TestEax(LVInt32 mask) {
+		B(0xA9);
+		D(mask);
+	}
+
+	/* rax = rax <op> [slot] */
+	void ArithVal(LVInteger op, LVInteger slot) {
+		B(0x48);
+		switch (op) {
+			case '+':
+				B(0x03);
+				break;
+			case '-':
+				B(0x2B);
+				break;
+			default:
+				B(0x0F);
+				B(0xAF);
+				break;
+		}
+		Mem(RAX, SLOT_VAL(slot));
+	}
+
+	void CmpVal(LVInteger slot) {
+		B(0x48);
+		B(0x3B);
+		Mem(RAX, SLOT_VAL(slot));
+	}
+
+	void CmpValZero(LVInteger slot) {
+		B(0x48);
+		B(0x83);
+		Mem(7, SLOT_VAL(slot));
+		B(0);
+	}
+
+	void AddVal(LVInteger slot, LVInt32 imm) {
+		B(0x48);
+		B(0x81);
+		Mem(0, SLOT_VAL(slot));
+		D(imm);
+	}
+
+	void LeaSlot(LVInteger reg, LVInteger slot) {
+		B((unsigned char)(reg >= 8 ? 0x4C : 0x48));
+		B(0x8D);
+		Mem(reg, SLOT(slot));
+	}
+
+	void MovImm(LVInteger reg, LVInteger imm) {
+		B((unsigned char)(reg >= 8 ? 0x49 : 0x48));
+		B((unsigned char)(0xB8 + (reg & 7)));
+		Q(imm);
+	}
+
+	/* jumps to instruction rdx through the entry table */
+	void JmpTable() {
+		Fixup f;
+		MovImm(RAX, 0);
+		f.buf = _cur;
+		f.pos = _code[_cur].size() - 8;
+		f.label = -1;
+		_tablefixes.push_back(f);
+		B(0xFF);
+		B(0x24);
+		B(0xD0);
+	}
+
+	void MovVm() {
+		B(0x4C);
+		B(0x89);
+		B(0xE7); /* mov rdi, r12 */
+	}
+
+	void Call(const void *fn) {
+		MovImm(RAX, (LVInteger)fn);
+		B(0xFF);
+		B(0xD0);
+	}
+
+	void TestAl() {
+		B(0x84);
+		B(0xC0);
+	}
+
+	void TestRax() {
+		B(0x48);
+		B(0x85);
+		B(0xC0);
+	}
+
+	lvvector<unsigned char> _code[2];
+	lvvector<Label> _labels;
+	lvvector<Fixup> _fixups;
+	lvvector<Fixup> _tablefixes;
+	LVInteger _cur;
+};
+
+struct LVJitCompiler {
+	LVJitCompiler(FunctionPrototype *func) {
+		_func = func;
+		_n = func->_ninstructions;
+		for (LVInteger i = 0; i <= _n; i++) {
+			_ops.push_back(a.NewLabel());
+			_exits.push_back(-1);
+		}
+		_epilogue = a.NewLabel();
+	}
+
+	LVInteger Exit(LVInteger i) {
+		if (_exits[i] == -1)
+			_exits[i] = a.NewLabel();
+		return _exits[i];
+	}
+
+	/* slot = constant of a non refcounted type */
+	void LoadConst(LVInteger slot, const LVObject& o) {
+		LVInteger slow = a.NewLabel(), back = a.NewLabel();
+		a.TestType(slot, OBJECT_REF_COUNTED);
+		a.Jcc(CC_NE, slow);
+		a.Bind(back);
+		a.SetType(slot, (LVInt32)type(o));
+		a.SetVal(slot, (LVInteger)_rawval(o));
+
+		a._cur = LVJitAssembler::COLD;
+		a.Bind(slow);
+		a.LeaSlot(RDI, slot);
+		a.Call((const void *)jit_null);
+		a.Jmp(back);
+		a._cur = LVJitAssembler::MAIN;
+	}
+
+	void Move(LVInteger trg, LVInteger src) {
+		LVInteger slow = a.NewLabel(), next = a.NewLabel();
+		a.LoadType(src);
+		a.OrType(trg);
+		a.TestEax(OBJECT_REF_COUNTED);
+		a.Jcc(CC_NE, slow);
+		a.LoadType(src);
+		a.StoreType(trg);
+		a.LoadVal(src);
+		a.StoreVal(trg);
+		a.Bind(next);
+
+		a._cur = LVJitAssembler::COLD;
+		a.Bind(slow);
+		a.LeaSlot(RDI, trg);
+		a.LeaSlot(RSI, src);
+		a.Call((const void *)jit_move);
+		a.Jmp(next);
+		a._cur = LVJitAssembler::MAIN;
+	}
+
+	void MoveLiteral(LVInteger trg, LVInteger lit) {
+		LVObjectPtr& o = _func->_literals[lit];
+		if (!ISREFCOUNTED(type(o))) {
+			LoadConst(trg, o);
+			return;
+		}
+		a.LeaSlot(RDI, trg);
+		a.MovImm(RSI, (LVInteger)&o);
+		a.Call((const void *)jit_move);
+	}
+
+	/* trg = o1 op o2, integers inline, other numbers through ARITH_OP */
+	void Arith(LVInteger i, LVInteger op, LVInteger trg, LVInteger o1, LVInteger o2) {
+		LVInteger slow = a.NewLabel(), next = a.NewLabel();
+		if (op == '+' || op == '-' || op == '*') {
+			a.CmpType(o1, OT_INTEGER);
+			a.Jcc(CC_NE, slow);
+			a.CmpType(o2, OT_INTEGER);
+			a.Jcc(CC_NE, slow);
+			a.TestType(trg, OBJECT_REF_COUNTED);
+			a.Jcc(CC_NE, slow);
+			a.LoadVal(o1);
+			a.ArithVal(op, o2);
+			a.StoreVal(trg);
+			a.SetType(trg, OT_INTEGER);
+			a._cur = LVJitAssembler::COLD;
+			a.Bind(slow);
+		}
+		a.MovVm();
+		a.MovImm(RSI, op);
+		a.LeaSlot(RDX, trg);
+		a.LeaSlot(RCX, o1);
+		a.LeaSlot(R8, o2);
+		a.Call((const void *)jit_arith);
+		a.TestAl();
+		a.Jcc(CC_E, Exit(i));
+		if (a._cur == LVJitAssembler::COLD) {
+			a.Jmp(next);
+			a._cur = LVJitAssembler::MAIN;
+		}
+		a.Bind(next);
+	}
+
+	void JumpCmp(LVInteger i, LVInteger op, LVInteger o1, LVInteger o2, LVInteger target) {
+		LVInteger slow = a.NewLabel();
+		LVInteger cc;
+		switch (op) {
+			case CMP_G:
+				cc = CC_LE;
+				break;
+			case CMP_GE:
+				cc = CC_L;
+				break;
+			case CMP_L:
+				cc = CC_GE;
+				break;
+			case CMP_LE:
+				cc = CC_G;
+				break;
+			default:
+				cc = CC_E;
+				break;
+		}
+		a.CmpType(o1, OT_INTEGER);
+		a.Jcc(CC_NE, slow);
+		a.CmpType(o2, OT_INTEGER);
+		a.Jcc(CC_NE, slow);
+		a.LoadVal(o1);
+		a.CmpVal(o2);
+		a.Jcc(cc, _ops[target]);
+
+		a._cur = LVJitAssembler::COLD;
+		a.Bind(slow);
+		a.MovVm();
+		a.MovImm(RSI, op);
+		a.LeaSlot(RDX, o1);
+		a.LeaSlot(RCX, o2);
+		a.Call((const void *)jit_jcmp);
+		a.TestRax();
+		a.Jcc(CC_E, _ops[target]);
+		a.Jcc(CC_S, Exit(i));
+		a.Jmp(_ops[i + 1]);
+		a._cur = LVJitAssembler::MAIN;
+	}
+
+	/* Jumps to target when the slot is false */
+	void JumpFalse(LVInteger slot, LVInteger target) {
+		LVInteger slow = a.NewLabel(), test = a.NewLabel();
+		a.CmpType(slot, OT_BOOL);
+		a.Jcc(CC_E, test);
+		a.CmpType(slot, OT_INTEGER);
+		a.Jcc(CC_NE, slow);
+		a.Bind(test);
+		a.CmpValZero(slot);
+		a.Jcc(CC_E, target);
+
+		a._cur = LVJitAssembler::COLD;
+		a.Bind(slow);
+		a.LeaSlot(RDI, slot);
+		a.Call((const void *)jit_isfalse);
+		a.TestAl();
+		a.Jcc(CC_NE, target);
+		LVInteger next = a.NewLabel();
+		a.Jmp(next);
+		a._cur = LVJitAssembler::MAIN;
+		a.Bind(next);
+	}
+
+	/* and/or, moves the slot to trg and jumps when it is false (true for or) */
+	void Logical(LVInteger i, bool isand, LVInteger trg, LVInteger src, LVInteger target) {
+		LVInteger next = _ops[i + 1];
+		a.LeaSlot(RDI, src);
+		a.Call((const void *)jit_isfalse);
+		a.TestAl();
+		a.Jcc(isand ? CC_E : CC_NE, next);
+		a.LeaSlot(RDI, trg);
+		a.LeaSlot(RSI, src);
+		a.Call((const void *)jit_move);
+		a.Jmp(_ops[target]);
+	}
+
+	void Get(LVInteger i, LVInteger trg, LVInteger self, const LVObjectPtr *key, LVInteger keyslot) {
+		a.MovVm();
+		a.LeaSlot(RSI, trg);
+		a.LeaSlot(RDX, self);
+		if (key)
+			a.MovImm(RCX, (LVInteger)key);
+		else
+			a.LeaSlot(RCX, keyslot);
+		a.Call((const void *)jit_get);
+		a.TestAl();
+		a.Jcc(CC_E, Exit(i));
+	}
+
+	bool Emit(LVInteger i, const LVInstruction& ins) {
+		LVInteger arg0 = ins._arg0, arg1 = ins._arg1, arg2 = ins._arg2, arg3 = ins._arg3;
+		LVInteger sarg1 = ins._arg1;
+		LVInteger sarg3 = (signed char)ins._arg3;
+		switch (ins.op) {
+			case _OP_LINE:
+				return true;
+			case _OP_LOAD:
+				MoveLiteral(arg0, arg1);
+				return true;
+			case _OP_DLOAD:
+				MoveLiteral(arg0, arg1);
+				MoveLiteral(arg2, arg3);
+				return true;
+			case _OP_LOADINT:
+				LoadConst(arg0, LVObjectPtr((LVInteger)((LVInt32)arg1)));
+				return true;
+			case _OP_LOADFLOAT:
+				LoadConst(arg0, LVObjectPtr(*((const LVFloat *)&ins._arg1)));
+				return true;
+			case _OP_LOADBOOL:
+				LoadConst(arg0, LVObjectPtr(arg1 ? true : false));
+				return true;
+			case _OP_LOADNULLS:
+				for (LVInteger n = 0; n < arg1; n++)
+					LoadConst(arg0 + n, LVObjectPtr());
+				return true;
+			case _OP_MOVE:
+				Move(arg0, arg1);
+				return true;
+			case _OP_DMOVE:
+				Move(arg0, arg1);
+				Move(arg2, arg3);
+				return true;
+			case _OP_ADD:
+			case _OP_ADDI:
+			case _OP_ADDF:
+				Arith(i, '+', arg0, arg2, arg1);
+				return true;
+			case _OP_SUB:
+			case _OP_SUBI:
+			case _OP_SUBF:
+				Arith(i, '-', arg0, arg2, arg1);
+				return true;
+			case _OP_MUL:
+			case _OP_MULI:
+			case _OP_MULF:
+				Arith(i, '*', arg0, arg2, arg1);
+				return true;
+			case _OP_DIV:
+				Arith(i, '/', arg0, arg2, arg1);
+				return true;
+			case _OP_MOD:
+				Arith(i, '%', arg0, arg2, arg1);
+				return true;
+			case _OP_BITW:
+				a.MovVm();
+				a.MovImm(RSI, arg3);
+				a.LeaSlot(RDX, arg0);
+				a.LeaSlot(RCX, arg2);
+				a.LeaSlot(R8, arg1);
+				a.Call((const void *)jit_bitw);
+				a.TestAl();
+				a.Jcc(CC_E, Exit(i));
+				return true;
+			case _OP_NEG:
+				a.MovVm();
+				a.LeaSlot(RSI, arg0);
+				a.LeaSlot(RDX, arg1);
+				a.Call((const void *)jit_neg);
+				a.TestAl();
+				a.Jcc(CC_E, Exit(i));
+				return true;
+			case _OP_NOT:
+				a.LeaSlot(RDI, arg0);
+				a.LeaSlot(RSI, arg1);
+				a.Call((const void *)jit_not);
+				return true;
+			case _OP_EQ:
+			case _OP_NE:
+				a.LeaSlot(RDI, arg0);
+				a.LeaSlot(RSI, arg2);
+				if (arg3 != 0)
+					a.MovImm(RDX, (LVInteger)&_func->_literals[arg1]);
+				else
+					a.LeaSlot(RDX, arg1);
+				a.MovImm(RCX, ins.op == _OP_NE ? 1 : 0);
+				a.Call((const void *)jit_eq);
+				return true;
+			case _OP_CMP:
+				a.MovVm();
+				a.MovImm(RSI, arg3);
+				a.LeaSlot(RDX, arg0);
+				a.LeaSlot(RCX, arg2);
+				a.LeaSlot(R8, arg1);
+				a.Call((const void *)jit_cmp);
+				a.TestAl();
+				a.Jcc(CC_E, Exit(i));
+				return true;
+			case _OP_JMP:
+				a.Jmp(_ops[i + 1 + sarg1]);
+				return true;
+			case _OP_JCMP:
+			case _OP_JCMPI:
+			case _OP_JCMPF:
+				JumpCmp(i, arg3, arg2, arg0, i + 1 + sarg1);
+				return true;
+			case _OP_JZ:
+				JumpFalse(arg0, _ops[i + 1 + sarg1]);
+				return true;
+			case _OP_AND:
+				Logical(i, true, arg0, arg2, i + 1 + sarg1);
+				return true;
+			case _OP_OR:
+				Logical(i, false, arg0, arg2, i + 1 + sarg1);
+				return true;
+			case _OP_INCL:
+				a.CmpType(arg1, OT_INTEGER);
+				a.Jcc(CC_NE, Exit(i));
+				a.AddVal(arg1, (LVInt32)sarg3);
+				return true;
+			case _OP_PINCL:
+				a.CmpType(arg1, OT_INTEGER);
+				a.Jcc(CC_NE, Exit(i));
+				a.TestType(arg0, OBJECT_REF_COUNTED);
+				a.Jcc(CC_NE, Exit(i));
+				a.LoadVal(arg1);
+				a.StoreVal(arg0);
+				a.SetType(arg0, OT_INTEGER);
+				a.AddVal(arg1, (LVInt32)sarg3);
+				return true;
+			case _OP_GET:
+				Get(i, arg0, arg1, NULL, arg2);
+				return true;
+			case _OP_GETK:
+				Get(i, arg0, arg2, &_func->_literals[arg1], 0);
+				return true;
+			case _OP_SWITCH:
+				a.LeaSlot(RDI, arg0);
+				a.MovImm(RSI, (LVInteger)&_func->_literals[arg2 | (arg3 << 8)]);
+				a.MovImm(RDX, i);
+				a.MovImm(RCX, i + 1 + sarg1);
+				a.Call((const void *)jit_switch);
+				a.B(0x48);
+				a.B(0x89);
+				a.B(0xC2); /* mov rdx, rax */
+				a.JmpTable();
+				return true;
+			case _OP_SET:
+				a.LeaSlot(RDI, arg1);
+				a.LeaSlot(RSI, arg2);
+				a.LeaSlot(RDX, arg3);
+				a.Call((const void *)jit_set);
+				a.TestAl();
+				a.Jcc(CC_E, Exit(i));
+				if (arg0 != 0xFF)
+					Move(arg0, arg3);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	LVJitCode *Compile() {
+		/* push rbx; push r12; push r13; mov r12, rdi; mov rbx, rsi */
+		a.B(0x53);
+		a.B(0x41);
+		a.B(0x54);
+		a.B(0x41);
+		a.B(0x55);
+		a.B(0x49);
+		a.B(0x89);
+		a.B(0xFC);
+		a.B(0x48);
+		a.B(0x89);
+		a.B(0xF3);
+		a.JmpTable();
+
+		for (LVInteger i = 0; i < _n; i++) {
+			a.Bind(_ops[i]);
+			if (!Emit(i, _func->_instructions[i]))
+				a.Jmp(Exit(i));
+		}
+		a.Bind(_ops[_n]);
+		a.Jmp(Exit(_n));
+
+		a._cur = LVJitAssembler::COLD;
+		for (LVInteger i = 0; i <= _n; i++) {
+			if (_exits[i] == -1)
+				continue;
+			a.Bind(_exits[i]);
+			a.B(0xB8); /* mov eax, i */
+			a.D((LVInt32)i);
+			a.Jmp(_epilogue);
+		}
+		/* pop r13; pop r12; pop rbx; ret */
+		a.Bind(_epilogue);
+		a.B(0x41);
+		a.B(0x5D);
+		a.B(0x41);
+		a.B(0x5C);
+		a.B(0x5B);
+		a.B(0xC3);
+
+		LVInteger mainsize = a._code[LVJitAssembler::MAIN].size();
+		LVInteger codesize = LV_ALIGN(mainsize + a._code[LVJitAssembler::COLD].size());
+		LVInteger size = codesize + (_n + 1) * sizeof(LVInteger);
+		void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			return NULL;
+
+		unsigned char *code = (unsigned char *)mem;
+		memcpy(code, a._code[LVJitAssembler::MAIN]._vals, mainsize);
+		memcpy(code + mainsize, a._code[LVJitAssembler::COLD]._vals, a._code[LVJitAssembler::COLD].size());
+		for (LVUnsignedInteger k = 0; k < a._fixups.size(); k++) {
+			LVJitAssembler::Fixup& f = a._fixups[k];
+			LVInteger at = (f.buf == LVJitAssembler::COLD ? mainsize : 0) + f.pos;
+			LVInt32 rel = (LVInt32)(a.Offset(f.label) - (at + 4));
+			memcpy(code + at, &rel, sizeof(rel));
+		}
+		LVInteger *table = (LVInteger *)(code + codesize);
+		for (LVInteger i = 0; i <= _n; i++)
+			table[i] = (LVInteger)(code + a.Offset(_ops[i]));
+		for (LVUnsignedInteger k = 0; k < a._tablefixes.size(); k++) {
+			LVJitAssembler::Fixup& f = a._tablefixes[k];
+			memcpy(code + (f.buf == LVJitAssembler::COLD ? mainsize : 0) + f.pos, &table, sizeof(table));
+		}
+
+		if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+			munmap(mem, size);
+			return NULL;
+		}
+
+		LVJitCode *jc;
+		lv_new(jc, LVJitCode);
+		jc->_entry = (LVJitEntry)mem;
+		jc->_mem = mem;
+		jc->_memsize = size;
+		return jc;
+	}
+
+	FunctionPrototype *_func;
+	LVInteger _n;
+	LVJitAssembler a;
+	lvvector<LVInteger> _ops;
+	lvvector<LVInteger> _exits;
+	LVInteger _epilogue;
+};
+
+LVJitCode *LVJitCode::Compile(FunctionPrototype *func) {
+	if (sizeof(LVObjectPtr) != 16 || func->_ninstructions == 0)
+		return NULL;
+	LVJitCompiler c(func);
+	return c.Compile();
+}
+
+void LVJitCode::Release() {
+	munmap(_mem, _memsize);
+	lv_delete(this, LVJitCode);
+}
+
+#else
+
+LVJitCode *LVJitCode::Compile(FunctionPrototype *func) {
+	return NULL;
+}
+
+void LVJitCode::Release() {
+}
+
+#endif // LV_JIT
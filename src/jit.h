@@ -0,0 +1,37 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+/* Baseline JIT, only for x86-64 Linux with unpacked objects. Define NO_JIT to leave it out */
+#if defined(__x86_64__) && defined(__linux__) && defined(_LV64) && !defined(USEPACKEDOBJ) && !defined(NO_JIT)
+#define LV_JIT
+#endif
+
+/* Number of calls before a function is compiled */
+#define JIT_HOT_CALLS 64
+
+struct FunctionPrototype;
+
+/*
+ * Native code of a function prototype. Run() starts at instruction pc of the
+ * frame whose stack begins at stk, and returns the index of the instruction
+ * the interpreter has to continue with. Any instruction or operand the native
+ * code does not handle is left to the interpreter, so compiled code never
+ * raises errors or calls script code.
+ */
+typedef LVInteger (*LVJitEntry)(LVVM *v, LVObjectPtr *stk, LVInteger pc);
+
+struct LVJitCode {
+	static LVJitCode *Compile(FunctionPrototype *func);
+
+	LVInteger Run(LVVM *v, LVObjectPtr *stk, LVInteger pc) {
+		return _entry(v, stk, pc);
+	}
+
+	void Release();
+
+	LVJitEntry _entry;
+	void *_mem;
+	LVInteger _memsize;
+};
+
+#endif // _JIT_H_
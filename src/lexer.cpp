@@ -348,7 +348,7 @@ LVInteger LVLexer::Lex() {
 
 LVInteger LVLexer::GetIDType(const LVChar *s, LVInteger len) {
 	LVObjectPtr t;
-	if (_keywords->GetStr(s, len, t)) {
+	if (_keywords->GetStr(s, len, _sharedstate->_hashseed, t)) {
 		return LVInteger(_integer(t));
 	}
 
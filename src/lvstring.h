@@ -1,12 +1,93 @@
 #ifndef _LVSTRING_H_
 #define _LVSTRING_H_
 
-inline LVHash _hashstr (const LVChar *s, size_t l) {
-	LVHash h = (LVHash)l;  /* seed */
-	size_t step = (l >> 5) | 1; /* if string is too long, don't hash all its chars */
-	for (; l >= step; l -= step)
-		h = h ^ ((h << 5) + (h >> 2) + (unsigned short) * (s++));
-	return h;
+/*
+ * wyhash, every byte of the string is hashed. seed is picked at random by
+ * every shared state, so the keys of a request can't be chosen to collide.
+ */
+typedef unsigned long long LVHash64;
+
+inline void _wymum(LVHash64 *a, LVHash64 *b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (LVHash64)r;
+	*b = (LVHash64)(r >> 64);
+#else
+	LVHash64 ha = *a >> 32, hb = *b >> 32, la = (unsigned int)*a, lb = (unsigned int)*b;
+	LVHash64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+	LVHash64 c = t < rl, lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline LVHash64 _wymix(LVHash64 a, LVHash64 b) {
+	_wymum(&a, &b);
+	return a ^ b;
+}
+
+inline LVHash64 _wyr8(const unsigned char *p) {
+	LVHash64 v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+inline LVHash64 _wyr4(const unsigned char *p) {
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+#define WYP0 0x2d358dccaa6c78a5ULL
+#define WYP1 0x8bb84b93962eacc9ULL
+#define WYP2 0x4b33a62ed433d4a3ULL
+#define WYP3 0x4d5a2da51de1aa47ULL
+
+inline LVHash _hashstr(const LVChar *s, size_t l, LVHash seed) {
+	const unsigned char *p = (const unsigned char *)s;
+	size_t len = l * sizeof(LVChar);
+	LVHash64 see = (LVHash64)seed, a, b;
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (_wyr4(p) << 32) | _wyr4(p + ((len >> 3) << 2));
+			b = (_wyr4(p + len - 4) << 32) | _wyr4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((LVHash64)p[0] << 16) | ((LVHash64)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if (i >= 48) {
+			LVHash64 see1 = see, see2 = see;
+			do {
+				see = _wymix(_wyr8(p) ^ WYP1, _wyr8(p + 8) ^ see);
+				see1 = _wymix(_wyr8(p + 16) ^ WYP2, _wyr8(p + 24) ^ see1);
+				see2 = _wymix(_wyr8(p + 32) ^ WYP3, _wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i >= 48);
+			see ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			see = _wymix(_wyr8(p) ^ WYP1, _wyr8(p + 8) ^ see);
+			i -= 16;
+			p += 16;
+		}
+		a = _wyr8(p + i - 16);
+		b = _wyr8(p + i - 8);
+	}
+	a ^= WYP1;
+	b ^= see;
+	_wymum(&a, &b);
+	return (LVHash)_wymix(a ^ WYP0 ^ len, b ^ WYP1);
+}
+
+/* Turns any value into a seed for _hashstr */
+inline LVHash _mkhashseed(LVHash64 x) {
+	return (LVHash)_wymix(x ^ WYP0, WYP1);
 }
 
 struct LVString : public LVRefCounted {
@@ -15,3 +15,186 @@ void lv_vm_free(void *p, LVUnsignedInteger LV_UNUSED_ARG(size)) {
 }
 
 #endif
+
+#ifndef NO_POOL_ALLOCATOR
+
+#include <mutex>
+
+/*
+ * Blocks of up to POOL_MAXSIZE bytes come from per thread free lists, one for
+ * every multiple of POOL_GRANULE. The callers of LV_FREE pass the exact size,
+ * so a block carries no header. A block freed by another thread than the one
+ * that allocated it joins the lists of the freeing thread, which is why
+ * chunks are never given back: when a thread exits its lists are left for
+ * the next thread that runs out of blocks.
+ */
+#define POOL_GRANULE 16
+#define POOL_MAXSIZE 256
+#define POOL_NCLASSES (POOL_MAXSIZE / POOL_GRANULE)
+#define POOL_CHUNKSIZE 16384
+
+#define _poolclass(size) ((size) ? ((size) - 1) / POOL_GRANULE : 0)
+
+struct LVPoolBlock {
+	LVPoolBlock *next;
+};
+
+struct LVPoolClass {
+	LVPoolBlock *freelist;
+	char *bump;
+	char *bumpend;
+	LVInteger allocs;
+	LVInteger frees;
+	LVInteger chunks;
+};
+
+struct LVPool {
+	LVPoolClass classes[POOL_NCLASSES];
+	LVPool *next;
+};
+
+//plain data, so the fast paths need no thread local initialization
+static thread_local LVPool _pool;
+static LVPool *_orphans = NULL;
+static std::mutex _orphanslock;
+
+static void _PoolOrphan() {
+	LVPool *orphan = (LVPool *)lv_vm_malloc(sizeof(LVPool));
+	*orphan = _pool;
+	memset(&_pool, 0, sizeof(LVPool));
+	std::lock_guard<std::mutex> lock(_orphanslock);
+	orphan->next = _orphans;
+	_orphans = orphan;
+}
+
+//only armed once the thread owns chunks
+struct LVPoolExit {
+	~LVPoolExit() {
+		if (armed)
+			_PoolOrphan();
+	}
+	bool armed;
+};
+static thread_local LVPoolExit _poolexit;
+
+/* Takes over the lists of an exited thread, returns false if there are none */
+static bool _PoolAdopt() {
+	LVPool *orphan;
+	{
+		std::lock_guard<std::mutex> lock(_orphanslock);
+		orphan = _orphans;
+		if (orphan)
+			_orphans = orphan->next;
+	}
+	if (!orphan)
+		return false;
+	for (LVInteger i = 0; i < POOL_NCLASSES; i++) {
+		LVPoolClass& c = _pool.classes[i];
+		LVPoolClass& o = orphan->classes[i];
+		LVUnsignedInteger size = (i + 1) * POOL_GRANULE;
+		//what is left of the orphan chunk goes to the free list
+		for (; o.bump && o.bump + size <= o.bumpend; o.bump += size) {
+			LVPoolBlock *b = (LVPoolBlock *)o.bump;
+			b->next = o.freelist;
+			o.freelist = b;
+		}
+		if (o.freelist) {
+			LVPoolBlock *last = o.freelist;
+			while (last->next)
+				last = last->next;
+			last->next = c.freelist;
+			c.freelist = o.freelist;
+		}
+	}
+	lv_vm_free(orphan, sizeof(LVPool));
+	return true;
+}
+
+static void *_PoolRefill(LVPoolClass& c, LVUnsignedInteger size) {
+	if (!_poolexit.armed) {
+		_poolexit.armed = true;
+		if (_PoolAdopt() && c.freelist) {
+			LVPoolBlock *b = c.freelist;
+			c.freelist = b->next;
+			return b;
+		}
+	}
+	if (!c.bump || c.bump + size > c.bumpend) {
+		c.bump = (char *)lv_vm_malloc(POOL_CHUNKSIZE);
+		c.bumpend = c.bump + POOL_CHUNKSIZE;
+		c.chunks++;
+	}
+	void *p = c.bump;
+	c.bump += size;
+	return p;
+}
+
+void *lv_pool_malloc(LVUnsignedInteger size) {
+	if (size > POOL_MAXSIZE)
+		return lv_vm_malloc(size);
+	LVInteger idx = _poolclass(size);
+	LVPoolClass& c = _pool.classes[idx];
+	c.allocs++;
+	LVPoolBlock *b = c.freelist;
+	if (b) {
+		c.freelist = b->next;
+		return b;
+	}
+	return _PoolRefill(c, (idx + 1) * POOL_GRANULE);
+}
+
+void lv_pool_free(void *p, LVUnsignedInteger size) {
+	if (size > POOL_MAXSIZE) {
+		lv_vm_free(p, size);
+		return;
+	}
+	LVPoolClass& c = _pool.classes[_poolclass(size)];
+	LVPoolBlock *b = (LVPoolBlock *)p;
+	c.frees++;
+	b->next = c.freelist;
+	c.freelist = b;
+}
+
+void *lv_pool_realloc(void *p, LVUnsignedInteger oldsize, LVUnsignedInteger size) {
+	if (oldsize > POOL_MAXSIZE && size > POOL_MAXSIZE)
+		return lv_vm_realloc(p, oldsize, size);
+	if (p && oldsize <= POOL_MAXSIZE && size <= POOL_MAXSIZE && _poolclass(oldsize) == _poolclass(size))
+		return p;
+	void *np = lv_pool_malloc(size);
+	if (p) {
+		memcpy(np, p, oldsize < size ? oldsize : size);
+		lv_pool_free(p, oldsize);
+	}
+	return np;
+}
+
+LVInteger lv_pool_getstats(LVPoolStats *stats, LVInteger n) {
+	LVInteger i;
+	for (i = 0; i < n && i < POOL_NCLASSES; i++) {
+		stats[i].size = (i + 1) * POOL_GRANULE;
+		stats[i].allocs = _pool.classes[i].allocs;
+		stats[i].frees = _pool.classes[i].frees;
+		stats[i].chunks = _pool.classes[i].chunks;
+	}
+	return POOL_NCLASSES;
+}
+
+#else
+
+void *lv_pool_malloc(LVUnsignedInteger size) {
+	return lv_vm_malloc(size);
+}
+
+void *lv_pool_realloc(void *p, LVUnsignedInteger oldsize, LVUnsignedInteger size) {
+	return lv_vm_realloc(p, oldsize, size);
+}
+
+void lv_pool_free(void *p, LVUnsignedInteger size) {
+	lv_vm_free(p, size);
+}
+
+LVInteger lv_pool_getstats(LVPoolStats *LV_UNUSED_ARG(stats), LVInteger LV_UNUSED_ARG(n)) {
+	return 0;
+}
+
+#endif // NO_POOL_ALLOCATOR
@@ -7,11 +7,21 @@
 #include "funcproto.h"
 #include "class.h"
 #include "closure.h"
+#include "jit.h"
 
 #define CLOSURESTREAM_HEAD (('S'<<24)|('Q'<<16)|('I'<<8)|('R'))
 #define CLOSURESTREAM_PART (('P'<<24)|('A'<<16)|('R'<<8)|('T'))
 #define CLOSURESTREAM_TAIL (('T'<<24)|('A'<<16)|('I'<<8)|('L'))
 
+#ifdef USEPACKEDOBJ
+/* Indexed by the position of the raw type bit */
+const LVObjectType lv_tagtypes[1 << LV_TAGBITS] = {
+	OT_NULL, OT_INTEGER, OT_FLOAT, OT_BOOL, OT_STRING, OT_TABLE, OT_ARRAY, OT_USERDATA,
+	OT_CLOSURE, OT_NATIVECLOSURE, OT_GENERATOR, OT_USERPOINTER, OT_THREAD, OT_FUNCPROTO,
+	OT_CLASS, OT_INSTANCE, OT_WEAKREF, OT_OUTER
+};
+#endif
+
 const LVChar *IdType2Name(LVObjectType type) {
 	switch (_RAW_TYPE(type)) {
 		case _RT_NULL:
@@ -93,25 +103,20 @@ LVUnsignedInteger TranslateIndex(const LVObjectPtr& idx) {
 LVWeakRef *LVRefCounted::GetWeakRef(LVObjectType type) {
 	if (!_weakref) {
 		lv_new(_weakref, LVWeakRef);
-#if defined(USEDOUBLE) && !defined(_LV64)
-		_weakref->_obj._unVal.raw = 0; //clean the whole union on 32 bits with double
-#endif
-		_weakref->_obj._type = type;
-		_weakref->_obj._unVal.pRefCounted = this;
+		OBJECT_INIT(_weakref->_obj, type, pRefCounted, this);
 	}
 	return _weakref;
 }
 
 LVRefCounted::~LVRefCounted() {
 	if (_weakref) {
-		_weakref->_obj._type = OT_NULL;
-		_weakref->_obj._unVal.pRefCounted = NULL;
+		OBJECT_INIT(_weakref->_obj, OT_NULL, pRefCounted, NULL);
 	}
 }
 
 void LVWeakRef::Release() {
-	if (ISREFCOUNTED(_obj._type)) {
-		_obj._unVal.pRefCounted->_weakref = NULL;
+	if (ISREFCOUNTED(type(_obj))) {
+		_refcounted(_obj)->_weakref = NULL;
 	}
 	lv_delete(this, LVWeakRef);
 }
@@ -221,9 +226,65 @@ bool LVGenerator::Resume(LVVM *v, LVObjectPtr& dest) {
 
 void LVArray::Extend(const LVArray *a) {
 	LVInteger xlen;
+	Unshare();
 	if ((xlen = a->Size()))
 		for (LVInteger i = 0; i < xlen; i++)
-			Append(a->_values[i]);
+			Append(a->Values()[i]);
+}
+
+/* Unlinks a view from its base, leaving it empty */
+void LVArray::Unview() {
+	LVArray *base = _array(_base);
+	if (_prevview)
+		_prevview->_nextview = _nextview;
+	else
+		base->_views = _nextview;
+	if (_nextview)
+		_nextview->_prevview = _prevview;
+	_nextview = NULL;
+	_prevview = NULL;
+	_offset = 0;
+	_length = 0;
+	_base.Null();
+}
+
+/* Turns a view into an array with a copy of its values, and the views of this array too */
+void LVArray::UnshareViews() {
+	if (IsView()) {
+		LVObjectPtr *src = Values();
+		LVInteger n = _length;
+		_values.reserve(n);
+		for (LVInteger i = 0; i < n; i++)
+			_values.push_back(_realval(src[i]));
+		Unview();
+	}
+	while (_views)
+		_views->UnshareViews();
+}
+
+/* The values from sidx to eidx, which the caller checked are in range */
+LVArray *LVArray::Slice(LVInteger sidx, LVInteger eidx) {
+	LVArray *arr;
+	if (eidx - sidx < ARRAY_VIEW_MINSIZE) {
+		LVObjectPtr *src = Values();
+		arr = Create(_opt_ss(this), 0);
+		arr->_values.reserve(eidx - sidx);
+		for (LVInteger i = sidx; i < eidx; i++)
+			arr->_values.push_back(_realval(src[i]));
+		return arr;
+	}
+	//a view of a view reads from the same base
+	if (IsView())
+		return _array(_base)->Slice(_offset + sidx, _offset + eidx);
+	arr = Create(_opt_ss(this), 0);
+	arr->_base = this;
+	arr->_offset = sidx;
+	arr->_length = eidx - sidx;
+	arr->_nextview = _views;
+	if (_views)
+		_views->_prevview = arr;
+	_views = arr;
+	return arr;
 }
 
 const LVChar *FunctionPrototype::GetLocal(LVVM *vm, LVUnsignedInteger stackbase, LVUnsignedInteger nseq, LVUnsignedInteger nop) {
@@ -281,6 +342,29 @@ LVClosure::~LVClosure() {
 	REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain, this);
 }
 
+/* Trade the stack slots the closure reads for the open outers of those slots */
+void LVClosure::CloseStackOuters() {
+	for (LVInteger i = 0; i < _function->_noutervalues; i++) {
+		if (type(_outervalues[i]) == OT_INTEGER) {
+			LVInteger idx = _integer(_outervalues[i]);
+			_stackowner->FindOuter(_outervalues[i], &_stackowner->_stack._vals[idx]);
+		}
+	}
+	_stackowner = NULL;
+}
+
+LVClosure *LVClosure::Clone() {
+	FunctionPrototype *f = _function;
+	if (_stackowner)
+		CloseStackOuters();
+	LVClosure *ret = LVClosure::Create(_opt_ss(this), f, _root);
+	ret->_env = _env;
+	if (ret->_env) __ObjAddRef(ret->_env);
+	_COPY_VECTOR(ret->_outervalues, _outervalues, f->_noutervalues);
+	_COPY_VECTOR(ret->_defaultparams, _defaultparams, f->_ndefaultparams);
+	return ret;
+}
+
 #define _CHECK_IO(exp) { \
 	if (!exp) \
 		return false; \
@@ -325,14 +409,30 @@ bool WriteObject(VMHANDLE v, LVUserPointer up, LVWRITEFUNC write, LVObjectPtr& o
 			_CHECK_IO(SafeWrite(v, write, up, _stringval(o), lv_rsl(_string(o)->_len)));
 			break;
 		case OT_BOOL:
-		case OT_INTEGER:
-			_CHECK_IO(SafeWrite(v, write, up, &_integer(o), sizeof(LVInteger)));
+		case OT_INTEGER: {
+			LVInteger i = _integer(o);
+			_CHECK_IO(SafeWrite(v, write, up, &i, sizeof(LVInteger)));
 			break;
-		case OT_FLOAT:
-			_CHECK_IO(SafeWrite(v, write, up, &_float(o), sizeof(LVFloat)));
+		}
+		case OT_FLOAT: {
+			LVFloat f = _float(o);
+			_CHECK_IO(SafeWrite(v, write, up, &f, sizeof(LVFloat)));
 			break;
+		}
 		case OT_NULL:
 			break;
+		//the jump table of a switch
+		case OT_TABLE: {
+			LVInteger n = _table(o)->CountUsed(), idx;
+			LVObjectPtr refidx, key, val;
+			_CHECK_IO(SafeWrite(v, write, up, &n, sizeof(LVInteger)));
+			while ((idx = _table(o)->Next(false, refidx, key, val)) != -1) {
+				_CHECK_IO(WriteObject(v, up, write, key));
+				_CHECK_IO(WriteObject(v, up, write, val));
+				refidx = idx;
+			}
+			break;
+		}
 		default:
 			v->Raise_Error(_LC("cannot serialize a %s"), GetTypeName(o));
 			return false;
@@ -361,8 +461,7 @@ bool ReadObject(VMHANDLE v, LVUserPointer up, LVREADFUNC read, LVObjectPtr& o) {
 		case OT_BOOL: {
 			LVInteger i;
 			_CHECK_IO(SafeRead(v, read, up, &i, sizeof(LVInteger)));
-			o._type = OT_BOOL;
-			o._unVal.nInteger = i;
+			o = (i != 0);
 			break;
 		}
 		case OT_FLOAT: {
@@ -374,6 +473,18 @@ bool ReadObject(VMHANDLE v, LVUserPointer up, LVREADFUNC read, LVObjectPtr& o) {
 		case OT_NULL:
 			o.Null();
 			break;
+		case OT_TABLE: {
+			LVInteger n;
+			LVObjectPtr key, val;
+			_CHECK_IO(SafeRead(v, read, up, &n, sizeof(LVInteger)));
+			o = LVTable::Create(_ss(v), n);
+			for (LVInteger i = 0; i < n; i++) {
+				_CHECK_IO(ReadObject(v, up, read, key));
+				_CHECK_IO(ReadObject(v, up, read, val));
+				_table(o)->NewSlot(key, val);
+			}
+			break;
+		}
 		default:
 			v->Raise_Error(_LC("cannot serialize a %s"), IdType2Name(t));
 			return false;
@@ -407,11 +518,18 @@ bool LVClosure::Load(LVVM *v, LVUserPointer up, LVREADFUNC read, LVObjectPtr& re
 FunctionPrototype::FunctionPrototype(LVSharedState *ss) {
 	_stacksize = 0;
 	_bgenerator = false;
+	_hotcount = 0;
+	_jitcode = NULL;
+	_gcache = NULL;
 	INIT_CHAIN();
 	ADD_TO_CHAIN(&_ss(this)->_gc_chain, this);
 }
 
 FunctionPrototype::~FunctionPrototype() {
+	if (_jitcode)
+		_jitcode->Release();
+	if (_gcache)
+		LV_FREE(_gcache, _ninstructions * sizeof(LVGlobalCache));
 	REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain, this);
 }
 
@@ -560,11 +678,9 @@ bool FunctionPrototype::Load(LVVM *v, LVUserPointer up, LVREADFUNC read, LVObjec
 
 #ifndef NO_GARBAGE_COLLECTOR
 
-#define START_MARK()    if(!(_uiRef&MARK_FLAG)){ \
-		_uiRef|=MARK_FLAG;
+#define START_MARK()    if(EnterMark()){
 
-#define END_MARK() RemoveFromChain(&_sharedstate->_gc_chain, this); \
-		AddToChain(chain, this); }
+#define END_MARK() LeaveMark(chain); }
 
 void LVVM::Mark(LVCollectable **chain) {
 	START_MARK()
@@ -575,6 +691,7 @@ void LVVM::Mark(LVCollectable **chain) {
 	LVSharedState::MarkObject(temp_reg, chain);
 	for (LVUnsignedInteger i = 0; i < _stack.size(); i++) LVSharedState::MarkObject(_stack[i], chain);
 	for (LVInteger k = 0; k < _callsstacksize; k++) LVSharedState::MarkObject(_callsstack[k]._closure, chain);
+	for (LVUnsignedInteger j = 0; j < _stackclosures.size(); j++) LVSharedState::MarkObject(_stackclosures[j]._closure, chain);
 	END_MARK()
 }
 
@@ -582,13 +699,21 @@ void LVArray::Mark(LVCollectable **chain) {
 	START_MARK()
 	LVInteger len = _values.size();
 	for (LVInteger i = 0; i < len; i++) LVSharedState::MarkObject(_values[i], chain);
+	LVSharedState::MarkObject(_base, chain);
 	END_MARK()
 }
 void LVTable::Mark(LVCollectable **chain) {
 	START_MARK()
 	if (_delegate) _delegate->Mark(chain);
+	//the keys of a shape are strings, only the values can hold collectables
+	if (_shape) {
+		for (LVInteger i = 0; i < _shape->_nkeys; i++)
+			LVSharedState::MarkObject(_slots[i], chain);
+	}
 	LVInteger len = _numofnodes;
 	for (LVInteger i = 0; i < len; i++) {
+		if (_ctrl[i] & CTRL_EMPTY)
+			continue;
 		LVSharedState::MarkObject(_nodes[i].key, chain);
 		LVSharedState::MarkObject(_nodes[i].val, chain);
 	}
@@ -669,6 +794,55 @@ void LVUserData::Mark(LVCollectable **chain) {
 	END_MARK()
 }
 
+/*
+ * Mark() serves four passes. A full collection marks from the roots and
+ * moves every object it reaches to chain. A young collection, and the end of
+ * an incremental cycle, first count the references the candidates hold to
+ * each other, visiting only the children of _gc_scan, and then mark in place
+ * from the candidates that are still referenced from elsewhere. An
+ * incremental step only visits the children of _gc_scan and grays the white
+ * ones.
+ */
+bool LVCollectable::EnterMark() {
+	LVSharedState *ss = _sharedstate;
+	switch (ss->_gc_phase) {
+		case GC_PHASE_COUNT:
+			if (ss->_gc_scan == this) {
+				ss->_gc_scan = NULL;
+				return true;
+			}
+			if (_gcrefs > 0 && ss->IsCandidate(this))
+				_gcrefs--;
+			return false;
+		case GC_PHASE_RESCUE:
+			if ((_uiRef & MARK_FLAG) || !ss->IsCandidate(this))
+				return false;
+			break;
+		case GC_PHASE_STEP:
+			if (ss->_gc_scan == this) {
+				ss->_gc_scan = NULL;
+				return true;
+			}
+			if (ss->IsCandidate(this))
+				ss->Gray(this);
+			return false;
+		default:
+			if (_uiRef & MARK_FLAG)
+				return false;
+			break;
+	}
+	_uiRef |= MARK_FLAG;
+	return true;
+}
+
+void LVCollectable::LeaveMark(LVCollectable **chain) {
+	if (chain) {
+		RemoveFromChain(&_sharedstate->_gc_chain, this);
+		_sharedstate->_gc_young--;
+		AddToChain(chain, this);
+	}
+}
+
 void LVCollectable::UnMark() {
 	_uiRef &= ~MARK_FLAG;
 }
@@ -103,14 +103,14 @@ struct LVWeakRef : LVRefCounted {
 
 struct LVObjectPtr;
 
-#define __AddRef(type,unval) if(ISREFCOUNTED(type)) \
+#define __AddRef(obj) if(ISREFCOUNTED(type(obj))) \
         { \
-            unval.pRefCounted->_uiRef++; \
+            _refcounted(obj)->_uiRef++; \
         }
 
-#define __Release(type,unval) if(ISREFCOUNTED(type) && ((--unval.pRefCounted->_uiRef)==0))  \
+#define __Release(obj) if(ISREFCOUNTED(type(obj)) && ((--_refcounted(obj)->_uiRef)==0))  \
         {   \
-            unval.pRefCounted->Release();   \
+            _refcounted(obj)->Release();   \
         }
 
 #define __ObjRelease(obj) { \
@@ -126,9 +126,89 @@ struct LVObjectPtr;
     (obj)->_uiRef++; \
 }
 
+#ifdef USEPACKEDOBJ
+#ifdef __GNUC__
+#define _typetag(t) ((LVUnsignedInteger)__builtin_ctz(_RAW_TYPE(t)))
+#else
+inline LVUnsignedInteger _typetag(LVObjectType t) {
+	LVUnsignedInteger tag = 0;
+	while (!(_RAW_TYPE(t) & (1 << tag)))
+		tag++;
+	return tag;
+}
+#endif
+
+inline LVUnsignedInteger _boxint(LVObjectType t, LVInteger i) {
+	return (_typetag(t) << LV_TAGSHIFT) | ((LVUnsignedInteger)i & LV_PAYLOADMASK);
+}
+
+inline LVUnsignedInteger _boxfloat(LVObjectType t, LVFloat f) {
+	union {
+		LVFloat f;
+		LVUnsignedInteger32 u;
+	} v;
+	v.f = f;
+	return (_typetag(t) << LV_TAGSHIFT) | v.u;
+}
+
+inline LVUnsignedInteger _boxptr(LVObjectType t, const void *p) {
+	return (_typetag(t) << LV_TAGSHIFT) | (LVUnsignedInteger)p;
+}
+
+inline LVFloat _unboxfloat(LVUnsignedInteger raw) {
+	union {
+		LVFloat f;
+		LVUnsignedInteger32 u;
+	} v;
+	v.u = (LVUnsignedInteger32)raw;
+	return v.f;
+}
+
+#define _BOX_nInteger(t,x) _boxint(t,x)
+#define _BOX_fFloat(t,x) _boxfloat(t,x)
+#define _BOX_pTable(t,x) _boxptr(t,x)
+#define _BOX_pArray(t,x) _boxptr(t,x)
+#define _BOX_pClosure(t,x) _boxptr(t,x)
+#define _BOX_pOuter(t,x) _boxptr(t,x)
+#define _BOX_pGenerator(t,x) _boxptr(t,x)
+#define _BOX_pNativeClosure(t,x) _boxptr(t,x)
+#define _BOX_pString(t,x) _boxptr(t,x)
+#define _BOX_pUserData(t,x) _boxptr(t,x)
+#define _BOX_pUserPointer(t,x) _boxptr(t,x)
+#define _BOX_pFunctionProto(t,x) _boxptr(t,x)
+#define _BOX_pRefCounted(t,x) _boxptr(t,x)
+#define _BOX_pThread(t,x) _boxptr(t,x)
+#define _BOX_pClass(t,x) _boxptr(t,x)
+#define _BOX_pInstance(t,x) _boxptr(t,x)
+#define _BOX_pWeakRef(t,x) _boxptr(t,x)
+
+#define type(obj) lv_type(obj)
+#define _payload(obj,T) ((T)((obj)._raw & LV_PAYLOADMASK))
+
+#define _integer(obj) (((LVInteger)((obj)._raw << LV_TAGBITS)) >> LV_TAGBITS)
+#define _float(obj) _unboxfloat((obj)._raw)
+#define _string(obj) _payload(obj, LVString *)
+#define _table(obj) _payload(obj, LVTable *)
+#define _array(obj) _payload(obj, LVArray *)
+#define _closure(obj) _payload(obj, LVClosure *)
+#define _generator(obj) _payload(obj, LVGenerator *)
+#define _nativeclosure(obj) _payload(obj, LVNativeClosure *)
+#define _userdata(obj) _payload(obj, LVUserData *)
+#define _userpointer(obj) _payload(obj, LVUserPointer)
+#define _thread(obj) _payload(obj, LVVM *)
+#define _funcproto(obj) _payload(obj, FunctionPrototype *)
+#define _class(obj) _payload(obj, LVClass *)
+#define _instance(obj) _payload(obj, LVInstance *)
+#define _delegable(obj) _payload(obj, LVDelegable *)
+#define _weakref(obj) _payload(obj, LVWeakRef *)
+#define _outer(obj) _payload(obj, LVOuter *)
+#define _refcounted(obj) _payload(obj, LVRefCounted *)
+#define _rawval(obj) ((obj)._raw)
+
+/* Sets a plain LVObject, no reference counting is done */
+#define OBJECT_INIT(obj,t,sym,x) { (obj)._raw = _BOX_##sym(t, x); }
+#else
 #define type(obj) ((obj)._type)
-#define is_delegable(t) (type(t) & OBJECT_DELEGABLE)
-#define raw_type(obj) _RAW_TYPE((obj)._type)
 
 #define _integer(obj) ((obj)._unVal.nInteger)
 #define _float(obj) ((obj)._unVal.fFloat)
@@ -150,75 +230,66 @@ struct LVObjectPtr;
 #define _refcounted(obj) ((obj)._unVal.pRefCounted)
 #define _rawval(obj) ((obj)._unVal.raw)
 
-#define _stringval(obj) (obj)._unVal.pString->_val
-#define _userdataval(obj) ((LVUserPointer)LV_ALIGN((obj)._unVal.pUserData + 1))
+/* Sets a plain LVObject, no reference counting is done */
+#define OBJECT_INIT(obj,t,sym,x) { \
+        LVObjectValue _v_; \
+        _v_.raw = 0; \
+        _v_.sym = (x); \
+        (obj)._type = (t); \
+        (obj)._unVal = _v_; \
+    }
+#endif // USEPACKEDOBJ
+
+#define is_delegable(t) (type(t) & OBJECT_DELEGABLE)
+#define raw_type(obj) _RAW_TYPE(type(obj))
+
+#define _stringval(obj) _string(obj)->_val
+#define _userdataval(obj) ((LVUserPointer)LV_ALIGN(_userdata(obj) + 1))
 
 #define tofloat(num) ((type(num)==OT_INTEGER)?(LVFloat)_integer(num):_float(num))
 #define tointeger(num) ((type(num)==OT_FLOAT)?(LVInteger)_float(num):_integer(num))
 
-#if defined(USEDOUBLE) && !defined(_LV64) || !defined(USEDOUBLE) && defined(_LV64)
-#define OBJECT_RAWINIT() { _unVal.raw = 0; }
-#define REFOBJECT_INIT() OBJECT_RAWINIT()
-#else
-#define REFOBJECT_INIT()
-#endif
-
 #define _REF_TYPE_DECL(type,_class,sym) \
     LVObjectPtr(_class * x) \
     { \
-        OBJECT_RAWINIT() \
-        _type=type; \
-        _unVal.sym = x; \
-        assert(_unVal.pTable); \
-        _unVal.pRefCounted->_uiRef++; \
+        OBJECT_INIT(*this, type, sym, x) \
+        assert(x); \
+        _refcounted(*this)->_uiRef++; \
     } \
     inline LVObjectPtr& operator=(_class *x) \
     {  \
-        LVObjectType tOldType; \
-        LVObjectValue unOldVal; \
-        tOldType=_type; \
-        unOldVal=_unVal; \
-        _type = type; \
-        REFOBJECT_INIT() \
-        _unVal.sym = x; \
-        _unVal.pRefCounted->_uiRef++; \
-        __Release(tOldType,unOldVal); \
+        LVObject old = *this; \
+        OBJECT_INIT(*this, type, sym, x) \
+        _refcounted(*this)->_uiRef++; \
+        __Release(old); \
         return *this; \
     }
 
 #define _SCALAR_TYPE_DECL(type,_class,sym) \
     LVObjectPtr(_class x) \
     { \
-        OBJECT_RAWINIT() \
-        _type=type; \
-        _unVal.sym = x; \
+        OBJECT_INIT(*this, type, sym, x) \
     } \
     inline LVObjectPtr& operator=(_class x) \
     {  \
-        __Release(_type,_unVal); \
-        _type = type; \
-        OBJECT_RAWINIT() \
-        _unVal.sym = x; \
+        __Release(*this); \
+        OBJECT_INIT(*this, type, sym, x) \
         return *this; \
     }
 
 struct LVObjectPtr : public LVObject {
 	LVObjectPtr() {
-		OBJECT_RAWINIT()
-		_type = OT_NULL;
-		_unVal.pUserPointer = NULL;
+		OBJECT_INIT(*this, OT_NULL, pUserPointer, NULL)
 	}
 
 	LVObjectPtr(const LVObjectPtr& o) {
-		_type = o._type;
-		_unVal = o._unVal;
-		__AddRef(_type, _unVal);
+		*(LVObject *)this = o;
+		__AddRef(*this);
 	}
 
 	LVObjectPtr(const LVObject& o) {
-		_type = o._type;
-		_unVal = o._unVal;
-		__AddRef(_type, _unVal);
+		*(LVObject *)this = o;
+		__AddRef(*this);
 	}
 
 	_REF_TYPE_DECL(OT_TABLE, LVTable, pTable)
@@ -240,53 +311,39 @@ struct LVObjectPtr : public LVObject {
 	_SCALAR_TYPE_DECL(OT_USERPOINTER, LVUserPointer, pUserPointer)
 
 	LVObjectPtr(bool bBool) {
-		OBJECT_RAWINIT()
-		_type = OT_BOOL;
-		_unVal.nInteger = bBool ? 1 : 0;
+		OBJECT_INIT(*this, OT_BOOL, nInteger, bBool ? 1 : 0)
 	}
 
 	inline LVObjectPtr& operator=(bool b) {
-		__Release(_type, _unVal);
-		OBJECT_RAWINIT()
-		_type = OT_BOOL;
-		_unVal.nInteger = b ? 1 : 0;
+		__Release(*this);
+		OBJECT_INIT(*this, OT_BOOL, nInteger, b ? 1 : 0)
 		return *this;
 	}
 
 	~LVObjectPtr() {
-		__Release(_type, _unVal);
+		__Release(*this);
 	}
 
 	inline LVObjectPtr& operator=(const LVObjectPtr& obj) {
-		LVObjectType tOldType;
-		LVObjectValue unOldVal;
-		tOldType = _type;
-		unOldVal = _unVal;
-		_unVal = obj._unVal;
-		_type = obj._type;
-		__AddRef(_type, _unVal);
-		__Release(tOldType, unOldVal);
+		LVObject old = *this;
+		*(LVObject *)this = obj;
+		__AddRef(*this);
+		__Release(old);
 		return *this;
 	}
 
 	inline LVObjectPtr& operator=(const LVObject& obj) {
-		LVObjectType tOldType;
-		LVObjectValue unOldVal;
-		tOldType = _type;
-		unOldVal = _unVal;
-		_unVal = obj._unVal;
-		_type = obj._type;
-		__AddRef(_type, _unVal);
-		__Release(tOldType, unOldVal);
+		LVObject old = *this;
+		*(LVObject *)this = obj;
+		__AddRef(*this);
+		__Release(old);
 		return *this;
 	}
 
 	inline void Null() {
-		LVObjectType tOldType = _type;
-		LVObjectValue unOldVal = _unVal;
-		_type = OT_NULL;
-		_unVal.raw = (LVRawObjectVal)NULL;
-		__Release(tOldType , unOldVal);
+		LVObject old = *this;
+		OBJECT_INIT(*this, OT_NULL, pUserPointer, NULL)
+		__Release(old);
 	}
 
 #ifdef _DEBUG
@@ -298,34 +355,42 @@ struct LVObjectPtr : public LVObject {
 };
 
 inline void _Swap(LVObject& a, LVObject& b) {
-	LVObjectType tOldType = a._type;
-	LVObjectValue unOldVal = a._unVal;
-	a._type = b._type;
-	a._unVal = b._unVal;
-	b._type = tOldType;
-	b._unVal = unOldVal;
+	LVObject old = a;
+	a = b;
+	b = old;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
 #ifndef NO_GARBAGE_COLLECTOR
 #define MARK_FLAG 0x80000000
+/* Bits of _gcflags, whether GC_COLOR means white flips with every incremental cycle */
+#define GC_OLD 0x01
+#define GC_COLOR 0x02
 struct LVCollectable : public LVRefCounted {
 	LVCollectable *_next;
 	LVCollectable *_prev;
 	LVSharedState *_sharedstate;
+	//references from outside the collected set, only valid during a collection
+	LVInt32 _gcrefs;
+	LVInt32 _gcflags;
 	virtual LVObjectType GetType() = 0;
 	virtual void Release() = 0;
 	virtual void Mark(LVCollectable **chain) = 0;
+	bool EnterMark();
+	void LeaveMark(LVCollectable **chain);
 	void UnMark();
 	virtual void Finalize() = 0;
 	static void AddToChain(LVCollectable **chain, LVCollectable *c);
 	static void RemoveFromChain(LVCollectable **chain, LVCollectable *c);
+	static void AddToGeneration(LVCollectable **chain, LVCollectable *c);
+	static void RemoveFromGeneration(LVCollectable **chain, LVCollectable *c);
 };
 
-#define ADD_TO_CHAIN(chain,obj) AddToChain(chain,obj)
-#define REMOVE_FROM_CHAIN(chain,obj) {if(!(_uiRef&MARK_FLAG))RemoveFromChain(chain,obj);}
+//new objects start in the young generation, chain is the young chain
+#define ADD_TO_CHAIN(chain,obj) AddToGeneration(chain,obj)
+#define REMOVE_FROM_CHAIN(chain,obj) {if(!(_uiRef&MARK_FLAG))RemoveFromGeneration(chain,obj);}
 #define CHAINABLE_OBJ LVCollectable
-#define INIT_CHAIN() {_next=NULL;_prev=NULL;_sharedstate=ss;}
+#define INIT_CHAIN() {_next=NULL;_prev=NULL;_gcrefs=0;_gcflags=0;LVCollectable::_sharedstate=ss;}
 #else
 
 #define ADD_TO_CHAIN(chain,obj) ((void)0)
@@ -3,6 +3,7 @@
 
 #define MAX_FUNC_STACKSIZE 0xFF
 #define MAX_LITERALS ((LVInteger)0x7FFFFFFF)
+#define MAX_SWITCH_LITERAL 0xFFFF
 
 enum BitWiseOP {
 	BW_AND = 0,
@@ -97,7 +98,18 @@ enum Opcode {
 	_OP_THROW =              0x39,
 	_OP_NEWSLOTA =           0x3A,
 	_OP_GETBASE =            0x3B,
-	_OP_CLOSE =              0x3C
+	_OP_CLOSE =              0x3C,
+	/* Quickened variants, only written by the VM at runtime */
+	_OP_ADDI =               0x3D,
+	_OP_SUBI =               0x3E,
+	_OP_MULI =               0x3F,
+	_OP_ADDF =               0x40,
+	_OP_SUBF =               0x41,
+	_OP_MULF =               0x42,
+	_OP_JCMPI =              0x43,
+	_OP_JCMPF =              0x44,
+	/* Jump table of a switch, the table is literal arg2 | arg3 << 8 */
+	_OP_SWITCH =             0x45
 };
 
 struct LVInstructionDesc {
@@ -0,0 +1,1132 @@
+//before the headers of the VM, whose type() macro breaks them
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "pcheader.h"
+#include "vm.h"
+#include "lvstring.h"
+#include "table.h"
+#include "array.h"
+#include "funcproto.h"
+#include "closure.h"
+#include "stream.h"
+
+#define ISOLATE_TYPE_TAG 0x20000000
+#define CHANNEL_TYPE_TAG (ISOLATE_TYPE_TAG | 0x00000001)
+#define ISOLATE_HANDLE_TYPE_TAG (ISOLATE_TYPE_TAG | 0x00000002)
+
+/*
+ * pmap, pfilter and preduce split an array in chunks, which a pool of worker
+ * threads processes. Every worker runs a VM of its own and the VMs share
+ * nothing, so the function and the values travel between them as bytes:
+ *
+ *  - the function must be a script function without free variables. It runs
+ *    in the root table of the worker, which has the base library and what
+ *    the worker hook of the host adds, not the globals of the caller;
+ *  - the values, and whatever the function returns, must be null, bools,
+ *    numbers, strings, blobs, channels, or arrays and tables of those.
+ *    Tables lose their delegates.
+ *
+ * The workers and their VMs live until the VM that started them is closed.
+ * Inside a worker the functions run on the worker itself, one value after
+ * the other.
+ *
+ * isolate(func, ...) runs a function the same way on a thread and a VM of
+ * its own, which it keeps until the function returns. The isolates and the
+ * VM that started them talk through channels, which are the only objects
+ * the VMs share: a channel passed to another VM is the same channel there.
+ */
+
+#define WORKERS_MAX 64
+//chunks per worker, so that the workers that finish early take more of them
+#define WORKER_CHUNKS 4
+//deeper values are taken for cycles
+#define PACK_MAXDEPTH 64
+
+enum { PJOB_MAP, PJOB_FILTER, PJOB_REDUCE };
+//what follows OT_INSTANCE in a packed value
+enum { PACK_BLOB, PACK_BLOBMOVE, PACK_CHANNEL };
+
+struct LVPackBuffer {
+	void Init() {
+		_buf = NULL;
+		_size = 0;
+		_allocated = 0;
+	}
+	void Free() {
+		if (_buf)
+			lv_free(_buf, _allocated);
+		Init();
+	}
+	void Append(const void *data, LVInteger size) {
+		if (_size + size > _allocated) {
+			LVInteger n = _allocated ? _allocated * 2 : 256;
+			if (n < _size + size)
+				n = _size + size;
+			_buf = (unsigned char *)lv_realloc(_buf, _allocated, n);
+			_allocated = n;
+		}
+		memcpy(&_buf[_size], data, size);
+		_size += size;
+	}
+	unsigned char *_buf;
+	LVInteger _size;
+	LVInteger _allocated;
+};
+
+struct LVPackReader {
+	LVPackReader(const LVPackBuffer& b) : _p(b._buf), _end(b._buf + b._size) {}
+	bool Read(void *data, LVInteger size) {
+		if (_end - _p < size)
+			return false;
+		memcpy(data, _p, size);
+		_p += size;
+		return true;
+	}
+	const unsigned char *_p;
+	const unsigned char *_end;
+};
+
+struct LVMessage {
+	LVPackBuffer buf;
+	LVMessage *next;
+};
+
+/* Shared by every VM that holds the channel, the last one to let go frees it */
+struct LVChannel {
+	std::atomic<LVInteger> refs;
+	std::mutex lock;
+	std::condition_variable readable;
+	std::condition_variable writable;
+	LVMessage *head;
+	LVMessage *tail;
+	LVInteger pending;
+	LVInteger capacity;     //0 for no limit
+	bool closed;
+};
+
+static void _channel_release(LVChannel *ch);
+
+static LVInteger _pack_write(LVUserPointer up, LVUserPointer data, LVInteger size) {
+	((LVPackBuffer *)up)->Append(data, size);
+	return size;
+}
+
+static LVInteger _pack_read(LVUserPointer up, LVUserPointer data, LVInteger size) {
+	return ((LVPackReader *)up)->Read(data, size) ? size : -1;
+}
+
+/* Blobs hand their buffers over with transfer, and are left empty */
+static bool _pack_instance(LVVM *v, LVPackBuffer& b, const LVObjectPtr& o, bool transfer) {
+	LVObjectType t = OT_INSTANCE;
+	LVInteger kind, size, allocated;
+	LVUserPointer p;
+	bool ok = true;
+	v->Push(o);
+	if (LV_SUCCEEDED(lv_getinstanceup(v, -1, &p, (LVUserPointer)CHANNEL_TYPE_TAG))) {
+		LVChannel *ch = (LVChannel *)p;
+		kind = PACK_CHANNEL;
+		ch->refs++;
+		b.Append(&t, sizeof(t));
+		b.Append(&kind, sizeof(kind));
+		b.Append(&ch, sizeof(ch));
+	} else if (LV_SUCCEEDED(lv_getblob(v, -1, &p))) {
+		size = lv_getblobsize(v, -1);
+		b.Append(&t, sizeof(t));
+		if (transfer && (p = blob_takebuffer(v, -1, &size, &allocated)) != NULL) {
+			kind = PACK_BLOBMOVE;
+			b.Append(&kind, sizeof(kind));
+			b.Append(&p, sizeof(p));
+			b.Append(&size, sizeof(size));
+			b.Append(&allocated, sizeof(allocated));
+		} else {
+			kind = PACK_BLOB;
+			b.Append(&kind, sizeof(kind));
+			b.Append(&size, sizeof(size));
+			b.Append(p, size);
+		}
+	} else {
+		v->Raise_Error(_LC("values of type %s cannot be passed to another VM"), GetTypeName(o));
+		ok = false;
+	}
+	v->Pop();
+	return ok;
+}
+
+static bool _pack(LVVM *v, LVPackBuffer& b, const LVObjectPtr& o, LVInteger depth, bool transfer = false) {
+	LVObjectType t = type(o);
+	if (depth > PACK_MAXDEPTH) {
+		v->Raise_Error(_LC("value nested too deeply to pass to another VM"));
+		return false;
+	}
+	switch (t) {
+		case OT_NULL:
+			b.Append(&t, sizeof(t));
+			return true;
+		case OT_BOOL:
+		case OT_INTEGER: {
+			LVInteger i = _integer(o);
+			b.Append(&t, sizeof(t));
+			b.Append(&i, sizeof(i));
+			return true;
+		}
+		case OT_FLOAT: {
+			LVFloat f = _float(o);
+			b.Append(&t, sizeof(t));
+			b.Append(&f, sizeof(f));
+			return true;
+		}
+		case OT_STRING:
+			b.Append(&t, sizeof(t));
+			b.Append(&_string(o)->_len, sizeof(LVInteger));
+			b.Append(_stringval(o), _string(o)->_len * sizeof(LVChar));
+			return true;
+		case OT_ARRAY: {
+			LVArray *a = _array(o);
+			LVInteger n = a->Size();
+			LVObjectPtr val;
+			b.Append(&t, sizeof(t));
+			b.Append(&n, sizeof(n));
+			for (LVInteger i = 0; i < n; i++) {
+				a->Get(i, val);
+				if (!_pack(v, b, val, depth + 1, transfer))
+					return false;
+			}
+			return true;
+		}
+		case OT_TABLE: {
+			LVTable *tbl = _table(o);
+			LVInteger n = tbl->CountUsed(), ridx;
+			LVObjectPtr refpos, key, val;
+			b.Append(&t, sizeof(t));
+			b.Append(&n, sizeof(n));
+			while ((ridx = tbl->Next(false, refpos, key, val)) != -1) {
+				if (!_pack(v, b, key, depth + 1, transfer) || !_pack(v, b, val, depth + 1, transfer))
+					return false;
+				refpos = ridx;
+			}
+			return true;
+		}
+		case OT_INSTANCE:
+			return _pack_instance(v, b, o, transfer);
+		default:
+			v->Raise_Error(_LC("values of type %s cannot be passed to another VM"), GetTypeName(o));
+			return false;
+	}
+}
+
+static bool _channel_push(VMHANDLE v, LVChannel *ch);
+
+static bool _unpack_instance(LVVM *v, LVPackReader& r, LVObjectPtr& o) {
+	LVInteger kind, size, allocated;
+	LVUserPointer p;
+	LVChannel *ch;
+	if (!r.Read(&kind, sizeof(kind)))
+		return false;
+	switch (kind) {
+		case PACK_CHANNEL:
+			if (!r.Read(&ch, sizeof(ch)) || !_channel_push(v, ch))
+				return false;
+			break;
+		case PACK_BLOBMOVE:
+			if (!r.Read(&p, sizeof(p)) || !r.Read(&size, sizeof(size)) || !r.Read(&allocated, sizeof(allocated)))
+				return false;
+			if (LV_FAILED(blob_givebuffer(v, p, size, allocated))) {
+				lv_free(p, allocated);
+				return false;
+			}
+			break;
+		case PACK_BLOB:
+			if (!r.Read(&size, sizeof(size)) || r._end - r._p < size || !(p = lv_createblob(v, size)))
+				return false;
+			memcpy(p, r._p, size);
+			r._p += size;
+			break;
+		default:
+			return false;
+	}
+	o = v->GetUp(-1);
+	v->Pop();
+	return true;
+}
+
+/* Frees what a packed value that is never unpacked owns: the buffers of the blobs and the channels */
+static bool _unpack_discard(LVPackReader& r) {
+	LVObjectType t;
+	LVInteger n, kind, size, allocated;
+	LVUserPointer p;
+	LVChannel *ch;
+	if (!r.Read(&t, sizeof(t)))
+		return false;
+	switch (t) {
+		case OT_NULL:
+			return true;
+		case OT_BOOL:
+		case OT_INTEGER:
+			return r.Read(&n, sizeof(n));
+		case OT_FLOAT: {
+			LVFloat f;
+			return r.Read(&f, sizeof(f));
+		}
+		case OT_STRING:
+			if (!r.Read(&n, sizeof(n)) || r._end - r._p < n * (LVInteger)sizeof(LVChar))
+				return false;
+			r._p += n * sizeof(LVChar);
+			return true;
+		case OT_ARRAY:
+		case OT_TABLE:
+			if (!r.Read(&n, sizeof(n)))
+				return false;
+			if (t == OT_TABLE)
+				n *= 2;
+			for (LVInteger i = 0; i < n; i++) {
+				if (!_unpack_discard(r))
+					return false;
+			}
+			return true;
+		case OT_INSTANCE:
+			if (!r.Read(&kind, sizeof(kind)))
+				return false;
+			if (kind == PACK_CHANNEL) {
+				if (!r.Read(&ch, sizeof(ch)))
+					return false;
+				_channel_release(ch);
+				return true;
+			}
+			if (kind == PACK_BLOBMOVE) {
+				if (!r.Read(&p, sizeof(p)) || !r.Read(&size, sizeof(size)) || !r.Read(&allocated, sizeof(allocated)))
+					return false;
+				lv_free(p, allocated);
+				return true;
+			}
+			if (!r.Read(&size, sizeof(size)) || r._end - r._p < size)
+				return false;
+			r._p += size;
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Drops a packed value, whether or not it was unpacked */
+static void _pack_free(LVPackBuffer& b, bool unpacked) {
+	if (!unpacked) {
+		LVPackReader r(b);
+		_unpack_discard(r);
+	}
+	b.Free();
+}
+
+//the bytes come from _pack, only a bug would make them invalid
+static bool _unpack(LVVM *v, LVPackReader& r, LVObjectPtr& o) {
+	LVObjectType t;
+	LVInteger n;
+	if (!r.Read(&t, sizeof(t)))
+		return false;
+	switch (t) {
+		case OT_NULL:
+			o.Null();
+			return true;
+		case OT_BOOL:
+			if (!r.Read(&n, sizeof(n)))
+				return false;
+			o = n ? true : false;
+			return true;
+		case OT_INTEGER:
+			if (!r.Read(&n, sizeof(n)))
+				return false;
+			o = n;
+			return true;
+		case OT_FLOAT: {
+			LVFloat f;
+			if (!r.Read(&f, sizeof(f)))
+				return false;
+			o = f;
+			return true;
+		}
+		case OT_STRING:
+			if (!r.Read(&n, sizeof(n)) || r._end - r._p < n * (LVInteger)sizeof(LVChar))
+				return false;
+			o = LVString::Create(_ss(v), (const LVChar *)r._p, n);
+			r._p += n * sizeof(LVChar);
+			return true;
+		case OT_ARRAY: {
+			if (!r.Read(&n, sizeof(n)))
+				return false;
+			LVArray *a = LVArray::Create(_ss(v), 0);
+			LVObjectPtr val;
+			o = a;
+			a->Reserve(n);
+			for (LVInteger i = 0; i < n; i++) {
+				if (!_unpack(v, r, val))
+					return false;
+				a->Append(val);
+			}
+			return true;
+		}
+		case OT_TABLE: {
+			if (!r.Read(&n, sizeof(n)))
+				return false;
+			LVTable *tbl = LVTable::Create(_ss(v), n);
+			LVObjectPtr key, val;
+			o = tbl;
+			for (LVInteger i = 0; i < n; i++) {
+				if (!_unpack(v, r, key) || !_unpack(v, r, val))
+					return false;
+				tbl->NewSlot(key, val);
+			}
+			return true;
+		}
+		case OT_INSTANCE:
+			return _unpack_instance(v, r, o);
+		default:
+			return false;
+	}
+}
+
+/*
+ * Runs the function at stack index func over the values of a chunk that
+ * starts at index first of the array. out gets the results for map, the
+ * indices of the values kept for filter, and the reduced value for reduce.
+ */
+static bool _run_chunk(LVVM *v, LVInteger kind, LVInteger func, LVArray *in, LVInteger first, LVObjectPtr& out) {
+	LVInteger n = in->Size();
+	LVArray *res = LVArray::Create(_ss(v), 0);
+	LVObjectPtr val, acc;
+	out = res;
+	if (kind == PJOB_REDUCE) {
+		in->Get(0, acc);
+		for (LVInteger i = 1; i < n; i++) {
+			in->Get(i, val);
+			lv_push(v, func);
+			lv_pushroottable(v);
+			v->Push(acc);
+			v->Push(val);
+			if (LV_FAILED(lv_call(v, 3, LVTrue, LVFalse)))
+				return false;
+			acc = v->GetUp(-1);
+			lv_pop(v, 2);
+		}
+		res->Append(acc);
+		return true;
+	}
+	res->Reserve(kind == PJOB_MAP ? n : 0);
+	for (LVInteger i = 0; i < n; i++) {
+		in->Get(i, val);
+		lv_push(v, func);
+		lv_pushroottable(v);
+		if (kind == PJOB_FILTER)
+			lv_pushinteger(v, first + i);
+		v->Push(val);
+		if (LV_FAILED(lv_call(v, kind == PJOB_FILTER ? 3 : 2, LVTrue, LVFalse)))
+			return false;
+		if (kind == PJOB_MAP)
+			res->Append(v->GetUp(-1));
+		else if (!LVVM::IsFalse(v->GetUp(-1)))
+			res->Append(LVObjectPtr(first + i));
+		lv_pop(v, 2);
+	}
+	return true;
+}
+
+struct LVChunk {
+	LVPackBuffer in;        //the values, packed as an array
+	LVPackBuffer out;       //what _run_chunk returned, or the error
+	LVInteger first;
+	bool inread;            //whether the worker unpacked in
+	bool failed;
+};
+
+struct LVJob {
+	LVInteger kind;
+	LVPackBuffer func;
+	LVChunk *chunks;
+	LVInteger nchunks;
+	LVInteger nworkers;
+	LVInteger running;      //workers still on the job, under the lock of the pool
+	std::atomic<LVInteger> next;
+	std::atomic<bool> failed;
+};
+
+struct LVWorkerPool {
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	LVJob *job;
+	LVInteger generation;
+	bool quit;
+	std::thread *threads[WORKERS_MAX];
+	LVInteger nthreads;
+	LVPRINTFUNCTION printfunc;
+	LVPRINTFUNCTION errorfunc;
+	LVWORKERHOOK hook;
+	bool jit;
+};
+
+static void _worker_fail(LVVM *v, LVChunk& c) {
+	const LVChar *msg = _LC("worker failed");
+	if (type(v->_lasterror) == OT_STRING)
+		msg = _stringval(v->_lasterror);
+	_pack_free(c.out, false);
+	c.out.Append(msg, (scstrlen(msg) + 1) * sizeof(LVChar));
+	c.failed = true;
+}
+
+static void _worker_run(LVVM *v, LVJob *job) {
+	LVInteger top = lv_gettop(v);
+	LVPackReader fr(job->func);
+	bool loaded = LV_SUCCEEDED(lv_readclosure(v, _pack_read, &fr));
+	for (;;) {
+		LVInteger i = job->next++;
+		if (i >= job->nchunks || job->failed)
+			break;
+		LVChunk& c = job->chunks[i];
+		LVPackReader r(c.in);
+		LVObjectPtr in, out;
+		c.inread = loaded;
+		if (!loaded || !_unpack(v, r, in) || !_run_chunk(v, job->kind, top + 1, _array(in), c.first, out)
+		        || !_pack(v, c.out, out, 0)) {
+			_worker_fail(v, c);
+			job->failed = true;
+			break;
+		}
+	}
+	lv_settop(v, top);
+}
+
+static void _worker_main(LVWorkerPool *pool, LVInteger id, LVInteger seen) {
+	VMHANDLE v = lv_open(1024);
+	_ss(v)->_isworker = true;
+	lv_setprintfunc(v, pool->printfunc, pool->errorfunc);
+	lv_enablejit(v, pool->jit ? LVTrue : LVFalse);
+	if (pool->hook)
+		pool->hook(v);
+	for (;;) {
+		LVJob *job;
+		{
+			std::unique_lock<std::mutex> l(pool->lock);
+			while (!pool->quit && pool->generation == seen)
+				pool->wake.wait(l);
+			if (pool->quit)
+				break;
+			seen = pool->generation;
+			job = pool->job;
+		}
+		//the job may be over already when a worker it did not need wakes up
+		if (!job || id >= job->nworkers)
+			continue;
+		_worker_run(v, job);
+		std::lock_guard<std::mutex> l(pool->lock);
+		if (--job->running == 0)
+			pool->done.notify_all();
+	}
+	lv_close(v);
+}
+
+static LVWorkerPool *_workers_get(LVVM *v, LVInteger nworkers) {
+	LVSharedState *ss = _ss(v);
+	LVWorkerPool *pool = ss->_workers;
+	if (!pool) {
+		pool = new(lv_malloc(sizeof(LVWorkerPool))) LVWorkerPool;
+		pool->job = NULL;
+		pool->generation = 0;
+		pool->quit = false;
+		pool->nthreads = 0;
+		pool->printfunc = ss->_printfunc;
+		pool->errorfunc = ss->_errorfunc;
+		pool->hook = ss->_workerhook;
+		pool->jit = ss->_jit;
+		ss->_workers = pool;
+	}
+	//no job runs, so the new workers start from the current generation
+	while (pool->nthreads < nworkers) {
+		LVInteger id = pool->nthreads++;
+		pool->threads[id] = new(lv_malloc(sizeof(std::thread))) std::thread(_worker_main, pool, id, pool->generation);
+	}
+	return pool;
+}
+
+void ReleaseWorkers(LVWorkerPool *pool) {
+	{
+		std::lock_guard<std::mutex> l(pool->lock);
+		pool->quit = true;
+		pool->wake.notify_all();
+	}
+	for (LVInteger i = 0; i < pool->nthreads; i++) {
+		pool->threads[i]->join();
+		pool->threads[i]->~thread();
+		lv_free(pool->threads[i], sizeof(std::thread));
+	}
+	pool->~LVWorkerPool();
+	lv_free(pool, sizeof(LVWorkerPool));
+}
+
+static LVInteger _default_workers() {
+	LVInteger n = (LVInteger)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+/* Runs the job over the array at stack index 1, out gets what _run_chunk returned for every chunk */
+static bool _parallel_run(LVVM *v, LVInteger kind, LVInteger nworkers, LVArray *out) {
+	LVArray *a = _array(stack_get(v, 1));
+	LVInteger n = a->Size();
+	LVObjectPtr& func = stack_get(v, 2);
+	LVObjectPtr val;
+
+	//nested inside a worker, or with nothing to split
+	if (_ss(v)->_isworker) {
+		LVObjectPtr res;
+		if (!_run_chunk(v, kind, 2, a, 0, res))
+			return false;
+		out->Append(res);
+		return true;
+	}
+	if (type(func) != OT_CLOSURE) {
+		v->Raise_Error(_LC("only script functions can run on workers"));
+		return false;
+	}
+	if (_closure(func)->_function->_noutervalues) {
+		v->Raise_Error(_LC("a function with free variables cannot run on workers"));
+		return false;
+	}
+	if (nworkers > WORKERS_MAX)
+		nworkers = WORKERS_MAX;
+
+	LVJob job;
+	job.kind = kind;
+	job.func.Init();
+	job.nchunks = nworkers * WORKER_CHUNKS < n ? nworkers * WORKER_CHUNKS : n;
+	job.nworkers = nworkers;
+	job.running = nworkers;
+	job.next = 0;
+	job.failed = false;
+	job.chunks = (LVChunk *)lv_malloc(job.nchunks * sizeof(LVChunk));
+	for (LVInteger i = 0; i < job.nchunks; i++) {
+		job.chunks[i].in.Init();
+		job.chunks[i].out.Init();
+		job.chunks[i].inread = false;
+		job.chunks[i].failed = false;
+	}
+
+	bool ok = true;
+	v->Push(func);
+	if (LV_FAILED(lv_writeclosure(v, _pack_write, &job.func)))
+		ok = false;
+	v->Pop();
+	LVObjectType at = OT_ARRAY;
+	for (LVInteger i = 0; ok && i < job.nchunks; i++) {
+		LVChunk& c = job.chunks[i];
+		LVInteger end = n * (i + 1) / job.nchunks;
+		c.first = n * i / job.nchunks;
+		LVInteger len = end - c.first;
+		c.in.Append(&at, sizeof(at));
+		c.in.Append(&len, sizeof(len));
+		for (LVInteger k = c.first; ok && k < end; k++) {
+			a->Get(k, val);
+			ok = _pack(v, c.in, val, 1);
+		}
+	}
+
+	if (ok) {
+		LVWorkerPool *pool = _workers_get(v, nworkers);
+		std::unique_lock<std::mutex> l(pool->lock);
+		pool->job = &job;
+		pool->generation++;
+		pool->wake.notify_all();
+		while (job.running > 0)
+			pool->done.wait(l);
+		pool->job = NULL;
+	}
+
+	bool *outread = (bool *)lv_malloc(job.nchunks * sizeof(bool));
+	for (LVInteger i = 0; i < job.nchunks; i++) {
+		LVChunk& c = job.chunks[i];
+		outread[i] = c.failed;
+		if (!ok || job.failed) {
+			if (ok && c.failed) {
+				v->Raise_Error(_LC("%s"), (const LVChar *)c.out._buf);
+				ok = false;
+			}
+			continue;
+		}
+		LVPackReader r(c.out);
+		outread[i] = true;
+		if (!_unpack(v, r, val)) {
+			v->Raise_Error(_LC("worker failed"));
+			ok = false;
+		} else {
+			out->Append(val);
+		}
+	}
+
+	for (LVInteger i = 0; i < job.nchunks; i++) {
+		_pack_free(job.chunks[i].in, job.chunks[i].inread);
+		_pack_free(job.chunks[i].out, outread[i]);
+	}
+	lv_free(outread, job.nchunks * sizeof(bool));
+	lv_free(job.chunks, job.nchunks * sizeof(LVChunk));
+	job.func.Free();
+	return ok;
+}
+
+static bool _parallel_workers(VMHANDLE v, LVInteger idx, LVInteger& nworkers) {
+	nworkers = _default_workers();
+	if (lv_gettop(v) >= idx) {
+		lv_getinteger(v, idx, &nworkers);
+		if (nworkers < 1) {
+			v->Raise_Error(_LC("at least one worker is needed"));
+			return false;
+		}
+	}
+	return true;
+}
+
+LVInteger array_pmap(VMHANDLE v) {
+	LVInteger nworkers;
+	LVObjectPtr parts = LVArray::Create(_ss(v), 0);
+	LVArray *res = LVArray::Create(_ss(v), 0);
+	LVObjectPtr ret = res;
+	if (!_parallel_workers(v, 3, nworkers))
+		return LV_ERROR;
+	if (_array(stack_get(v, 1))->Size() > 0 && !_parallel_run(v, PJOB_MAP, nworkers, _array(parts)))
+		return LV_ERROR;
+	res->Reserve(_array(stack_get(v, 1))->Size());
+	for (LVInteger i = 0; i < _array(parts)->Size(); i++)
+		res->Extend(_array(_array(parts)->Values()[i]));
+	v->Push(ret);
+	return 1;
+}
+
+LVInteger array_pfilter(VMHANDLE v) {
+	LVInteger nworkers;
+	LVObjectPtr parts = LVArray::Create(_ss(v), 0);
+	LVArray *res = LVArray::Create(_ss(v), 0);
+	LVObjectPtr ret = res, val;
+	if (!_parallel_workers(v, 3, nworkers))
+		return LV_ERROR;
+	if (_array(stack_get(v, 1))->Size() > 0 && !_parallel_run(v, PJOB_FILTER, nworkers, _array(parts)))
+		return LV_ERROR;
+	//the workers send back indices, the values kept are the ones of the array
+	LVArray *a = _array(stack_get(v, 1));
+	for (LVInteger i = 0; i < _array(parts)->Size(); i++) {
+		LVArray *kept = _array(_array(parts)->Values()[i]);
+		for (LVInteger k = 0; k < kept->Size(); k++) {
+			if (a->Get(_integer(kept->Values()[k]), val))
+				res->Append(val);
+		}
+	}
+	v->Push(ret);
+	return 1;
+}
+
+/* The chunks are reduced on the workers, their results here, so the function must be associative */
+LVInteger array_preduce(VMHANDLE v) {
+	LVInteger nworkers;
+	LVObjectPtr parts = LVArray::Create(_ss(v), 0);
+	LVObjectPtr acc, val;
+	if (!_parallel_workers(v, 3, nworkers))
+		return LV_ERROR;
+	if (_array(stack_get(v, 1))->Size() == 0)
+		return 0;
+	if (!_parallel_run(v, PJOB_REDUCE, nworkers, _array(parts)))
+		return LV_ERROR;
+	LVArray *p = _array(parts);
+	_array(p->Values()[0])->Get(0, acc);
+	for (LVInteger i = 1; i < p->Size(); i++) {
+		_array(p->Values()[i])->Get(0, val);
+		lv_push(v, 2);
+		lv_pushroottable(v);
+		v->Push(acc);
+		v->Push(val);
+		if (LV_FAILED(lv_call(v, 3, LVTrue, LVFalse)))
+			return LV_ERROR;
+		acc = v->GetUp(-1);
+		lv_pop(v, 2);
+	}
+	v->Push(acc);
+	return 1;
+}
+
+static void _channel_release(LVChannel *ch) {
+	if (--ch->refs > 0)
+		return;
+	while (ch->head) {
+		LVMessage *m = ch->head;
+		ch->head = m->next;
+		_pack_free(m->buf, false);
+		lv_free(m, sizeof(LVMessage));
+	}
+	ch->~LVChannel();
+	lv_free(ch, sizeof(LVChannel));
+}
+
+static LVInteger _channel_releasehook(LVUserPointer p, LVInteger LV_UNUSED_ARG(size)) {
+	_channel_release((LVChannel *)p);
+	return 1;
+}
+
+/* Pushes an instance of the channel class that holds ch, taking over a reference */
+static bool _channel_push(VMHANDLE v, LVChannel *ch) {
+	LVInteger top = lv_gettop(v);
+	lv_pushregistrytable(v);
+	lv_pushstring(v, _LC("std_channel"), -1);
+	if (LV_FAILED(lv_get(v, -2)) || LV_FAILED(lv_createinstance(v, -1))) {
+		lv_settop(v, top);
+		_channel_release(ch);
+		return false;
+	}
+	lv_setinstanceup(v, -1, ch);
+	lv_setreleasehook(v, -1, _channel_releasehook);
+	lv_remove(v, -2);
+	lv_remove(v, -2);
+	return true;
+}
+
+#define SETUP_CHANNEL(v) \
+	LVChannel *self = NULL; \
+	{ if(LV_FAILED(lv_getinstanceup(v,1,(LVUserPointer*)&self,(LVUserPointer)CHANNEL_TYPE_TAG))) \
+		return lv_throwerror(v,_LC("invalid type tag"));  } \
+	if(!self)  \
+		return lv_throwerror(v,_LC("the channel is invalid"));
+
+/* channel([capacity]), send blocks while capacity messages wait to be received */
+static LVInteger _channel_constructor(VMHANDLE v) {
+	LVInteger capacity = 0;
+	if (lv_gettop(v) > 1)
+		lv_getinteger(v, 2, &capacity);
+	if (capacity < 0)
+		return lv_throwerror(v, _LC("cannot create channel with negative capacity"));
+	LVChannel *ch = new(lv_malloc(sizeof(LVChannel))) LVChannel;
+	ch->refs = 1;
+	ch->head = ch->tail = NULL;
+	ch->pending = 0;
+	ch->capacity = capacity;
+	ch->closed = false;
+	if (LV_FAILED(lv_setinstanceup(v, 1, ch))) {
+		_channel_release(ch);
+		return lv_throwerror(v, _LC("cannot create channel"));
+	}
+	lv_setreleasehook(v, 1, _channel_releasehook);
+	return 0;
+}
+
+/* send(value[, transfer]) copies the value, with transfer its blobs give their buffers instead */
+static LVInteger _channel_send(VMHANDLE v) {
+	SETUP_CHANNEL(v);
+	LVBool transfer = LVFalse;
+	if (lv_gettop(v) > 2)
+		lv_getbool(v, 3, &transfer);
+	LVMessage *m = (LVMessage *)lv_malloc(sizeof(LVMessage));
+	m->buf.Init();
+	m->next = NULL;
+	if (!_pack(v, m->buf, stack_get(v, 2), 0, transfer ? true : false)) {
+		_pack_free(m->buf, false);
+		lv_free(m, sizeof(LVMessage));
+		return LV_ERROR;
+	}
+	{
+		std::unique_lock<std::mutex> l(self->lock);
+		while (!self->closed && self->capacity && self->pending >= self->capacity)
+			self->writable.wait(l);
+		if (!self->closed) {
+			if (self->tail)
+				self->tail->next = m;
+			else
+				self->head = m;
+			self->tail = m;
+			self->pending++;
+			self->readable.notify_one();
+			return 0;
+		}
+	}
+	_pack_free(m->buf, false);
+	lv_free(m, sizeof(LVMessage));
+	return lv_throwerror(v, _LC("the channel is closed"));
+}
+
+/* Waits for the next message, null once the channel is closed and empty */
+static LVInteger _channel_recv(VMHANDLE v) {
+	SETUP_CHANNEL(v);
+	LVMessage *m;
+	{
+		std::unique_lock<std::mutex> l(self->lock);
+		while (!self->closed && !self->head)
+			self->readable.wait(l);
+		if (!(m = self->head))
+			return 0;
+		if (!(self->head = m->next))
+			self->tail = NULL;
+		self->pending--;
+		self->writable.notify_one();
+	}
+	LVPackReader r(m->buf);
+	LVObjectPtr val;
+	bool ok = _unpack(v, r, val);
+	_pack_free(m->buf, true);
+	lv_free(m, sizeof(LVMessage));
+	if (!ok)
+		return lv_throwerror(v, _LC("invalid message"));
+	v->Push(val);
+	return 1;
+}
+
+static LVInteger _channel_pending(VMHANDLE v) {
+	SETUP_CHANNEL(v);
+	std::lock_guard<std::mutex> l(self->lock);
+	lv_pushinteger(v, self->pending);
+	return 1;
+}
+
+/* The messages already sent can still be received */
+static LVInteger _channel_close(VMHANDLE v) {
+	SETUP_CHANNEL(v);
+	std::lock_guard<std::mutex> l(self->lock);
+	self->closed = true;
+	self->readable.notify_all();
+	self->writable.notify_all();
+	return 0;
+}
+
+static LVInteger _channel_isclosed(VMHANDLE v) {
+	SETUP_CHANNEL(v);
+	std::lock_guard<std::mutex> l(self->lock);
+	lv_pushbool(v, self->closed ? LVTrue : LVFalse);
+	return 1;
+}
+
+#define _DECL_CHANNEL_FUNC(name,nparams,typecheck) {_LC(#name),_channel_##name,nparams,typecheck}
+static const LVRegFunction _channel_methods[] = {
+	_DECL_CHANNEL_FUNC(constructor, -1, _LC("xn")),
+	_DECL_CHANNEL_FUNC(send, -2, _LC("x.b")),
+	_DECL_CHANNEL_FUNC(recv, 1, _LC("x")),
+	_DECL_CHANNEL_FUNC(pending, 1, _LC("x")),
+	_DECL_CHANNEL_FUNC(close, 1, _LC("x")),
+	_DECL_CHANNEL_FUNC(isclosed, 1, _LC("x")),
+	{NULL, (LVFUNCTION)0, 0, NULL}
+};
+
+/* Shared by the thread of the isolate and the object that started it, the last one to let go frees it */
+struct LVIsolate {
+	std::atomic<LVInteger> refs;
+	std::mutex lock;
+	std::thread *thread;
+	LVPackBuffer func;
+	LVPackBuffer args;      //packed as an array
+	LVPackBuffer out;       //what the function returned, or the error
+	bool argsread;
+	bool done;
+	bool failed;
+	bool joined;
+	LVPRINTFUNCTION printfunc;
+	LVPRINTFUNCTION errorfunc;
+	LVWORKERHOOK hook;
+	bool jit;
+};
+
+static void _isolate_release(LVIsolate *iso) {
+	if (--iso->refs > 0)
+		return;
+	iso->func.Free();
+	_pack_free(iso->args, iso->argsread);
+	if (iso->failed)
+		iso->out.Free();
+	else
+		_pack_free(iso->out, iso->joined);
+	iso->~LVIsolate();
+	lv_free(iso, sizeof(LVIsolate));
+}
+
+static void _isolate_run(VMHANDLE v, LVIsolate *iso) {
+	LVPackReader fr(iso->func), ar(iso->args);
+	LVObjectPtr args;
+	bool ok = LV_SUCCEEDED(lv_readclosure(v, _pack_read, &fr));
+	iso->argsread = ok;
+	if (ok && (ok = _unpack(v, ar, args))) {
+		LVArray *a = _array(args);
+		lv_pushroottable(v);
+		for (LVInteger i = 0; i < a->Size(); i++)
+			v->Push(a->Values()[i]);
+		//the result is no use to this VM anymore, so its blobs give their buffers
+		ok = LV_SUCCEEDED(lv_call(v, a->Size() + 1, LVTrue, LVFalse)) && _pack(v, iso->out, v->GetUp(-1), 0, true);
+	}
+	std::lock_guard<std::mutex> l(iso->lock);
+	if (!ok) {
+		const LVChar *msg = type(v->_lasterror) == OT_STRING ? _stringval(v->_lasterror) : _LC("isolate failed");
+		_pack_free(iso->out, false);
+		iso->out.Append(msg, (scstrlen(msg) + 1) * sizeof(LVChar));
+		iso->failed = true;
+	}
+}
+
+static void _isolate_main(LVIsolate *iso) {
+	VMHANDLE v = lv_open(1024);
+	lv_setprintfunc(v, iso->printfunc, iso->errorfunc);
+	lv_enablejit(v, iso->jit ? LVTrue : LVFalse);
+	lv_setworkerhook(v, iso->hook);
+	if (iso->hook)
+		iso->hook(v);
+	_isolate_run(v, iso);
+	lv_close(v);
+	{
+		std::lock_guard<std::mutex> l(iso->lock);
+		iso->done = true;
+	}
+	_isolate_release(iso);
+}
+
+//an isolate that is never joined runs on, detached
+static LVInteger _isolate_releasehook(LVUserPointer p, LVInteger LV_UNUSED_ARG(size)) {
+	LVIsolate *iso = (LVIsolate *)p;
+	if (iso->thread) {
+		iso->thread->detach();
+		iso->thread->~thread();
+		lv_free(iso->thread, sizeof(std::thread));
+	}
+	_isolate_release(iso);
+	return 1;
+}
+
+#define SETUP_ISOLATE(v) \
+	LVIsolate *self = NULL; \
+	{ if(LV_FAILED(lv_getinstanceup(v,1,(LVUserPointer*)&self,(LVUserPointer)ISOLATE_HANDLE_TYPE_TAG))) \
+		return lv_throwerror(v,_LC("invalid type tag"));  } \
+	if(!self)  \
+		return lv_throwerror(v,_LC("the isolate is invalid"));
+
+/* isolate(func, ...) calls func with the other arguments on a new thread and VM */
+static LVInteger _isolate_constructor(VMHANDLE v) {
+	LVInteger nargs = lv_gettop(v) - 2;
+	LVObjectPtr& func = stack_get(v, 2);
+	LVSharedState *ss = _ss(v);
+	if (type(func) != OT_CLOSURE)
+		return lv_throwerror(v, _LC("only script functions can run in an isolate"));
+	if (_closure(func)->_function->_noutervalues)
+		return lv_throwerror(v, _LC("a function with free variables cannot run in an isolate"));
+
+	LVIsolate *iso = new(lv_malloc(sizeof(LVIsolate))) LVIsolate;
+	iso->refs = 1;
+	iso->thread = NULL;
+	iso->func.Init();
+	iso->args.Init();
+	iso->out.Init();
+	iso->argsread = false;
+	iso->done = false;
+	iso->failed = false;
+	iso->joined = false;
+	iso->printfunc = ss->_printfunc;
+	iso->errorfunc = ss->_errorfunc;
+	iso->hook = ss->_workerhook;
+	iso->jit = ss->_jit;
+
+	LVObjectType at = OT_ARRAY;
+	bool ok = true;
+	iso->args.Append(&at, sizeof(at));
+	iso->args.Append(&nargs, sizeof(nargs));
+	for (LVInteger i = 0; ok && i < nargs; i++)
+		ok = _pack(v, iso->args, stack_get(v, i + 3), 1);
+	v->Push(func);
+	if (ok && LV_FAILED(lv_writeclosure(v, _pack_write, &iso->func)))
+		ok = false;
+	v->Pop();
+	if (!ok || LV_FAILED(lv_setinstanceup(v, 1, iso))) {
+		//the error, if any, is already raised
+		_isolate_release(iso);
+		return LV_ERROR;
+	}
+	lv_setreleasehook(v, 1, _isolate_releasehook);
+	iso->refs++;
+	iso->thread = new(lv_malloc(sizeof(std::thread))) std::thread(_isolate_main, iso);
+	return 0;
+}
+
+/* Waits for the function to return and returns what it did, or raises its error */
+static LVInteger _isolate_join(VMHANDLE v) {
+	SETUP_ISOLATE(v);
+	if (self->joined)
+		return lv_throwerror(v, _LC("the isolate is joined already"));
+	self->thread->join();
+	self->thread->~thread();
+	lv_free(self->thread, sizeof(std::thread));
+	self->thread = NULL;
+	self->joined = true;
+	if (self->failed)
+		return lv_throwerror(v, (const LVChar *)self->out._buf);
+	LVPackReader r(self->out);
+	LVObjectPtr val;
+	if (!_unpack(v, r, val))
+		return lv_throwerror(v, _LC("isolate failed"));
+	v->Push(val);
+	return 1;
+}
+
+static LVInteger _isolate_done(VMHANDLE v) {
+	SETUP_ISOLATE(v);
+	std::lock_guard<std::mutex> l(self->lock);
+	lv_pushbool(v, self->done ? LVTrue : LVFalse);
+	return 1;
+}
+
+#define _DECL_ISOLATE_FUNC(name,nparams,typecheck) {_LC(#name),_isolate_##name,nparams,typecheck}
+static const LVRegFunction _isolate_methods[] = {
+	_DECL_ISOLATE_FUNC(constructor, -2, _LC("xc")),
+	_DECL_ISOLATE_FUNC(join, 1, _LC("x")),
+	_DECL_ISOLATE_FUNC(done, 1, _LC("x")),
+	{NULL, (LVFUNCTION)0, 0, NULL}
+};
+
+static void _isolate_declare(VMHANDLE v, const LVChar *name, LVUserPointer typetag, const LVChar *reg_name, const LVRegFunction *methods) {
+	lv_pushregistrytable(v);
+	lv_pushstring(v, reg_name, -1);
+	lv_newclass(v, LVFalse);
+	lv_settypetag(v, -1, typetag);
+	for (LVInteger i = 0; methods[i].name != 0; i++) {
+		const LVRegFunction& f = methods[i];
+		lv_pushstring(v, f.name, -1);
+		lv_newclosure(v, f.f, 0);
+		lv_setparamscheck(v, f.nparamscheck, f.typemask);
+		lv_setnativeclosurename(v, -1, f.name);
+		lv_newslot(v, -3, LVFalse);
+	}
+	lv_newslot(v, -3, LVFalse);
+	lv_pop(v, 1);
+	//register the class in the target table
+	lv_pushstring(v, name, -1);
+	lv_pushregistrytable(v);
+	lv_pushstring(v, reg_name, -1);
+	lv_get(v, -2);
+	lv_remove(v, -2);
+	lv_newslot(v, -3, LVFalse);
+}
+
+LVRESULT mod_init_isolate(VMHANDLE v) {
+	if (lv_gettype(v, -1) != OT_TABLE)
+		return lv_throwerror(v, _LC("table expected"));
+	LVInteger top = lv_gettop(v);
+	_isolate_declare(v, _LC("channel"), (LVUserPointer)CHANNEL_TYPE_TAG, _LC("std_channel"), _channel_methods);
+	_isolate_declare(v, _LC("isolate"), (LVUserPointer)ISOLATE_HANDLE_TYPE_TAG, _LC("std_isolate"), _isolate_methods);
+	lv_settop(v, top);
+	return LV_OK;
+}
+
+/*
+ * Copies the value at idx of one VM to the top of another, as a message
+ * through a channel would. Neither VM may run meanwhile.
+ */
+LVRESULT lv_copyvalue(VMHANDLE from, LVInteger idx, VMHANDLE to) {
+	LVPackBuffer b;
+	LVObjectPtr val;
+	b.Init();
+	if (!_pack(from, b, stack_get(from, idx), 0)) {
+		_pack_free(b, false);
+		return LV_ERROR;
+	}
+	LVPackReader r(b);
+	bool ok = _unpack(to, r, val);
+	_pack_free(b, true);
+	if (!ok)
+		return lv_throwerror(to, _LC("cannot copy the value"));
+	to->Push(val);
+	return LV_OK;
+}
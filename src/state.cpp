@@ -1,4 +1,5 @@
 #include "pcheader.h"
+#include <time.h>
 #include "opcodes.h"
 #include "vm.h"
 #include "funcproto.h"
@@ -14,9 +15,15 @@ LVSharedState::LVSharedState() {
 	_printfunc = NULL;
 	_errorfunc = NULL;
 	_debuginfo = false;
+	_optlevel = 2;
+	_classstamp = 0;
 	_notifyallexceptions = false;
+	_jit = true;
 	_foreignptr = NULL;
 	_releasehook = NULL;
+	_workers = NULL;
+	_workerhook = NULL;
+	_isworker = false;
 }
 
 #define newsysstring(s) {   \
@@ -123,17 +130,41 @@ LVTable *CreateDefaultDelegate(LVSharedState *ss, const LVRegFunction *funcz) {
 	return t;
 }
 
-void LVSharedState::Init() {
+void LVSharedState::InitHeap(LVHash hashseed) {
 	_scratchpad = NULL;
 	_scratchpadsize = 0;
 #ifndef NO_GARBAGE_COLLECTOR
 	_gc_chain = NULL;
+	_gc_oldchain = NULL;
+	_gc_blackchain = NULL;
+	_gc_oldblackchain = NULL;
+	_gc_scan = NULL;
+	_gc_young = 0;
+	_gc_old = 0;
+	_gc_threshold = GC_YOUNG_THRESHOLD;
+	_gc_phase = GC_PHASE_FULL;
+	_gc_white = 0;
+	_gc_stepping = false;
+	_gc_collecting = false;
+	memset(&_gc_stats, 0, sizeof(_gc_stats));
 #endif
+	_hashseed = hashseed;
 	_stringtable = (LVStringTable *)LV_MALLOC(sizeof(LVStringTable));
 	new(_stringtable) LVStringTable(this);
 	lv_new(_metamethods, LVObjectPtrVec);
 	lv_new(_systemstrings, LVObjectPtrVec);
 	lv_new(_types, LVObjectPtrVec);
+	_rootshape = LVShape::Create(NULL, 0);
+}
+
+void LVSharedState::Init() {
+	//the address of the state changes with every run where ASLR is on
+	LVHash64 seed = ((LVHash64)time(NULL) << 20) ^ (LVHash64)clock() ^ (LVHash64)(size_t)this;
+	//a fixed seed gives the same key order on every run, for tests and reproducible output
+	const char *fixed = getenv("LAVRIL_HASHSEED");
+	if (fixed && *fixed)
+		seed = (LVHash64)strtoull(fixed, NULL, 0);
+	InitHeap(_mkhashseed(seed));
 	_metamethodsmap = LVTable::Create(this, MT_LAST - 1);
 
 	//types names
@@ -189,6 +220,10 @@ void LVSharedState::Init() {
 }
 
 LVSharedState::~LVSharedState() {
+	if (_workers) {
+		ReleaseWorkers(_workers);
+		_workers = NULL;
+	}
 	if (_releasehook) {
 		_releasehook(_foreignptr, 0);
 		_releasehook = NULL;
@@ -218,6 +253,8 @@ LVSharedState::~LVSharedState() {
 	_weakref_default_delegate.Null();
 	_refs_table.Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
+	AbortStep();
+	MergeGenerations();
 	LVCollectable *t = _gc_chain;
 	LVCollectable *nx = NULL;
 	if (t) {
@@ -238,6 +275,7 @@ LVSharedState::~LVSharedState() {
 	}
 #endif
 
+	_rootshape->Release();
 	lv_delete(_types, LVObjectPtrVec);
 	lv_delete(_systemstrings, LVObjectPtrVec);
 	lv_delete(_metamethods, LVObjectPtrVec);
@@ -319,10 +357,52 @@ void LVSharedState::RunMark(LVVM LV_UNUSED_ARG(*vm), LVCollectable **tchain) {
 	MarkObject(_weakref_default_delegate, tchain);
 }
 
+/* Moves the old generation back to the young chain for a full collection */
+void LVSharedState::MergeGenerations() {
+	LVCollectable *t = _gc_oldchain;
+	if (!t)
+		return;
+	for (;;) {
+		t->_gcflags &= ~GC_OLD;
+		if (!t->_next)
+			break;
+		t = t->_next;
+	}
+	t->_next = _gc_chain;
+	if (_gc_chain)
+		_gc_chain->_prev = t;
+	_gc_chain = _gc_oldchain;
+	_gc_oldchain = NULL;
+	_gc_young += _gc_old;
+	_gc_old = 0;
+}
+
+/* Finalizes every object left in the young chain, returns their number */
+LVInteger LVSharedState::FinalizeYoung() {
+	LVInteger n = 0;
+	LVCollectable *t = _gc_chain;
+	LVCollectable *nx = NULL;
+	if (t) {
+		t->_uiRef++;
+		while (t) {
+			t->Finalize();
+			nx = t->_next;
+			if (nx) nx->_uiRef++;
+			if (--t->_uiRef == 0)
+				t->Release();
+			t = nx;
+			n++;
+		}
+	}
+	return n;
+}
+
 LVInteger LVSharedState::ResurrectUnreachable(LVVM *vm) {
 	LVInteger n = 0;
 	LVCollectable *tchain = NULL;
 
+	AbortStep();
+	MergeGenerations();
 	RunMark(vm, &tchain);
 
 	LVCollectable *resurrected = _gc_chain;
@@ -340,8 +420,7 @@ LVInteger LVSharedState::ResurrectUnreachable(LVVM *vm) {
 			LVObjectType type = t->GetType();
 			if (type != OT_FUNCPROTO && type != OT_OUTER) {
 				LVObject obj;
-				obj._type = type;
-				obj._unVal.pRefCounted = t;
+				OBJECT_INIT(obj, type, pRefCounted, t);
 				ret->Append(obj);
 			}
 			t = t->_next;
@@ -356,11 +435,17 @@ LVInteger LVSharedState::ResurrectUnreachable(LVVM *vm) {
 		_gc_chain = resurrected;
 	}
 
+	//everything left is alive again and joins the old generation
+	_gc_young = 0;
 	t = _gc_chain;
 	while (t) {
 		t->UnMark();
+		t->_gcflags |= GC_OLD;
+		_gc_old++;
 		t = t->_next;
 	}
+	_gc_oldchain = _gc_chain;
+	_gc_chain = NULL;
 
 	if (ret) {
 		LVObjectPtr temp = ret;
@@ -371,36 +456,250 @@ LVInteger LVSharedState::ResurrectUnreachable(LVVM *vm) {
 	return n;
 }
 
+/*
+ * A full collection marks from the roots through both generations. The
+ * unreachable objects are finalized and the survivors become old.
+ */
 LVInteger LVSharedState::CollectGarbage(LVVM *vm) {
 	LVInteger n = 0;
 	LVCollectable *tchain = NULL;
+	clock_t start = clock();
 
+	_gc_collecting = true;
+	AbortStep();
+	MergeGenerations();
 	RunMark(vm, &tchain);
 
-	LVCollectable *t = _gc_chain;
-	LVCollectable *nx = NULL;
-	if (t) {
-		t->_uiRef++;
-		while (t) {
-			t->Finalize();
-			nx = t->_next;
-			if (nx) nx->_uiRef++;
-			if (--t->_uiRef == 0)
-				t->Release();
-			t = nx;
-			n++;
-		}
-	}
+	n = FinalizeYoung();
 
-	t = tchain;
+	LVCollectable *t = tchain;
 	while (t) {
 		t->UnMark();
+		t->_gcflags |= GC_OLD;
+		_gc_old++;
 		t = t->_next;
 	}
-	_gc_chain = tchain;
+	_gc_oldchain = tchain;
+	_gc_collecting = false;
+
+	_gc_stats.major++;
+	_gc_stats.collected += n;
+	_gc_stats.lastpause = (LVFloat)(clock() - start) / CLOCKS_PER_SEC;
+	_gc_stats.totalpause += _gc_stats.lastpause;
+	return n;
+}
+
+/*
+ * A young collection only walks the young generation. The store into an old
+ * object needs no write barrier: every reference is counted, so a young
+ * object referenced from the old generation, a stack or native code has more
+ * references than the young objects hold to it. Those objects are the roots,
+ * whatever they reach survives and is promoted, the rest are young cycles.
+ */
+LVInteger LVSharedState::CollectYoung() {
+	LVInteger n = 0;
+	LVCollectable *t, *nx;
+	if (_gc_collecting || _gc_stepping)
+		return 0;
+	clock_t start = clock();
+
+	_gc_collecting = true;
+	MarkReferenced(&_gc_chain, 1);
 
+	LVCollectable *garbage = NULL;
+	LVInteger ngarbage = 0;
+	t = _gc_chain;
+	while (t) {
+		nx = t->_next;
+		if (t->_uiRef & MARK_FLAG) {
+			t->UnMark();
+			t->_gcflags |= GC_OLD;
+			LVCollectable::AddToChain(&_gc_oldchain, t);
+			_gc_old++;
+			_gc_stats.promoted++;
+		} else {
+			LVCollectable::AddToChain(&garbage, t);
+			ngarbage++;
+		}
+		t = nx;
+	}
+	_gc_chain = garbage;
+	_gc_young = ngarbage;
+
+	n = FinalizeYoung();
+	_gc_collecting = false;
+
+	_gc_stats.minor++;
+	_gc_stats.collected += n;
+	_gc_stats.lastpause = (LVFloat)(clock() - start) / CLOCKS_PER_SEC;
+	_gc_stats.totalpause += _gc_stats.lastpause;
 	return n;
 }
+
+/* Recolors the objects of src and moves them in front of *dest */
+static void _JoinChains(LVCollectable **dest, LVCollectable *src, LVInt32 color) {
+	LVCollectable *t = src;
+	if (!t)
+		return;
+	for (;;) {
+		t->_gcflags = (t->_gcflags & ~GC_COLOR) | color;
+		if (!t->_next)
+			break;
+		t = t->_next;
+	}
+	t->_next = *dest;
+	if (*dest)
+		(*dest)->_prev = t;
+	*dest = src;
+}
+
+/* Blackens a white object and queues it for the scan of its children */
+void LVSharedState::Gray(LVCollectable *c) {
+	bool old = (c->_gcflags & GC_OLD) != 0;
+	LVCollectable::RemoveFromChain(old ? &_gc_oldchain : &_gc_chain, c);
+	LVCollectable::AddToChain(old ? &_gc_oldblackchain : &_gc_blackchain, c);
+	c->_gcflags ^= GC_COLOR;
+	c->_uiRef++;
+	_gc_gray.push_back(c);
+}
+
+/*
+ * An incremental step scans gray objects until its budget, in microseconds,
+ * runs out. The stores made between two steps need no write barrier: the
+ * cycle ends with the reference counting pass of the young collections over
+ * the objects left white, so a white object that a black one, a stack or
+ * native code got hold of meanwhile is rescued. Objects created during the
+ * cycle are black. Returns the number of freed objects when the step ends the
+ * cycle, -1 otherwise.
+ */
+LVInteger LVSharedState::CollectStep(LVVM *vm, LVInteger budget) {
+	LVInteger n = -1;
+	LVInteger scanned = 0;
+	if (_gc_collecting)
+		return -1;
+	clock_t start = clock();
+	clock_t limit = start + (clock_t)((LVFloat)budget * CLOCKS_PER_SEC / 1000000);
+
+	_gc_collecting = true;
+	_gc_phase = GC_PHASE_STEP;
+	if (!_gc_stepping) {
+		_gc_stepping = true;
+		RunMark(vm, NULL);
+	}
+	while (!_gc_gray.empty()) {
+		LVCollectable *c = _gc_gray.back();
+		_gc_gray.pop_back();
+		_gc_scan = c;
+		c->Mark(NULL);
+		if (--c->_uiRef == 0)
+			c->Release();
+		if (++scanned % GC_STEP_BATCH == 0 && clock() >= limit)
+			break;
+	}
+	_gc_phase = GC_PHASE_FULL;
+	if (_gc_gray.empty())
+		n = FinishStep();
+	_gc_collecting = false;
+
+	_gc_stats.steps++;
+	if (n >= 0) {
+		_gc_stats.incremental++;
+		_gc_stats.collected += n;
+	}
+	_gc_stats.lastpause = (LVFloat)(clock() - start) / CLOCKS_PER_SEC;
+	_gc_stats.totalpause += _gc_stats.lastpause;
+	return n;
+}
+
+/* Ends an incremental cycle, the white objects only other whites reference are freed */
+LVInteger LVSharedState::FinishStep() {
+	LVCollectable *whites[2] = { _gc_chain, _gc_oldchain };
+	LVCollectable *garbage = NULL;
+	LVCollectable *t, *nx;
+	LVInt32 black = _gc_white ^ GC_COLOR;
+
+	MarkReferenced(whites, 2);
+	_gc_chain = NULL;
+	_gc_oldchain = NULL;
+	for (LVInteger i = 0; i < 2; i++) {
+		for (t = whites[i]; t; t = nx) {
+			nx = t->_next;
+			if (t->_uiRef & MARK_FLAG) {
+				t->UnMark();
+				t->_gcflags ^= GC_COLOR;
+				LVCollectable::AddToChain((t->_gcflags & GC_OLD) ? &_gc_oldblackchain : &_gc_blackchain, t);
+			} else {
+				//garbage is finalized from the young chain
+				if (t->_gcflags & GC_OLD) {
+					t->_gcflags &= ~GC_OLD;
+					_gc_old--;
+					_gc_young++;
+				}
+				LVCollectable::AddToChain(&garbage, t);
+			}
+		}
+	}
+	_gc_chain = garbage;
+	LVInteger n = FinalizeYoung();
+
+	//what is left turns black, and black is the white of the next cycle
+	_JoinChains(&_gc_blackchain, _gc_chain, black);
+	_JoinChains(&_gc_oldblackchain, _gc_oldchain, black);
+	_gc_chain = _gc_blackchain;
+	_gc_oldchain = _gc_oldblackchain;
+	_gc_blackchain = NULL;
+	_gc_oldblackchain = NULL;
+	_gc_white = black;
+	_gc_stepping = false;
+	return n;
+}
+
+/* Drops the incremental cycle in progress, every object becomes white again */
+void LVSharedState::AbortStep() {
+	if (!_gc_stepping)
+		return;
+	while (!_gc_gray.empty()) {
+		LVCollectable *c = _gc_gray.back();
+		_gc_gray.pop_back();
+		if (--c->_uiRef == 0)
+			c->Release();
+	}
+	_JoinChains(&_gc_chain, _gc_blackchain, _gc_white);
+	_JoinChains(&_gc_oldchain, _gc_oldblackchain, _gc_white);
+	_gc_blackchain = NULL;
+	_gc_oldblackchain = NULL;
+	_gc_stepping = false;
+}
+
+/*
+ * Marks in place the candidates referenced from outside the candidates, and
+ * whatever they reach. The others are only referenced by each other.
+ */
+void LVSharedState::MarkReferenced(LVCollectable **chains, LVInteger nchains) {
+	LVCollectable *t;
+	LVInteger i;
+	//an object nobody references yet is still being built by native code
+	for (i = 0; i < nchains; i++) {
+		for (t = chains[i]; t; t = t->_next)
+			t->_gcrefs = t->_uiRef ? (LVInt32)t->_uiRef : 1;
+	}
+	_gc_phase = GC_PHASE_COUNT;
+	for (i = 0; i < nchains; i++) {
+		for (t = chains[i]; t; t = t->_next) {
+			_gc_scan = t;
+			t->Mark(NULL);
+		}
+	}
+	_gc_scan = NULL;
+	_gc_phase = GC_PHASE_RESCUE;
+	for (i = 0; i < nchains; i++) {
+		for (t = chains[i]; t; t = t->_next) {
+			if (t->_gcrefs > 0)
+				t->Mark(NULL);
+		}
+	}
+	_gc_phase = GC_PHASE_FULL;
+}
 #endif
 
 #ifndef NO_GARBAGE_COLLECTOR
@@ -419,6 +718,30 @@ void LVCollectable::RemoveFromChain(LVCollectable **chain, LVCollectable *c) {
 	c->_next = NULL;
 	c->_prev = NULL;
 }
+
+void LVCollectable::AddToGeneration(LVCollectable **chain, LVCollectable *c) {
+	LVSharedState *ss = c->_sharedstate;
+	if (ss->_gc_stepping) {
+		c->_gcflags = ss->_gc_white ^ GC_COLOR;
+		AddToChain(&ss->_gc_blackchain, c);
+	} else {
+		c->_gcflags = ss->_gc_white;
+		AddToChain(chain, c);
+	}
+	ss->_gc_young++;
+}
+
+void LVCollectable::RemoveFromGeneration(LVCollectable **chain, LVCollectable *c) {
+	LVSharedState *ss = c->_sharedstate;
+	bool black = ss->_gc_stepping && !ss->IsCandidate(c);
+	if (c->_gcflags & GC_OLD) {
+		RemoveFromChain(black ? &ss->_gc_oldblackchain : &ss->_gc_oldchain, c);
+		ss->_gc_old--;
+	} else {
+		RemoveFromChain(black ? &ss->_gc_blackchain : chain, c);
+		ss->_gc_young--;
+	}
+}
 #endif
 
 LVChar *LVSharedState::GetScratchPad(LVInteger size) {
@@ -596,9 +919,24 @@ LVStringTable::LVStringTable(LVSharedState *ss) {
 	_sharedstate = ss;
 	AllocNodes(4);
 	_slotused = 0;
+	_oldstrings = NULL;
+	_oldnumofslots = 0;
+	_moved = 0;
+	memset(_shortcache, 0, sizeof(_shortcache));
+	memset(_charstrings, 0, sizeof(_charstrings));
 }
 
 LVStringTable::~LVStringTable() {
+	for (LVInteger i = 0; i < SHORTSTR_CACHESIZE; i++) {
+		if (_shortcache[i] && _shortcache[i]->_uiRef == 0)
+			Free(_shortcache[i]);
+	}
+	for (LVInteger i = 0; i < CHARSTR_COUNT; i++) {
+		if (_charstrings[i])
+			Free(_charstrings[i]);
+	}
+	if (_oldstrings)
+		LV_FREE(_oldstrings, sizeof(LVString *)*_oldnumofslots);
 	LV_FREE(_strings, sizeof(LVString *)*_numofslots);
 	_strings = NULL;
 }
@@ -609,13 +947,67 @@ void LVStringTable::AllocNodes(LVInteger size) {
 	memset(_strings, 0, sizeof(LVString *)*_numofslots);
 }
 
+/* Slot of a string of at most SHORTSTR_MAXSIZE bytes, read as wyhash reads short input */
+static inline LVHash _shortslot(const LVChar *s, LVInteger size) {
+	const unsigned char *p = (const unsigned char *)s;
+	LVHash64 w = 0;
+	if (size >= 4)
+		w = (_wyr4(p) << 32) | _wyr4(p + size - 4);
+	else if (size > 0)
+		w = ((LVHash64)p[0] << 16) | ((LVHash64)p[size >> 1] << 8) | p[size - 1];
+	return (LVHash)(((w ^ (LVHash64)size) * 0x9E3779B97F4A7C15ULL) >> (64 - SHORTSTR_CACHEBITS));
+}
+
+/*
+ * Short strings are what a tokenizer creates and drops over and over. Single
+ * characters never leave the table once created. Other short strings are
+ * found through a direct mapped cache without hashing or walking a chain, and
+ * one that loses its last reference stays allocated until it is evicted.
+ */
 LVString *LVStringTable::Add(const LVChar *news, LVInteger len) {
 	if (len < 0)
 		len = (LVInteger)scstrlen(news);
-	LVHash newhash = ::_hashstr(news, len);
-	LVHash h = newhash & (_numofslots - 1);
+	if (len == 1 && (LVUnsignedInteger)news[0] < CHARSTR_COUNT) {
+		LVString *&c = _charstrings[(LVUnsignedInteger)news[0]];
+		if (!c) {
+			c = Intern(news, 1, ::_hashstr(news, 1, _sharedstate->_hashseed));
+			c->_uiRef++;
+		}
+		return c;
+	}
+	if (lv_rsl(len) <= SHORTSTR_MAXSIZE) {
+		LVString *&e = _shortcache[_shortslot(news, lv_rsl(len))];
+		if (e && e->_len == len && !memcmp(news, e->_val, lv_rsl(len)))
+			return e;
+		LVString *t = Intern(news, len, ::_hashstr(news, len, _sharedstate->_hashseed));
+		if (e && e->_uiRef == 0)
+			Free(e);
+		e = t;
+		return t;
+	}
+	return Intern(news, len, ::_hashstr(news, len, _sharedstate->_hashseed));
+}
+
+LVString *LVStringTable::Add(const LVString *s) {
+	return Intern(s->_val, s->_len, s->_hash);
+}
+
+/* Chain a string with this hash is in, in the old array if its bucket was not moved yet */
+inline LVString **LVStringTable::Bucket(LVHash hash) {
+	if (_oldstrings) {
+		LVHash h = hash & (_oldnumofslots - 1);
+		if (h >= _moved)
+			return &_oldstrings[h];
+	}
+	return &_strings[hash & (_numofslots - 1)];
+}
+
+LVString *LVStringTable::Intern(const LVChar *news, LVInteger len, LVHash newhash) {
+	if (_oldstrings)
+		MoveBuckets(STRTABLE_MOVE_BUCKETS);
+	LVString **bucket = Bucket(newhash);
 	LVString *s;
-	for (s = _strings[h]; s; s = s->_next) {
+	for (s = *bucket; s; s = s->_next) {
 		if (s->_len == len && (!memcmp(news, s->_val, lv_rsl(len))))
 			return s; //found
 	}
@@ -627,20 +1019,36 @@ LVString *LVStringTable::Add(const LVChar *news, LVInteger len) {
 	t->_val[len] = _LC('\0');
 	t->_len = len;
 	t->_hash = newhash;
-	t->_next = _strings[h];
-	_strings[h] = t;
+	t->_next = *bucket;
+	*bucket = t;
 	_slotused++;
 	if (_slotused > _numofslots)  /* too crowded? */
 		Resize(_numofslots * 2);
 	return t;
 }
 
+/*
+ * Rehashing millions of strings at once stalls whichever request grows the
+ * table, so the old array is kept and emptied a few buckets at a time by the
+ * strings created and freed after the resize. It is gone long before the
+ * table is crowded again. Clearing the new array is spread the same way.
+ */
 void LVStringTable::Resize(LVInteger size) {
-	LVInteger oldsize = _numofslots;
-	LVString **oldtable = _strings;
-	AllocNodes(size);
-	for (LVInteger i = 0; i < oldsize; i++) {
-		LVString *p = oldtable[i];
+	if (_oldstrings)
+		MoveBuckets(_oldnumofslots);
+	_oldstrings = _strings;
+	_oldnumofslots = _numofslots;
+	_moved = 0;
+	//a bucket is cleared when the old bucket its strings come from is moved
+	_numofslots = size;
+	_strings = (LVString **)LV_MALLOC(sizeof(LVString *)*_numofslots);
+}
+
+void LVStringTable::MoveBuckets(LVUnsignedInteger n) {
+	for (; n > 0 && _moved < _oldnumofslots; n--, _moved++) {
+		for (LVUnsignedInteger i = _moved; i < _numofslots; i += _oldnumofslots)
+			_strings[i] = NULL;
+		LVString *p = _oldstrings[_moved];
 		while (p) {
 			LVString *next = p->_next;
 			LVHash h = p->_hash & (_numofslots - 1);
@@ -649,20 +1057,70 @@ void LVStringTable::Resize(LVInteger size) {
 			p = next;
 		}
 	}
-	LV_FREE(oldtable, oldsize * sizeof(LVString *));
+	if (_moved == _oldnumofslots) {
+		LV_FREE(_oldstrings, _oldnumofslots * sizeof(LVString *));
+		_oldstrings = NULL;
+		_oldnumofslots = 0;
+		_moved = 0;
+	}
+}
+
+/* Grows the table to at least size buckets at once, for hosts that know how many strings they will hold */
+void LVStringTable::Reserve(LVInteger size) {
+	LVUnsignedInteger n = _numofslots;
+	while (n < (LVUnsignedInteger)size)
+		n *= 2;
+	if (n == _numofslots)
+		return;
+	Resize(n);
+	MoveBuckets(_oldnumofslots);
+}
+
+void LVStringTable::GetStats(LVStringTableStats *stats) {
+	LVInteger chained = 0;
+	LVUnsignedInteger pending = _oldstrings ? _oldnumofslots - _moved : 0;
+	stats->strings = _slotused;
+	stats->slots = _numofslots;
+	stats->used = 0;
+	stats->longest = 0;
+	stats->pending = pending;
+	for (LVUnsignedInteger i = 0; i < _numofslots + pending; i++) {
+		if (i < _numofslots && pending && (i & (_oldnumofslots - 1)) >= _moved)
+			continue; //not cleared yet
+		LVString *p = i < _numofslots ? _strings[i] : _oldstrings[_moved + i - _numofslots];
+		LVInteger n = 0;
+		for (; p; p = p->_next)
+			n++;
+		if (n) {
+			stats->used++;
+			chained += n;
+		}
+		if (n > stats->longest)
+			stats->longest = n;
+	}
+	stats->meanchain = stats->used ? (LVFloat)chained / stats->used : 0;
 }
 
 void LVStringTable::Remove(LVString *bs) {
+	LVInteger size = lv_rsl(bs->_len);
+	if (size <= SHORTSTR_MAXSIZE && _shortcache[_shortslot(bs->_val, size)] == bs)
+		return;
+	Free(bs);
+}
+
+void LVStringTable::Free(LVString *bs) {
+	if (_oldstrings)
+		MoveBuckets(STRTABLE_MOVE_BUCKETS);
 	LVString *s;
 	LVString *prev = NULL;
-	LVHash h = bs->_hash & (_numofslots - 1);
+	LVString **bucket = Bucket(bs->_hash);
 
-	for (s = _strings[h]; s; ) {
+	for (s = *bucket; s; ) {
 		if (s == bs) {
 			if (prev)
 				prev->_next = s->_next;
 			else
-				_strings[h] = s->_next;
+				*bucket = s->_next;
 			_slotused--;
 			LVInteger slen = s->_len;
 			s->~LVString();
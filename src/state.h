@@ -6,20 +6,63 @@
 
 struct LVString;
 struct LVTable;
+struct LVShape;
 
 /* Max number of character for a printed number */
 #define NUMBER_MAX_CHAR 50
 
+/* Default size of the young generation that triggers a young collection */
+#define GC_YOUNG_THRESHOLD 10000
+
+/* Number of objects an incremental step scans between two checks of its budget */
+#define GC_STEP_BATCH 32
+
+/* What LVCollectable::EnterMark does for the pass in progress */
+enum LVGCPhase {
+	GC_PHASE_FULL,
+	GC_PHASE_COUNT,
+	GC_PHASE_RESCUE,
+	GC_PHASE_STEP
+};
+
+/* Strings up to this many bytes are looked up in the short string cache first */
+#define SHORTSTR_MAXSIZE 8
+#define SHORTSTR_CACHEBITS 9
+#define SHORTSTR_CACHESIZE (1 << SHORTSTR_CACHEBITS)
+/* Single character strings below this code stay interned for the life of the state */
+#define CHARSTR_COUNT 256
+/* Buckets moved from the old to the resized string table by every new or freed string */
+#define STRTABLE_MOVE_BUCKETS 8
+
 struct LVStringTable {
 	LVStringTable(LVSharedState *ss);
 	~LVStringTable();
 	LVString *Add(const LVChar *, LVInteger len);
+	//a string of a shared state with the same hash seed, whose hash is reused
+	LVString *Add(const LVString *s);
 	void Remove(LVString *);
+	void Reserve(LVInteger size);
+	LVInteger Count() {
+		return (LVInteger)_slotused;
+	}
+	void GetStats(LVStringTableStats *stats);
 
   private:
 	void Resize(LVInteger size);
 	void AllocNodes(LVInteger size);
+	void MoveBuckets(LVUnsignedInteger n);
+	LVString **Bucket(LVHash hash);
+	LVString *Intern(const LVChar *, LVInteger len, LVHash hash);
+	void Free(LVString *);
 	LVString **_strings;
+	//while resizing, the buckets of the old array from _moved on are still in use
+	LVString **_oldstrings;
+	LVUnsignedInteger _oldnumofslots;
+	LVUnsignedInteger _moved;
+	//entries may have no references left, they are freed on eviction
+	LVString *_shortcache[SHORTSTR_CACHESIZE];
+	//owning, every string holds a reference
+	LVString *_charstrings[CHARSTR_COUNT];
 	LVUnsignedInteger _numofslots;
 	LVUnsignedInteger _slotused;
 	LVSharedState *_sharedstate;
@@ -56,17 +99,36 @@ struct RefTable {
 #define REMOVE_STRING(ss,bstr) ss->_stringtable->Remove(bstr)
 
 struct LVObjectPtr;
+struct LVWorkerPool;
+
+void ReleaseWorkers(LVWorkerPool *pool);
 
 struct LVSharedState {
 	LVSharedState();
 	~LVSharedState();
 	void Init();
+	//takes the hash seed and the settings of a bootstrap state, see bootstrap.cpp
+	void InitFrom(LVSharedState *boot);
 
   public:
 	LVChar *GetScratchPad(LVInteger size);
 	LVInteger GetMetaMethodIdxByName(const LVObjectPtr& name);
 #ifndef NO_GARBAGE_COLLECTOR
 	LVInteger CollectGarbage(LVVM *vm);
+	LVInteger CollectYoung();
+	LVInteger CollectStep(LVVM *vm, LVInteger budget);
+	LVInteger FinishStep();
+	void AbortStep();
+	void MergeGenerations();
+	LVInteger FinalizeYoung();
+	void MarkReferenced(LVCollectable **chains, LVInteger nchains);
+	void Gray(LVCollectable *c);
+	//the objects a young collection, or the end of an incremental cycle, may free
+	inline bool IsCandidate(LVCollectable *c) {
+		if (_gc_stepping)
+			return (c->_gcflags & GC_COLOR) == _gc_white;
+		return !(c->_gcflags & GC_OLD);
+	}
 	void RunMark(LVVM *vm, LVCollectable **tchain);
 	LVInteger ResurrectUnreachable(LVVM *vm);
 	static void MarkObject(LVObjectPtr& o, LVCollectable **chain);
@@ -76,12 +138,31 @@ struct LVSharedState {
 	LVObjectPtrVec *_systemstrings;
 	LVObjectPtrVec *_types;
 	LVStringTable *_stringtable;
+	LVHash _hashseed;
 	RefTable _refs_table;
 	LVObjectPtr _registry;
 	LVObjectPtr _consts;
 	LVObjectPtr _constructoridx;
+	LVShape *_rootshape;
 #ifndef NO_GARBAGE_COLLECTOR
+	//new objects go to _gc_chain, the young generation. While an incremental
+	//cycle runs the chains hold the white objects, the black ones are kept apart
 	LVCollectable *_gc_chain;
+	LVCollectable *_gc_oldchain;
+	LVCollectable *_gc_blackchain;
+	LVCollectable *_gc_oldblackchain;
+	LVCollectable *_gc_scan;
+	//black objects whose children are not scanned yet, each holds a reference
+	lvvector<LVCollectable *> _gc_gray;
+	LVInteger _gc_young;
+	LVInteger _gc_old;
+	//a young collection runs when the young generation reaches this size
+	LVInteger _gc_threshold;
+	LVGCPhase _gc_phase;
+	LVInt32 _gc_white;
+	bool _gc_stepping;
+	bool _gc_collecting;
+	LVGCStats _gc_stats;
 #endif
 	LVObjectPtr _root_vm;
 	LVObjectPtr _table_default_delegate;
@@ -110,11 +191,20 @@ struct LVSharedState {
 	LVREADFUNCTION _readfunc;
 	LVPRINTFUNCTION _errorfunc;
 	bool _debuginfo;
+	LVInteger _optlevel;
+	/* Last stamp given to a class, see LVClass::_stamp */
+	LVUnsignedInteger _classstamp;
 	bool _notifyallexceptions;
+	bool _jit;
 	LVUserPointer _foreignptr;
 	LVRELEASEHOOK _releasehook;
+	//the threads of pmap, pfilter and preduce, and whether this VM is one of them
+	LVWorkerPool *_workers;
+	LVWORKERHOOK _workerhook;
+	bool _isworker;
 
   private:
+	void InitHeap(LVHash hashseed);
 	LVChar *_scratchpad;
 	LVInteger _scratchpadsize;
 };
@@ -0,0 +1,254 @@
+#include "pcheader.h"
+#include "stream.h"
+
+#define STRINGBUILDER_TYPE_TAG (STREAM_TYPE_TAG | 0x00000004)
+
+LVRESULT strformat(VMHANDLE v, LVInteger nformatstringidx, LVInteger *outlen, LVChar **output);
+
+/*
+ * Text collected in a buffer that doubles when full, so building a string of
+ * n characters copies O(n) of them. The string is only created, and interned,
+ * when the builder is converted with tostring(). Writes always append, reads
+ * start from the position given by seek().
+ */
+struct LVStringBuilder : public LVStream {
+	LVStringBuilder(LVInteger capacity) {
+		_allocated = capacity > 0 ? capacity : 64;
+		_buf = (unsigned char *)lv_malloc(_allocated);
+		_size = 0;
+		_ptr = 0;
+	}
+	virtual ~LVStringBuilder() {
+		lv_free(_buf, _allocated);
+	}
+	void Append(const void *data, LVInteger size) {
+		if (_size + size > _allocated) {
+			LVInteger n = _allocated * 2;
+			if (n < _size + size)
+				n = _size + size;
+			_buf = (unsigned char *)lv_realloc(_buf, _allocated, n);
+			_allocated = n;
+		}
+		memcpy(&_buf[_size], data, size);
+		_size += size;
+	}
+	void Clear() {
+		_size = 0;
+		_ptr = 0;
+	}
+	LVInteger Write(void *buffer, LVInteger size) {
+		Append(buffer, size);
+		return size;
+	}
+	LVInteger Read(void *buffer, LVInteger size) {
+		LVInteger n = _size - _ptr;
+		if (n <= 0)
+			return 0;
+		if (size < n)
+			n = size;
+		memcpy(buffer, &_buf[_ptr], n);
+		_ptr += n;
+		return n;
+	}
+	LVInteger Seek(LVInteger offset, LVInteger origin) {
+		LVInteger pos;
+		switch (origin) {
+			case LV_SEEK_SET:
+				pos = offset;
+				break;
+			case LV_SEEK_CUR:
+				pos = _ptr + offset;
+				break;
+			case LV_SEEK_END:
+				pos = _size + offset;
+				break;
+			default:
+				return -1;
+		}
+		if (pos < 0 || pos > _size)
+			return -1;
+		_ptr = pos;
+		return 0;
+	}
+	bool IsValid() {
+		return _buf ? true : false;
+	}
+	bool EOS() {
+		return _ptr == _size;
+	}
+	LVInteger Flush() {
+		return 0;
+	}
+	LVInteger Tell() {
+		return _ptr;
+	}
+	LVInteger Len() {
+		return _size;
+	}
+	const LVChar *GetString() {
+		return (const LVChar *)_buf;
+	}
+	LVInteger GetStringLen() {
+		return _size / sizeof(LVChar);
+	}
+
+  private:
+	LVInteger _size;
+	LVInteger _allocated;
+	LVInteger _ptr;
+	unsigned char *_buf;
+};
+
+#define SETUP_STRINGBUILDER(v) \
+	LVStringBuilder *self = NULL; \
+	{ if(LV_FAILED(lv_getinstanceup(v,1,(LVUserPointer*)&self,(LVUserPointer)STRINGBUILDER_TYPE_TAG))) \
+		return lv_throwerror(v,_LC("invalid type tag"));  } \
+	if(!self || !self->IsValid())  \
+		return lv_throwerror(v,_LC("the stringbuilder is invalid"));
+
+/* Appends the value at idx as tostring() would print it */
+static LVRESULT _stringbuilder_appendvalue(VMHANDLE v, LVStringBuilder *self, LVInteger idx) {
+	const LVChar *s;
+	switch (lv_gettype(v, idx)) {
+		case OT_STRING:
+			lv_getstring(v, idx, &s);
+			self->Append(s, lv_getsize(v, idx) * sizeof(LVChar));
+			return LV_OK;
+		case OT_INTEGER: {
+			//no need to intern a string for a number
+			LVInteger i;
+			LVChar buf[NUMBER_MAX_CHAR + 1];
+			lv_getinteger(v, idx, &i);
+			LVInteger len = scsprintf(buf, NUMBER_MAX_CHAR, _PRINT_INT_FMT, i);
+			self->Append(buf, len * sizeof(LVChar));
+			return LV_OK;
+		}
+		default:
+			if (LV_FAILED(lv_tostring(v, idx)))
+				return LV_ERROR;
+			lv_getstring(v, -1, &s);
+			self->Append(s, lv_getsize(v, -1) * sizeof(LVChar));
+			lv_pop(v, 1);
+			return LV_OK;
+	}
+}
+
+static LVInteger _stringbuilder_append(VMHANDLE v) {
+	SETUP_STRINGBUILDER(v);
+	LVInteger top = lv_gettop(v);
+	for (LVInteger i = 2; i <= top; i++) {
+		if (LV_FAILED(_stringbuilder_appendvalue(v, self, i)))
+			return LV_ERROR;
+	}
+	lv_push(v, 1);
+	return 1;
+}
+
+static LVInteger _stringbuilder_appendf(VMHANDLE v) {
+	SETUP_STRINGBUILDER(v);
+	LVChar *dest;
+	LVInteger length = 0;
+	if (LV_FAILED(strformat(v, 2, &length, &dest)))
+		return LV_ERROR;
+	self->Append(dest, length * sizeof(LVChar));
+	lv_push(v, 1);
+	return 1;
+}
+
+static LVInteger _stringbuilder_join(VMHANDLE v) {
+	SETUP_STRINGBUILDER(v);
+	const LVChar *sep = NULL;
+	LVInteger seplen = 0;
+	if (lv_gettop(v) > 2) {
+		lv_getstring(v, 3, &sep);
+		seplen = lv_getsize(v, 3);
+	}
+	LVInteger n = lv_getsize(v, 2);
+	for (LVInteger i = 0; i < n; i++) {
+		if (i > 0 && seplen > 0)
+			self->Append(sep, seplen * sizeof(LVChar));
+		lv_pushinteger(v, i);
+		if (LV_FAILED(lv_rawget(v, 2)))
+			return LV_ERROR;
+		if (LV_FAILED(_stringbuilder_appendvalue(v, self, -1)))
+			return LV_ERROR;
+		lv_pop(v, 1);
+	}
+	lv_push(v, 1);
+	return 1;
+}
+
+static LVInteger _stringbuilder_clear(VMHANDLE v) {
+	SETUP_STRINGBUILDER(v);
+	self->Clear();
+	return 0;
+}
+
+static LVInteger _stringbuilder_flushto(VMHANDLE v) {
+	SETUP_STRINGBUILDER(v);
+	LVStream *dest = NULL;
+	if (LV_FAILED(lv_getinstanceup(v, 2, (LVUserPointer *)&dest, (LVUserPointer)STREAM_TYPE_TAG)) || !dest || !dest->IsValid())
+		return lv_throwerror(v, _LC("stream expected"));
+	LVInteger size = self->Len();
+	if (dest->Write((void *)self->GetString(), size) != size)
+		return lv_throwerror(v, _LC("io error"));
+	self->Clear();
+	lv_pushinteger(v, size);
+	return 1;
+}
+
+static LVInteger _stringbuilder__tostring(VMHANDLE v) {
+	SETUP_STRINGBUILDER(v);
+	lv_pushstring(v, self->GetString(), self->GetStringLen());
+	return 1;
+}
+
+static LVInteger _stringbuilder__typeof(VMHANDLE v) {
+	lv_pushstring(v, _LC("stringbuilder"), -1);
+	return 1;
+}
+
+static LVInteger _stringbuilder_releasehook(LVUserPointer p, LVInteger LV_UNUSED_ARG(size)) {
+	LVStringBuilder *self = (LVStringBuilder *)p;
+	self->~LVStringBuilder();
+	lv_free(self, sizeof(LVStringBuilder));
+	return 1;
+}
+
+static LVInteger _stringbuilder_constructor(VMHANDLE v) {
+	LVInteger capacity = 0;
+	if (lv_gettop(v) == 2)
+		lv_getinteger(v, 2, &capacity);
+	if (capacity < 0)
+		return lv_throwerror(v, _LC("cannot create stringbuilder with negative capacity"));
+
+	LVStringBuilder *b = new(lv_malloc(sizeof(LVStringBuilder))) LVStringBuilder(capacity * sizeof(LVChar));
+	if (LV_FAILED(lv_setinstanceup(v, 1, b))) {
+		b->~LVStringBuilder();
+		lv_free(b, sizeof(LVStringBuilder));
+		return lv_throwerror(v, _LC("cannot create stringbuilder"));
+	}
+	lv_setreleasehook(v, 1, _stringbuilder_releasehook);
+	return 0;
+}
+
+#define _DECL_STRINGBUILDER_FUNC(name,nparams,typecheck) {_LC(#name),_stringbuilder_##name,nparams,typecheck}
+static const LVRegFunction _stringbuilder_methods[] = {
+	_DECL_STRINGBUILDER_FUNC(constructor, -1, _LC("xn")),
+	_DECL_STRINGBUILDER_FUNC(append, -1, _LC("x")),
+	_DECL_STRINGBUILDER_FUNC(appendf, -2, _LC("xs")),
+	_DECL_STRINGBUILDER_FUNC(join, -2, _LC("xas")),
+	_DECL_STRINGBUILDER_FUNC(clear, 1, _LC("x")),
+	_DECL_STRINGBUILDER_FUNC(flushto, 2, _LC("xx")),
+	_DECL_STRINGBUILDER_FUNC(_tostring, 1, _LC("x")),
+	_DECL_STRINGBUILDER_FUNC(_typeof, 1, _LC("x")),
+	{NULL, (LVFUNCTION)0, 0, NULL}
+};
+
+static const LVRegFunction _stringbuilder_funcs[] = {
+	{NULL, (LVFUNCTION)0, 0, NULL}
+};
+
+LVRESULT mod_init_stringbuilder(VMHANDLE v) {
+	return declare_stream(v, _LC("stringbuilder"), (LVUserPointer)STRINGBUILDER_TYPE_TAG, _LC("std_stringbuilder"), _stringbuilder_methods, _stringbuilder_funcs);
+}
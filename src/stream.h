@@ -23,6 +23,10 @@ LVInteger _stream_len(VMHANDLE v);
 LVInteger _stream_eos(VMHANDLE v);
 LVInteger _stream_flush(VMHANDLE v);
 
+/* Move a buffer from lv_malloc out of a blob and into a new one pushed on the stack, without copying */
+LVUserPointer blob_takebuffer(VMHANDLE v, LVInteger idx, LVInteger *size, LVInteger *allocated);
+LVRESULT blob_givebuffer(VMHANDLE v, LVUserPointer buf, LVInteger size, LVInteger allocated);
+
 #define _DECL_STREAM_FUNC(name,nparams,typecheck) {_LC(#name),_stream_##name,nparams,typecheck}
 LVRESULT declare_stream(VMHANDLE v, const LVChar *name, LVUserPointer typetag, const LVChar *reg_name, const LVRegFunction *methods, const LVRegFunction *globals);
 #endif // _STREAM_H_
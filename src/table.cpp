@@ -4,94 +4,235 @@
 #include "funcproto.h"
 #include "closure.h"
 
+#define _NODES_SIZE(n) ((n) * sizeof(_HashNode) + (n) + TABLE_GROUP)
+#define _SHAPE_SIZE(n) (sizeof(LVShape) + (n) * sizeof(LVObjectPtr))
+
+LVShape *LVShape::Create(LVShape *parent, LVInteger nkeys) {
+	LVShape *shape = (LVShape *)LV_MALLOC(_SHAPE_SIZE(nkeys));
+	shape->_root = parent ? parent->_root : shape;
+	shape->_parent = parent;
+	shape->_children = NULL;
+	shape->_next = NULL;
+	shape->_count = 1;
+	shape->_nkeys = nkeys;
+	shape->_keys = (LVObjectPtr *)&shape[1];
+	for (LVInteger i = 0; i < nkeys; i++)
+		new (&shape->_keys[i]) LVObjectPtr(parent && i < parent->_nkeys ? parent->_keys[i] : LVObjectPtr());
+	return shape;
+}
+
+LVShape *LVShape::AddKey(const LVObjectPtr& key) {
+	for (LVShape **c = &_children; *c; c = &(*c)->_next) {
+		LVShape *child = *c;
+		if (_rawval(child->_keys[_nkeys]) == _rawval(key)) {
+			//the last used transition is found first next time
+			*c = child->_next;
+			child->_next = _children;
+			_children = child;
+			return child;
+		}
+	}
+	if (_nkeys == SHAPE_MAXKEYS || _root->_count == SHAPE_MAXCOUNT)
+		return NULL;
+	LVShape *child = Create(this, _nkeys + 1);
+	child->_keys[_nkeys] = key;
+	child->_next = _children;
+	_children = child;
+	_root->_count++;
+	return child;
+}
+
+void LVShape::Release() {
+	while (_children) {
+		LVShape *child = _children;
+		_children = child->_next;
+		child->Release();
+	}
+	for (LVInteger i = 0; i < _nkeys; i++)
+		_keys[i].~LVObjectPtr();
+	LV_FREE(this, _SHAPE_SIZE(_nkeys));
+}
+
 LVTable::LVTable(LVSharedState *ss, LVInteger nInitialSize) {
 	LVInteger pow2size = MINPOWER2;
-	while (nInitialSize > pow2size)pow2size = pow2size << 1;
+	while (_MaxLoad(pow2size) < nInitialSize)pow2size = pow2size << 1;
 	AllocNodes(pow2size);
+	_shape = NULL;
+	_slots = NULL;
+	_holes = 0;
+	_delegate = NULL;
+	INIT_CHAIN();
+	ADD_TO_CHAIN(&_sharedstate->_gc_chain, this);
+}
+
+LVTable::LVTable(LVSharedState *ss, LVShape *shape, LVInteger nSlots) {
+	_ctrl = NULL;
+	_nodes = NULL;
+	_numofnodes = 0;
 	_usednodes = 0;
+	_growthleft = nSlots > 0 ? nSlots : 1;
+	_shape = shape;
+	_slots = (LVObjectPtr *)LV_MALLOC(_growthleft * sizeof(LVObjectPtr));
+	_holes = 0;
 	_delegate = NULL;
 	INIT_CHAIN();
 	ADD_TO_CHAIN(&_sharedstate->_gc_chain, this);
 }
 
+void LVTable::FreeSlots() {
+	for (LVInteger i = 0; i < _shape->_nkeys; i++)
+		_slots[i].~LVObjectPtr();
+	LV_FREE(_slots, (_shape->_nkeys + _growthleft) * sizeof(LVObjectPtr));
+}
+
+void LVTable::GrowSlots() {
+	LVInteger size = _shape->_nkeys + _growthleft;
+	//values are moved bitwise like the hash nodes
+	_slots = (LVObjectPtr *)LV_REALLOC(_slots, size * sizeof(LVObjectPtr), size * 2 * sizeof(LVObjectPtr));
+	_growthleft += size;
+}
+
+/* Turns a shaped table into a hash table, for keys the shape can't hold */
+void LVTable::Unshape() {
+	LVShape *shape = _shape;
+	LVObjectPtr *slots = _slots;
+	LVInteger n = shape->_nkeys, size = n + _growthleft, holes = _holes;
+	LVInteger pow2size = MINPOWER2;
+	while (_MaxLoad(pow2size) <= _usednodes)pow2size = pow2size << 1;
+	_shape = NULL;
+	_slots = NULL;
+	_holes = 0;
+	AllocNodes(pow2size);
+	for (LVInteger i = 0; i < n; i++) {
+		if (!((holes >> i) & 1))
+			NewSlot(shape->_keys[i], slots[i]);
+		slots[i].~LVObjectPtr();
+	}
+	LV_FREE(slots, size * sizeof(LVObjectPtr));
+}
+
 void LVTable::Remove(const LVObjectPtr& key) {
-	_HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+	if (_shape) {
+		LVInteger i = _shape->Find(key);
+		if (i < 0 || _IsHole(i))
+			return;
+		_usednodes--;
+		if (i < _shape->_nkeys - 1) {
+			/* Any other key leaves a hole, the keys after it stay where a
+			 * foreach over the table expects them */
+			LVObjectPtr val = _slots[i];
+			_slots[i].Null();
+			_holes |= (LVInteger)1 << i;
+			return;
+		}
+		//removing the last key goes back to the parent shape, with the holes before it
+		do {
+			LVObjectPtr val = _slots[i];
+			_shape = _shape->_parent;
+			_holes &= ~((LVInteger)1 << i);
+			_growthleft++;
+			_slots[i].~LVObjectPtr();
+			i--;
+		} while (i >= 0 && _IsHole(i));
+		return;
+	}
+	_HashNode *n = _Get(key);
 	if (n) {
-		n->val.Null();
-		n->key.Null();
+		LVInteger i = n - _nodes;
+		LVInteger mask = _numofnodes - 1;
+		/* The slot can only become empty again if no probe ever went past it,
+		 * that is when the group around it was never entirely full */
+		LVGroupMask before = _GroupMatchEmpty(&_ctrl[(i - TABLE_GROUP) & mask]);
+		LVGroupMask after = _GroupMatchEmpty(&_ctrl[i]);
+		if (_numofnodes < TABLE_GROUP
+		        || (before && after && (TABLE_GROUP - 1 - _GroupLast(before)) + _GroupFirst(after) < TABLE_GROUP)) {
+			_SetCtrl(i, CTRL_EMPTY);
+			_growthleft++;
+		} else {
+			_SetCtrl(i, CTRL_DELETED);
+		}
 		_usednodes--;
-		Rehash(false);
+		n->~_HashNode();
 	}
 }
 
 void LVTable::AllocNodes(LVInteger nSize) {
-	_HashNode *nodes = (_HashNode *)LV_MALLOC(sizeof(_HashNode) * nSize);
-	for (LVInteger i = 0; i < nSize; i++) {
-		_HashNode& n = nodes[i];
-		new (&n) _HashNode;
-		n.next = NULL;
-	}
+	_HashNode *nodes = (_HashNode *)LV_MALLOC(_NODES_SIZE(nSize));
 	_numofnodes = nSize;
 	_nodes = nodes;
-	_firstfree = &_nodes[_numofnodes - 1];
+	_ctrl = (unsigned char *)&nodes[nSize];
+	memset(_ctrl, CTRL_EMPTY, nSize + TABLE_GROUP);
+	_usednodes = 0;
+	_growthleft = _MaxLoad(nSize);
+}
+
+void LVTable::FreeNodes(_HashNode *nodes, LVInteger nSize) {
+	unsigned char *ctrl = (unsigned char *)&nodes[nSize];
+	for (LVInteger i = 0; i < nSize; i++) {
+		if (!(ctrl[i] & CTRL_EMPTY))
+			nodes[i].~_HashNode();
+	}
+	LV_FREE(nodes, _NODES_SIZE(nSize));
 }
 
-void LVTable::Rehash(bool force) {
+LVInteger LVTable::_FindFree(LVHash h) {
+	LVHash mask = (LVHash)_numofnodes - 1;
+	LVHash pos = h & mask;
+	for (LVHash stride = TABLE_GROUP; ; stride += TABLE_GROUP) {
+		LVGroupMask m = _GroupMatchFree(&_ctrl[pos]);
+		if (m)
+			return (LVInteger)((pos + _GroupFirst(m)) & mask);
+		pos = (pos + stride) & mask;
+	}
+}
+
+void LVTable::Rehash() {
 	LVInteger oldsize = _numofnodes;
-	//prevent problems with the integer division
-	if (oldsize < 4)oldsize = 4;
 	_HashNode *nold = _nodes;
+	unsigned char *cold = _ctrl;
 	LVInteger nelems = CountUsed();
-	if (nelems >= oldsize - oldsize / 4) /* using more than 3/4? */
-		AllocNodes(oldsize * 2);
-	else if (nelems <= oldsize / 4 && /* less than 1/4? */
-	         oldsize > MINPOWER2)
-		AllocNodes(oldsize / 2);
-	else if (force)
-		AllocNodes(oldsize);
+	/* grow when more than half of the load is live, otherwise only the deleted
+	 * slots are reclaimed, or the table shrinks when it became mostly empty */
+	LVInteger newsize = oldsize;
+	if (nelems >= _MaxLoad(oldsize) / 2)
+		newsize = oldsize * 2;
 	else
-		return;
-	_usednodes = 0;
+		while (newsize > MINPOWER2 && nelems <= newsize / 4)
+			newsize >>= 1;
+	AllocNodes(newsize);
+	//nodes are moved bitwise, the references they hold stay the same
 	for (LVInteger i = 0; i < oldsize; i++) {
-		_HashNode *old = nold + i;
-		if (type(old->key) != OT_NULL)
-			NewSlot(old->key, old->val);
+		if (!(cold[i] & CTRL_EMPTY)) {
+			LVHash h = HashObj(nold[i].key);
+			LVInteger k = _FindFree(h);
+			_SetCtrl(k, _ctrltag(h));
+			memcpy((void *)&_nodes[k], (void *)&nold[i], sizeof(_HashNode));
+		}
 	}
-	for (LVInteger k = 0; k < oldsize; k++)
-		nold[k].~_HashNode();
-	LV_FREE(nold, oldsize * sizeof(_HashNode));
+	_usednodes = nelems;
+	_growthleft -= nelems;
+	LV_FREE(nold, _NODES_SIZE(oldsize));
 }
 
 LVTable *LVTable::Clone() {
-	LVTable *nt = Create(_opt_ss(this), _numofnodes);
-#ifdef _FAST_CLONE
-	_HashNode *basesrc = _nodes;
-	_HashNode *basedst = nt->_nodes;
-	_HashNode *src = _nodes;
-	_HashNode *dst = nt->_nodes;
-	LVInteger n = 0;
-	for (n = 0; n < _numofnodes; n++) {
-		dst->key = src->key;
-		dst->val = src->val;
-		if (src->next) {
-			assert(src->next > basesrc);
-			dst->next = basedst + (src->next - basesrc);
-			assert(dst != dst->next);
-		}
-		dst++;
-		src++;
+	if (_shape) {
+		LVTable *nt = Create(_opt_ss(this), _shape, _shape->_nkeys);
+		for (LVInteger i = 0; i < _shape->_nkeys; i++)
+			new (&nt->_slots[i]) LVObjectPtr(_slots[i]);
+		nt->_usednodes = _usednodes;
+		nt->_growthleft -= _shape->_nkeys;
+		nt->_holes = _holes;
+		nt->SetDelegate(_delegate);
+		return nt;
 	}
-	assert(_firstfree > basesrc);
-	assert(_firstfree != NULL);
-	nt->_firstfree = basedst + (_firstfree - basesrc);
-	nt->_usednodes = _usednodes;
-#else
-	LVInteger ridx = 0;
-	LVObjectPtr key, val;
-	while ((ridx = Next(true, ridx, key, val)) != -1) {
-		nt->NewSlot(key, val);
+	LVTable *nt = Create(_opt_ss(this), _MaxLoad(_numofnodes));
+	memcpy(nt->_ctrl, _ctrl, _numofnodes + TABLE_GROUP);
+	for (LVInteger i = 0; i < _numofnodes; i++) {
+		if (!(_ctrl[i] & CTRL_EMPTY))
+			new (&nt->_nodes[i]) _HashNode(_nodes[i].key, _nodes[i].val);
 	}
-#endif
+	nt->_usednodes = _usednodes;
+	nt->_growthleft = _growthleft;
 	nt->SetDelegate(_delegate);
 	return nt;
 }
@@ -99,7 +240,15 @@ LVTable *LVTable::Clone() {
 bool LVTable::Get(const LVObjectPtr& key, LVObjectPtr& val) {
 	if (type(key) == OT_NULL)
 		return false;
-	_HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+	if (_shape) {
+		LVInteger i = _shape->Find(key);
+		if (i >= 0 && !_IsHole(i)) {
+			val = _realval(_slots[i]);
+			return true;
+		}
+		return false;
+	}
+	_HashNode *n = _Get(key);
 	if (n) {
 		val = _realval(n->val);
 		return true;
@@ -109,62 +258,65 @@ bool LVTable::Get(const LVObjectPtr& key, LVObjectPtr& val) {
 
 bool LVTable::NewSlot(const LVObjectPtr& key, const LVObjectPtr& val) {
 	assert(type(key) != OT_NULL);
-	LVHash h = HashObj(key) & (_numofnodes - 1);
-	_HashNode *n = _Get(key, h);
+	if (_shape) {
+		LVInteger i = _shape->Find(key);
+		if (i >= 0) {
+			_slots[i] = val;
+			if (!_IsHole(i))
+				return false;
+			//a removed key is back in its old slot
+			_holes &= ~((LVInteger)1 << i);
+			_usednodes++;
+			return true;
+		}
+		//a new key after a removed one does not keep the shape
+		LVShape *next = type(key) == OT_STRING && !_holes ? _shape->AddKey(key) : NULL;
+		if (next) {
+			if (_growthleft == 0)
+				GrowSlots();
+			new (&_slots[_shape->_nkeys]) LVObjectPtr(val);
+			_usednodes++;
+			_growthleft--;
+			_shape = next;
+			return true;
+		}
+		Unshape();
+	}
+	_HashNode *n = _Get(key);
 	if (n) {
 		n->val = val;
 		return false;
 	}
-	_HashNode *mp = &_nodes[h];
-	n = mp;
-
-
-	//key not found I'll insert it
-	//main pos is not free
-
-	if (type(mp->key) != OT_NULL) {
-		n = _firstfree;  /* get a free place */
-		LVHash mph = HashObj(mp->key) & (_numofnodes - 1);
-		_HashNode *othern;  /* main position of colliding node */
-
-		if (mp > n && (othern = &_nodes[mph]) != mp) {
-			/* yes; move colliding node into free position */
-			while (othern->next != mp) {
-				assert(othern->next != NULL);
-				othern = othern->next;  /* find previous */
-			}
-			othern->next = n;  /* redo the chain with `n' in place of `mp' */
-			n->key = mp->key;
-			n->val = mp->val;/* copy colliding node into free pos. (mp->next also goes) */
-			n->next = mp->next;
-			mp->key.Null();
-			mp->val.Null();
-			mp->next = NULL;  /* now `mp' is free */
-		} else {
-			/* new node will go into free position */
-			n->next = mp->next;  /* chain new position */
-			mp->next = n;
-			mp = n;
-		}
-	}
-	mp->key = key;
 
-	for (;;) {  /* correct `firstfree' */
-		if (type(_firstfree->key) == OT_NULL && _firstfree->next == NULL) {
-			mp->val = val;
-			_usednodes++;
-			return true;  /* OK; table still has a free place */
-		} else if (_firstfree == _nodes) break; /* cannot decrement from here */
-		else (_firstfree)--;
+	//key not found, take the first free slot on its probe sequence
+	LVHash h = HashObj(key);
+	LVInteger i = _FindFree(h);
+	if (_growthleft == 0 && _ctrl[i] == CTRL_EMPTY) {
+		Rehash();
+		i = _FindFree(h);
 	}
-	Rehash(true);
-	return NewSlot(key, val);
+	if (_ctrl[i] == CTRL_EMPTY)
+		_growthleft--;
+	_SetCtrl(i, _ctrltag(h));
+	new (&_nodes[i]) _HashNode(key, val);
+	_usednodes++;
+	return true;
 }
 
 LVInteger LVTable::Next(bool getweakrefs, const LVObjectPtr& refpos, LVObjectPtr& outkey, LVObjectPtr& outval) {
 	LVInteger idx = (LVInteger)TranslateIndex(refpos);
+	if (_shape) {
+		while (idx < _shape->_nkeys && _IsHole(idx))
+			++idx;
+		if (idx < _shape->_nkeys) {
+			outkey = _shape->_keys[idx];
+			outval = getweakrefs ? (LVObject)_slots[idx] : _realval(_slots[idx]);
+			return ++idx;
+		}
+		return -1;
+	}
 	while (idx < _numofnodes) {
-		if (type(_nodes[idx].key) != OT_NULL) {
+		if (!(_ctrl[idx] & CTRL_EMPTY)) {
 			//first found
 			_HashNode& n = _nodes[idx];
 			outkey = n.key;
@@ -180,7 +332,15 @@ LVInteger LVTable::Next(bool getweakrefs, const LVObjectPtr& refpos, LVObjectPtr
 
 
 bool LVTable::Set(const LVObjectPtr& key, const LVObjectPtr& val) {
-	_HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+	if (_shape) {
+		LVInteger i = _shape->Find(key);
+		if (i >= 0 && !_IsHole(i)) {
+			_slots[i] = val;
+			return true;
+		}
+		return false;
+	}
+	_HashNode *n = _Get(key);
 	if (n) {
 		n->val = val;
 		return true;
@@ -189,10 +349,30 @@ bool LVTable::Set(const LVObjectPtr& key, const LVObjectPtr& val) {
 }
 
 void LVTable::_ClearNodes() {
+	if (_shape) {
+		while (_shape->_nkeys > 0) {
+			LVInteger i = _shape->_nkeys - 1;
+			LVObjectPtr val = _slots[i];
+			_shape = _shape->_parent;
+			_growthleft++;
+			_slots[i].~LVObjectPtr();
+		}
+		_usednodes = 0;
+		_holes = 0;
+		return;
+	}
 	for (LVInteger i = 0; i < _numofnodes; i++) {
-		_HashNode& n = _nodes[i];
-		n.key.Null();
-		n.val.Null();
+		if (!(_ctrl[i] & CTRL_EMPTY)) {
+			//keep the references alive until the slot is released
+			LVObjectPtr key = _nodes[i].key, val = _nodes[i].val;
+			_SetCtrl(i, CTRL_DELETED);
+			_usednodes--;
+			_nodes[i].~_HashNode();
+		}
+	}
+	if (_usednodes == 0) {
+		memset(_ctrl, CTRL_EMPTY, _numofnodes + TABLE_GROUP);
+		_growthleft = _MaxLoad(_numofnodes);
 	}
 }
 
@@ -203,6 +383,8 @@ void LVTable::Finalize() {
 
 void LVTable::Clear() {
 	_ClearNodes();
-	_usednodes = 0;
-	Rehash(true);
+	if (_usednodes == 0 && !_shape && _numofnodes > MINPOWER2) {
+		LV_FREE(_nodes, _NODES_SIZE(_numofnodes));
+		AllocNodes(MINPOWER2);
+	}
 }
@@ -3,6 +3,10 @@
 
 #include "lvstring.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define hashptr(p)  ((LVHash)(((LVInteger)p) >> 3))
 
 inline LVHash HashObj(const LVObjectPtr& key) {
@@ -15,31 +19,160 @@ inline LVHash HashObj(const LVObjectPtr& key) {
 		case OT_INTEGER:
 			return (LVHash)((LVInteger)_integer(key));
 		default:
-			return hashptr(key._unVal.pRefCounted);
+			return hashptr(_refcounted(key));
+	}
+}
+
+/* Mixes the object hash so both the slot position and the tag bits are usable */
+#ifdef _LV64
+#define _mixhash(h) ((LVHash)(h) * 0x9E3779B97F4A7C15ULL)
+#else
+#define _mixhash(h) ((LVHash)(h) * 0x9E3779B9U)
+#endif
+
+/*
+ * Control bytes of the open addressing table. A used slot holds the top 7 bits
+ * of its mixed hash, free slots have the high bit set.
+ */
+#define TABLE_GROUP 16
+#define CTRL_EMPTY ((unsigned char)0x80)
+#define CTRL_DELETED ((unsigned char)0xFE)
+#define _ctrltag(h) ((unsigned char)(_mixhash(h) >> (sizeof(LVHash) * 8 - 7)))
+
+typedef unsigned int LVGroupMask;
+
+#ifdef __SSE2__
+inline LVGroupMask _GroupMatch(const unsigned char *g, unsigned char tag) {
+	__m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+	return (LVGroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)tag), ctrl));
+}
+
+inline LVGroupMask _GroupMatchFree(const unsigned char *g) {
+	return (LVGroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+#else
+inline LVGroupMask _GroupMatch(const unsigned char *g, unsigned char tag) {
+	LVGroupMask m = 0;
+	for (int i = 0; i < TABLE_GROUP; i++)
+		m |= (LVGroupMask)(g[i] == tag) << i;
+	return m;
+}
+
+inline LVGroupMask _GroupMatchFree(const unsigned char *g) {
+	LVGroupMask m = 0;
+	for (int i = 0; i < TABLE_GROUP; i++)
+		m |= (LVGroupMask)(g[i] >> 7) << i;
+	return m;
+}
+#endif // __SSE2__
+
+#define _GroupMatchEmpty(g) _GroupMatch(g, CTRL_EMPTY)
+
+inline int _GroupFirst(LVGroupMask m) {
+#ifdef __GNUC__
+	return __builtin_ctz(m);
+#else
+	int i = 0;
+	while (!(m & 1)) {
+		m >>= 1;
+		i++;
 	}
+	return i;
+#endif
 }
 
+inline int _GroupLast(LVGroupMask m) {
+#ifdef __GNUC__
+	return 31 - __builtin_clz(m);
+#else
+	int i = 0;
+	while (m >>= 1)
+		i++;
+	return i;
+#endif
+}
+
+/* Max number of keys of a shaped table, and of shapes in a shared state */
+#define SHAPE_MAXKEYS 16
+#define SHAPE_MAXCOUNT 4096
+
+/*
+ * Key layout shared by tables built from literals with constant string keys.
+ * Shapes form a transition tree rooted in the shared state, every child has
+ * the keys of its parent plus one. Shapes are never collected, the tree is
+ * released together with the shared state.
+ */
+struct LVShape {
+	static LVShape *Create(LVShape *parent, LVInteger nkeys);
+	//returns NULL when no further shape can be created
+	LVShape *AddKey(const LVObjectPtr& key);
+	void Release();
+
+	//keys are interned strings, so comparing the pointers is enough
+	inline LVInteger Find(const LVObjectPtr& key) {
+		if (type(key) != OT_STRING)
+			return -1;
+		for (LVInteger i = 0; i < _nkeys; i++) {
+			if (_rawval(_keys[i]) == _rawval(key))
+				return i;
+		}
+		return -1;
+	}
+
+	LVShape *_root;
+	LVShape *_parent;
+	LVShape *_children;
+	LVShape *_next;
+	LVInteger _count;
+	LVInteger _nkeys;
+	LVObjectPtr *_keys;
+};
+
 struct LVTable : public LVDelegable {
+	friend struct LVStateCopy;
   private:
+	//only the nodes of used slots are constructed
 	struct _HashNode {
-		_HashNode() {
-			next = NULL;
-		}
+		_HashNode(const LVObjectPtr& k, const LVObjectPtr& v): val(v), key(k) {}
 		LVObjectPtr val;
 		LVObjectPtr key;
-		_HashNode *next;
 	};
 
-	_HashNode *_firstfree;
+	unsigned char *_ctrl;
 	_HashNode *_nodes;
 	LVInteger _numofnodes;
 	LVInteger _usednodes;
+	LVInteger _growthleft;
+	//a shaped table keeps its values in _slots, in the key order of _shape
+	LVShape *_shape;
+	LVObjectPtr *_slots;
+	//slots of removed keys, kept so a foreach over the table keeps its place
+	LVInteger _holes;
 
 	///////////////////////////
 	void AllocNodes(LVInteger nSize);
-	void Rehash(bool force);
+	void FreeNodes(_HashNode *nodes, LVInteger nSize);
+	void Rehash();
 	LVTable(LVSharedState *ss, LVInteger nInitialSize);
+	LVTable(LVSharedState *ss, LVShape *shape, LVInteger nSlots);
 	void _ClearNodes();
+	void FreeSlots();
+	void GrowSlots();
+	void Unshape();
+	inline bool _IsHole(LVInteger i) {
+		return (_holes >> i) & 1;
+	}
+
+	//a table of n slots keeps at least one empty slot, which ends every probe
+	static LVInteger _MaxLoad(LVInteger n) {
+		return n - (n / 8 > 0 ? n / 8 : 1);
+	}
+	//control bytes past the last slot mirror the first ones, so a group never wraps
+	inline void _SetCtrl(LVInteger i, unsigned char c) {
+		for (LVInteger j = i; j < _numofnodes + TABLE_GROUP; j += _numofnodes)
+			_ctrl[j] = c;
+	}
+	LVInteger _FindFree(LVHash h);
 
   public:
 	static LVTable *Create(LVSharedState *ss, LVInteger nInitialSize) {
@@ -48,14 +181,21 @@ struct LVTable : public LVDelegable {
 		newtable->_delegate = NULL;
 		return newtable;
 	}
+	static LVTable *Create(LVSharedState *ss, LVShape *shape, LVInteger nSlots) {
+		LVTable *newtable = (LVTable *)LV_MALLOC(sizeof(LVTable));
+		new (newtable) LVTable(ss, shape, nSlots);
+		newtable->_delegate = NULL;
+		return newtable;
+	}
 	void Finalize();
 	LVTable *Clone();
 	~LVTable() {
 		SetDelegate(NULL);
 		REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
-		for (LVInteger i = 0; i < _numofnodes; i++)
-			_nodes[i].~_HashNode();
-		LV_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+		if (_shape)
+			FreeSlots();
+		else
+			FreeNodes(_nodes, _numofnodes);
 	}
 #ifndef NO_GARBAGE_COLLECTOR
 	void Mark(LVCollectable **chain);
@@ -63,31 +203,87 @@ struct LVTable : public LVDelegable {
 		return OT_TABLE;
 	}
 #endif
-	inline _HashNode *_Get(const LVObjectPtr& key, LVHash hash) {
-		_HashNode *n = &_nodes[hash];
-		do {
+	inline _HashNode *_Get(const LVObjectPtr& key) {
+		LVHash h = HashObj(key);
+		LVHash mask = (LVHash)_numofnodes - 1;
+		LVHash pos = h & mask;
+		//most keys sit in their home slot
+		if (!(_ctrl[pos] & CTRL_EMPTY)) {
+			_HashNode *n = &_nodes[pos];
 			if (_rawval(n->key) == _rawval(key) && type(n->key) == type(key)) {
 				return n;
 			}
-		} while ((n = n->next));
-		return NULL;
+		}
+		unsigned char tag = _ctrltag(h);
+		for (LVHash stride = TABLE_GROUP; ; stride += TABLE_GROUP) {
+			const unsigned char *g = &_ctrl[pos];
+			for (LVGroupMask m = _GroupMatch(g, tag); m; m &= m - 1) {
+				_HashNode *n = &_nodes[(pos + _GroupFirst(m)) & mask];
+				if (_rawval(n->key) == _rawval(key) && type(n->key) == type(key)) {
+					return n;
+				}
+			}
+			if (_GroupMatchEmpty(g))
+				return NULL;
+			pos = (pos + stride) & mask;
+		}
+	}
+	//for compiler use, seed is the string hash seed of the shared state
+	inline bool GetStr(const LVChar *key, LVInteger keylen, LVHash seed, LVObjectPtr& val) {
+		if (_shape) {
+			for (LVInteger i = 0; i < _shape->_nkeys; i++) {
+				if (!_IsHole(i) && scstrcmp(_stringval(_shape->_keys[i]), key) == 0) {
+					val = _realval(_slots[i]);
+					return true;
+				}
+			}
+			return false;
+		}
+		LVHash h = _hashstr(key, keylen, seed);
+		unsigned char tag = _ctrltag(h);
+		LVHash mask = (LVHash)_numofnodes - 1;
+		LVHash pos = h & mask;
+		for (LVHash stride = TABLE_GROUP; ; stride += TABLE_GROUP) {
+			const unsigned char *g = &_ctrl[pos];
+			for (LVGroupMask m = _GroupMatch(g, tag); m; m &= m - 1) {
+				_HashNode *n = &_nodes[(pos + _GroupFirst(m)) & mask];
+				if (type(n->key) == OT_STRING && (scstrcmp(_stringval(n->key), key) == 0)) {
+					val = _realval(n->val);
+					return true;
+				}
+			}
+			if (_GroupMatchEmpty(g))
+				return false;
+			pos = (pos + stride) & mask;
+		}
 	}
-	//for compiler use
-	inline bool GetStr(const LVChar *key, LVInteger keylen, LVObjectPtr& val) {
-		LVHash hash = _hashstr(key, keylen);
-		_HashNode *n = &_nodes[hash & (_numofnodes - 1)];
-		_HashNode *res = NULL;
-		do {
-			if (type(n->key) == OT_STRING && (scstrcmp(_stringval(n->key), key) == 0)) {
-				res = n;
-				break;
+	//for inline caches, slot holds the node or value index of the last hit
+	inline LVObjectPtr *GetCached(const LVObjectPtr& key, LVInt32& slot) {
+		if (type(key) == OT_NULL)
+			return NULL;
+		if (_shape) {
+			//a hit holds for every shape with the key at the same index
+			if (slot < _shape->_nkeys && _rawval(_shape->_keys[slot]) == _rawval(key) && type(key) == OT_STRING)
+				return _IsHole(slot) ? NULL : &_slots[slot];
+			LVInteger i = _shape->Find(key);
+			if (i >= 0 && !_IsHole(i)) {
+				slot = (LVInt32)i;
+				return &_slots[i];
+			}
+			return NULL;
+		}
+		if (slot < _numofnodes && !(_ctrl[slot] & CTRL_EMPTY)) {
+			_HashNode *n = &_nodes[slot];
+			if (_rawval(n->key) == _rawval(key) && type(n->key) == type(key)) {
+				return &n->val;
 			}
-		} while ((n = n->next));
-		if (res) {
-			val = _realval(res->val);
-			return true;
 		}
-		return false;
+		_HashNode *n = _Get(key);
+		if (n) {
+			slot = (LVInt32)(n - _nodes);
+			return &n->val;
+		}
+		return NULL;
 	}
 	bool Get(const LVObjectPtr& key, LVObjectPtr& val);
 	void Remove(const LVObjectPtr& key);
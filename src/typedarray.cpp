@@ -0,0 +1,710 @@
+#include "pcheader.h"
+#include "stream.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TYPEDARRAY_TYPE_TAG 0x40000000
+#define INTARRAY_TYPE_TAG (TYPEDARRAY_TYPE_TAG | 0x00000001)
+#define FLOATARRAY_TYPE_TAG (TYPEDARRAY_TYPE_TAG | 0x00000002)
+#define BYTEARRAY_TYPE_TAG (TYPEDARRAY_TYPE_TAG | 0x00000003)
+
+/* Elements allocated for an empty typed array */
+#define TYPEDARRAY_MINSIZE 4
+
+typedef long long LVInt64Elem;
+typedef double LVFloat64Elem;
+typedef unsigned char LVByteElem;
+
+/*
+ * How a script value becomes an element and back. Floats are stored as 64
+ * bits whatever LVFloat is, so sums and dot products keep their precision.
+ */
+template<typename T> struct LVElem;
+
+template<> struct LVElem<LVInt64Elem> {
+	//sums and dot products
+	typedef LVInt64Elem Acc;
+	static const bool Float = false;
+	static const LVChar *Name() { return _LC("intarray"); }
+	static LVUserPointer Tag() { return (LVUserPointer)INTARRAY_TYPE_TAG; }
+	static bool Get(VMHANDLE v, LVInteger idx, LVInt64Elem& e) {
+		LVInteger i;
+		if (LV_FAILED(lv_getinteger(v, idx, &i)))
+			return false;
+		e = i;
+		return true;
+	}
+	static void Push(VMHANDLE v, LVInt64Elem e) { lv_pushinteger(v, (LVInteger)e); }
+	static void PushAcc(VMHANDLE v, Acc a) { lv_pushinteger(v, (LVInteger)a); }
+};
+
+template<> struct LVElem<LVFloat64Elem> {
+	typedef LVFloat64Elem Acc;
+	static const bool Float = true;
+	static const LVChar *Name() { return _LC("floatarray"); }
+	static LVUserPointer Tag() { return (LVUserPointer)FLOATARRAY_TYPE_TAG; }
+	static bool Get(VMHANDLE v, LVInteger idx, LVFloat64Elem& e) {
+		LVFloat f;
+		if (LV_FAILED(lv_getfloat(v, idx, &f)))
+			return false;
+		e = f;
+		return true;
+	}
+	static void Push(VMHANDLE v, LVFloat64Elem e) { lv_pushfloat(v, (LVFloat)e); }
+	static void PushAcc(VMHANDLE v, Acc a) { lv_pushfloat(v, (LVFloat)a); }
+};
+
+template<> struct LVElem<LVByteElem> {
+	typedef LVInt64Elem Acc;
+	static const bool Float = false;
+	static const LVChar *Name() { return _LC("bytearray"); }
+	static LVUserPointer Tag() { return (LVUserPointer)BYTEARRAY_TYPE_TAG; }
+	//wraps around as blob indexing does
+	static bool Get(VMHANDLE v, LVInteger idx, LVByteElem& e) {
+		LVInteger i;
+		if (LV_FAILED(lv_getinteger(v, idx, &i)))
+			return false;
+		e = (LVByteElem)i;
+		return true;
+	}
+	static void Push(VMHANDLE v, LVByteElem e) { lv_pushinteger(v, e); }
+	static void PushAcc(VMHANDLE v, Acc a) { lv_pushinteger(v, (LVInteger)a); }
+};
+
+/* Elements stored back to back in a buffer from lv_malloc, so a blob can take it over */
+template<typename T> struct LVTypedArray {
+	LVTypedArray(LVInteger size) {
+		_allocated = (size > TYPEDARRAY_MINSIZE ? size : TYPEDARRAY_MINSIZE) * sizeof(T);
+		_vals = (T *)lv_malloc(_allocated);
+		memset(_vals, 0, size * sizeof(T));
+		_size = size;
+	}
+	LVTypedArray(LVUserPointer vals, LVInteger size, LVInteger allocated) {
+		_vals = (T *)vals;
+		_size = size;
+		_allocated = allocated;
+	}
+	~LVTypedArray() {
+		lv_free(_vals, _allocated);
+	}
+	void Reserve(LVInteger n) {
+		if (n * (LVInteger)sizeof(T) <= _allocated)
+			return;
+		LVInteger newsize = n * sizeof(T);
+		if (newsize < _allocated * 2)
+			newsize = _allocated * 2;
+		_vals = (T *)lv_realloc(_vals, _allocated, newsize);
+		_allocated = newsize;
+	}
+	void Resize(LVInteger n) {
+		Reserve(n);
+		if (n > _size)
+			memset(&_vals[_size], 0, (n - _size) * sizeof(T));
+		_size = n;
+	}
+	void Push(T e) {
+		Reserve(_size + 1);
+		_vals[_size++] = e;
+	}
+	T *_vals;
+	LVInteger _size;
+	LVInteger _allocated; //bytes
+};
+
+/*
+ * Bulk kernels. The generic loops serve every element type, the SSE2
+ * overloads take over where SSE2 has the instructions: 64 bit integers have
+ * no packed compare or multiply there, so min, max and dot stay scalar.
+ */
+template<typename T, typename A> static A _ta_sum(const T *p, LVInteger n) {
+	A s = 0;
+	for (LVInteger i = 0; i < n; i++)
+		s += p[i];
+	return s;
+}
+
+template<typename T> static T _ta_min(const T *p, LVInteger n) {
+	T m = p[0];
+	for (LVInteger i = 1; i < n; i++)
+		if (p[i] < m)
+			m = p[i];
+	return m;
+}
+
+template<typename T> static T _ta_max(const T *p, LVInteger n) {
+	T m = p[0];
+	for (LVInteger i = 1; i < n; i++)
+		if (p[i] > m)
+			m = p[i];
+	return m;
+}
+
+template<typename T, typename A> static A _ta_dot(const T *a, const T *b, LVInteger n) {
+	A s = 0;
+	for (LVInteger i = 0; i < n; i++)
+		s += (A)a[i] * b[i];
+	return s;
+}
+
+template<typename T> static void _ta_add(T *dst, const T *src, LVInteger n) {
+	for (LVInteger i = 0; i < n; i++)
+		dst[i] += src[i];
+}
+
+template<typename T> static void _ta_addscalar(T *dst, T k, LVInteger n) {
+	for (LVInteger i = 0; i < n; i++)
+		dst[i] += k;
+}
+
+template<typename T, typename K> static void _ta_scale(T *dst, K k, LVInteger n) {
+	for (LVInteger i = 0; i < n; i++)
+		dst[i] = (T)(dst[i] * k);
+}
+
+template<typename T> static LVInteger _ta_find(const T *p, T e, LVInteger n) {
+	for (LVInteger i = 0; i < n; i++)
+		if (p[i] == e)
+			return i;
+	return -1;
+}
+
+//NaN sorts after every number, a plain < is no strict weak ordering with NaN
+static bool _ta_less(LVFloat64Elem a, LVFloat64Elem b) {
+	return a < b || (b != b && a == a);
+}
+
+template<typename T> static void _ta_sort(T *p, LVInteger n) {
+	std::sort(p, p + n);
+}
+
+template<> void _ta_sort(LVFloat64Elem *p, LVInteger n) {
+	std::sort(p, p + n, _ta_less);
+}
+
+template<> LVInteger _ta_find(const LVByteElem *p, LVByteElem e, LVInteger n) {
+	const LVByteElem *r = (const LVByteElem *)memchr(p, e, n);
+	return r ? r - p : -1;
+}
+
+#ifdef __SSE2__
+template<> LVFloat64Elem _ta_sum<LVFloat64Elem, LVFloat64Elem>(const LVFloat64Elem *p, LVInteger n) {
+	__m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+	LVInteger i = 0;
+	for (; i + 4 <= n; i += 4) {
+		a0 = _mm_add_pd(a0, _mm_loadu_pd(p + i));
+		a1 = _mm_add_pd(a1, _mm_loadu_pd(p + i + 2));
+	}
+	double t[2];
+	_mm_storeu_pd(t, _mm_add_pd(a0, a1));
+	double s = t[0] + t[1];
+	for (; i < n; i++)
+		s += p[i];
+	return s;
+}
+
+template<> LVInt64Elem _ta_sum<LVInt64Elem, LVInt64Elem>(const LVInt64Elem *p, LVInteger n) {
+	__m128i a0 = _mm_setzero_si128(), a1 = _mm_setzero_si128();
+	LVInteger i = 0;
+	for (; i + 4 <= n; i += 4) {
+		a0 = _mm_add_epi64(a0, _mm_loadu_si128((const __m128i *)(p + i)));
+		a1 = _mm_add_epi64(a1, _mm_loadu_si128((const __m128i *)(p + i + 2)));
+	}
+	LVInt64Elem t[2];
+	_mm_storeu_si128((__m128i *)t, _mm_add_epi64(a0, a1));
+	LVInt64Elem s = t[0] + t[1];
+	for (; i < n; i++)
+		s += p[i];
+	return s;
+}
+
+//psadbw against zero adds 8 bytes into each 64 bit lane
+template<> LVInt64Elem _ta_sum<LVByteElem, LVInt64Elem>(const LVByteElem *p, LVInteger n) {
+	__m128i a = _mm_setzero_si128(), zero = _mm_setzero_si128();
+	LVInteger i = 0;
+	for (; i + 16 <= n; i += 16)
+		a = _mm_add_epi64(a, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + i)), zero));
+	LVInt64Elem t[2];
+	_mm_storeu_si128((__m128i *)t, a);
+	LVInt64Elem s = t[0] + t[1];
+	for (; i < n; i++)
+		s += p[i];
+	return s;
+}
+
+template<> LVFloat64Elem _ta_min(const LVFloat64Elem *p, LVInteger n) {
+	LVInteger i = 0;
+	double m = p[0];
+	if (n >= 2) {
+		__m128d a = _mm_loadu_pd(p);
+		for (i = 2; i + 2 <= n; i += 2)
+			a = _mm_min_pd(a, _mm_loadu_pd(p + i));
+		double t[2];
+		_mm_storeu_pd(t, a);
+		m = t[0] < t[1] ? t[0] : t[1];
+	}
+	for (; i < n; i++)
+		if (p[i] < m)
+			m = p[i];
+	return m;
+}
+
+template<> LVFloat64Elem _ta_max(const LVFloat64Elem *p, LVInteger n) {
+	LVInteger i = 0;
+	double m = p[0];
+	if (n >= 2) {
+		__m128d a = _mm_loadu_pd(p);
+		for (i = 2; i + 2 <= n; i += 2)
+			a = _mm_max_pd(a, _mm_loadu_pd(p + i));
+		double t[2];
+		_mm_storeu_pd(t, a);
+		m = t[0] > t[1] ? t[0] : t[1];
+	}
+	for (; i < n; i++)
+		if (p[i] > m)
+			m = p[i];
+	return m;
+}
+
+template<> LVByteElem _ta_min(const LVByteElem *p, LVInteger n) {
+	LVInteger i = 0;
+	LVByteElem m = p[0];
+	if (n >= 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)p);
+		for (i = 16; i + 16 <= n; i += 16)
+			a = _mm_min_epu8(a, _mm_loadu_si128((const __m128i *)(p + i)));
+		LVByteElem t[16];
+		_mm_storeu_si128((__m128i *)t, a);
+		m = t[0];
+		for (int j = 1; j < 16; j++)
+			if (t[j] < m)
+				m = t[j];
+	}
+	for (; i < n; i++)
+		if (p[i] < m)
+			m = p[i];
+	return m;
+}
+
+template<> LVByteElem _ta_max(const LVByteElem *p, LVInteger n) {
+	LVInteger i = 0;
+	LVByteElem m = p[0];
+	if (n >= 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)p);
+		for (i = 16; i + 16 <= n; i += 16)
+			a = _mm_max_epu8(a, _mm_loadu_si128((const __m128i *)(p + i)));
+		LVByteElem t[16];
+		_mm_storeu_si128((__m128i *)t, a);
+		m = t[0];
+		for (int j = 1; j < 16; j++)
+			if (t[j] > m)
+				m = t[j];
+	}
+	for (; i < n; i++)
+		if (p[i] > m)
+			m = p[i];
+	return m;
+}
+
+template<> LVFloat64Elem _ta_dot<LVFloat64Elem, LVFloat64Elem>(const LVFloat64Elem *a, const LVFloat64Elem *b, LVInteger n) {
+	__m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+	LVInteger i = 0;
+	for (; i + 4 <= n; i += 4) {
+		a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+	}
+	double t[2];
+	_mm_storeu_pd(t, _mm_add_pd(a0, a1));
+	double s = t[0] + t[1];
+	for (; i < n; i++)
+		s += a[i] * b[i];
+	return s;
+}
+
+template<> void _ta_add(LVFloat64Elem *dst, const LVFloat64Elem *src, LVInteger n) {
+	LVInteger i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+	for (; i < n; i++)
+		dst[i] += src[i];
+}
+
+template<> void _ta_add(LVInt64Elem *dst, const LVInt64Elem *src, LVInteger n) {
+	LVInteger i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi64(_mm_loadu_si128((const __m128i *)(dst + i)), _mm_loadu_si128((const __m128i *)(src + i))));
+	for (; i < n; i++)
+		dst[i] += src[i];
+}
+
+template<> void _ta_add(LVByteElem *dst, const LVByteElem *src, LVInteger n) {
+	LVInteger i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(_mm_loadu_si128((const __m128i *)(dst + i)), _mm_loadu_si128((const __m128i *)(src + i))));
+	for (; i < n; i++)
+		dst[i] += src[i];
+}
+
+template<> void _ta_addscalar(LVFloat64Elem *dst, LVFloat64Elem k, LVInteger n) {
+	__m128d vk = _mm_set1_pd(k);
+	LVInteger i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), vk));
+	for (; i < n; i++)
+		dst[i] += k;
+}
+
+template<> void _ta_addscalar(LVInt64Elem *dst, LVInt64Elem k, LVInteger n) {
+	__m128i vk = _mm_set1_epi64x(k);
+	LVInteger i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi64(_mm_loadu_si128((const __m128i *)(dst + i)), vk));
+	for (; i < n; i++)
+		dst[i] += k;
+}
+
+template<> void _ta_addscalar(LVByteElem *dst, LVByteElem k, LVInteger n) {
+	__m128i vk = _mm_set1_epi8((char)k);
+	LVInteger i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(_mm_loadu_si128((const __m128i *)(dst + i)), vk));
+	for (; i < n; i++)
+		dst[i] += k;
+}
+
+template<> void _ta_scale(LVFloat64Elem *dst, LVFloat64Elem k, LVInteger n) {
+	__m128d vk = _mm_set1_pd(k);
+	LVInteger i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(dst + i), vk));
+	for (; i < n; i++)
+		dst[i] *= k;
+}
+#endif // __SSE2__
+
+#define SETUP_TYPEDARRAY(v) \
+	LVTypedArray<T> *self = NULL; \
+	{ if(LV_FAILED(lv_getinstanceup(v,1,(LVUserPointer*)&self,LVElem<T>::Tag()))) \
+		return lv_throwerror(v,_LC("invalid type tag"));  } \
+	if(!self)  \
+		return lv_throwerror(v,_LC("the typed array is invalid"));
+
+/* The typed array of the same element type at idx, or NULL */
+template<typename T> static LVTypedArray<T> *_typedarray_other(VMHANDLE v, LVInteger idx) {
+	LVTypedArray<T> *other = NULL;
+	if (LV_FAILED(lv_getinstanceup(v, idx, (LVUserPointer *)&other, LVElem<T>::Tag())))
+		return NULL;
+	return other;
+}
+
+template<typename T> static LVInteger _typedarray_releasehook(LVUserPointer p, LVInteger LV_UNUSED_ARG(size)) {
+	LVTypedArray<T> *self = (LVTypedArray<T> *)p;
+	self->~LVTypedArray<T>();
+	lv_free(self, sizeof(LVTypedArray<T>));
+	return 1;
+}
+
+template<typename T> static LVRESULT _typedarray_setup(VMHANDLE v, LVTypedArray<T> *a) {
+	if (LV_FAILED(lv_setinstanceup(v, 1, a))) {
+		a->~LVTypedArray<T>();
+		lv_free(a, sizeof(LVTypedArray<T>));
+		return lv_throwerror(v, _LC("cannot create typed array"));
+	}
+	lv_setreleasehook(v, 1, _typedarray_releasehook<T>);
+	return 0;
+}
+
+/*
+ * intarray(size), intarray(array) copies the elements of the array and
+ * intarray(blob) takes over the buffer of the blob, which is left empty.
+ */
+template<typename T> static LVInteger _typedarray_constructor(VMHANDLE v) {
+	LVTypedArray<T> *a;
+	LVInteger size = 0;
+	switch (lv_gettop(v) > 1 ? lv_gettype(v, 2) : OT_NULL) {
+		case OT_ARRAY: {
+			size = lv_getsize(v, 2);
+			a = new(lv_malloc(sizeof(LVTypedArray<T>))) LVTypedArray<T>(size);
+			for (LVInteger i = 0; i < size; i++) {
+				lv_pushinteger(v, i);
+				lv_rawget(v, 2);
+				if (!LVElem<T>::Get(v, -1, a->_vals[i])) {
+					a->~LVTypedArray<T>();
+					lv_free(a, sizeof(LVTypedArray<T>));
+					return lv_throwerror(v, _LC("the array holds a value that is not a number"));
+				}
+				lv_pop(v, 1);
+			}
+			break;
+		}
+		case OT_INSTANCE: {
+			LVInteger allocated, bytes = lv_getblobsize(v, 2);
+			LVUserPointer buf;
+			if (bytes < 0)
+				return lv_throwerror(v, _LC("blob expected"));
+			if (bytes % sizeof(T))
+				return lv_throwerror(v, _LC("the blob size is not a multiple of the element size"));
+			if (!(buf = blob_takebuffer(v, 2, &size, &allocated)))
+				return lv_throwerror(v, _LC("blob expected"));
+			a = new(lv_malloc(sizeof(LVTypedArray<T>))) LVTypedArray<T>(buf, size / sizeof(T), allocated);
+			break;
+		}
+		default:
+			lv_getinteger(v, 2, &size);
+			if (size < 0)
+				return lv_throwerror(v, _LC("cannot create typed array with negative size"));
+			a = new(lv_malloc(sizeof(LVTypedArray<T>))) LVTypedArray<T>(size);
+			break;
+	}
+	return _typedarray_setup<T>(v, a);
+}
+
+template<typename T> static LVInteger _typedarray__cloned(VMHANDLE v) {
+	LVTypedArray<T> *other = _typedarray_other<T>(v, 2);
+	if (!other)
+		return LV_ERROR;
+	LVTypedArray<T> *a = new(lv_malloc(sizeof(LVTypedArray<T>))) LVTypedArray<T>(other->_size);
+	memcpy(a->_vals, other->_vals, other->_size * sizeof(T));
+	return _typedarray_setup<T>(v, a);
+}
+
+template<typename T> static LVInteger _typedarray__get(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	LVInteger idx;
+	lv_getinteger(v, 2, &idx);
+	if (idx < 0 || idx >= self->_size)
+		return lv_throwerror(v, _LC("index out of range"));
+	LVElem<T>::Push(v, self->_vals[idx]);
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray__set(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	LVInteger idx;
+	lv_getinteger(v, 2, &idx);
+	if (idx < 0 || idx >= self->_size)
+		return lv_throwerror(v, _LC("index out of range"));
+	LVElem<T>::Get(v, 3, self->_vals[idx]);
+	lv_push(v, 3);
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray__nexti(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	if (lv_gettype(v, 2) == OT_NULL) {
+		if (self->_size > 0)
+			lv_pushinteger(v, 0);
+		else
+			lv_pushnull(v);
+		return 1;
+	}
+	LVInteger idx;
+	if (LV_SUCCEEDED(lv_getinteger(v, 2, &idx))) {
+		if (idx + 1 < self->_size)
+			lv_pushinteger(v, idx + 1);
+		else
+			lv_pushnull(v);
+		return 1;
+	}
+	return lv_throwerror(v, _LC("internal error (_nexti) wrong argument type"));
+}
+
+template<typename T> static LVInteger _typedarray__typeof(VMHANDLE v) {
+	lv_pushstring(v, LVElem<T>::Name(), -1);
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_size(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	lv_pushinteger(v, self->_size);
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_resize(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	LVInteger size;
+	lv_getinteger(v, 2, &size);
+	if (size < 0)
+		return lv_throwerror(v, _LC("negative size"));
+	self->Resize(size);
+	return 0;
+}
+
+template<typename T> static LVInteger _typedarray_push(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	T e;
+	LVElem<T>::Get(v, 2, e);
+	self->Push(e);
+	return 0;
+}
+
+template<typename T> static LVInteger _typedarray_sum(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	LVElem<T>::PushAcc(v, _ta_sum<T, typename LVElem<T>::Acc>(self->_vals, self->_size));
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_min(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	if (self->_size == 0)
+		return 0;
+	LVElem<T>::Push(v, _ta_min<T>(self->_vals, self->_size));
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_max(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	if (self->_size == 0)
+		return 0;
+	LVElem<T>::Push(v, _ta_max<T>(self->_vals, self->_size));
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_dot(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	LVTypedArray<T> *other = _typedarray_other<T>(v, 2);
+	if (!other)
+		return lv_throwerror(v, _LC("a typed array of the same type expected"));
+	if (other->_size != self->_size)
+		return lv_throwerror(v, _LC("size mismatch"));
+	LVElem<T>::PushAcc(v, _ta_dot<T, typename LVElem<T>::Acc>(self->_vals, other->_vals, self->_size));
+	return 1;
+}
+
+/* Multiplies in place, an integer array scaled by a float is truncated */
+template<typename T> static LVInteger _typedarray_scale(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	if (lv_gettype(v, 2) == OT_FLOAT || LVElem<T>::Float) {
+		LVFloat f;
+		lv_getfloat(v, 2, &f);
+		_ta_scale<T, LVFloat64Elem>(self->_vals, f, self->_size);
+	} else {
+		LVInteger i;
+		lv_getinteger(v, 2, &i);
+		_ta_scale<T, LVInt64Elem>(self->_vals, i, self->_size);
+	}
+	lv_push(v, 1);
+	return 1;
+}
+
+/* Adds a number or a typed array of the same type and size in place */
+template<typename T> static LVInteger _typedarray_add(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	if (lv_gettype(v, 2) & OBJECT_NUMERIC) {
+		T k;
+		LVElem<T>::Get(v, 2, k);
+		_ta_addscalar<T>(self->_vals, k, self->_size);
+	} else {
+		LVTypedArray<T> *other = _typedarray_other<T>(v, 2);
+		if (!other)
+			return lv_throwerror(v, _LC("a number or a typed array of the same type expected"));
+		if (other->_size != self->_size)
+			return lv_throwerror(v, _LC("size mismatch"));
+		_ta_add<T>(self->_vals, other->_vals, self->_size);
+	}
+	lv_push(v, 1);
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_sort(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	_ta_sort<T>(self->_vals, self->_size);
+	lv_push(v, 1);
+	return 1;
+}
+
+/* Index of the first element equal to the value, null if there is none */
+template<typename T> static LVInteger _typedarray_find(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	T e;
+	LVElem<T>::Get(v, 2, e);
+	LVInteger idx = _ta_find<T>(self->_vals, e, self->_size);
+	if (idx < 0)
+		return 0;
+	lv_pushinteger(v, idx);
+	return 1;
+}
+
+template<typename T> static LVInteger _typedarray_toarray(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	lv_newarray(v, 0);
+	for (LVInteger i = 0; i < self->_size; i++) {
+		LVElem<T>::Push(v, self->_vals[i]);
+		lv_arrayappend(v, -2);
+	}
+	return 1;
+}
+
+/* Hands the elements to a new blob without copying, the typed array is left empty */
+template<typename T> static LVInteger _typedarray_toblob(VMHANDLE v) {
+	SETUP_TYPEDARRAY(v);
+	LVInteger allocated = TYPEDARRAY_MINSIZE * sizeof(T);
+	LVUserPointer empty = lv_malloc(allocated);
+	if (LV_FAILED(blob_givebuffer(v, self->_vals, self->_size * sizeof(T), self->_allocated))) {
+		lv_free(empty, allocated);
+		return lv_throwerror(v, _LC("cannot create blob"));
+	}
+	self->_vals = (T *)empty;
+	self->_allocated = allocated;
+	self->_size = 0;
+	return 1;
+}
+
+#define _DECL_TYPEDARRAY_FUNC(name,nparams,typecheck) {_LC(#name),_typedarray_##name<T>,nparams,typecheck}
+template<typename T> struct LVTypedArrayClass {
+	static const LVRegFunction methods[];
+};
+
+template<typename T> const LVRegFunction LVTypedArrayClass<T>::methods[] = {
+	_DECL_TYPEDARRAY_FUNC(constructor, -1, _LC("xn|a|x")),
+	_DECL_TYPEDARRAY_FUNC(_cloned, 2, _LC("xx")),
+	_DECL_TYPEDARRAY_FUNC(_get, 2, _LC("xn")),
+	_DECL_TYPEDARRAY_FUNC(_set, 3, _LC("xnn")),
+	_DECL_TYPEDARRAY_FUNC(_nexti, 2, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(_typeof, 1, _LC("x")),
+	{_LC("length"), _typedarray_size<T>, 1, _LC("x")},
+	_DECL_TYPEDARRAY_FUNC(size, 1, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(resize, 2, _LC("xn")),
+	_DECL_TYPEDARRAY_FUNC(push, 2, _LC("xn")),
+	_DECL_TYPEDARRAY_FUNC(sum, 1, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(min, 1, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(max, 1, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(dot, 2, _LC("xx")),
+	_DECL_TYPEDARRAY_FUNC(scale, 2, _LC("xn")),
+	_DECL_TYPEDARRAY_FUNC(add, 2, _LC("xn|x")),
+	_DECL_TYPEDARRAY_FUNC(sort, 1, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(find, 2, _LC("xn")),
+	_DECL_TYPEDARRAY_FUNC(toarray, 1, _LC("x")),
+	_DECL_TYPEDARRAY_FUNC(toblob, 1, _LC("x")),
+	{NULL, (LVFUNCTION)0, 0, NULL}
+};
+
+template<typename T> static LVRESULT _typedarray_declare(VMHANDLE v) {
+	LVInteger top = lv_gettop(v);
+	const LVRegFunction *methods = LVTypedArrayClass<T>::methods;
+	lv_pushstring(v, LVElem<T>::Name(), -1);
+	lv_newclass(v, LVFalse);
+	lv_settypetag(v, -1, LVElem<T>::Tag());
+	for (LVInteger i = 0; methods[i].name != 0; i++) {
+		const LVRegFunction& f = methods[i];
+		lv_pushstring(v, f.name, -1);
+		lv_newclosure(v, f.f, 0);
+		lv_setparamscheck(v, f.nparamscheck, f.typemask);
+		lv_setnativeclosurename(v, -1, f.name);
+		lv_newslot(v, -3, LVFalse);
+	}
+	lv_newslot(v, -3, LVFalse);
+	lv_settop(v, top);
+	return LV_OK;
+}
+
+LVRESULT mod_init_typedarray(VMHANDLE v) {
+	if (lv_gettype(v, -1) != OT_TABLE)
+		return lv_throwerror(v, _LC("table expected"));
+	_typedarray_declare<LVInt64Elem>(v);
+	_typedarray_declare<LVFloat64Elem>(v);
+	_typedarray_declare<LVByteElem>(v);
+	return LV_OK;
+}
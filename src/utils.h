@@ -5,12 +5,23 @@ void *lv_vm_malloc(LVUnsignedInteger size);
 void *lv_vm_realloc(void *p, LVUnsignedInteger oldsize, LVUnsignedInteger size);
 void lv_vm_free(void *p, LVUnsignedInteger size);
 
-#define lv_new(__ptr,__type) {__ptr=(__type *)lv_vm_malloc(sizeof(__type));new (__ptr) __type;}
-#define lv_delete(__ptr,__type) {__ptr->~__type();lv_vm_free(__ptr,sizeof(__type));}
-
-#define LV_MALLOC(__size) lv_vm_malloc((__size));
-#define LV_FREE(__ptr,__size) lv_vm_free((__ptr),(__size));
-#define LV_REALLOC(__ptr,__oldsize,__size) lv_vm_realloc((__ptr),(__oldsize),(__size));
+/* Small blocks come from size class pools, define NO_POOL_ALLOCATOR to leave them out */
+#if defined(__SANITIZE_ADDRESS__) && !defined(NO_POOL_ALLOCATOR)
+#define NO_POOL_ALLOCATOR //the sanitizer has to see every block
+#endif
+
+//the size given to lv_pool_free and lv_pool_realloc must be the allocated one
+void *lv_pool_malloc(LVUnsignedInteger size);
+void *lv_pool_realloc(void *p, LVUnsignedInteger oldsize, LVUnsignedInteger size);
+void lv_pool_free(void *p, LVUnsignedInteger size);
+LVInteger lv_pool_getstats(LVPoolStats *stats, LVInteger n);
+
+#define lv_new(__ptr,__type) {__ptr=(__type *)lv_pool_malloc(sizeof(__type));new (__ptr) __type;}
+#define lv_delete(__ptr,__type) {__ptr->~__type();lv_pool_free(__ptr,sizeof(__type));}
+
+#define LV_MALLOC(__size) lv_pool_malloc((__size));
+#define LV_FREE(__ptr,__size) lv_pool_free((__ptr),(__size));
+#define LV_REALLOC(__ptr,__oldsize,__size) lv_pool_realloc((__ptr),(__oldsize),(__size));
 
 #define LV_ALIGN(v) (((size_t)(v) + (LV_ALIGNMENT-1)) & (~(LV_ALIGNMENT-1)))
 
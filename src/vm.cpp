@@ -8,6 +8,7 @@
 #include "lvstring.h"
 #include "table.h"
 #include "userdata.h"
+#include "jit.h"
 #include "array.h"
 #include "class.h"
 
@@ -71,6 +72,54 @@ bool LVVM::BW_OP(LVUnsignedInteger op, LVObjectPtr& trg, const LVObjectPtr& o1,
 	} \
 }
 
+/*
+ * Quickening. A generic arithmetic or compare instruction that sees two
+ * integers or two floats rewrites itself in place to the specialized variant,
+ * the variant rewrites itself back when its operands no longer match.
+ */
+#define QUICKEN(newop) (((LVInstruction *)_pi_)->op = (unsigned char)(newop))
+
+#define _QARITH_(op,iop,fop,trg,o1,o2) \
+{ \
+	LVInteger tmask = type(o1)|type(o2); \
+	switch(tmask) { \
+		case OT_INTEGER: QUICKEN(iop); trg = _integer(o1) op _integer(o2);break; \
+		case (OT_FLOAT): QUICKEN(fop); trg = _float(o1) op _float(o2); break;\
+		case (OT_FLOAT|OT_INTEGER): trg = tofloat(o1) op tofloat(o2); break;\
+		default: _GUARD(ARITH_OP((#op)[0],trg,o1,o2)); break;\
+	} \
+}
+
+#define _ARITH_INT_(op,genop,trg,o1,o2) \
+{ \
+	if ((type(o1)|type(o2)) == OT_INTEGER) { trg = _integer(o1) op _integer(o2); } \
+	else { QUICKEN(genop); _ARITH_(op,trg,o1,o2); } \
+}
+
+#define _ARITH_FLOAT_(op,genop,trg,o1,o2) \
+{ \
+	if ((type(o1)|type(o2)) == OT_FLOAT) { trg = _float(o1) op _float(o2); } \
+	else { QUICKEN(genop); _ARITH_(op,trg,o1,o2); } \
+}
+
+/* Same ordering as ObjCmp so the quickened compares agree with CMP_OP */
+#define _NUMCMP(a,b) (((a) == (b)) ? 0 : (((a) < (b)) ? -1 : 1))
+
+static inline bool _cmp_istrue(LVInteger op, LVInteger r) {
+	switch (op) {
+		case CMP_G:
+			return r > 0;
+		case CMP_GE:
+			return r >= 0;
+		case CMP_L:
+			return r < 0;
+		case CMP_LE:
+			return r <= 0;
+		default:
+			return r != 0;
+	}
+}
+
 bool LVVM::ARITH_OP(LVUnsignedInteger op, LVObjectPtr& trg, const LVObjectPtr& o1, const LVObjectPtr& o2) {
 	LVInteger tmask = type(o1) | type(o2);
 	switch (tmask) {
@@ -173,6 +222,8 @@ void LVVM::Finalize() {
 		_releasehook(_foreignptr, 0);
 		_releasehook = NULL;
 	}
+	if (_stackclosures.size())
+		CloseStackClosures(0, 0, 0, -1);
 	if (_openouters)
 		CloseOuters(&_stack._vals[0]);
 	_roottable.Null();
@@ -485,7 +536,7 @@ bool LVVM::TypeOf(const LVObjectPtr& obj1, LVObjectPtr& dest) {
 	return true;
 }
 
-bool LVVM::Init(LVVM *friendvm, LVInteger stacksize) {
+void LVVM::InitStack(LVInteger stacksize) {
 	_stack.resize(stacksize);
 	_alloccallsstacksize = 4;
 	_callstackdata.resize(_alloccallsstacksize);
@@ -493,6 +544,10 @@ bool LVVM::Init(LVVM *friendvm, LVInteger stacksize) {
 	_callsstack = &_callstackdata[0];
 	_stackbase = 0;
 	_top = 0;
+}
+
+bool LVVM::Init(LVVM *friendvm, LVInteger stacksize) {
+	InitStack(stacksize);
 	if (!friendvm) {
 		_roottable = LVTable::Create(_ss(this), 0);
 		lv_base_register(this);
@@ -562,6 +617,14 @@ bool LVVM::StartCall(LVClosure *closure, LVInteger target, LVInteger args, LVInt
 		CallDebugHook(_LC('c'));
 	}
 
+#ifdef LV_JIT
+	if (_ss(this)->_jit && !func->_bgenerator) {
+		if (!func->_jitcode && ++func->_hotcount == JIT_HOT_CALLS)
+			func->_jitcode = LVJitCode::Compile(func);
+		RunJit(func);
+	}
+#endif
+
 	if (closure->_function->_bgenerator) {
 		FunctionPrototype *f = closure->_function;
 		LVGenerator *gen = LVGenerator::Create(_ss(this), closure);
@@ -575,6 +638,16 @@ bool LVVM::StartCall(LVClosure *closure, LVInteger target, LVInteger args, LVInt
 	return true;
 }
 
+#ifdef LV_JIT
+/* Runs native code from the current instruction of the frame, if any */
+void LVVM::RunJit(FunctionPrototype *func) {
+	if (!func->_jitcode || _debughook || !_ss(this)->_jit)
+		return;
+	LVInteger pc = ci->_ip - func->_instructions;
+	ci->_ip = func->_instructions + func->_jitcode->Run(this, &_stack._vals[_stackbase], pc);
+}
+#endif
+
 bool LVVM::Return(LVInteger _arg0, LVInteger _arg1, LVObjectPtr& retval) {
 	LVBool    _isroot      = ci->_root;
 	LVInteger callerbase   = _stackbase - ci->_prevstkbase;
@@ -714,21 +787,189 @@ bool LVVM::FOREACH_OP(LVObjectPtr& o1, LVObjectPtr& o2, LVObjectPtr
 
 #define _GUARD(exp) { if(!exp) { THROW();} }
 
-bool LVVM::CLOSURE_OP(LVObjectPtr& target, FunctionPrototype *func) {
-	LVInteger nouters;
+/*
+ * Monomorphic inline caches for member access. Each instruction owns one
+ * slot that remembers the node index where the key was last resolved in the
+ * table, or in the member table of the instance class. A hit is verified
+ * against the node key so a stale slot just misses and the caller falls back
+ * to the generic Get or Set.
+ */
+bool LVVM::GetCached(const LVObjectPtr& self, const LVObjectPtr& key, LVObjectPtr& dest, LVInt32& slot) {
+	LVObjectPtr *v;
+	switch (type(self)) {
+		case OT_TABLE:
+			if ((v = _table(self)->GetCached(key, slot))) {
+				dest = _realval(*v);
+				return true;
+			}
+			break;
+		case OT_INSTANCE: {
+			LVInstance *inst = _instance(self);
+			if ((v = inst->_class->_members->GetCached(key, slot))) {
+				if (_isfield(*v)) {
+					LVObjectPtr& o = inst->_values[_member_idx(*v)];
+					dest = _realval(o);
+				} else {
+					dest = inst->_class->_methods[_member_idx(*v)].val;
+				}
+				return true;
+			}
+		}
+		break;
+		default:
+			break;
+	}
+	return false;
+}
+
+/*
+ * A free variable is read as a member of this, and is found in the root
+ * table only after this, its fallbacks and the default delegate of its type
+ * all missed. Once the inline cache missed on this, the lookup goes straight
+ * to the default delegate and the root table when this cannot hold the key:
+ * an array, a string, a number, null, or a table without a delegate. An
+ * instance can hold it in its class, so the global cache of the instruction
+ * remembers the class and the stamp it had when it was found to have neither
+ * the key nor _get; while the class gains no member the class is skipped.
+ * The root table is read through the inline cache slot of the instruction.
+ */
+bool LVVM::GetGlobalCached(const LVObjectPtr& self, const LVObjectPtr& key, LVObjectPtr& dest, LVInteger pc) {
+	LVWeakRef *w = _closure(ci->_closure)->_root;
+	if (type(key) != OT_STRING || type(w->_obj) != OT_TABLE)
+		return false;
+	FunctionPrototype *func = _closure(ci->_closure)->_function;
+	LVTable *ddel = NULL;
+	switch (type(self)) {
+		case OT_INSTANCE: {
+			LVClass *cls = _instance(self)->_class;
+			LVGlobalCache *gc = func->_gcache ? &func->_gcache[pc] : NULL;
+			if (!gc || gc->_class != cls || gc->_stamp != cls->_stamp) {
+				LVObjectPtr temp;
+				if (type(cls->_metamethods[MT_GET]) != OT_NULL || cls->_members->Get(key, temp))
+					return false;
+				if (!func->_gcache) {
+					func->_gcache = (LVGlobalCache *)LV_MALLOC(func->_ninstructions * sizeof(LVGlobalCache));
+					memset(func->_gcache, 0, func->_ninstructions * sizeof(LVGlobalCache));
+				}
+				gc = &func->_gcache[pc];
+				gc->_class = cls;
+				gc->_stamp = cls->_stamp;
+			}
+			ddel = _instance_ddel;
+		}
+		break;
+		case OT_TABLE:
+			if (_table(self)->_delegate)
+				return false;
+			ddel = _table_ddel;
+			break;
+		case OT_ARRAY:
+			ddel = _array_ddel;
+			break;
+		case OT_STRING:
+			ddel = _string_ddel;
+			break;
+		case OT_INTEGER:
+		case OT_FLOAT:
+		case OT_BOOL:
+			ddel = _number_ddel;
+			break;
+		case OT_NULL:
+			break;
+		default:
+			return false;
+	}
+	LVObjectPtr *v;
+	LVInt32 ddelslot = 0;
+	if (ddel && ddel->GetCached(key, ddelslot))
+		return false;
+	if ((v = _table(w->_obj)->GetCached(key, func->_icache[pc]))) {
+		dest = _realval(*v);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * An accessor is a function that is just 'return key;' with key a member of
+ * this. Called with no arguments, and with its 'this' holding the key, it
+ * runs inline: the member is read through the inline cache slot of the
+ * accessor itself and no frame is entered. Anything else, a miss included,
+ * is an ordinary call.
+ */
+static _INLINE bool IsAccessor(LVClosure *c, LVInteger nargs) {
+	FunctionPrototype *f = c->_function;
+	return nargs == 1 && f->_ninstructions == 2 && f->_nparameters == 1 && !c->_env
+	       && f->_instructions[0].op == _OP_GETK && f->_instructions[0]._arg2 == 0
+	       && f->_instructions[1].op == _OP_RETURN && f->_instructions[1]._arg0 != 0xFF
+	       && f->_instructions[1]._arg1 == f->_instructions[0]._arg0;
+}
+
+bool LVVM::SetCached(const LVObjectPtr& self, const LVObjectPtr& key, const LVObjectPtr& val, LVInt32& slot) {
+	LVObjectPtr *v;
+	switch (type(self)) {
+		case OT_TABLE:
+			if ((v = _table(self)->GetCached(key, slot))) {
+				*v = val;
+				return true;
+			}
+			break;
+		case OT_INSTANCE: {
+			LVInstance *inst = _instance(self);
+			if ((v = inst->_class->_members->GetCached(key, slot)) && _isfield(*v)) {
+				inst->_values[_member_idx(*v)] = val;
+				return true;
+			}
+		}
+		break;
+		default:
+			break;
+	}
+	return false;
+}
+
+/*
+ * A closure the compiler sees passed straight to a call is expected to die
+ * with the frame that made it, so it reads the locals it captures from the
+ * stack by their index instead of through a new LVOuter. It stays on
+ * _stackclosures until the scope of those locals ends, where it gets its
+ * outers after all if something still holds it, see CloseStackClosures.
+ * It takes the place of the closure of the frame made before it if that one
+ * is gone, or the list is pruned first, so a loop passing a new callback
+ * each time keeps the list short.
+ */
+bool LVVM::CLOSURE_OP(LVObjectPtr& target, FunctionPrototype *func, bool onstack) {
+	LVInteger nouters, stacktop = -1;
 	LVClosure *closure = LVClosure::Create(_ss(this), func, _table(_roottable)->GetWeakRef(OT_TABLE));
 	if ((nouters = func->_noutervalues)) {
+		onstack = onstack && !ci->_generator && !func->_bgenerator;
 		for (LVInteger i = 0; i < nouters; i++) {
 			LVOuterVar& v = func->_outervalues[i];
 			switch (v._type) {
 				case otLOCAL:
-					FindOuter(closure->_outervalues[i], &STK(_integer(v._src)));
-					break;
-				case otOUTER:
-					closure->_outervalues[i] = _closure(ci->_closure)->_outervalues[_integer(v._src)];
+					if (onstack) {
+						closure->_outervalues[i] = _stackbase + _integer(v._src);
+						if (_integer(closure->_outervalues[i]) > stacktop)
+							stacktop = _integer(closure->_outervalues[i]);
+					} else {
+						FindOuter(closure->_outervalues[i], &STK(_integer(v._src)));
+					}
 					break;
+				case otOUTER: {
+					LVClosure *parent = _closure(ci->_closure);
+					LVObjectPtr& ov = parent->_outervalues[_integer(v._src)];
+					if (type(ov) == OT_INTEGER) {
+						LVVM *owner = parent->_stackowner;
+						owner->FindOuter(closure->_outervalues[i], &owner->_stack._vals[_integer(ov)]);
+					} else {
+						closure->_outervalues[i] = ov;
+					}
+				}
+				break;
 			}
 		}
+		if (stacktop >= 0)
+			closure->_stackowner = this;
 	}
 	LVInteger ndefparams;
 	if ((ndefparams = func->_ndefaultparams)) {
@@ -738,6 +979,20 @@ bool LVVM::CLOSURE_OP(LVObjectPtr& target, FunctionPrototype *func) {
 		}
 	}
 	target = closure;
+	if (stacktop >= 0) {
+		StackClosure *last = _stackclosures.size() ? &_stackclosures.top() : NULL;
+		if (last && last->_top >= _stackbase && _closure(last->_closure)->_uiRef == 1) {
+			//the callback of the previous call, which nothing holds anymore
+			last->_closure = closure;
+		} else {
+			if (last && last->_top >= _stackbase)
+				PruneStackClosures();
+			_stackclosures.push_back(StackClosure());
+			last = &_stackclosures.top();
+			last->_closure = closure;
+		}
+		last->_top = stacktop;
+	}
 	return true;
 
 }
@@ -802,6 +1057,33 @@ bool LVVM::IsFalse(LVObjectPtr& o) {
 	return false;
 }
 
+/*
+ * Instruction dispatch. With LV_COMPUTED_GOTO every handler jumps straight
+ * to the next one through a label table indexed by opcode (direct threading),
+ * otherwise the loop falls back to the portable switch. A computed goto does
+ * not run destructors, so VM_NEXT must never leave a scope holding objects.
+ */
+#define _i_ (*_pi_)
+#define PC (_pi_ - _closure(ci->_closure)->_function->_instructions)
+#define ICACHE (_closure(ci->_closure)->_function->_icache[PC])
+
+/* Young collections start only from allocating instructions, where every live value is on a stack */
+#ifndef NO_GARBAGE_COLLECTOR
+#define GC_SAFEPOINT() { if (_ss(this)->_gc_young >= _ss(this)->_gc_threshold) _ss(this)->CollectYoung(); }
+#else
+#define GC_SAFEPOINT()
+#endif
+
+#ifdef LV_COMPUTED_GOTO
+#define VM_DISPATCH() goto *_dispatch_table[_pi_->op]
+#define VM_NEXT { _pi_ = ci->_ip++; VM_DISPATCH(); }
+#define VM_CASE(op) L##op: case op
+#else
+#define VM_DISPATCH()
+#define VM_NEXT continue
+#define VM_CASE(op) case op
+#endif
+
 extern LVInstructionDesc instruction_desc[];
 bool LVVM::Execute(LVObjectPtr& closure, LVInteger nargs, LVInteger stackbase, LVObjectPtr& outres, LVBool raiseerror, ExecutionType et) {
 	if ((_nnativecalls + 1) > MAX_NATIVE_CALLS) {
@@ -811,10 +1093,35 @@ bool LVVM::Execute(LVObjectPtr& closure, LVInteger nargs, LVInteger stackbase, L
 
 	// puts("Execute");
 
+#ifdef LV_COMPUTED_GOTO
+	/* Must follow the order of enum Opcode */
+	static const void *const _dispatch_table[] = {
+		&&L_OP_LINE, &&L_OP_LOAD, &&L_OP_LOADINT, &&L_OP_LOADFLOAT,
+		&&L_OP_DLOAD, &&L_OP_TAILCALL, &&L_OP_CALL, &&L_OP_PREPCALL,
+		&&L_OP_PREPCALLK, &&L_OP_GETK, &&L_OP_MOVE, &&L_OP_NEWSLOT,
+		&&L_OP_DELETE, &&L_OP_SET, &&L_OP_GET, &&L_OP_EQ,
+		&&L_OP_NE, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL,
+		&&L_OP_DIV, &&L_OP_MOD, &&L_OP_BITW, &&L_OP_RETURN,
+		&&L_OP_LOADNULLS, &&L_OP_LOADROOT, &&L_OP_LOADBOOL, &&L_OP_DMOVE,
+		&&L_OP_JMP, &&L_OP_JCMP, &&L_OP_JZ, &&L_OP_SETOUTER,
+		&&L_OP_GETOUTER, &&L_OP_NEWOBJ, &&L_OP_APPENDARRAY, &&L_OP_COMPARITH,
+		&&L_OP_INC, &&L_OP_INCL, &&L_OP_PINC, &&L_OP_PINCL,
+		&&L_OP_CMP, &&L_OP_EXISTS, &&L_OP_INSTANCEOF, &&L_OP_AND,
+		&&L_OP_OR, &&L_OP_NEG, &&L_OP_NOT, &&L_OP_BWNOT,
+		&&L_OP_CLOSURE, &&L_OP_YIELD, &&L_OP_RESUME, &&L_OP_FOREACH,
+		&&L_OP_POSTFOREACH, &&L_OP_CLONE, &&L_OP_TYPEOF, &&L_OP_PUSHTRAP,
+		&&L_OP_POPTRAP, &&L_OP_THROW, &&L_OP_NEWSLOTA, &&L_OP_GETBASE,
+		&&L_OP_CLOSE, &&L_OP_ADDI, &&L_OP_SUBI, &&L_OP_MULI,
+		&&L_OP_ADDF, &&L_OP_SUBF, &&L_OP_MULF, &&L_OP_JCMPI,
+		&&L_OP_JCMPF, &&L_OP_SWITCH
+	};
+#endif
+
 	_nnativecalls++;
 	AutoDec ad(&_nnativecalls);
 	LVInteger traps = 0;
 	CallInfo *prevci = ci;
+	const LVInstruction *_pi_;
 
 	switch (et) {
 		case ET_CALL: {
@@ -852,49 +1159,64 @@ exception_restore:
 	//
 	{
 		for (;;) {
-			const LVInstruction& _i_ = *ci->_ip++;
+			_pi_ = ci->_ip++;
 			// dumpstack(_stackbase);
 			// scprintf("\n[%d] %s %d %d %d %d\n", ci->_ip - _closure(ci->_closure)->_function->_instructions, instruction_desc[_i_.op].name, arg0, arg1, arg2, arg3);
+			VM_DISPATCH();
 			switch (_i_.op) {
-				case _OP_LINE:
+				VM_CASE(_OP_LINE):
 					if (_debughook)
 						CallDebugHook(_LC('l'), arg1);
-					continue;
-				case _OP_LOAD:
+					VM_NEXT;
+				VM_CASE(_OP_LOAD):
 					TARGET = ci->_literals[arg1];
-					continue;
-				case _OP_LOADINT:
+					VM_NEXT;
+				VM_CASE(_OP_LOADINT):
 #ifndef _LV64
 					TARGET = (LVInteger)arg1;
-					continue;
+					VM_NEXT;
 #else
 					TARGET = (LVInteger)((LVInt32)arg1);
-					continue;
+					VM_NEXT;
 #endif
-				case _OP_LOADFLOAT:
+				VM_CASE(_OP_LOADFLOAT):
 					TARGET = *((const LVFloat *)&arg1);
-					continue;
-				case _OP_DLOAD:
+					VM_NEXT;
+				VM_CASE(_OP_DLOAD):
 					TARGET = ci->_literals[arg1];
 					STK(arg2) = ci->_literals[arg3];
-					continue;
-				case _OP_TAILCALL: {
+					VM_NEXT;
+				VM_CASE(_OP_TAILCALL): {
 					LVObjectPtr& t = STK(arg1);
 					if (type(t) == OT_CLOSURE
 					        && (!_closure(t)->_function->_bgenerator)) {
-						LVObjectPtr clo = t;
-						if (_openouters) CloseOuters(&(_stack._vals[_stackbase]));
-						for (LVInteger i = 0; i < arg3; i++) STK(i) = STK(arg2 + i);
-						_GUARD(StartCall(_closure(clo), ci->_target, arg3, _stackbase, true));
-						continue;
+						{
+							LVObjectPtr clo = t;
+							if (_stackclosures.size() && _stackclosures.top()._top >= _stackbase)
+								CloseStackClosures(_stackbase, _stackbase, _stackbase, -1);
+							if (_openouters) CloseOuters(&(_stack._vals[_stackbase]));
+							for (LVInteger i = 0; i < arg3; i++) STK(i) = STK(arg2 + i);
+							_GUARD(StartCall(_closure(clo), ci->_target, arg3, _stackbase, true));
+						}
+						VM_NEXT;
 					}
 				}
-				case _OP_CALL: {
+				VM_CASE(_OP_CALL): {
+					GC_SAFEPOINT();
 					LVObjectPtr clo = STK(arg1);
 					switch (type(clo)) {
-						case OT_CLOSURE:
-							_GUARD(StartCall(_closure(clo), sarg0, arg3, _stackbase + arg2, false));
-							continue;
+						case OT_CLOSURE: {
+							LVClosure *c = _closure(clo);
+							FunctionPrototype *f = c->_function;
+							if (!_debughook && IsAccessor(c, arg3)
+							        && GetCached(STK(arg2), f->_literals[f->_instructions[0]._arg1], temp_reg, f->_icache[0])) {
+								if (sarg0 != -1)
+									_Swap(STK(arg0), temp_reg);
+								break;
+							}
+							_GUARD(StartCall(c, sarg0, arg3, _stackbase + arg2, false));
+						}
+						break;
 						case OT_NATIVECLOSURE: {
 							bool suspend;
 							_GUARD(CallNative(_nativeclosure(clo), arg3, _stackbase + arg2, clo, suspend));
@@ -910,7 +1232,7 @@ exception_restore:
 								STK(arg0) = clo;
 							}
 						}
-						continue;
+						break;
 						case OT_CLASS: {
 							LVObjectPtr inst;
 							LVClass *_class = _class(clo);
@@ -962,81 +1284,104 @@ exception_restore:
 							THROW();
 					}
 				}
-				continue;
-				case _OP_PREPCALL:
-				case _OP_PREPCALLK: {
+				VM_NEXT;
+				VM_CASE(_OP_PREPCALL):
+				VM_CASE(_OP_PREPCALLK): {
 					LVObjectPtr& key = _i_.op == _OP_PREPCALLK ? (ci->_literals)[arg1] : STK(arg1);
 					LVObjectPtr& o = STK(arg2);
-					if (!Get(o, key, temp_reg, 0, arg2)) {
+					if (!GetCached(o, key, temp_reg, ICACHE) && !(arg2 == 0 && GetGlobalCached(o, key, temp_reg, PC))
+					        && !Get(o, key, temp_reg, 0, arg2)) {
 						THROW();
 					}
 					STK(arg3) = o;
 					_Swap(TARGET, temp_reg); //TARGET = temp_reg;
 				}
-				continue;
-				case _OP_GETK:
-					if (!Get(STK(arg2), ci->_literals[arg1], temp_reg, 0, arg2)) {
+				VM_NEXT;
+				VM_CASE(_OP_GETK):
+					if (!GetCached(STK(arg2), ci->_literals[arg1], temp_reg, ICACHE)
+					        && !(arg2 == 0 && GetGlobalCached(STK(arg2), ci->_literals[arg1], temp_reg, PC))
+					        && !Get(STK(arg2), ci->_literals[arg1], temp_reg, 0, arg2)) {
 						THROW();
 					}
 					_Swap(TARGET, temp_reg); //TARGET = temp_reg;
-					continue;
-				case _OP_MOVE:
+					VM_NEXT;
+				VM_CASE(_OP_MOVE):
 					TARGET = STK(arg1);
-					continue;
-				case _OP_NEWSLOT:
+					VM_NEXT;
+				VM_CASE(_OP_NEWSLOT):
 					_GUARD(NewSlot(STK(arg1), STK(arg2), STK(arg3), false));
 					if (arg0 != 0xFF) TARGET = STK(arg3);
-					continue;
-				case _OP_DELETE:
+					VM_NEXT;
+				VM_CASE(_OP_DELETE):
 					_GUARD(DeleteSlot(STK(arg1), STK(arg2), TARGET));
-					continue;
-				case _OP_SET:
-					if (!Set(STK(arg1), STK(arg2), STK(arg3), arg1)) {
+					VM_NEXT;
+				VM_CASE(_OP_SET):
+					if (!SetCached(STK(arg1), STK(arg2), STK(arg3), ICACHE)
+					        && !Set(STK(arg1), STK(arg2), STK(arg3), arg1)) {
 						THROW();
 					}
 					if (arg0 != 0xFF) TARGET = STK(arg3);
-					continue;
-				case _OP_GET:
-					if (!Get(STK(arg1), STK(arg2), temp_reg, 0, arg1)) {
+					VM_NEXT;
+				VM_CASE(_OP_GET):
+					if (!GetCached(STK(arg1), STK(arg2), temp_reg, ICACHE)
+					        && !Get(STK(arg1), STK(arg2), temp_reg, 0, arg1)) {
 						THROW();
 					}
 					_Swap(TARGET, temp_reg); //TARGET = temp_reg;
-					continue;
-				case _OP_EQ: {
+					VM_NEXT;
+				VM_CASE(_OP_EQ): {
 					bool res;
 					if (!IsEqual(STK(arg2), COND_LITERAL, res)) {
 						THROW();
 					}
 					TARGET = res ? true : false;
 				}
-				continue;
-				case _OP_NE: {
+				VM_NEXT;
+				VM_CASE(_OP_NE): {
 					bool res;
 					if (!IsEqual(STK(arg2), COND_LITERAL, res)) {
 						THROW();
 					}
 					TARGET = (!res) ? true : false;
 				}
-				continue;
-				case _OP_ADD:
-					_ARITH_(+, TARGET, STK(arg2), STK(arg1));
-					continue;
-				case _OP_SUB:
-					_ARITH_(-, TARGET, STK(arg2), STK(arg1));
-					continue;
-				case _OP_MUL:
-					_ARITH_(*, TARGET, STK(arg2), STK(arg1));
-					continue;
-				case _OP_DIV:
+				VM_NEXT;
+				VM_CASE(_OP_ADD):
+					_QARITH_(+, _OP_ADDI, _OP_ADDF, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_SUB):
+					_QARITH_(-, _OP_SUBI, _OP_SUBF, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_MUL):
+					_QARITH_(*, _OP_MULI, _OP_MULF, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_ADDI):
+					_ARITH_INT_(+, _OP_ADD, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_SUBI):
+					_ARITH_INT_(-, _OP_SUB, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_MULI):
+					_ARITH_INT_(*, _OP_MUL, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_ADDF):
+					_ARITH_FLOAT_(+, _OP_ADD, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_SUBF):
+					_ARITH_FLOAT_(-, _OP_SUB, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_MULF):
+					_ARITH_FLOAT_(*, _OP_MUL, TARGET, STK(arg2), STK(arg1));
+					VM_NEXT;
+				VM_CASE(_OP_DIV):
 					_ARITH_NOZERO( /, TARGET, STK(arg2), STK(arg1), _LC("division by zero"));
-					continue;
-				case _OP_MOD:
+					VM_NEXT;
+				VM_CASE(_OP_MOD):
 					ARITH_OP('%', TARGET, STK(arg2), STK(arg1));
-					continue;
-				case _OP_BITW:
+					VM_NEXT;
+				VM_CASE(_OP_BITW):
 					_GUARD(BW_OP( arg3, TARGET, STK(arg2), STK(arg1)));
-					continue;
-				case _OP_RETURN:
+					VM_NEXT;
+				VM_CASE(_OP_RETURN):
 					if ((ci)->_generator) {
 						(ci)->_generator->Kill();
 					}
@@ -1046,12 +1391,12 @@ exception_restore:
 						_Swap(outres, temp_reg);
 						return true;
 					}
-					continue;
-				case _OP_LOADNULLS: {
+					VM_NEXT;
+				VM_CASE(_OP_LOADNULLS): {
 					for (LVInt32 n = 0; n < arg1; n++) STK(arg0 + n).Null();
 				}
-				continue;
-				case _OP_LOADROOT:  {
+				VM_NEXT;
+				VM_CASE(_OP_LOADROOT):  {
 					LVWeakRef *w = _closure(ci->_closure)->_root;
 					if (type(w->_obj) != OT_NULL) {
 						TARGET = w->_obj;
@@ -1059,59 +1404,111 @@ exception_restore:
 						TARGET = _roottable; //shoud this be like this? or null
 					}
 				}
-				continue;
-				case _OP_LOADBOOL:
+				VM_NEXT;
+				VM_CASE(_OP_LOADBOOL):
 					TARGET = arg1 ? true : false;
-					continue;
-				case _OP_DMOVE:
+					VM_NEXT;
+				VM_CASE(_OP_DMOVE):
 					STK(arg0) = STK(arg1);
 					STK(arg2) = STK(arg3);
-					continue;
-				case _OP_JMP:
+					VM_NEXT;
+				VM_CASE(_OP_JMP):
 					ci->_ip += (sarg1);
-					continue;
+#ifdef LV_JIT
+					if (sarg1 < 0) RunJit(_closure(ci->_closure)->_function);
+#endif
+					VM_NEXT;
 				//case _OP_JNZ: if(!IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-				case _OP_JCMP:
-					_GUARD(CMP_OP((CmpOP)arg3, STK(arg2), STK(arg0), temp_reg));
+				VM_CASE(_OP_SWITCH): {
+					//a float can still equal an integer case, the chain of comparisons after this sorts it out
+					LVObjectPtr& o = STK(arg0);
+					LVObjectPtr offset;
+					if (type(o) == OT_INTEGER || type(o) == OT_STRING) {
+						if (_table(ci->_literals[arg2 | (arg3 << 8)])->Get(o, offset))
+							ci->_ip += _integer(offset);
+						else
+							ci->_ip += (sarg1);
+					} else if (type(o) != OT_FLOAT) {
+						ci->_ip += (sarg1);
+					}
+				}
+				VM_NEXT;
+				VM_CASE(_OP_JCMP): {
+					LVObjectPtr& o1 = STK(arg2);
+					LVObjectPtr& o2 = STK(arg0);
+					LVInteger tmask = type(o1) | type(o2);
+					if (tmask == OT_INTEGER) {
+						QUICKEN(_OP_JCMPI);
+					} else if (tmask == OT_FLOAT) {
+						QUICKEN(_OP_JCMPF);
+					}
+					_GUARD(CMP_OP((CmpOP)arg3, o1, o2, temp_reg));
 					if (IsFalse(temp_reg)) ci->_ip += (sarg1);
-					continue;
-				case _OP_JZ:
+				}
+				VM_NEXT;
+				VM_CASE(_OP_JCMPI): {
+					LVObjectPtr& o1 = STK(arg2);
+					LVObjectPtr& o2 = STK(arg0);
+					if ((type(o1) | type(o2)) == OT_INTEGER) {
+						if (!_cmp_istrue(arg3, _NUMCMP(_integer(o1), _integer(o2)))) ci->_ip += (sarg1);
+					} else {
+						QUICKEN(_OP_JCMP);
+						_GUARD(CMP_OP((CmpOP)arg3, o1, o2, temp_reg));
+						if (IsFalse(temp_reg)) ci->_ip += (sarg1);
+					}
+				}
+				VM_NEXT;
+				VM_CASE(_OP_JCMPF): {
+					LVObjectPtr& o1 = STK(arg2);
+					LVObjectPtr& o2 = STK(arg0);
+					if ((type(o1) | type(o2)) == OT_FLOAT) {
+						LVInteger r = _rawval(o1) == _rawval(o2) ? 0 : (_float(o1) < _float(o2) ? -1 : 1);
+						if (!_cmp_istrue(arg3, r)) ci->_ip += (sarg1);
+					} else {
+						QUICKEN(_OP_JCMP);
+						_GUARD(CMP_OP((CmpOP)arg3, o1, o2, temp_reg));
+						if (IsFalse(temp_reg)) ci->_ip += (sarg1);
+					}
+				}
+				VM_NEXT;
+				VM_CASE(_OP_JZ):
 					if (IsFalse(STK(arg0))) ci->_ip += (sarg1);
-					continue;
-				case _OP_GETOUTER: {
+					VM_NEXT;
+				VM_CASE(_OP_GETOUTER): {
 					LVClosure *cur_cls = _closure(ci->_closure);
-					LVOuter *otr = _outer(cur_cls->_outervalues[arg1]);
-					TARGET = *(otr->_valptr);
+					TARGET = *_outervalptr(cur_cls, arg1);
 				}
-				continue;
-				case _OP_SETOUTER: {
+				VM_NEXT;
+				VM_CASE(_OP_SETOUTER): {
 					LVClosure *cur_cls = _closure(ci->_closure);
-					LVOuter   *otr = _outer(cur_cls->_outervalues[arg1]);
-					*(otr->_valptr) = STK(arg2);
+					*_outervalptr(cur_cls, arg1) = STK(arg2);
 					if (arg0 != 0xFF) {
 						TARGET = STK(arg2);
 					}
 				}
-				continue;
-				case _OP_NEWOBJ:
+				VM_NEXT;
+				VM_CASE(_OP_NEWOBJ):
+					GC_SAFEPOINT();
 					switch (arg3) {
 						case NOT_TABLE:
-							TARGET = LVTable::Create(_ss(this), arg1);
-							continue;
+							if (arg2)
+								TARGET = LVTable::Create(_ss(this), _ss(this)->_rootshape, arg1);
+							else
+								TARGET = LVTable::Create(_ss(this), arg1);
+							VM_NEXT;
 						case NOT_ARRAY:
 							TARGET = LVArray::Create(_ss(this), 0);
 							_array(TARGET)->Reserve(arg1);
-							continue;
+							VM_NEXT;
 						case NOT_CLASS:
 							_GUARD(CLASS_OP(TARGET, arg1, arg2));
-							continue;
+							VM_NEXT;
 						default:
 							assert(0);
-							continue;
+							VM_NEXT;
 					}
-				case _OP_APPENDARRAY: {
+				VM_CASE(_OP_APPENDARRAY): {
 					LVObject val;
-					val._unVal.raw = 0;
 					switch (arg2) {
 						case AAT_STACK:
 							val = STK(arg1);
@@ -1120,114 +1517,112 @@ exception_restore:
 							val = ci->_literals[arg1];
 							break;
 						case AAT_INT:
-							val._type = OT_INTEGER;
 #ifndef _LV64
-							val._unVal.nInteger = (LVInteger)arg1;
+							OBJECT_INIT(val, OT_INTEGER, nInteger, (LVInteger)arg1);
 #else
-							val._unVal.nInteger = (LVInteger)((LVInt32)arg1);
+							OBJECT_INIT(val, OT_INTEGER, nInteger, (LVInteger)((LVInt32)arg1));
 #endif
 							break;
 						case AAT_FLOAT:
-							val._type = OT_FLOAT;
-							val._unVal.fFloat = *((const LVFloat *)&arg1);
+							OBJECT_INIT(val, OT_FLOAT, fFloat, *((const LVFloat *)&arg1));
 							break;
 						case AAT_BOOL:
-							val._type = OT_BOOL;
-							val._unVal.nInteger = arg1;
+							OBJECT_INIT(val, OT_BOOL, nInteger, arg1);
 							break;
 						default:
-							val._type = OT_INTEGER;
+							OBJECT_INIT(val, OT_INTEGER, nInteger, 0);
 							assert(0);
 							break;
 
 					}
 					_array(STK(arg0))->Append(val);
-					continue;
+					VM_NEXT;
 				}
-				case _OP_COMPARITH: {
+				VM_CASE(_OP_COMPARITH): {
 					LVInteger selfidx = (((LVUnsignedInteger)arg1 & 0xFFFF0000) >> 16);
 					_GUARD(DerefInc(arg3, TARGET, STK(selfidx), STK(arg2), STK(arg1 & 0x0000FFFF), false, selfidx));
 				}
-				continue;
-				case _OP_INC: {
+				VM_NEXT;
+				VM_CASE(_OP_INC): {
 					LVObjectPtr o(sarg3);
 					_GUARD(DerefInc('+', TARGET, STK(arg1), STK(arg2), o, false, arg1));
 				}
-				continue;
-				case _OP_INCL: {
+				VM_NEXT;
+				VM_CASE(_OP_INCL): {
 					LVObjectPtr& a = STK(arg1);
 					if (type(a) == OT_INTEGER) {
-						a._unVal.nInteger = _integer(a) + sarg3;
+						OBJECT_INIT(a, OT_INTEGER, nInteger, _integer(a) + sarg3);
 					} else {
 						LVObjectPtr o(sarg3); //_GUARD(LOCAL_INC('+',TARGET, STK(arg1), o));
 						_ARITH_(+, a, a, o);
 					}
 				}
-				continue;
-				case _OP_PINC: {
+				VM_NEXT;
+				VM_CASE(_OP_PINC): {
 					LVObjectPtr o(sarg3);
 					_GUARD(DerefInc('+', TARGET, STK(arg1), STK(arg2), o, true, arg1));
 				}
-				continue;
-				case _OP_PINCL: {
+				VM_NEXT;
+				VM_CASE(_OP_PINCL): {
 					LVObjectPtr& a = STK(arg1);
 					if (type(a) == OT_INTEGER) {
 						TARGET = a;
-						a._unVal.nInteger = _integer(a) + sarg3;
+						OBJECT_INIT(a, OT_INTEGER, nInteger, _integer(a) + sarg3);
 					} else {
 						LVObjectPtr o(sarg3);
 						_GUARD(PLOCAL_INC('+', TARGET, STK(arg1), o));
 					}
 
 				}
-				continue;
-				case _OP_CMP:
-					_GUARD(CMP_OP((CmpOP)arg3, STK(arg2), STK(arg1), TARGET))  continue;
-				case _OP_EXISTS:
+				VM_NEXT;
+				VM_CASE(_OP_CMP):
+					_GUARD(CMP_OP((CmpOP)arg3, STK(arg2), STK(arg1), TARGET))  VM_NEXT;
+				VM_CASE(_OP_EXISTS):
 					TARGET = Get(STK(arg1), STK(arg2), temp_reg, GET_FLAG_DO_NOT_RAISE_ERROR | GET_FLAG_RAW, DONT_FALL_BACK) ? true : false;
-					continue;
-				case _OP_INSTANCEOF:
+					VM_NEXT;
+				VM_CASE(_OP_INSTANCEOF):
 					if (type(STK(arg1)) != OT_CLASS) {
 						Raise_Error(_LC("cannot apply instanceof between a %s and a %s"), GetTypeName(STK(arg1)), GetTypeName(STK(arg2)));
 						THROW();
 					}
 					TARGET = (type(STK(arg2)) == OT_INSTANCE) ? (_instance(STK(arg2))->InstanceOf(_class(STK(arg1))) ? true : false) : false;
-					continue;
-				case _OP_AND:
+					VM_NEXT;
+				VM_CASE(_OP_AND):
 					if (IsFalse(STK(arg2))) {
 						TARGET = STK(arg2);
 						ci->_ip += (sarg1);
 					}
-					continue;
-				case _OP_OR:
+					VM_NEXT;
+				VM_CASE(_OP_OR):
 					if (!IsFalse(STK(arg2))) {
 						TARGET = STK(arg2);
 						ci->_ip += (sarg1);
 					}
-					continue;
-				case _OP_NEG:
+					VM_NEXT;
+				VM_CASE(_OP_NEG):
 					_GUARD(NEG_OP(TARGET, STK(arg1)));
-					continue;
-				case _OP_NOT:
+					VM_NEXT;
+				VM_CASE(_OP_NOT):
 					TARGET = IsFalse(STK(arg1));
-					continue;
-				case _OP_BWNOT:
+					VM_NEXT;
+				VM_CASE(_OP_BWNOT):
 					if (type(STK(arg1)) == OT_INTEGER) {
 						LVInteger t = _integer(STK(arg1));
 						TARGET = LVInteger(~t);
-						continue;
+						VM_NEXT;
 					}
 					Raise_Error(_LC("attempt to perform a bitwise op on a %s"), GetTypeName(STK(arg1)));
 					THROW();
-				case _OP_CLOSURE: {
-					LVClosure *c = ci->_closure._unVal.pClosure;
+				VM_CASE(_OP_CLOSURE): {
+					GC_SAFEPOINT();
+					LVClosure *c = _closure(ci->_closure);
 					FunctionPrototype *fp = c->_function;
-					if (!CLOSURE_OP(TARGET, fp->_functions[arg1]._unVal.pFunctionProto)) {
+					if (!CLOSURE_OP(TARGET, _funcproto(fp->_functions[arg1]), arg3 != 0)) {
 						THROW();
 					}
-					continue;
+					VM_NEXT;
 				}
-				case _OP_YIELD: {
+				VM_CASE(_OP_YIELD): {
 					if (ci->_generator) {
 						if (sarg1 != MAX_FUNC_STACKSIZE) temp_reg = STK(arg1);
 						_GUARD(ci->_generator->Yield(this, arg2));
@@ -1244,65 +1639,67 @@ exception_restore:
 					}
 
 				}
-				continue;
-				case _OP_RESUME:
+				VM_NEXT;
+				VM_CASE(_OP_RESUME):
 					if (type(STK(arg1)) != OT_GENERATOR) {
 						Raise_Error(_LC("trying to resume a '%s',only genenerator can be resumed"), GetTypeName(STK(arg1)));
 						THROW();
 					}
 					_GUARD(_generator(STK(arg1))->Resume(this, TARGET));
 					traps += ci->_etraps;
-					continue;
-				case _OP_FOREACH: {
+					VM_NEXT;
+				VM_CASE(_OP_FOREACH): {
 					int tojump;
 					_GUARD(FOREACH_OP(STK(arg0), STK(arg2), STK(arg2 + 1), STK(arg2 + 2), arg2, sarg1, tojump));
 					ci->_ip += tojump;
 				}
-				continue;
-				case _OP_POSTFOREACH:
+				VM_NEXT;
+				VM_CASE(_OP_POSTFOREACH):
 					assert(type(STK(arg0)) == OT_GENERATOR);
 					if (_generator(STK(arg0))->_state == LVGenerator::eDead)
 						ci->_ip += (sarg1 - 1);
-					continue;
-				case _OP_CLONE:
+					VM_NEXT;
+				VM_CASE(_OP_CLONE):
 					_GUARD(Clone(STK(arg1), TARGET));
-					continue;
-				case _OP_TYPEOF:
-					_GUARD(TypeOf(STK(arg1), TARGET)) continue;
-				case _OP_PUSHTRAP: {
+					VM_NEXT;
+				VM_CASE(_OP_TYPEOF):
+					_GUARD(TypeOf(STK(arg1), TARGET)) VM_NEXT;
+				VM_CASE(_OP_PUSHTRAP): {
 					LVInstruction *_iv = _closure(ci->_closure)->_function->_instructions;
 					_etraps.push_back(LVExceptionTrap(_top, _stackbase, &_iv[(ci->_ip - _iv) + arg1], arg0));
 					traps++;
 					ci->_etraps++;
 				}
-				continue;
-				case _OP_POPTRAP: {
+				VM_NEXT;
+				VM_CASE(_OP_POPTRAP): {
 					for (LVInteger i = 0; i < arg0; i++) {
 						_etraps.pop_back();
 						traps--;
 						ci->_etraps--;
 					}
 				}
-				continue;
-				case _OP_THROW:
+				VM_NEXT;
+				VM_CASE(_OP_THROW):
 					Raise_Error(TARGET);
 					THROW();
-					continue;
-				case _OP_NEWSLOTA:
+					VM_NEXT;
+				VM_CASE(_OP_NEWSLOTA):
 					_GUARD(NewSlotA(STK(arg1), STK(arg2), STK(arg3), (arg0 & NEW_SLOT_ATTRIBUTES_FLAG) ? STK(arg2 - 1) : LVObjectPtr(), (arg0 & NEW_SLOT_STATIC_FLAG) ? true : false, false));
-					continue;
-				case _OP_GETBASE: {
+					VM_NEXT;
+				VM_CASE(_OP_GETBASE): {
 					LVClosure *clo = _closure(ci->_closure);
 					if (clo->_base) {
 						TARGET = clo->_base;
 					} else {
 						TARGET.Null();
 					}
-					continue;
+					VM_NEXT;
 				}
-				case _OP_CLOSE:
+				VM_CASE(_OP_CLOSE):
+					if (_stackclosures.size() && _stackclosures.top()._top >= _stackbase)
+						CloseStackClosures(_stackbase + arg1, _stackbase, _top, -1);
 					if (_openouters) CloseOuters(&(STK(arg1)));
-					continue;
+					VM_NEXT;
 			}
 
 		}
@@ -1939,6 +2336,8 @@ void LVVM::LeaveFrame() {
 	LVInteger last_top = _top;
 	LVInteger last_stackbase = _stackbase;
 	LVInteger css = --_callsstacksize;
+	//the slot of the caller that Return put the result in
+	LVInteger dest = (!ci->_root && ci->_target != -1) ? last_stackbase - ci->_prevstkbase + ci->_target : -1;
 
 	/* First clean out the call stack frame */
 	ci->_closure.Null();
@@ -1946,6 +2345,8 @@ void LVVM::LeaveFrame() {
 	_top = _stackbase + ci->_prevtop;
 	ci = (css) ? &_callsstack[css - 1] : NULL;
 
+	if (_stackclosures.size() && _stackclosures.top()._top >= last_stackbase)
+		CloseStackClosures(last_stackbase, last_stackbase, last_top + 1, dest);
 	if (_openouters)
 		CloseOuters(&(_stack._vals[last_stackbase]));
 	while (last_top >= _top) {
@@ -1961,6 +2362,88 @@ void LVVM::RelocateOuters() {
 	}
 }
 
+/* Times the stack slots from 'from' below 'top' hold closure c */
+static LVUnsignedInteger StackRefs(LVObjectPtr *stack, LVInteger from, LVInteger top, LVClosure *c) {
+	LVUnsignedInteger refs = 0;
+	for (LVInteger i = from; i < top; i++) {
+		if (type(stack[i]) == OT_CLOSURE && _closure(stack[i]) == c)
+			refs++;
+	}
+	return refs;
+}
+
+/*
+ * Drops the closures of the running frame that nothing holds anymore, and
+ * gives outers to the ones something besides the slots of the frame holds.
+ * What stays on the list are the closures the frame itself holds.
+ */
+void LVVM::PruneStackClosures() {
+	LVInteger size = _stackclosures.size(), first = size, kept, i;
+	while (first > 0 && _stackclosures[first - 1]._top >= _stackbase)
+		first--;
+	kept = first;
+	for (i = first; i < size; i++) {
+		LVClosure *c = _closure(_stackclosures[i]._closure);
+		if (c->_uiRef == 1 || !c->_stackowner)
+			continue;
+		if (c->_uiRef > 1 + StackRefs(_stack._vals, _stackbase, _top, c)) {
+			c->CloseStackOuters();
+			continue;
+		}
+		_stackclosures[kept++] = _stackclosures[i];
+	}
+	_stackclosures.resize(kept);
+}
+
+/* Whether an open outer or a closure of _stackclosures from 'first' on reads stack slot idx */
+bool LVVM::StackSlotRead(LVInteger idx, LVInteger first) {
+	for (LVOuter *p = _openouters; p && p->_valptr >= &_stack._vals[idx]; p = p->_next) {
+		if (p->_valptr == &_stack._vals[idx])
+			return true;
+	}
+	for (LVUnsignedInteger i = first; i < _stackclosures.size(); i++) {
+		LVClosure *c = _closure(_stackclosures[i]._closure);
+		for (LVInteger k = 0; c->_stackowner && k < c->_function->_noutervalues; k++) {
+			if (type(c->_outervalues[k]) == OT_INTEGER && _integer(c->_outervalues[k]) == idx)
+				return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The locals from stack index 'from' up go out of scope, and the slots below
+ * 'top' with them, but for 'keep' where a frame returns its result. A closure reading any of them from the stack that nothing
+ * but _stackclosures and those slots holds anymore is dropped as it is, the
+ * others get open outers for their locals, for CloseOuters to close next.
+ * A dying slot some outer reads does not count as dying, as the closure it
+ * holds lives on through that outer. Closures of older frames read below
+ * 'base' and end the scan of the list.
+ */
+void LVVM::CloseStackClosures(LVInteger from, LVInteger base, LVInteger top, LVInteger keep) {
+	LVInteger size = _stackclosures.size(), first = size, i, j, kept;
+	while (first > 0 && _stackclosures[first - 1]._top >= base)
+		first--;
+	for (i = first; i < size; i++) {
+		LVClosure *c = _closure(_stackclosures[i]._closure);
+		if (_stackclosures[i]._top < from || !c->_stackowner)
+			continue;
+		LVUnsignedInteger refs = 1;
+		for (j = from; j < top; j++) {
+			if (j != keep && type(_stack._vals[j]) == OT_CLOSURE && _closure(_stack._vals[j]) == c && !StackSlotRead(j, first))
+				refs++;
+		}
+		if (c->_uiRef > refs)
+			c->CloseStackOuters();
+	}
+	kept = first;
+	for (i = first; i < size; i++) {
+		if (_stackclosures[i]._top < from && _closure(_stackclosures[i]._closure)->_stackowner)
+			_stackclosures[kept++] = _stackclosures[i];
+	}
+	_stackclosures.resize(kept);
+}
+
 void LVVM::CloseOuters(LVObjectPtr *stackindex) {
 	LVOuter *p;
 	while ((p = _openouters) != NULL && p->_valptr >= stackindex) {
@@ -2045,7 +2528,7 @@ void LVVM::dumpstack(LVInteger stackbase, bool dumpall) {
 
 		LVInteger res = 0;
 		for (LVUnsignedInteger j = 0; j < resources.size(); ++j) {
-			if (resources[j].second == _rawval(obj))
+			if (resources[j].second == (LVRawObjectVal)_rawval(obj))
 				res = resources[j].first;
 		}
 
@@ -7,6 +7,11 @@
 #define MAX_NATIVE_CALLS 100
 #define MIN_STACK_OVERHEAD 15
 
+/* Direct threaded dispatch, define NO_COMPUTED_GOTO to use the switch loop */
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define LV_COMPUTED_GOTO
+#endif
+
 #define SUSPEND_FLAG -666
 #define DONT_FALL_BACK 666
 //#define EXISTS_FALL_BACK -1
@@ -56,6 +61,12 @@ struct LVVM : public CHAINABLE_OBJ {
 	};
 
 	typedef lvvector<CallInfo> CallInfoVec;
+
+	/* A closure reading locals off the stack and the highest index it reads, see CLOSURE_OP */
+	struct StackClosure {
+		LVObjectPtr _closure;
+		LVInteger _top;
+	};
   public:
 	void DebugHookProxy(LVInteger type, const LVChar *sourcename, LVInteger line, const LVChar *funcname);
 	static void _DebugHookProxy(VMHANDLE v, LVInteger type, const LVChar *sourcename, LVInteger line, const LVChar *funcname);
@@ -63,6 +74,9 @@ struct LVVM : public CHAINABLE_OBJ {
 	LVVM(LVSharedState *ss);
 	~LVVM();
 	bool Init(LVVM *friendvm, LVInteger stacksize);
+	//copies the objects of a bootstrap VM into a fresh shared state, see bootstrap.cpp
+	bool InitFrom(LVVM *boot, LVInteger stacksize);
+	void InitStack(LVInteger stacksize);
 	bool Execute(LVObjectPtr& func, LVInteger nargs, LVInteger stackbase, LVObjectPtr& outres, LVBool raiseerror, ExecutionType et = ET_CALL);
 	bool CallNative(LVNativeClosure *nclosure, LVInteger nargs, LVInteger newbase, LVObjectPtr& retval, bool& suspend);
 	bool StartCall(LVClosure *closure, LVInteger target, LVInteger nargs, LVInteger stackbase, bool tailcall);
@@ -77,6 +91,9 @@ struct LVVM : public CHAINABLE_OBJ {
 	bool InvokeDefaultDelegate(const LVObjectPtr& self, const LVObjectPtr& key, LVObjectPtr& dest);
 	bool Set(const LVObjectPtr& self, const LVObjectPtr& key, const LVObjectPtr& val, LVInteger selfidx);
 	LVInteger FallBackSet(const LVObjectPtr& self, const LVObjectPtr& key, const LVObjectPtr& val);
+	_INLINE bool GetCached(const LVObjectPtr& self, const LVObjectPtr& key, LVObjectPtr& dest, LVInt32& slot);
+	bool GetGlobalCached(const LVObjectPtr& self, const LVObjectPtr& key, LVObjectPtr& dest, LVInteger pc);
+	_INLINE bool SetCached(const LVObjectPtr& self, const LVObjectPtr& key, const LVObjectPtr& val, LVInt32& slot);
 	bool NewSlot(const LVObjectPtr& self, const LVObjectPtr& key, const LVObjectPtr& val, bool bstatic);
 	bool NewSlotA(const LVObjectPtr& self, const LVObjectPtr& key, const LVObjectPtr& val, const LVObjectPtr& attrs, bool bstatic, bool raw);
 	bool DeleteSlot(const LVObjectPtr& self, const LVObjectPtr& key, LVObjectPtr& res);
@@ -97,18 +114,22 @@ struct LVVM : public CHAINABLE_OBJ {
 	void FindOuter(LVObjectPtr& target, LVObjectPtr *stackindex);
 	void RelocateOuters();
 	void CloseOuters(LVObjectPtr *stackindex);
+	void PruneStackClosures();
+	bool StackSlotRead(LVInteger idx, LVInteger first);
+	void CloseStackClosures(LVInteger from, LVInteger base, LVInteger top, LVInteger keep);
 
 	bool TypeOf(const LVObjectPtr& obj1, LVObjectPtr& dest);
 	bool CallMetaMethod(LVObjectPtr& closure, LVMetaMethod mm, LVInteger nparams, LVObjectPtr& outres);
 	bool ArithMetaMethod(LVInteger op, const LVObjectPtr& o1, const LVObjectPtr& o2, LVObjectPtr& dest);
 	bool Return(LVInteger _arg0, LVInteger _arg1, LVObjectPtr& retval);
+	void RunJit(FunctionPrototype *func);
 
 	//new stuff
 	_INLINE bool ARITH_OP(LVUnsignedInteger op, LVObjectPtr& trg, const LVObjectPtr& o1, const LVObjectPtr& o2);
 	_INLINE bool BW_OP(LVUnsignedInteger op, LVObjectPtr& trg, const LVObjectPtr& o1, const LVObjectPtr& o2);
 	_INLINE bool NEG_OP(LVObjectPtr& trg, const LVObjectPtr& o1);
 	_INLINE bool CMP_OP(CmpOP op, const LVObjectPtr& o1, const LVObjectPtr& o2, LVObjectPtr& res);
-	bool CLOSURE_OP(LVObjectPtr& target, FunctionPrototype *func);
+	bool CLOSURE_OP(LVObjectPtr& target, FunctionPrototype *func, bool onstack);
 	bool CLASS_OP(LVObjectPtr& target, LVInteger base, LVInteger attrs);
 	//return true if the loop is finished
 	bool FOREACH_OP(LVObjectPtr& o1, LVObjectPtr& o2, LVObjectPtr& o3, LVObjectPtr& o4, LVInteger arg_2, int exitpos, int& jump);
@@ -157,6 +178,7 @@ struct LVVM : public CHAINABLE_OBJ {
 	LVInteger _top;
 	LVInteger _stackbase;
 	LVOuter *_openouters;
+	lvvector<StackClosure> _stackclosures;
 	LVObjectPtr _roottable;
 	LVObjectPtr _lasterror;
 	LVObjectPtr _errorhandler;
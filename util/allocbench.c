@@ -0,0 +1,66 @@
+#include "bench.h"
+
+/* Iterations of every workload */
+#define BENCH_ITERATIONS 2000000
+
+static const LVChar *closures =
+	_LC("var n = vargv[0], sum = 0;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	var f = function(a) { return a + 1; };\n")
+	_LC("	sum += f(i);\n")
+	_LC("}\n")
+	_LC("return sum;\n");
+
+static const LVChar *strings =
+	_LC("var n = vargv[0], len = 0;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	var s = \"key\" + i;\n")
+	_LC("	s += \"/\" + (i % 100);\n")
+	_LC("	len += s.length();\n")
+	_LC("}\n")
+	_LC("return len;\n");
+
+static const LVChar *tables =
+	_LC("var n = vargv[0], t = {};\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	t[i % 512] <- {x = i, y = [i, i + 1]};\n")
+	_LC("	var k = (i * 7) % 512;\n")
+	_LC("	if (i % 3 == 0 && k in t) delete t[k];\n")
+	_LC("}\n")
+	_LC("return t.length();\n");
+
+static void bench_workload(VMHANDLE v, const LVChar *name, const LVChar *src) {
+	LVInteger top = lv_gettop(v), n = BENCH_ITERATIONS;
+	double secs = bench_script(v, name, src, &n, 1, LVFalse);
+
+	if (secs >= 0)
+		printf("%-10s %6.1f ns per iteration\n", name, secs * 1e9 / BENCH_ITERATIONS);
+	lv_settop(v, top);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+	LVPoolStats stats[32];
+	LVInteger i, n;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	bench_workload(v, _LC("closures"), closures);
+	bench_workload(v, _LC("strings"), strings);
+	bench_workload(v, _LC("tables"), tables);
+
+	n = lv_getpoolstats(stats, 32);
+	if (n > 32)
+		n = 32;
+	for (i = 0; i < n; i++) {
+		if (!stats[i].allocs)
+			continue;
+		printf("%4d bytes   allocs %10d   frees %10d   chunks %6d\n",
+		       (int)stats[i].size, (int)stats[i].allocs, (int)stats[i].frees, (int)stats[i].chunks);
+	}
+
+	lv_close(v);
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lavril.h>
+
+#ifdef _MSC_VER
+#pragma comment (lib ,"lvcore.lib")
+#pragma comment (lib ,"lvmods.lib")
+#endif
+
+/*
+ * What the benches under util share. Every one is a main of its own that
+ * runs its workloads, most of them scripts called with the size of the
+ * workload in vargv.
+ */
+
+/* Seconds of CPU time the process took */
+static inline double bench_cpu(void) {
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* Seconds of wall time, for workloads running on more than one thread */
+static inline double bench_wall(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Pushes the script compiled from src and the root table to call it with */
+static inline LVBool bench_compile(VMHANDLE v, const LVChar *name, const LVChar *src) {
+	if (LV_FAILED(lv_compilebuffer(v, src, (LVInteger)strlen(src), name, LVTrue))) {
+		fprintf(stderr, "%s does not compile\n", name);
+		return LVFalse;
+	}
+	lv_pushroottable(v);
+	return LVTrue;
+}
+
+/*
+ * Calls what bench_compile pushed with the nargs values pushed after it, and
+ * returns the CPU seconds of the call, -1 if it failed. With retval the
+ * result is left on the stack.
+ */
+static inline double bench_call(VMHANDLE v, const LVChar *name, LVInteger nargs, LVBool retval) {
+	double start = bench_cpu();
+	if (LV_FAILED(lv_call(v, nargs + 1, retval, LVTrue))) {
+		fprintf(stderr, "%s failed\n", name);
+		return -1;
+	}
+	return bench_cpu() - start;
+}
+
+/* Runs the script src with the integers of args in vargv, as bench_call */
+static inline double bench_script(VMHANDLE v, const LVChar *name, const LVChar *src,
+                                  const LVInteger *args, LVInteger nargs, LVBool retval) {
+	LVInteger i;
+	if (!bench_compile(v, name, src))
+		return -1;
+	for (i = 0; i < nargs; i++)
+		lv_pushinteger(v, args[i]);
+	return bench_call(v, name, nargs, retval);
+}
+
+#endif // _BENCH_H_
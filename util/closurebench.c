@@ -0,0 +1,67 @@
+#include <sys/resource.h>
+
+#include "bench.h"
+
+/* Iterations of every workload */
+#define BENCH_ITERATIONS 2000000
+
+/* A new callback literal is passed on every iteration, it dies with the call */
+static const LVChar *callback =
+	_LC("var n = vargv[0], s = 0, x = 3;\n")
+	_LC("var apply = function(f, v) { return f(v); };\n")
+	_LC("for (var i = 0; i < n; i++)\n")
+	_LC("	s += apply(function(v) { return v + x; }, i);\n")
+	_LC("return s;\n");
+
+static const LVChar *callback3 =
+	_LC("var n = vargv[0], s = 0, x = 3, y = 4, z = 5;\n")
+	_LC("var apply = function(f, v) { return f(v); };\n")
+	_LC("for (var i = 0; i < n; i++)\n")
+	_LC("	s += apply(function(v) { return v + x + y + z; }, i);\n")
+	_LC("return s;\n");
+
+/* The same callback stored in a local first, which always gets its outers */
+static const LVChar *local =
+	_LC("var n = vargv[0], s = 0, x = 3;\n")
+	_LC("var apply = function(f, v) { return f(v); };\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	var f = function(v) { return v + x; };\n")
+	_LC("	s += apply(f, i);\n")
+	_LC("}\n")
+	_LC("return s;\n");
+
+/* Every callback outlives the call, one in 64 is kept */
+static const LVChar *escaping =
+	_LC("var n = vargv[0], s = 0, x = 3, kept = array(64);\n")
+	_LC("var keep = function(f, v) { kept[v % 64] = f; return f(v); };\n")
+	_LC("for (var i = 0; i < n; i++)\n")
+	_LC("	s += keep(function(v) { return v + x; }, i);\n")
+	_LC("return s;\n");
+
+static void bench_workload(VMHANDLE v, const LVChar *name, const LVChar *src) {
+	LVInteger top = lv_gettop(v), n = BENCH_ITERATIONS;
+	double secs = bench_script(v, name, src, &n, 1, LVFalse);
+	struct rusage ru;
+
+	/* the peak of the process so far, a workload holding on to its closures shows up in it */
+	getrusage(RUSAGE_SELF, &ru);
+	if (secs >= 0)
+		printf("%-10s %6.1f ns per iteration   max rss %6ld KB\n", name, secs * 1e9 / BENCH_ITERATIONS, ru.ru_maxrss);
+	lv_settop(v, top);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	bench_workload(v, _LC("callback"), callback);
+	bench_workload(v, _LC("callback3"), callback3);
+	bench_workload(v, _LC("local"), local);
+	bench_workload(v, _LC("escaping"), escaping);
+
+	lv_close(v);
+
+	return 0;
+}
@@ -12,6 +12,9 @@
 #define scvprintf vfprintf
 #endif
 
+/* Time in microseconds the garbage collector may take after each request */
+#define GC_STEP_US 2000
+
 /* some of the HTTP variables we are interest in */
 #define MAX_VARS 30
 const char *vars[MAX_VARS] = {
@@ -139,6 +142,10 @@ int main(int argc, char *argv[]) {
 				lv_reseterror(v);
 			}
 		}
+
+		/* Send the response first, then collect while waiting for the next request */
+		FCGI_Finish();
+		lv_collectgarbagestep(v, GC_STEP_US);
 	}
 
 	/* Pop the root table */
@@ -0,0 +1,103 @@
+#include "bench.h"
+
+/* Keys per set, and interning rounds over every set */
+#define BENCH_KEYS 50000
+#define BENCH_ROUNDS 5
+#define KEY_MAXLEN 128
+
+/* The string hash up to 1.0, which skipped characters of long strings, for comparison */
+static LVHash old_hashstr(const LVChar *s, size_t l) {
+	LVHash h = (LVHash)l;
+	size_t step = (l >> 5) | 1;
+	for (; l >= step; l -= step)
+		h = h ^ ((h << 5) + (h >> 2) + (unsigned short) * (s++));
+	return h;
+}
+
+static void make_url(LVChar *buf, int i) {
+	snprintf(buf, KEY_MAXLEN, "https://shop.example.com/api/v2/customers/%d/orders?page=%d&sort=date", i / 7, i % 7);
+}
+
+static void make_path(LVChar *buf, int i) {
+	snprintf(buf, KEY_MAXLEN, "/var/www/htdocs/static/images/products/thumbnails/%04d/%d.png", i / 100, i);
+}
+
+static void make_json(LVChar *buf, int i) {
+	snprintf(buf, KEY_MAXLEN, "customer_shipping_address_line_%d", i);
+}
+
+static void make_ident(LVChar *buf, int i) {
+	snprintf(buf, KEY_MAXLEN, "v%d", i);
+}
+
+/* Longest and mean chain of a string table with one slot per key */
+static void chains(LVHash *hashes, LVInteger n, LVInteger *longest, double *mean) {
+	LVInteger slots = 1, i, used = 0;
+	LVInteger *counts;
+	while (slots < n)
+		slots *= 2;
+	counts = (LVInteger *)calloc(slots, sizeof(LVInteger));
+	for (i = 0; i < n; i++)
+		counts[hashes[i] & (slots - 1)]++;
+	*longest = 0;
+	for (i = 0; i < slots; i++) {
+		if (counts[i] > *longest)
+			*longest = counts[i];
+		if (counts[i])
+			used++;
+	}
+	/* average length of the chain a lookup of a present key walks */
+	*mean = 0;
+	for (i = 0; i < slots; i++)
+		*mean += (double)counts[i] * (counts[i] + 1) / 2;
+	*mean /= n;
+	free(counts);
+}
+
+static void bench_keys(VMHANDLE v, const char *name, void (*make)(LVChar *, int)) {
+	static LVChar keys[BENCH_KEYS][KEY_MAXLEN];
+	static LVHash oldh[BENCH_KEYS], newh[BENCH_KEYS];
+	LVInteger i, r, oldlongest, newlongest;
+	double oldmean, newmean, ns;
+	double start;
+
+	for (i = 0; i < BENCH_KEYS; i++) {
+		make(keys[i], (int)i);
+		oldh[i] = old_hashstr(keys[i], strlen(keys[i]));
+		lv_pushstring(v, keys[i], -1);
+		newh[i] = lv_gethash(v, -1);
+		lv_pop(v, 1);
+	}
+	chains(oldh, BENCH_KEYS, &oldlongest, &oldmean);
+	chains(newh, BENCH_KEYS, &newlongest, &newmean);
+
+	/* the keys stay alive until the round ends, as the keys of a table do */
+	start = bench_cpu();
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		lv_newarray(v, 0);
+		for (i = 0; i < BENCH_KEYS; i++) {
+			lv_pushstring(v, keys[i], -1);
+			lv_arrayappend(v, -2);
+		}
+		lv_pop(v, 1);
+	}
+	ns = (bench_cpu() - start) * 1e9 / (BENCH_ROUNDS * BENCH_KEYS);
+
+	printf("%-6s intern %6.1f ns   chains old max %5d mean %7.2f   new max %3d mean %5.2f\n",
+	       name, ns, (int)oldlongest, oldmean, (int)newlongest, newmean);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+
+	v = lv_open(1024);
+
+	bench_keys(v, "urls", make_url);
+	bench_keys(v, "paths", make_path);
+	bench_keys(v, "json", make_json);
+	bench_keys(v, "ident", make_ident);
+
+	lv_close(v);
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#include "bench.h"
+
+/* Strings interned and kept alive, enough for the string table to double many times */
+#define BENCH_STRINGS 2000000
+/* An intern slower than this counts as a stall */
+#define STALL_NS 100000
+
+static void bench_intern(const char *name, LVInteger reserve) {
+	VMHANDLE v = lv_open(1024);
+	LVStringTableStats stats;
+	LVChar key[64];
+	LVInteger i, stalls = 0;
+	double worst = 0, total = 0, start, t;
+
+	if (reserve)
+		lv_reservestrings(v, reserve);
+	lv_newarray(v, 0);
+	for (i = 0; i < BENCH_STRINGS; i++) {
+		snprintf(key, sizeof(key), "session/%d/user", (int)i);
+		start = bench_wall() * 1e9;
+		lv_pushstring(v, key, -1);
+		t = bench_wall() * 1e9 - start;
+		lv_arrayappend(v, -2);
+		total += t;
+		if (t > worst)
+			worst = t;
+		if (t > STALL_NS)
+			stalls++;
+	}
+	lv_getstringtablestats(v, &stats);
+	printf("%-8s %6.1f ns per string   worst %8.3f ms   stalls %4d   slots %8d   longest chain %d\n",
+	       name, total / BENCH_STRINGS, worst / 1e6, (int)stalls, (int)stats.slots, (int)stats.longest);
+	lv_close(v);
+}
+
+int main(int argc, char *argv[]) {
+	bench_intern("grow", 0);
+	bench_intern("reserve", BENCH_STRINGS);
+	return 0;
+}
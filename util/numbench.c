@@ -0,0 +1,78 @@
+#include "bench.h"
+
+/* Elements of every vector, and passes over them */
+#define BENCH_ELEMENTS 1000000
+#define BENCH_PASSES 10
+
+/*
+ * Every workload gets the number of elements in vargv[0] and the passes in
+ * vargv[1], once written as a loop over an array and once with the bulk
+ * methods of a typed array.
+ */
+static const LVChar *loop_float =
+	_LC("var n = vargv[0], a = array(n), b = array(n), s = 0.0;\n")
+	_LC("for (var i = 0; i < n; i++) { a[i] = i * 0.5; b[i] = 1.0 - i * 0.25; }\n")
+	_LC("for (var p = 0; p < vargv[1]; p++) {\n")
+	_LC("	for (var i = 0; i < n; i++) a[i] = a[i] * 0.5 + 1.0;\n")
+	_LC("	var d = 0.0;\n")
+	_LC("	for (var i = 0; i < n; i++) d += a[i] * b[i];\n")
+	_LC("	s += d;\n")
+	_LC("}\n")
+	_LC("return s;\n");
+
+static const LVChar *typed_float =
+	_LC("var n = vargv[0], a = array(n), b = array(n), s = 0.0;\n")
+	_LC("for (var i = 0; i < n; i++) { a[i] = i * 0.5; b[i] = 1.0 - i * 0.25; }\n")
+	_LC("a = floatarray(a);\n")
+	_LC("b = floatarray(b);\n")
+	_LC("for (var p = 0; p < vargv[1]; p++) {\n")
+	_LC("	a.scale(0.5).add(1.0);\n")
+	_LC("	s += a.dot(b);\n")
+	_LC("}\n")
+	_LC("return s;\n");
+
+static const LVChar *loop_int =
+	_LC("var n = vargv[0], a = array(n), s = 0;\n")
+	_LC("for (var i = 0; i < n; i++) a[i] = (i * 7919) % 10007;\n")
+	_LC("for (var p = 0; p < vargv[1]; p++) {\n")
+	_LC("	var sum = 0, hi = a[0];\n")
+	_LC("	foreach (x in a) { sum += x; if (x > hi) hi = x; }\n")
+	_LC("	s += sum + hi;\n")
+	_LC("}\n")
+	_LC("return s;\n");
+
+static const LVChar *typed_int =
+	_LC("var n = vargv[0], a = array(n), s = 0;\n")
+	_LC("for (var i = 0; i < n; i++) a[i] = (i * 7919) % 10007;\n")
+	_LC("a = intarray(a);\n")
+	_LC("for (var p = 0; p < vargv[1]; p++)\n")
+	_LC("	s += a.sum() + a.max();\n")
+	_LC("return s;\n");
+
+static void bench_workload(VMHANDLE v, const LVChar *name, const LVChar *src) {
+	LVInteger top = lv_gettop(v), args[] = {BENCH_ELEMENTS, BENCH_PASSES};
+	LVFloat result = 0;
+	double secs = bench_script(v, name, src, args, 2, LVTrue);
+
+	if (secs >= 0) {
+		lv_getfloat(v, -1, &result);
+		printf("%-12s %9.2f ms   result %g\n", name, secs * 1e3, (double)result);
+	}
+	lv_settop(v, top);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	bench_workload(v, _LC("loop float"), loop_float);
+	bench_workload(v, _LC("typed float"), typed_float);
+	bench_workload(v, _LC("loop int"), loop_int);
+	bench_workload(v, _LC("typed int"), typed_int);
+
+	lv_close(v);
+
+	return 0;
+}
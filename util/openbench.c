@@ -0,0 +1,60 @@
+#include "bench.h"
+
+/* VMs opened and closed by every workload */
+#define BENCH_CYCLES 20000
+
+/* What a sandbox for one request runs */
+static const LVChar *request =
+	_LC("var req = {path = \"/items/42\", query = {page = 1}};\n")
+	_LC("var parts = split(req.path, \"/\");\n")
+	_LC("return parts.length() + req.query.page + strip(\" ab \").length();\n");
+
+static VMHANDLE open_vm(VMHANDLE bootstrap, int modules) {
+	VMHANDLE v;
+	if (bootstrap)
+		return lv_openfrom(bootstrap, 1024);
+	v = lv_open(1024);
+	if (modules) {
+		lv_pushroottable(v);
+		lv_init_modules(v);
+		lv_pop(v, 1);
+	}
+	return v;
+}
+
+/* Result of the request, -1 if it failed */
+static LVInteger run_request(VMHANDLE v) {
+	LVInteger res = -1;
+	if (bench_script(v, _LC("request"), request, NULL, 0, LVTrue) >= 0)
+		lv_getinteger(v, -1, &res);
+	return res;
+}
+
+static void bench_open(const char *name, VMHANDLE bootstrap, int modules, int run) {
+	double start = bench_cpu();
+	LVInteger res = 0;
+	for (int i = 0; i < BENCH_CYCLES; i++) {
+		VMHANDLE v = open_vm(bootstrap, modules);
+		if (run)
+			res = run_request(v);
+		lv_close(v);
+	}
+	double secs = bench_cpu() - start;
+	printf("%-24s %9.0f cycles/s %8.2f us/cycle", name, BENCH_CYCLES / secs, secs * 1e6 / BENCH_CYCLES);
+	if (run)
+		printf("   result %d", (int)res);
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE bootstrap = open_vm(NULL, 1);
+
+	bench_open("open close", NULL, 0, 0);
+	bench_open("with modules", NULL, 1, 0);
+	bench_open("with modules + run", NULL, 1, 1);
+	bench_open("from bootstrap", bootstrap, 1, 0);
+	bench_open("from bootstrap + run", bootstrap, 1, 1);
+
+	lv_close(bootstrap);
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "bench.h"
+
+/* Values mapped by every run, and the most workers tried */
+#define BENCH_VALUES 200000
+#define BENCH_MAXWORKERS 16
+
+/*
+ * The kernel counts the steps of the Collatz sequence of every value, which
+ * is pure computation on integers. vargv[0] is the number of workers, 0 for
+ * the sequential map.
+ */
+static const LVChar *collatz =
+	_LC("var n = vargv[0], workers = vargv[1], a = array(n);\n")
+	_LC("for (var i = 0; i < n; i++) a[i] = i + 1;\n")
+	_LC("var steps = function(x) {\n")
+	_LC("	var s = 0;\n")
+	_LC("	while (x != 1) {\n")
+	_LC("		x = x % 2 ? x * 3 + 1 : x / 2;\n")
+	_LC("		s++;\n")
+	_LC("	}\n")
+	_LC("	return s;\n")
+	_LC("};\n")
+	_LC("var r = workers ? a.pmap(steps, workers) : a.map(steps);\n")
+	_LC("return r.reduce(function(x, y) { return x + y; });\n");
+
+/* The wall time of the run, the workers all add to the CPU time */
+static double bench_run(VMHANDLE v, LVInteger workers, LVInteger *sum) {
+	LVInteger top = lv_gettop(v), args[] = {BENCH_VALUES, workers};
+	double start = bench_wall(), elapsed = -1;
+
+	if (bench_script(v, _LC("collatz"), collatz, args, 2, LVTrue) >= 0) {
+		elapsed = bench_wall() - start;
+		lv_getinteger(v, -1, sum);
+	}
+	lv_settop(v, top);
+	return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+	LVInteger workers, sum = 0;
+	double seq, t;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	seq = bench_run(v, 0, &sum);
+	printf("map          %8.1f ms   steps %d\n", seq * 1e3, (int)sum);
+	//the first pmap also starts the workers
+	bench_run(v, BENCH_MAXWORKERS, &sum);
+	for (workers = 1; workers <= BENCH_MAXWORKERS; workers *= 2) {
+		t = bench_run(v, workers, &sum);
+		printf("pmap %2d      %8.1f ms   steps %d   speedup %5.2f\n", (int)workers, t * 1e3, (int)sum, seq / t);
+	}
+
+	lv_close(v);
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include "bench.h"
+
+/* Slices taken by every workload */
+#define BENCH_SLICES 200000
+
+/*
+ * Every workload gets the number of slices in vargv[0]. The buffer is a log
+ * of 100000 lines, split in records of fields.
+ */
+static const LVChar *windows =
+	_LC("var n = vargv[0], log = array(100000), total = 0;\n")
+	_LC("for (var i = 0; i < log.length(); i++) log[i] = i;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	var w = log.slice(i % 90000, i % 90000 + 1000);\n")
+	_LC("	total += w[0] + w[999];\n")
+	_LC("}\n")
+	_LC("return total;\n");
+
+static const LVChar *records =
+	_LC("var n = vargv[0], log = array(100000), total = 0;\n")
+	_LC("for (var i = 0; i < log.length(); i++) log[i] = i;\n")
+	_LC("for (var i = 0; i < n; i += 50) {\n")
+	_LC("	var page = log.slice((i * 7) % 50000, (i * 7) % 50000 + 50000);\n")
+	_LC("	for (var j = 0; j < 50; j++) {\n")
+	_LC("		var rec = page.slice(j * 100, j * 100 + 100);\n")
+	_LC("		total += rec[0];\n")
+	_LC("	}\n")
+	_LC("}\n")
+	_LC("return total;\n");
+
+static const LVChar *short_fields =
+	_LC("var n = vargv[0], log = array(100000), total = 0;\n")
+	_LC("for (var i = 0; i < log.length(); i++) log[i] = i;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	var f = log.slice(i % 90000, i % 90000 + 4);\n")
+	_LC("	total += f[3];\n")
+	_LC("}\n")
+	_LC("return total;\n");
+
+static void bench_workload(VMHANDLE v, const LVChar *name, const LVChar *src) {
+	LVInteger top = lv_gettop(v), n = BENCH_SLICES;
+	double secs = bench_script(v, name, src, &n, 1, LVFalse);
+
+	if (secs >= 0)
+		printf("%-14s %8.1f ns per slice\n", name, secs * 1e9 / BENCH_SLICES);
+	lv_settop(v, top);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	bench_workload(v, _LC("windows"), windows);
+	bench_workload(v, _LC("records"), records);
+	bench_workload(v, _LC("short fields"), short_fields);
+
+	lv_close(v);
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include "bench.h"
+
+/* Elements of every array sorted */
+#define BENCH_ELEMENTS 1000000
+
+/*
+ * Every setup script gets the number of elements in vargv[0] and returns the
+ * array to sort, every sort script gets that array in vargv[0]. Only the
+ * sort is timed.
+ */
+static const LVChar *random_ints =
+	_LC("var n = vargv[0], a = array(n), x = 12345;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	x = (x * 1103515245 + 12345) % 2147483648;\n")
+	_LC("	a[i] = x;\n")
+	_LC("}\n")
+	_LC("return a;\n");
+
+static const LVChar *sorted_ints =
+	_LC("var n = vargv[0], a = array(n);\n")
+	_LC("for (var i = 0; i < n; i++)\n")
+	_LC("	a[i] = i * 2 + (i % 10 == 0 ? 1 : 0);\n")
+	_LC("return a;\n");
+
+static const LVChar *random_strings =
+	_LC("var n = vargv[0], a = array(n), x = 12345;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	x = (x * 1103515245 + 12345) % 2147483648;\n")
+	_LC("	a[i] = \"customer/\" + x;\n")
+	_LC("}\n")
+	_LC("return a;\n");
+
+static const LVChar *random_records =
+	_LC("var n = vargv[0], a = array(n), x = 12345;\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	x = (x * 1103515245 + 12345) % 2147483648;\n")
+	_LC("	a[i] = {id = x % 100000, name = \"user\" + i};\n")
+	_LC("}\n")
+	_LC("return a;\n");
+
+static const LVChar *sort_native =
+	_LC("vargv[0].sort();\n");
+
+static const LVChar *sort_compare =
+	_LC("vargv[0].sort(function(a, b) { return a <=> b; });\n");
+
+static const LVChar *sort_records =
+	_LC("vargv[0].sort(function(a, b) { return a.id <=> b.id; });\n");
+
+static const LVChar *sortby_records =
+	_LC("vargv[0].sortby(function(r) { return r.id; });\n");
+
+static void bench_sort(VMHANDLE v, const LVChar *name, const LVChar *setup, const LVChar *sort) {
+	LVInteger top = lv_gettop(v), n = BENCH_ELEMENTS;
+	double secs;
+
+	if (bench_script(v, name, setup, &n, 1, LVTrue) < 0 || !bench_compile(v, name, sort)) {
+		lv_settop(v, top);
+		return;
+	}
+	lv_push(v, -3);
+	secs = bench_call(v, name, 1, LVFalse);
+	if (secs >= 0)
+		printf("%-16s %9.2f ms\n", name, secs * 1e3);
+	lv_settop(v, top);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	bench_sort(v, _LC("ints"), random_ints, sort_native);
+	bench_sort(v, _LC("ints compare"), random_ints, sort_compare);
+	bench_sort(v, _LC("sorted ints"), sorted_ints, sort_native);
+	bench_sort(v, _LC("strings"), random_strings, sort_native);
+	bench_sort(v, _LC("records compare"), random_records, sort_records);
+	bench_sort(v, _LC("records sortby"), random_records, sortby_records);
+
+	lv_close(v);
+
+	return 0;
+}
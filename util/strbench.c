@@ -0,0 +1,72 @@
+#include "bench.h"
+
+/*
+ * Every workload gets the number of rows in vargv[0] and returns the length
+ * of the page it built, once by concatenation and once with a stringbuilder.
+ */
+static const LVChar *html_concat =
+	_LC("var n = vargv[0], page = \"<html><body><table>\\n\";\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	page += \"<tr><td class=\\\"id\\\">\" + i + \"</td><td>item \" + i + \"</td><td>\" + (i * 3) + \".00</td></tr>\\n\";\n")
+	_LC("}\n")
+	_LC("page += \"</table></body></html>\\n\";\n")
+	_LC("return page.length();\n");
+
+static const LVChar *html_builder =
+	_LC("var n = vargv[0], page = stringbuilder();\n")
+	_LC("page.append(\"<html><body><table>\\n\");\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	page.append(\"<tr><td class=\\\"id\\\">\", i, \"</td><td>item \", i, \"</td><td>\", i * 3, \".00</td></tr>\\n\");\n")
+	_LC("}\n")
+	_LC("page.append(\"</table></body></html>\\n\");\n")
+	_LC("return page.tostring().length();\n");
+
+static const LVChar *json_concat =
+	_LC("var n = vargv[0], out = \"[\";\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	if (i > 0) out += \",\";\n")
+	_LC("	out += \"{\\\"id\\\":\" + i + \",\\\"name\\\":\\\"user\" + i + \"\\\",\\\"tags\\\":[\\\"a\\\",\\\"b\\\"]}\";\n")
+	_LC("}\n")
+	_LC("out += \"]\";\n")
+	_LC("return out.length();\n");
+
+static const LVChar *json_builder =
+	_LC("var n = vargv[0], out = stringbuilder();\n")
+	_LC("out.append(\"[\");\n")
+	_LC("for (var i = 0; i < n; i++) {\n")
+	_LC("	if (i > 0) out.append(\",\");\n")
+	_LC("	out.appendf(\"{\\\"id\\\":%d,\\\"name\\\":\\\"user%d\\\",\\\"tags\\\":[\", i, i);\n")
+	_LC("	out.join([\"\\\"a\\\"\", \"\\\"b\\\"\"], \",\").append(\"]}\");\n")
+	_LC("}\n")
+	_LC("out.append(\"]\");\n")
+	_LC("return out.tostring().length();\n");
+
+static void bench_workload(VMHANDLE v, const LVChar *name, const LVChar *src, LVInteger rows) {
+	LVInteger top = lv_gettop(v), len = 0;
+	double secs = bench_script(v, name, src, &rows, 1, LVTrue);
+
+	if (secs >= 0) {
+		lv_getinteger(v, -1, &len);
+		printf("%-14s %7d rows %9d bytes %9.2f ms\n", name, (int)rows, (int)len, secs * 1e3);
+	}
+	lv_settop(v, top);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+	LVInteger rows;
+
+	v = lv_open(1024);
+	lv_registererrorhandlers(v);
+
+	for (rows = 1000; rows <= 16000; rows *= 4) {
+		bench_workload(v, _LC("html concat"), html_concat, rows);
+		bench_workload(v, _LC("html builder"), html_builder, rows);
+		bench_workload(v, _LC("json concat"), json_concat, rows);
+		bench_workload(v, _LC("json builder"), json_builder, rows);
+	}
+
+	lv_close(v);
+
+	return 0;
+}
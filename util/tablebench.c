@@ -0,0 +1,87 @@
+#include "bench.h"
+
+/* Total number of operations per measurement, spread over the table size */
+#define BENCH_OPS 4000000
+
+static double elapsed_ns(double start, LVInteger ops) {
+	return (bench_cpu() - start) * 1e9 / ops;
+}
+
+static void bench_table(VMHANDLE v, LVInteger size) {
+	LVInteger rounds = BENCH_OPS / size;
+	LVInteger i, r, count = 0;
+	double insert, lookup, scattered, iterate;
+	double start;
+
+	if (rounds < 1)
+		rounds = 1;
+
+	/* Insert, a fresh table for every round */
+	start = bench_cpu();
+	for (r = 0; r < rounds; r++) {
+		lv_newtable(v);
+		for (i = 0; i < size; i++) {
+			lv_pushinteger(v, i * 7);
+			lv_pushinteger(v, i);
+			lv_newslot(v, -3, LVFalse);
+		}
+		if (r != rounds - 1)
+			lv_pop(v, 1);
+	}
+	insert = elapsed_ns(start, rounds * size);
+
+	/* Lookup of every key */
+	start = bench_cpu();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < size; i++) {
+			lv_pushinteger(v, i * 7);
+			lv_rawget(v, -2);
+			lv_pop(v, 1);
+		}
+	}
+	lookup = elapsed_ns(start, rounds * size);
+
+	/* Lookup of every key in a scattered order */
+	start = bench_cpu();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < size; i++) {
+			lv_pushinteger(v, ((i * 7919) % size) * 7);
+			lv_rawget(v, -2);
+			lv_pop(v, 1);
+		}
+	}
+	scattered = elapsed_ns(start, rounds * size);
+
+	/* Iteration over all slots */
+	start = bench_cpu();
+	for (r = 0; r < rounds; r++) {
+		lv_pushnull(v);
+		while (LV_SUCCEEDED(lv_next(v, -2))) {
+			lv_pop(v, 2);
+			count++;
+		}
+		lv_pop(v, 1);
+	}
+	iterate = elapsed_ns(start, rounds * size);
+
+	lv_pop(v, 1);
+	if (count != rounds * size)
+		fprintf(stderr, "iteration visited " _PRINT_INT_FMT " of " _PRINT_INT_FMT " slots\n", count, rounds * size);
+
+	printf("%8d keys   insert %6.1f ns   lookup %6.1f ns   scattered %6.1f ns   iterate %6.1f ns\n",
+	       (int)size, insert, lookup, scattered, iterate);
+}
+
+int main(int argc, char *argv[]) {
+	VMHANDLE v;
+
+	v = lv_open(1024);
+
+	bench_table(v, 10);
+	bench_table(v, 1000);
+	bench_table(v, 1000000);
+
+	lv_close(v);
+
+	return 0;
+}